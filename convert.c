@@ -422,25 +422,348 @@ static void convert_sc16q11_generic(void *iq_data,
     }
 }
 
+//
+// Vectorized converters
+//
+// These handle 8 samples per step: deinterleave I/Q, scale to floats,
+// optionally DC filter, then magsq -> clamp -> sqrt -> 16-bit magnitude,
+// exactly as the scalar float paths do per sample. Mean level and power are
+// accumulated as integer sums of the output magnitudes, like the table
+// paths, so the UC8 no-DC results are identical to convert_uc8_nodc().
+//
+// The 1Hz DC filter moves so little over 8 samples that they can share one
+// filter value: it is advanced by 8 steps at once from the block sum, which
+// keeps the filter out of the per-sample dependency chain.
+//
+
+// Scalar processing of the samples that don't fill a whole vector
+static inline __attribute__ ((always_inline)) void convert_tail(const void *iq_data,
+        uint16_t *mag_data,
+        unsigned nsamples,
+        input_format_t format,
+        bool filter_dc,
+        float dc_a,
+        float dc_b,
+        float *z1_I,
+        float *z1_Q,
+        uint64_t *sum_level,
+        uint64_t *sum_power) {
+    for (unsigned i = 0; i < nsamples; ++i) {
+        float fI, fQ;
+
+        if (format == INPUT_UC8) {
+            const uint8_t *in = iq_data;
+            fI = (in[i * 2] - 127.5f) / 127.5f;
+            fQ = (in[i * 2 + 1] - 127.5f) / 127.5f;
+        } else {
+            const uint16_t *in = iq_data;
+            float scale = (format == INPUT_SC16 ? 32768.0f : 2048.0f);
+            fI = (int16_t) le16toh(in[i * 2]) / scale;
+            fQ = (int16_t) le16toh(in[i * 2 + 1]) / scale;
+        }
+
+        if (filter_dc) {
+            *z1_I = fI * dc_a + *z1_I * dc_b;
+            *z1_Q = fQ * dc_a + *z1_Q * dc_b;
+            fI -= *z1_I;
+            fQ -= *z1_Q;
+        }
+
+        float magsq = fI * fI + fQ * fQ;
+        if (magsq > 1)
+            magsq = 1;
+
+        uint16_t mag = (uint16_t) (sqrtf(magsq) * 65535.0f + 0.5f);
+        mag_data[i] = mag;
+        *sum_level += mag;
+        *sum_power += (uint32_t) mag * (uint32_t) mag;
+    }
+}
+
+static void convert_finish(unsigned nsamples, uint64_t sum_level, uint64_t sum_power, double *out_mean_level, double *out_mean_power) {
+    if (out_mean_level) {
+        *out_mean_level = sum_level / 65536.0 / nsamples;
+    }
+
+    if (out_mean_power) {
+        *out_mean_power = sum_power / 65535.0 / 65535.0 / nsamples;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define HAVE_CONVERT_AVX2
+
+static inline __attribute__ ((always_inline, target("avx2"))) float hsum_avx2(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+static inline __attribute__ ((always_inline, target("avx2"))) void convert_avx2(void *iq_data,
+        uint16_t *mag_data,
+        unsigned nsamples,
+        struct converter_state *state,
+        double *out_mean_level,
+        double *out_mean_power,
+        input_format_t format,
+        bool filter_dc) {
+    const uint8_t *in = iq_data;
+    const unsigned in_step = (format == INPUT_UC8 ? 2 : 4) * 8;
+    const float scale = (format == INPUT_SC16 ? 1.0f / 32768.0f : 1.0f / 2048.0f);
+    const float dc_a = state->dc_a;
+    const float dc_b = state->dc_b;
+    float dc_b8 = dc_b * dc_b;
+    dc_b8 *= dc_b8;
+    dc_b8 *= dc_b8;
+    float z1_I = state->z1_I;
+    float z1_Q = state->z1_Q;
+
+    const __m128i uc8_deinterleave = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+    const __m256 uc8_offset = _mm256_set1_ps(127.5f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 full_scale = _mm256_set1_ps(65535.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    __m256i level = _mm256_setzero_si256(); // 4 x 64-bit
+    __m256i power = _mm256_setzero_si256(); // 4 x 64-bit
+    unsigned i;
+
+    for (i = 0; i + 8 <= nsamples; i += 8, in += in_step, mag_data += 8) {
+        __m256 fI, fQ;
+
+        if (format == INPUT_UC8) {
+            __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) in), uc8_deinterleave);
+            fI = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v));
+            fQ = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)));
+            fI = _mm256_div_ps(_mm256_sub_ps(fI, uc8_offset), uc8_offset);
+            fQ = _mm256_div_ps(_mm256_sub_ps(fQ, uc8_offset), uc8_offset);
+        } else {
+            // little-endian pairs of int16: I in the low half of each 32-bit lane
+            __m256i v = _mm256_loadu_si256((const __m256i *) in);
+            fI = _mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16));
+            fQ = _mm256_cvtepi32_ps(_mm256_srai_epi32(v, 16));
+            fI = _mm256_mul_ps(fI, _mm256_set1_ps(scale));
+            fQ = _mm256_mul_ps(fQ, _mm256_set1_ps(scale));
+        }
+
+        if (filter_dc) {
+            z1_I = z1_I * dc_b8 + hsum_avx2(fI) * dc_a;
+            z1_Q = z1_Q * dc_b8 + hsum_avx2(fQ) * dc_a;
+            fI = _mm256_sub_ps(fI, _mm256_set1_ps(z1_I));
+            fQ = _mm256_sub_ps(fQ, _mm256_set1_ps(z1_Q));
+        }
+
+        __m256 magsq = _mm256_add_ps(_mm256_mul_ps(fI, fI), _mm256_mul_ps(fQ, fQ));
+        magsq = _mm256_min_ps(magsq, one);
+        __m256i mag = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_sqrt_ps(magsq), full_scale), half));
+
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(mag, mag), 0x08);
+        _mm_storeu_si128((__m128i *) mag_data, _mm256_castsi256_si128(packed));
+
+        __m256i mag_odd = _mm256_srli_epi64(mag, 32);
+        level = _mm256_add_epi64(level, _mm256_add_epi64(_mm256_and_si256(mag, _mm256_set1_epi64x(0xffffffff)), mag_odd));
+        power = _mm256_add_epi64(power, _mm256_add_epi64(_mm256_mul_epu32(mag, mag), _mm256_mul_epu32(mag_odd, mag_odd)));
+    }
+
+    uint64_t lanes[4];
+    uint64_t sum_level, sum_power;
+    _mm256_storeu_si256((__m256i *) lanes, level);
+    sum_level = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm256_storeu_si256((__m256i *) lanes, power);
+    sum_power = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+    convert_tail(in, mag_data, nsamples - i, format, filter_dc, dc_a, dc_b, &z1_I, &z1_Q, &sum_level, &sum_power);
+
+    state->z1_I = z1_I;
+    state->z1_Q = z1_Q;
+
+    convert_finish(nsamples, sum_level, sum_power, out_mean_level, out_mean_power);
+}
+
+#define CONVERT_AVX2(name, format, filter_dc) \
+    static __attribute__ ((target("avx2"))) void name(void *iq_data, uint16_t *mag_data, unsigned nsamples, \
+            struct converter_state *state, double *out_mean_level, double *out_mean_power) { \
+        convert_avx2(iq_data, mag_data, nsamples, state, out_mean_level, out_mean_power, format, filter_dc); \
+    }
+
+CONVERT_AVX2(convert_uc8_nodc_avx2, INPUT_UC8, false)
+CONVERT_AVX2(convert_uc8_avx2, INPUT_UC8, true)
+CONVERT_AVX2(convert_sc16_nodc_avx2, INPUT_SC16, false)
+CONVERT_AVX2(convert_sc16_avx2, INPUT_SC16, true)
+CONVERT_AVX2(convert_sc16q11_nodc_avx2, INPUT_SC16Q11, false)
+CONVERT_AVX2(convert_sc16q11_avx2, INPUT_SC16Q11, true)
+
+#undef CONVERT_AVX2
+
+#endif /* x86 */
+
+// vdivq_f32 / vsqrtq_f32 are AArch64 only; 32-bit ARM keeps the scalar paths
+#if defined(__aarch64__) && defined(__ARM_NEON) && !defined(__ARM_BIG_ENDIAN)
+#include <arm_neon.h>
+
+#define HAVE_CONVERT_NEON
+
+static inline __attribute__ ((always_inline)) void convert_neon(void *iq_data,
+        uint16_t *mag_data,
+        unsigned nsamples,
+        struct converter_state *state,
+        double *out_mean_level,
+        double *out_mean_power,
+        input_format_t format,
+        bool filter_dc) {
+    const uint8_t *in = iq_data;
+    const unsigned in_step = (format == INPUT_UC8 ? 2 : 4) * 8;
+    const float scale = (format == INPUT_SC16 ? 1.0f / 32768.0f : 1.0f / 2048.0f);
+    const float dc_a = state->dc_a;
+    const float dc_b = state->dc_b;
+    float dc_b8 = dc_b * dc_b;
+    dc_b8 *= dc_b8;
+    dc_b8 *= dc_b8;
+    float z1_I = state->z1_I;
+    float z1_Q = state->z1_Q;
+
+    const float32x4_t uc8_offset = vdupq_n_f32(127.5f);
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t full_scale = vdupq_n_f32(65535.0f);
+    const float32x4_t half = vdupq_n_f32(0.5f);
+    uint64x2_t level = vdupq_n_u64(0);
+    uint64x2_t power = vdupq_n_u64(0);
+    unsigned i;
+
+    for (i = 0; i + 8 <= nsamples; i += 8, in += in_step, mag_data += 8) {
+        float32x4_t fI[2], fQ[2];
+
+        if (format == INPUT_UC8) {
+            uint8x8x2_t v = vld2_u8(in);
+            uint16x8_t I = vmovl_u8(v.val[0]);
+            uint16x8_t Q = vmovl_u8(v.val[1]);
+            fI[0] = vcvtq_f32_u32(vmovl_u16(vget_low_u16(I)));
+            fI[1] = vcvtq_f32_u32(vmovl_u16(vget_high_u16(I)));
+            fQ[0] = vcvtq_f32_u32(vmovl_u16(vget_low_u16(Q)));
+            fQ[1] = vcvtq_f32_u32(vmovl_u16(vget_high_u16(Q)));
+            for (int k = 0; k < 2; ++k) {
+                fI[k] = vdivq_f32(vsubq_f32(fI[k], uc8_offset), uc8_offset);
+                fQ[k] = vdivq_f32(vsubq_f32(fQ[k], uc8_offset), uc8_offset);
+            }
+        } else {
+            int16x8x2_t v = vld2q_s16((const int16_t *) in);
+            fI[0] = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v.val[0]))), scale);
+            fI[1] = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v.val[0]))), scale);
+            fQ[0] = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v.val[1]))), scale);
+            fQ[1] = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v.val[1]))), scale);
+        }
+
+        if (filter_dc) {
+            z1_I = z1_I * dc_b8 + vaddvq_f32(vaddq_f32(fI[0], fI[1])) * dc_a;
+            z1_Q = z1_Q * dc_b8 + vaddvq_f32(vaddq_f32(fQ[0], fQ[1])) * dc_a;
+            for (int k = 0; k < 2; ++k) {
+                fI[k] = vsubq_f32(fI[k], vdupq_n_f32(z1_I));
+                fQ[k] = vsubq_f32(fQ[k], vdupq_n_f32(z1_Q));
+            }
+        }
+
+        uint16x4_t mag[2];
+        for (int k = 0; k < 2; ++k) {
+            float32x4_t magsq = vaddq_f32(vmulq_f32(fI[k], fI[k]), vmulq_f32(fQ[k], fQ[k]));
+            magsq = vminq_f32(magsq, one);
+            mag[k] = vmovn_u32(vcvtq_u32_f32(vaddq_f32(vmulq_f32(vsqrtq_f32(magsq), full_scale), half)));
+            power = vpadalq_u32(power, vmull_u16(mag[k], mag[k]));
+        }
+
+        uint16x8_t mags = vcombine_u16(mag[0], mag[1]);
+        vst1q_u16(mag_data, mags);
+        level = vpadalq_u32(level, vpaddlq_u16(mags));
+    }
+
+    uint64_t sum_level = vaddvq_u64(level);
+    uint64_t sum_power = vaddvq_u64(power);
+
+    convert_tail(in, mag_data, nsamples - i, format, filter_dc, dc_a, dc_b, &z1_I, &z1_Q, &sum_level, &sum_power);
+
+    state->z1_I = z1_I;
+    state->z1_Q = z1_Q;
+
+    convert_finish(nsamples, sum_level, sum_power, out_mean_level, out_mean_power);
+}
+
+#define CONVERT_NEON(name, format, filter_dc) \
+    static void name(void *iq_data, uint16_t *mag_data, unsigned nsamples, \
+            struct converter_state *state, double *out_mean_level, double *out_mean_power) { \
+        convert_neon(iq_data, mag_data, nsamples, state, out_mean_level, out_mean_power, format, filter_dc); \
+    }
+
+CONVERT_NEON(convert_uc8_nodc_neon, INPUT_UC8, false)
+CONVERT_NEON(convert_uc8_neon, INPUT_UC8, true)
+CONVERT_NEON(convert_sc16_nodc_neon, INPUT_SC16, false)
+CONVERT_NEON(convert_sc16_neon, INPUT_SC16, true)
+CONVERT_NEON(convert_sc16q11_nodc_neon, INPUT_SC16Q11, false)
+CONVERT_NEON(convert_sc16q11_neon, INPUT_SC16Q11, true)
+
+#undef CONVERT_NEON
+
+#endif /* AArch64 NEON */
+
+// CPU features a converter needs
+typedef enum {
+    CONVERTER_CPU_ANY = 0, CONVERTER_CPU_AVX2, CONVERTER_CPU_NEON
+} converter_cpu_t;
+
+static bool converter_cpu_supported(converter_cpu_t cpu) {
+    switch (cpu) {
+        case CONVERTER_CPU_ANY:
+            return true;
+#ifdef HAVE_CONVERT_AVX2
+        case CONVERTER_CPU_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#endif
+#ifdef HAVE_CONVERT_NEON
+        case CONVERTER_CPU_NEON:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
 static struct {
     input_format_t format;
     int can_filter_dc;
+    converter_cpu_t cpu;
     iq_convert_fn fn;
     const char *description;
     bool(*init)();
 } converters_table[] = {
     // In order of preference
-    { INPUT_UC8, 0, convert_uc8_nodc, "UC8, integer/table path", init_uc8_lookup},
-    { INPUT_UC8, 1, convert_uc8_generic, "UC8, float path", NULL},
-    { INPUT_SC16, 0, convert_sc16_nodc, "SC16, float path, no DC", NULL},
-    { INPUT_SC16, 1, convert_sc16_generic, "SC16, float path", NULL},
+#ifdef HAVE_CONVERT_AVX2
+    { INPUT_UC8, 0, CONVERTER_CPU_AVX2, convert_uc8_nodc_avx2, "UC8, AVX2 path, no DC", NULL},
+    { INPUT_UC8, 1, CONVERTER_CPU_AVX2, convert_uc8_avx2, "UC8, AVX2 path", NULL},
+    { INPUT_SC16, 0, CONVERTER_CPU_AVX2, convert_sc16_nodc_avx2, "SC16, AVX2 path, no DC", NULL},
+    { INPUT_SC16, 1, CONVERTER_CPU_AVX2, convert_sc16_avx2, "SC16, AVX2 path", NULL},
+    { INPUT_SC16Q11, 0, CONVERTER_CPU_AVX2, convert_sc16q11_nodc_avx2, "SC16Q11, AVX2 path, no DC", NULL},
+    { INPUT_SC16Q11, 1, CONVERTER_CPU_AVX2, convert_sc16q11_avx2, "SC16Q11, AVX2 path", NULL},
+#endif
+#ifdef HAVE_CONVERT_NEON
+    { INPUT_UC8, 0, CONVERTER_CPU_NEON, convert_uc8_nodc_neon, "UC8, NEON path, no DC", NULL},
+    { INPUT_UC8, 1, CONVERTER_CPU_NEON, convert_uc8_neon, "UC8, NEON path", NULL},
+    { INPUT_SC16, 0, CONVERTER_CPU_NEON, convert_sc16_nodc_neon, "SC16, NEON path, no DC", NULL},
+    { INPUT_SC16, 1, CONVERTER_CPU_NEON, convert_sc16_neon, "SC16, NEON path", NULL},
+    { INPUT_SC16Q11, 0, CONVERTER_CPU_NEON, convert_sc16q11_nodc_neon, "SC16Q11, NEON path, no DC", NULL},
+    { INPUT_SC16Q11, 1, CONVERTER_CPU_NEON, convert_sc16q11_neon, "SC16Q11, NEON path", NULL},
+#endif
+    { INPUT_UC8, 0, CONVERTER_CPU_ANY, convert_uc8_nodc, "UC8, integer/table path", init_uc8_lookup},
+    { INPUT_UC8, 1, CONVERTER_CPU_ANY, convert_uc8_generic, "UC8, float path", NULL},
+    { INPUT_SC16, 0, CONVERTER_CPU_ANY, convert_sc16_nodc, "SC16, float path, no DC", NULL},
+    { INPUT_SC16, 1, CONVERTER_CPU_ANY, convert_sc16_generic, "SC16, float path", NULL},
 #if defined(SC16Q11_TABLE_BITS)
-    { INPUT_SC16Q11, 0, convert_sc16q11_table, "SC16Q11, integer/table path", init_sc16q11_lookup},
+    { INPUT_SC16Q11, 0, CONVERTER_CPU_ANY, convert_sc16q11_table, "SC16Q11, integer/table path", init_sc16q11_lookup},
 #else
-    { INPUT_SC16Q11, 0, convert_sc16q11_nodc, "SC16Q11, float path, no DC", NULL},
+    { INPUT_SC16Q11, 0, CONVERTER_CPU_ANY, convert_sc16q11_nodc, "SC16Q11, float path, no DC", NULL},
 #endif
-    { INPUT_SC16Q11, 1, convert_sc16q11_generic, "SC16Q11, float path", NULL},
-    { 0, 0, NULL, NULL, NULL}
+    { INPUT_SC16Q11, 1, CONVERTER_CPU_ANY, convert_sc16q11_generic, "SC16Q11, float path", NULL},
+    { 0, 0, CONVERTER_CPU_ANY, NULL, NULL, NULL}
 };
 
 iq_convert_fn init_converter(input_format_t format,
@@ -454,6 +777,8 @@ iq_convert_fn init_converter(input_format_t format,
             continue;
         if (filter_dc && !converters_table[i].can_filter_dc)
             continue;
+        if (!converter_cpu_supported(converters_table[i].cpu))
+            continue;
         break;
     }
 
@@ -490,10 +815,20 @@ iq_convert_fn init_converter(input_format_t format,
     return converters_table[i].fn;
 }
 
+const char *converter_description(iq_convert_fn fn) {
+    for (int i = 0; converters_table[i].fn; ++i) {
+        if (converters_table[i].fn == fn)
+            return converters_table[i].description;
+    }
+    return "unknown";
+}
+
 void cleanup_converter(struct converter_state *state) {
     free(state);
     free(uc8_lookup);
+    uc8_lookup = NULL;
 #if defined(SC16Q11_TABLE_BITS)
     free(sc16q11_lookup);
+    sc16q11_lookup = NULL;
 #endif
 }
@@ -42,6 +42,9 @@ iq_convert_fn init_converter(input_format_t format,
         int filter_dc,
         struct converter_state **out_state);
 
+// Human-readable name of a converter returned by init_converter()
+const char *converter_description(iq_convert_fn fn);
+
 void cleanup_converter(struct converter_state *state);
 
 #endif
@@ -78,75 +78,46 @@ static double cprModDouble(double a, double b) {
 //
 // The NL function uses the precomputed table from 1090-WP-9-14
 //
+// cpr_nl_lat[] holds the latitudes where NL drops by one, starting at 59.
+// cpr_nl_first[] holds the number of those below each whole degree, no degree
+// contains more than two of them, so NL is found without searching.
+//
+
+static const double cpr_nl_lat[] = {
+    10.47047130, 14.82817437, 18.18626357, 21.02939493, 23.54504487, 25.82924707,
+    27.93898710, 29.91135686, 31.77209708, 33.53993436, 35.22899598, 36.85025108,
+    38.41241892, 39.92256684, 41.38651832, 42.80914012, 44.19454951, 45.54626723,
+    46.86733252, 48.16039128, 49.42776439, 50.67150166, 51.89342469, 53.09516153,
+    54.27817472, 55.44378444, 56.59318756, 57.72747354, 58.84763776, 59.95459277,
+    61.04917774, 62.13216659, 63.20427479, 64.26616523, 65.31845310, 66.36171008,
+    67.39646774, 68.42322022, 69.44242631, 70.45451075, 71.45986473, 72.45884545,
+    73.45177442, 74.43893416, 75.42056257, 76.39684391, 77.36789461, 78.33374083,
+    79.29428225, 80.24923213, 81.19801349, 82.13956981, 83.07199445, 83.99173563,
+    84.89166191, 85.75541621, 86.53536998, 87.00000000,
+    91.0, 91.0 // padding, above any latitude
+};
+
+static const unsigned char cpr_nl_first[91] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2,
+    2, 2, 2, 3, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8,
+    9, 9, 10, 10, 11, 12, 12, 13, 14, 14, 15, 16, 16, 17, 18, 19,
+    19, 20, 21, 22, 23, 23, 24, 25, 26, 27, 28, 29, 30, 30, 31, 32,
+    33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48,
+    49, 50, 51, 52, 54, 55, 56, 57, 58, 58, 58
+};
 
 static int cprNLFunction(double lat) {
     if (lat < 0) lat = -lat; // Table is simmetric about the equator
-    if (lat < 10.47047130) return 59;
-    if (lat < 14.82817437) return 58;
-    if (lat < 18.18626357) return 57;
-    if (lat < 21.02939493) return 56;
-    if (lat < 23.54504487) return 55;
-    if (lat < 25.82924707) return 54;
-    if (lat < 27.93898710) return 53;
-    if (lat < 29.91135686) return 52;
-    if (lat < 31.77209708) return 51;
-    if (lat < 33.53993436) return 50;
-    if (lat < 35.22899598) return 49;
-    if (lat < 36.85025108) return 48;
-    if (lat < 38.41241892) return 47;
-    if (lat < 39.92256684) return 46;
-    if (lat < 41.38651832) return 45;
-    if (lat < 42.80914012) return 44;
-    if (lat < 44.19454951) return 43;
-    if (lat < 45.54626723) return 42;
-    if (lat < 46.86733252) return 41;
-    if (lat < 48.16039128) return 40;
-    if (lat < 49.42776439) return 39;
-    if (lat < 50.67150166) return 38;
-    if (lat < 51.89342469) return 37;
-    if (lat < 53.09516153) return 36;
-    if (lat < 54.27817472) return 35;
-    if (lat < 55.44378444) return 34;
-    if (lat < 56.59318756) return 33;
-    if (lat < 57.72747354) return 32;
-    if (lat < 58.84763776) return 31;
-    if (lat < 59.95459277) return 30;
-    if (lat < 61.04917774) return 29;
-    if (lat < 62.13216659) return 28;
-    if (lat < 63.20427479) return 27;
-    if (lat < 64.26616523) return 26;
-    if (lat < 65.31845310) return 25;
-    if (lat < 66.36171008) return 24;
-    if (lat < 67.39646774) return 23;
-    if (lat < 68.42322022) return 22;
-    if (lat < 69.44242631) return 21;
-    if (lat < 70.45451075) return 20;
-    if (lat < 71.45986473) return 19;
-    if (lat < 72.45884545) return 18;
-    if (lat < 73.45177442) return 17;
-    if (lat < 74.43893416) return 16;
-    if (lat < 75.42056257) return 15;
-    if (lat < 76.39684391) return 14;
-    if (lat < 77.36789461) return 13;
-    if (lat < 78.33374083) return 12;
-    if (lat < 79.29428225) return 11;
-    if (lat < 80.24923213) return 10;
-    if (lat < 81.19801349) return 9;
-    if (lat < 82.13956981) return 8;
-    if (lat < 83.07199445) return 7;
-    if (lat < 83.99173563) return 6;
-    if (lat < 84.89166191) return 5;
-    if (lat < 85.75541621) return 4;
-    if (lat < 86.53536998) return 3;
-    if (lat < 87.00000000) return 2;
-    else return 1;
+    if (!(lat <= 90)) lat = 90;
+    int i = cpr_nl_first[(int) lat];
+    return 59 - i - (lat >= cpr_nl_lat[i]) - (lat >= cpr_nl_lat[i + 1]);
 }
 //
 //=========================================================================
 //
 
-static int cprNFunction(double lat, int fflag) {
-    int nl = cprNLFunction(lat) - (fflag ? 1 : 0);
+static int cprNFunction(int nl, int fflag) {
+    nl -= (fflag ? 1 : 0);
     if (nl < 1) nl = 1;
     return nl;
 }
@@ -155,7 +126,18 @@ static int cprNFunction(double lat, int fflag) {
 //
 
 static double cprDlonFunction(double lat, int fflag, int surface) {
-    return (surface ? 90.0 : 360.0) / cprNFunction(lat, fflag);
+    return (surface ? 90.0 : 360.0) / cprNFunction(cprNLFunction(lat), fflag);
+}
+//
+//=========================================================================
+//
+// Zone index floor(a / 131072 + 0.5) for the integer a of the CPR equations,
+// exact in integer arithmetic. Right shift of a negative int is arithmetic
+// with gcc, so this floors too.
+//
+
+static inline int cprIndex(int a) {
+    return (a + 65536) >> 17;
 }
 //
 //=========================================================================
@@ -181,7 +163,7 @@ int decodeCPRairborne(int even_cprlat, int even_cprlon,
     double rlat, rlon;
 
     // Compute the Latitude Index "j"
-    int j = (int) floor(((59 * lat0 - 60 * lat1) / 131072) + 0.5);
+    int j = cprIndex(59 * even_cprlat - 60 * odd_cprlat);
     double rlat0 = AirDlat0 * (cprModInt(j, 60) + lat0 / 131072);
     double rlat1 = AirDlat1 * (cprModInt(j, 59) + lat1 / 131072);
 
@@ -193,21 +175,19 @@ int decodeCPRairborne(int even_cprlat, int even_cprlon,
         return (-2); // bad data
 
     // Check that both are in the same latitude zone, or abort.
-    if (cprNLFunction(rlat0) != cprNLFunction(rlat1))
+    int nl = cprNLFunction(rlat0);
+    if (nl != cprNLFunction(rlat1))
         return (-1); // positions crossed a latitude zone, try again later
 
     // Compute ni and the Longitude Index "m"
+    int m = cprIndex(even_cprlon * (nl - 1) - odd_cprlon * nl);
     if (fflag) { // Use odd packet.
-        int ni = cprNFunction(rlat1, 1);
-        int m = (int) floor((((lon0 * (cprNLFunction(rlat1) - 1)) -
-                (lon1 * cprNLFunction(rlat1))) / 131072.0) + 0.5);
-        rlon = cprDlonFunction(rlat1, 1, 0) * (cprModInt(m, ni) + lon1 / 131072);
+        int ni = cprNFunction(nl, 1);
+        rlon = (360.0 / ni) * (cprModInt(m, ni) + lon1 / 131072);
         rlat = rlat1;
     } else { // Use even packet.
-        int ni = cprNFunction(rlat0, 0);
-        int m = (int) floor((((lon0 * (cprNLFunction(rlat0) - 1)) -
-                (lon1 * cprNLFunction(rlat0))) / 131072) + 0.5);
-        rlon = cprDlonFunction(rlat0, 0, 0) * (cprModInt(m, ni) + lon0 / 131072);
+        int ni = cprNFunction(nl, 0);
+        rlon = (360.0 / ni) * (cprModInt(m, ni) + lon0 / 131072);
         rlat = rlat0;
     }
 
@@ -234,7 +214,7 @@ int decodeCPRsurface(double reflat, double reflon,
     double rlon, rlat;
 
     // Compute the Latitude Index "j"
-    int j = (int) floor(((59 * lat0 - 60 * lat1) / 131072) + 0.5);
+    int j = cprIndex(59 * even_cprlat - 60 * odd_cprlat);
     double rlat0 = AirDlat0 * (cprModInt(j, 60) + lat0 / 131072);
     double rlat1 = AirDlat1 * (cprModInt(j, 59) + lat1 / 131072);
 
@@ -284,21 +264,19 @@ int decodeCPRsurface(double reflat, double reflon,
         return (-2); // bad data
 
     // Check that both are in the same latitude zone, or abort.
-    if (cprNLFunction(rlat0) != cprNLFunction(rlat1))
+    int nl = cprNLFunction(rlat0);
+    if (nl != cprNLFunction(rlat1))
         return (-1); // positions crossed a latitude zone, try again later
 
     // Compute ni and the Longitude Index "m"
+    int m = cprIndex(even_cprlon * (nl - 1) - odd_cprlon * nl);
     if (fflag) { // Use odd packet.
-        int ni = cprNFunction(rlat1, 1);
-        int m = (int) floor((((lon0 * (cprNLFunction(rlat1) - 1)) -
-                (lon1 * cprNLFunction(rlat1))) / 131072.0) + 0.5);
-        rlon = cprDlonFunction(rlat1, 1, 1) * (cprModInt(m, ni) + lon1 / 131072);
+        int ni = cprNFunction(nl, 1);
+        rlon = (90.0 / ni) * (cprModInt(m, ni) + lon1 / 131072);
         rlat = rlat1;
     } else { // Use even packet.
-        int ni = cprNFunction(rlat0, 0);
-        int m = (int) floor((((lon0 * (cprNLFunction(rlat0) - 1)) -
-                (lon1 * cprNLFunction(rlat0))) / 131072) + 0.5);
-        rlon = cprDlonFunction(rlat0, 0, 1) * (cprModInt(m, ni) + lon0 / 131072);
+        int ni = cprNFunction(nl, 0);
+        rlon = (90.0 / ni) * (cprModInt(m, ni) + lon0 / 131072);
         rlat = rlat0;
     }
 
@@ -373,3 +351,32 @@ int decodeCPRrelative(double reflat, double reflon,
     *out_lon = rlon;
     return (0);
 }
+
+//
+//=========================================================================
+//
+// Batch decoding of even/odd pairs, e.g. when replaying recorded traffic.
+// Results are the same as from the single pair functions.
+//
+
+void decodeCPRairborneBatch(const struct cpr_pair *pairs, int count,
+        double *out_lat, double *out_lon, int *out_result) {
+    for (int i = 0; i < count; i++) {
+        out_result[i] = decodeCPRairborne(pairs[i].even_cprlat, pairs[i].even_cprlon,
+                pairs[i].odd_cprlat, pairs[i].odd_cprlon,
+                pairs[i].fflag,
+                &out_lat[i], &out_lon[i]);
+    }
+}
+
+void decodeCPRsurfaceBatch(double reflat, double reflon,
+        const struct cpr_pair *pairs, int count,
+        double *out_lat, double *out_lon, int *out_result) {
+    for (int i = 0; i < count; i++) {
+        out_result[i] = decodeCPRsurface(reflat, reflon,
+                pairs[i].even_cprlat, pairs[i].even_cprlon,
+                pairs[i].odd_cprlat, pairs[i].odd_cprlon,
+                pairs[i].fflag,
+                &out_lat[i], &out_lon[i]);
+    }
+}
@@ -24,6 +24,13 @@
 #ifndef CPR_H
 #define CPR_H
 
+// One even/odd message pair for batch decoding
+struct cpr_pair {
+    int even_cprlat, even_cprlon;
+    int odd_cprlat, odd_cprlon;
+    int fflag; // odd message is the latest
+};
+
 int decodeCPRairborne(int even_cprlat, int even_cprlon,
         int odd_cprlat, int odd_cprlon,
         int fflag,
@@ -40,4 +47,11 @@ int decodeCPRrelative(double reflat, double reflon,
         int fflag, int surface,
         double *out_lat, double *out_lon);
 
+void decodeCPRairborneBatch(const struct cpr_pair *pairs, int count,
+        double *out_lat, double *out_lon, int *out_result);
+
+void decodeCPRsurfaceBatch(double reflat, double reflon,
+        const struct cpr_pair *pairs, int count,
+        double *out_lat, double *out_lon, int *out_result);
+
 #endif
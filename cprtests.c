@@ -23,6 +23,9 @@
 
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "cpr.h"
 
@@ -306,10 +309,163 @@ static int testCPRRelative() {
     return ok;
 }
 
-int main(int __attribute__ ((unused)) argc, char __attribute__ ((unused)) **argv) {
+// The batch API must give the same results as decoding pair by pair
+
+static int testCPRBatch() {
+    struct cpr_pair pairs[2 * sizeof (cprGlobalAirborneTests) / sizeof (cprGlobalAirborneTests[0])];
+    double lat[sizeof (pairs) / sizeof (pairs[0])], lon[sizeof (pairs) / sizeof (pairs[0])];
+    int res[sizeof (pairs) / sizeof (pairs[0])];
+    int count = sizeof (pairs) / sizeof (pairs[0]);
+    int ok = 1;
+    int i;
+
+    for (i = 0; i < count; ++i) {
+        pairs[i].even_cprlat = cprGlobalAirborneTests[i / 2].even_cprlat;
+        pairs[i].even_cprlon = cprGlobalAirborneTests[i / 2].even_cprlon;
+        pairs[i].odd_cprlat = cprGlobalAirborneTests[i / 2].odd_cprlat;
+        pairs[i].odd_cprlon = cprGlobalAirborneTests[i / 2].odd_cprlon;
+        pairs[i].fflag = i & 1;
+    }
+
+    decodeCPRairborneBatch(pairs, count, lat, lon, res);
+    for (i = 0; i < count; ++i) {
+        int expected_res = (i & 1) ? cprGlobalAirborneTests[i / 2].odd_result : cprGlobalAirborneTests[i / 2].even_result;
+        double expected_lat = (i & 1) ? cprGlobalAirborneTests[i / 2].odd_rlat : cprGlobalAirborneTests[i / 2].even_rlat;
+        double expected_lon = (i & 1) ? cprGlobalAirborneTests[i / 2].odd_rlon : cprGlobalAirborneTests[i / 2].even_rlon;
+
+        if (res[i] != expected_res || fabs(lat[i] - expected_lat) > 1e-6 || fabs(lon[i] - expected_lon) > 1e-6) {
+            ok = 0;
+            fprintf(stderr,
+                    "testCPRBatch[%d]:  FAIL: result %d lat %.6f lon %.6f (expected %d %.6f %.6f)\n",
+                    i, res[i], lat[i], lon[i], expected_res, expected_lat, expected_lon);
+        } else {
+            fprintf(stderr, "testCPRBatch[%d]:  PASS\n", i);
+        }
+    }
+
+    // Surface pairs share one reference location per call
+    for (i = 0; i < (int) (sizeof (cprGlobalSurfaceTests) / sizeof (cprGlobalSurfaceTests[0])); ++i) {
+        int j;
+
+        for (j = 0; j < 2; ++j) {
+            pairs[j].even_cprlat = cprGlobalSurfaceTests[i].even_cprlat;
+            pairs[j].even_cprlon = cprGlobalSurfaceTests[i].even_cprlon;
+            pairs[j].odd_cprlat = cprGlobalSurfaceTests[i].odd_cprlat;
+            pairs[j].odd_cprlon = cprGlobalSurfaceTests[i].odd_cprlon;
+            pairs[j].fflag = j;
+        }
+
+        decodeCPRsurfaceBatch(cprGlobalSurfaceTests[i].reflat, cprGlobalSurfaceTests[i].reflon, pairs, 2, lat, lon, res);
+        for (j = 0; j < 2; ++j) {
+            int expected_res = j ? cprGlobalSurfaceTests[i].odd_result : cprGlobalSurfaceTests[i].even_result;
+            double expected_lat = j ? cprGlobalSurfaceTests[i].odd_rlat : cprGlobalSurfaceTests[i].even_rlat;
+            double expected_lon = j ? cprGlobalSurfaceTests[i].odd_rlon : cprGlobalSurfaceTests[i].even_rlon;
+
+            if (res[j] != expected_res || fabs(lat[j] - expected_lat) > 1e-6 || fabs(lon[j] - expected_lon) > 1e-6) {
+                ok = 0;
+                fprintf(stderr,
+                        "testCPRBatch surface[%d,%d]:  FAIL: result %d lat %.6f lon %.6f (expected %d %.6f %.6f)\n",
+                        i, j, res[j], lat[j], lon[j], expected_res, expected_lat, expected_lon);
+            } else {
+                fprintf(stderr, "testCPRBatch surface[%d,%d]:  PASS\n", i, j);
+            }
+        }
+    }
+
+    return ok;
+}
+
+// Benchmark: decodes a fixed set of pseudo-random pairs, one call per pair and
+// through the batch API, and reports decodes/second. Most of the pairs are
+// close enough in latitude to decode.
+
+#define BENCH_PAIRS 4096
+#define BENCH_ROUNDS 500
+
+static double benchElapsed(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int benchCPR(unsigned rounds) {
+    static struct cpr_pair pairs[BENCH_PAIRS];
+    static double lat[BENCH_PAIRS], lon[BENCH_PAIRS];
+    static int res[BENCH_PAIRS];
+    struct timespec start;
+    double single, batch, relative, sink = 0;
+    unsigned r;
+    int i, decoded = 0;
+
+    srand(1);
+    for (i = 0; i < BENCH_PAIRS; ++i) {
+        pairs[i].even_cprlat = rand() % 131072;
+        pairs[i].even_cprlon = rand() % 131072;
+        pairs[i].odd_cprlat = (i % 3) ? (pairs[i].even_cprlat + rand() % 64) % 131072 : rand() % 131072;
+        pairs[i].odd_cprlon = rand() % 131072;
+        pairs[i].fflag = i & 1;
+    }
+
+    decodeCPRairborneBatch(pairs, BENCH_PAIRS, lat, lon, res);
+    for (i = 0; i < BENCH_PAIRS; ++i) {
+        double rlat = 0, rlon = 0;
+        int result = decodeCPRairborne(pairs[i].even_cprlat, pairs[i].even_cprlon,
+                pairs[i].odd_cprlat, pairs[i].odd_cprlon, pairs[i].fflag, &rlat, &rlon);
+        if (result != res[i] || (result == 0 && (rlat != lat[i] || rlon != lon[i]))) {
+            fprintf(stderr, "benchCPR: batch mismatch on pair %d\n", i);
+            return 0;
+        }
+        if (result == 0)
+            decoded++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; ++r) {
+        for (i = 0; i < BENCH_PAIRS; ++i) {
+            double rlat, rlon;
+            if (decodeCPRairborne(pairs[i].even_cprlat, pairs[i].even_cprlon,
+                    pairs[i].odd_cprlat, pairs[i].odd_cprlon, pairs[i].fflag, &rlat, &rlon) == 0)
+                sink += rlat;
+        }
+    }
+    single = benchElapsed(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; ++r) {
+        decodeCPRairborneBatch(pairs, BENCH_PAIRS, lat, lon, res);
+        sink += lat[r % BENCH_PAIRS];
+    }
+    batch = benchElapsed(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; ++r) {
+        for (i = 0; i < BENCH_PAIRS; ++i) {
+            double rlat, rlon;
+            if (decodeCPRrelative(51.5, 0.5, pairs[i].even_cprlat, pairs[i].even_cprlon,
+                    pairs[i].fflag, 0, &rlat, &rlon) == 0)
+                sink += rlat;
+        }
+    }
+    relative = benchElapsed(&start);
+
+    printf("airborne  %8.2f Mdecodes/s single %8.2f Mdecodes/s batch (%d/%d decode)\n",
+            (double) rounds * BENCH_PAIRS / single / 1e6,
+            (double) rounds * BENCH_PAIRS / batch / 1e6,
+            decoded, BENCH_PAIRS);
+    printf("relative  %8.2f Mdecodes/s (%g)\n",
+            (double) rounds * BENCH_PAIRS / relative / 1e6, sink);
+    return 1;
+}
+
+int main(int argc, char **argv) {
     int ok = 1;
+
+    if (argc > 1 && !strcmp(argv[1], "bench"))
+        return benchCPR(argc > 2 ? (unsigned) atoi(argv[2]) : BENCH_ROUNDS) ? 0 : 1;
+
     ok = testCPRGlobalAirborne() && ok;
     ok = testCPRGlobalSurface() && ok;
     ok = testCPRRelative() && ok;
+    ok = testCPRBatch() && ok;
     return ok ? 0 : 1;
 }
@@ -30,32 +30,239 @@ static struct errorinfo NO_ERRORS;
 // Generator polynomial for the Mode S CRC:
 #define MODES_GENERATOR_POLY 0xfff409U
 
-// CRC values for all single-byte messages;
-// used to speed up CRC calculation.
-static uint32_t crc_table[256];
+// CRC values for all single-byte messages, left-aligned in 32 bits.
+// crc_table[k][b] is the CRC of byte b followed by k zero bytes;
+// the eight tables let modesChecksum() process 4 or 8 bytes per step.
+static uint32_t crc_table[8][256];
 
 // Syndrome values for all single-bit errors;
 // used to speed up construction of error-
 // correction tables.
 static uint32_t single_bit_syndrome[112];
 
-static void initLookupTables() {
+typedef uint32_t (*checksum_fn)(uint8_t *message, int bits);
+typedef void (*checksum_batch_fn)(uint8_t *messages, size_t stride, const int *bits, unsigned count, uint32_t *out);
+
+static inline uint32_t load_be32(const uint8_t *p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+// Table driven checksum, slicing by 8 / 4 / 1 bytes
+static inline __attribute__ ((always_inline)) uint32_t checksum_slicing_inline(uint8_t *message, int bits) {
+    uint32_t rem = 0;
+    int n = bits / 8 - 3;
+
+    assert(bits % 8 == 0);
+    assert(n >= 0);
+
+    while (n >= 8) {
+        uint32_t hi = rem ^ load_be32(message);
+        uint32_t lo = load_be32(message + 4);
+        rem = crc_table[7][hi >> 24] ^ crc_table[6][(hi >> 16) & 0xff] ^
+                crc_table[5][(hi >> 8) & 0xff] ^ crc_table[4][hi & 0xff] ^
+                crc_table[3][lo >> 24] ^ crc_table[2][(lo >> 16) & 0xff] ^
+                crc_table[1][(lo >> 8) & 0xff] ^ crc_table[0][lo & 0xff];
+        message += 8;
+        n -= 8;
+    }
+
+    if (n >= 4) {
+        uint32_t hi = rem ^ load_be32(message);
+        rem = crc_table[3][hi >> 24] ^ crc_table[2][(hi >> 16) & 0xff] ^
+                crc_table[1][(hi >> 8) & 0xff] ^ crc_table[0][hi & 0xff];
+        message += 4;
+        n -= 4;
+    }
+
+    while (n-- > 0) {
+        rem = (rem << 8) ^ crc_table[0][(rem >> 24) ^ *message++];
+    }
+
+    // the remainder is left-aligned; xor in the 24 parity bits
+    return (rem >> 8) ^ (message[0] << 16) ^ (message[1] << 8) ^ message[2];
+}
+
+// One byte per lookup; kept as a reference for crcbench
+static uint32_t checksum_bytewise(uint8_t *message, int bits) {
+    uint32_t rem = 0;
+    int i;
+    int n = bits / 8;
+
+    assert(bits % 8 == 0);
+    assert(n >= 3);
+
+    for (i = 0; i < n - 3; ++i)
+        rem = (rem << 8) ^ crc_table[0][(rem >> 24) ^ message[i]];
+
+    return (rem >> 8) ^ (message[n - 3] << 16) ^ (message[n - 2] << 8) ^ (message[n - 1]);
+}
+
+static void checksum_batch_bytewise(uint8_t *messages, size_t stride, const int *bits, unsigned count, uint32_t *out) {
+    unsigned i;
+    for (i = 0; i < count; ++i)
+        out[i] = checksum_bytewise(messages + i * stride, bits[i]);
+}
+
+static uint32_t checksum_slicing(uint8_t *message, int bits) {
+    return checksum_slicing_inline(message, bits);
+}
+
+static void checksum_batch_slicing(uint8_t *messages, size_t stride, const int *bits, unsigned count, uint32_t *out) {
+    unsigned i;
+    for (i = 0; i < count; ++i)
+        out[i] = checksum_slicing_inline(messages + i * stride, bits[i]);
+}
+
+//
+// Carry-less multiply checksum
+//
+// The syndrome is the whole message, read as a polynomial, modulo the
+// generator. A 112-bit message is folded to 64 bits using x^64 and x^96
+// mod G, then reduced with a Barrett step using floor(x^64 / G).
+// Only 56 and 112 bit messages take this path.
+//
+
+#if defined(__x86_64__)
+#include <wmmintrin.h>
+
+#define HAVE_CHECKSUM_CLMUL
+#define CLMUL_TARGET __attribute__ ((target("pclmul")))
+
+static inline __attribute__ ((always_inline)) CLMUL_TARGET uint64_t clmul64(uint64_t a, uint64_t b, uint64_t *hi) {
+    __m128i r = _mm_clmulepi64_si128(_mm_cvtsi64_si128(a), _mm_cvtsi64_si128(b), 0x00);
+    if (hi)
+        *hi = (uint64_t) _mm_cvtsi128_si64(_mm_unpackhi_epi64(r, r));
+    return (uint64_t) _mm_cvtsi128_si64(r);
+}
+#elif defined(__aarch64__) && (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES))
+#include <arm_neon.h>
+
+#define HAVE_CHECKSUM_CLMUL
+#define CLMUL_TARGET
+
+static inline __attribute__ ((always_inline)) uint64_t clmul64(uint64_t a, uint64_t b, uint64_t *hi) {
+    uint64x2_t r = vreinterpretq_u64_p128(vmull_p64((poly64_t) a, (poly64_t) b));
+    if (hi)
+        *hi = vgetq_lane_u64(r, 1);
+    return vgetq_lane_u64(r, 0);
+}
+#endif
+
+#ifdef HAVE_CHECKSUM_CLMUL
+// x^64 mod G, x^96 mod G and floor(x^64 / G)
+static uint64_t clmul_k64, clmul_k96, clmul_mu;
+
+static inline __attribute__ ((always_inline)) CLMUL_TARGET uint32_t checksum_clmul_inline(uint8_t *message, int bits) {
+    uint64_t t, q, hi;
+
+    if (bits == 56) {
+        t = ((uint64_t) load_be32(message) << 24) | ((uint64_t) message[4] << 16) | ((uint64_t) message[5] << 8) | message[6];
+    } else if (bits == 112) {
+        t = ((uint64_t) load_be32(message + 6) << 32) | load_be32(message + 10);
+        t ^= clmul64((message[0] << 8) | message[1], clmul_k96, NULL);
+        t ^= clmul64(load_be32(message + 2), clmul_k64, NULL);
+    } else {
+        return checksum_slicing_inline(message, bits);
+    }
+
+    // Barrett reduction of the (at most) 64-bit remainder
+    q = clmul64(t >> 24, clmul_mu, &hi);
+    q = (q >> 40) | (hi << 24);
+    t ^= clmul64(q, MODES_GENERATOR_POLY | 0x1000000U, NULL);
+    return t & 0xffffff;
+}
+
+static CLMUL_TARGET uint32_t checksum_clmul(uint8_t *message, int bits) {
+    return checksum_clmul_inline(message, bits);
+}
+
+static CLMUL_TARGET void checksum_batch_clmul(uint8_t *messages, size_t stride, const int *bits, unsigned count, uint32_t *out) {
+    unsigned i;
+    for (i = 0; i < count; ++i)
+        out[i] = checksum_clmul_inline(messages + i * stride, bits[i]);
+}
+
+static bool checksum_clmul_supported(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul");
+#else
+    return true;
+#endif
+}
+
+// Polynomial division of x^n by G; returns the low 64 bits of the quotient
+static uint64_t poly_divide(int n, uint32_t *remainder) {
+    uint64_t quotient = 0;
+    uint32_t rem = 0;
     int i;
+
+    for (i = n; i >= 0; --i) {
+        rem = (rem << 1) | (i == n);
+        quotient <<= 1;
+        if (rem & 0x1000000) {
+            rem ^= MODES_GENERATOR_POLY | 0x1000000U;
+            quotient |= 1;
+        }
+    }
+
+    if (remainder)
+        *remainder = rem;
+    return quotient;
+}
+#endif
+
+static const struct {
+    const char *name;
+    checksum_fn checksum;
+    checksum_batch_fn batch;
+    bool (*supported)(void);
+} checksum_engines[] = {
+#ifdef HAVE_CHECKSUM_CLMUL
+    { "clmul", checksum_clmul, checksum_batch_clmul, checksum_clmul_supported },
+#endif
+    { "slicing-by-8", checksum_slicing, checksum_batch_slicing, NULL },
+    { "bytewise", checksum_bytewise, checksum_batch_bytewise, NULL },
+    { NULL, NULL, NULL, NULL }
+};
+
+// Current engine; the slicing tables are always available once built
+static checksum_fn checksum_impl = checksum_slicing;
+static checksum_batch_fn checksum_batch_impl = checksum_batch_slicing;
+static const char *checksum_name = "slicing-by-8";
+
+static void initLookupTables() {
+    int i, k;
     uint8_t msg[112 / 8];
 
     for (i = 0; i < 256; ++i) {
-        uint32_t c = i << 16;
+        uint32_t c = i << 24;
         int j;
         for (j = 0; j < 8; ++j) {
-            if (c & 0x800000)
-                c = (c << 1) ^ MODES_GENERATOR_POLY;
+            if (c & 0x80000000)
+                c = (c << 1) ^ (MODES_GENERATOR_POLY << 8);
             else
                 c = (c << 1);
         }
 
-        crc_table[i] = c & 0x00ffffff;
+        crc_table[0][i] = c;
     }
 
+    for (k = 1; k < 8; ++k) {
+        for (i = 0; i < 256; ++i) {
+            uint32_t c = crc_table[k - 1][i];
+            crc_table[k][i] = (c << 8) ^ crc_table[0][c >> 24];
+        }
+    }
+
+#ifdef HAVE_CHECKSUM_CLMUL
+    uint32_t rem;
+    clmul_mu = poly_divide(64, &rem);
+    clmul_k64 = rem;
+    poly_divide(96, &rem);
+    clmul_k96 = rem;
+#endif
+
     memset(msg, 0, sizeof (msg));
     for (i = 0; i < 112; ++i) {
         msg[i / 8] ^= 1 << (7 - (i & 7));
@@ -64,28 +271,71 @@ static void initLookupTables() {
     }
 }
 
-uint32_t modesChecksum(uint8_t *message, int bits) {
-    uint32_t rem = 0;
+// Pick the first checksum engine the CPU supports
+static void selectChecksumEngine() {
     int i;
-    int n = bits / 8;
-
-    assert(bits % 8 == 0);
-    assert(n >= 3);
 
-    for (i = 0; i < n - 3; ++i) {
-        rem = (rem << 8) ^ crc_table[message[i] ^ ((rem & 0xff0000) >> 16)];
-        rem = rem & 0xffffff;
+    for (i = 0; checksum_engines[i].name; ++i) {
+        if (!checksum_engines[i].supported || checksum_engines[i].supported()) {
+            checksum_impl = checksum_engines[i].checksum;
+            checksum_batch_impl = checksum_engines[i].batch;
+            checksum_name = checksum_engines[i].name;
+            return;
+        }
     }
+}
+
+uint32_t modesChecksum(uint8_t *message, int bits) {
+    return checksum_impl(message, bits);
+}
 
-    rem = rem ^ (message[n - 3] << 16) ^ (message[n - 2] << 8) ^ (message[n - 1]);
-    return rem;
+// Checksum 'count' messages stored 'stride' bytes apart, with bits[i]
+// giving the length of message i; results are written to out[i].
+void modesChecksumBatch(uint8_t *messages, size_t stride, const int *bits, unsigned count, uint32_t *out) {
+    checksum_batch_impl(messages, stride, bits, count, out);
 }
 
+const char *modesChecksumEngine(void) {
+    return checksum_name;
+}
+
+// Error tables, open-addressed by syndrome (see prepareErrorIndex)
 static struct errorinfo *bitErrorTable_short;
-static int bitErrorTableSize_short;
+static unsigned bitErrorTableMask_short;
 
 static struct errorinfo *bitErrorTable_long;
-static int bitErrorTableSize_long;
+static unsigned bitErrorTableMask_long;
+
+#ifndef CRCGEN
+#include "crc_tables.h"
+
+// Error patterns removed by flagCollisions() for 2-bit correction with
+// 4-bit detection, generated by 'make crc-tables' so startup can skip the search
+static const uint8_t *precomputedFlags(int bits, int max_correct, int max_detect) {
+    if (max_correct != 2 || max_detect != 4)
+        return NULL;
+    return (bits == MODES_SHORT_MSG_BITS) ? flaggedErrors_short : flaggedErrors_long;
+}
+#else
+static const uint8_t *precomputedFlags(int bits, int max_correct, int max_detect) {
+    MODES_NOTUSED(bits);
+    MODES_NOTUSED(max_correct);
+    MODES_NOTUSED(max_detect);
+    return NULL;
+}
+#endif
+
+// Bit number of a 1- or 2-bit error pattern in the flaggedErrors tables:
+// all single bit errors first, then all pairs in ascending order
+static int errorPatternIndex(const struct errorinfo *ei, int bits) {
+    int n = bits - 5;
+    int a = ei->bit[0] - 5;
+
+    if (ei->errors == 1)
+        return a;
+
+    return n + a * n - a * (a + 1) / 2 + (ei->bit[1] - 5 - a - 1);
+}
 
 // compare two errorinfo structures
 
@@ -185,6 +435,7 @@ static struct errorinfo *prepareErrorTable(int bits, int max_correct, int max_de
     int maxsize, usedsize;
     struct errorinfo *table;
     struct errorinfo base_entry;
+    const uint8_t *flags;
     int i, j;
 
     assert(bits >= 0 && bits <= 112);
@@ -214,6 +465,20 @@ static struct errorinfo *prepareErrorTable(int bits, int max_correct, int max_de
     // ignore the first 5 bits (DF type)
     usedsize = prepareSubtable(table, 0, maxsize, 112 - bits, 5, bits, &base_entry, 0, max_correct);
 
+    flags = precomputedFlags(bits, max_correct, max_detect);
+    if (flags) {
+        for (i = 0, j = 0; i < usedsize; ++i) {
+            int k = errorPatternIndex(&table[i], bits);
+            if (!(flags[k >> 3] & (1 << (k & 7))))
+                table[j++] = table[i];
+        }
+
+#ifdef CRCDEBUG
+        fprintf(stderr, "Discarded %d precomputed collisions.\n", usedsize - j);
+#endif
+        usedsize = j;
+    }
+
 #ifdef CRCDEBUG
     fprintf(stderr, "%d syndromes (expected %d).\n", usedsize, maxsize);
     fprintf(stderr, "Sorting syndromes..\n");
@@ -267,7 +532,7 @@ static struct errorinfo *prepareErrorTable(int bits, int max_correct, int max_de
     }
 
     // Flag collisions we want to detect but not correct
-    if (max_detect > max_correct) {
+    if (max_detect > max_correct && !flags) {
         int flagged;
 
 #ifdef CRCDEBUG
@@ -353,31 +618,65 @@ static struct errorinfo *prepareErrorTable(int bits, int max_correct, int max_de
     return table;
 }
 
+// Scatter a sorted error table into an open-addressed table of at least
+// twice its size, indexed by syndrome_hash() with linear probing. Empty
+// slots have errors == 0. Frees the sorted table.
+
+static inline uint32_t syndrome_hash(uint32_t syndrome, unsigned mask) {
+    return ((syndrome * 0x9E3779B1U) >> 16) & mask;
+}
+
+static struct errorinfo *prepareErrorIndex(int bits, int max_correct, int max_detect, unsigned *mask_out) {
+    struct errorinfo *table, *index;
+    int size, i;
+    unsigned slots = 64;
+
+    *mask_out = 0;
+
+    table = prepareErrorTable(bits, max_correct, max_detect, &size);
+    if (!table)
+        return NULL;
+
+    while (slots < 2 * (unsigned) size)
+        slots <<= 1;
+
+    index = calloc(slots, sizeof (struct errorinfo));
+    for (i = 0; i < size; ++i) {
+        uint32_t h = syndrome_hash(table[i].syndrome, slots - 1);
+        while (index[h].errors)
+            h = (h + 1) & (slots - 1);
+        index[h] = table[i];
+    }
+
+    free(table);
+    *mask_out = slots - 1;
+    return index;
+}
+
 // Precompute syndrome tables for 56- and 112-bit messages.
 
 void modesChecksumInit(int fixBits) {
     initLookupTables();
+    selectChecksumEngine();
 
     switch (fixBits) {
         case 0:
             bitErrorTable_short = bitErrorTable_long = NULL;
-            bitErrorTableSize_short = bitErrorTableSize_long = 0;
+            bitErrorTableMask_short = bitErrorTableMask_long = 0;
             break;
 
         case 1:
             // For 1 bit correction, we have 100% coverage up to 4 bit detection, so don't bother
             // with flagging collisions there.
-            bitErrorTable_short = prepareErrorTable(MODES_SHORT_MSG_BITS, 1, 1, &bitErrorTableSize_short);
-            bitErrorTable_long = prepareErrorTable(MODES_LONG_MSG_BITS, 1, 1, &bitErrorTableSize_long);
+            bitErrorTable_short = prepareErrorIndex(MODES_SHORT_MSG_BITS, 1, 1, &bitErrorTableMask_short);
+            bitErrorTable_long = prepareErrorIndex(MODES_LONG_MSG_BITS, 1, 1, &bitErrorTableMask_long);
             break;
 
         default:
             // Detect out to 4 bit errors; this reduces our 2-bit coverage to about 65%.
-            // This can take a little while - tell the user.
-            fprintf(stderr, "Preparing error correction tables.. ");
-            bitErrorTable_short = prepareErrorTable(MODES_SHORT_MSG_BITS, 2, 4, &bitErrorTableSize_short);
-            bitErrorTable_long = prepareErrorTable(MODES_LONG_MSG_BITS, 2, 4, &bitErrorTableSize_long);
-            fprintf(stderr, "done.\n");
+            // The collisions to discard come from crc_tables.h.
+            bitErrorTable_short = prepareErrorIndex(MODES_SHORT_MSG_BITS, 2, 4, &bitErrorTableMask_short);
+            bitErrorTable_long = prepareErrorIndex(MODES_LONG_MSG_BITS, 2, 4, &bitErrorTableMask_long);
             break;
     }
 }
@@ -388,9 +687,8 @@ void modesChecksumInit(int fixBits) {
 
 struct errorinfo *modesChecksumDiagnose(uint32_t syndrome, int bitlen) {
     struct errorinfo *table;
-    int tablesize;
-
-    struct errorinfo ei;
+    unsigned mask;
+    uint32_t h;
 
     if (syndrome == 0)
         return &NO_ERRORS;
@@ -398,17 +696,21 @@ struct errorinfo *modesChecksumDiagnose(uint32_t syndrome, int bitlen) {
     assert(bitlen == 56 || bitlen == 112);
     if (bitlen == 56) {
         table = bitErrorTable_short;
-        tablesize = bitErrorTableSize_short;
+        mask = bitErrorTableMask_short;
     } else {
         table = bitErrorTable_long;
-        tablesize = bitErrorTableSize_long;
+        mask = bitErrorTableMask_long;
     }
 
     if (!table)
         return NULL;
 
-    ei.syndrome = syndrome;
-    return bsearch(&ei, table, tablesize, sizeof (struct errorinfo), syndrome_compare);
+    for (h = syndrome_hash(syndrome, mask); table[h].errors; h = (h + 1) & mask) {
+        if (table[h].syndrome == syndrome)
+            return &table[h];
+    }
+
+    return NULL;
 }
 
 // Given a message and an error-correction descriptor,
@@ -571,3 +873,143 @@ int main(int argc, char **argv) {
     return 0;
 }
 #endif
+
+#ifdef CRCGEN
+
+// Writes crc_tables.h: for the 2-bit correction / 4-bit detection tables,
+// a bitmap of the 1- and 2-bit error patterns that prepareErrorTable()
+// discards because they collide with other patterns.
+
+static void printFlaggedErrors(const char *name, int bits) {
+    struct errorinfo *table;
+    uint8_t *flags;
+    int size, i, npatterns, nbytes;
+
+    npatterns = combinations(bits - 5, 1) + combinations(bits - 5, 2);
+    nbytes = (npatterns + 7) / 8;
+    flags = calloc(nbytes, 1);
+
+    for (i = 0; i < npatterns; ++i)
+        flags[i >> 3] |= 1 << (i & 7);
+
+    table = prepareErrorTable(bits, 2, 4, &size);
+    for (i = 0; i < size; ++i) {
+        int k = errorPatternIndex(&table[i], bits);
+        flags[k >> 3] &= ~(1 << (k & 7));
+    }
+
+    printf("static const uint8_t %s[%d] = {", name, nbytes);
+    for (i = 0; i < nbytes; ++i)
+        printf("%s0x%02x%s", (i % 12) ? " " : "\n    ", flags[i], (i + 1 < nbytes) ? "," : "\n");
+    printf("};\n");
+
+    free(table);
+    free(flags);
+}
+
+int main(void) {
+    initLookupTables();
+
+    printf("// Part of readsb, a Mode-S/ADSB/TIS message decoder.\n"
+            "//\n"
+            "// crc_tables.h: Precomputed error correction collisions.\n"
+            "//\n"
+            "// Generated by crcgen (make crc-tables), do not edit.\n"
+            "//\n"
+            "// One bit per 1- or 2-bit error pattern, see errorPatternIndex() in crc.c.\n"
+            "// A set bit means the pattern's syndrome collides with another pattern of\n"
+            "// up to 4 bits and must not be used for correction.\n\n"
+            "#ifndef CRC_TABLES_H\n"
+            "#define CRC_TABLES_H\n\n");
+    printFlaggedErrors("flaggedErrors_short", MODES_SHORT_MSG_BITS);
+    printf("\n");
+    printFlaggedErrors("flaggedErrors_long", MODES_LONG_MSG_BITS);
+    printf("\n#endif\n");
+
+    return 0;
+}
+#endif
+
+#ifdef CRCBENCH
+
+// Microbenchmark for the checksum engines: checksums a fixed set of random
+// 56/112-bit messages, one call per message and through the batch API,
+// checks every engine against the bytewise reference and reports messages/second.
+
+#define BENCH_MESSAGES 4096
+#define BENCH_ROUNDS 2000
+
+static double bench_elapsed(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv) {
+    static uint8_t msgs[BENCH_MESSAGES][MODES_LONG_MSG_BYTES];
+    static int bits[BENCH_MESSAGES];
+    static uint32_t expected[BENCH_MESSAGES], out[BENCH_MESSAGES];
+    unsigned rounds = BENCH_ROUNDS;
+    int i, e;
+
+    if (argc > 1)
+        rounds = atoi(argv[1]);
+
+    initLookupTables();
+
+    srand(1);
+    for (i = 0; i < BENCH_MESSAGES; ++i) {
+        unsigned j;
+        for (j = 0; j < MODES_LONG_MSG_BYTES; ++j)
+            msgs[i][j] = rand();
+        bits[i] = (msgs[i][0] & 0x80) ? MODES_LONG_MSG_BITS : MODES_SHORT_MSG_BITS;
+        expected[i] = checksum_bytewise(msgs[i], bits[i]);
+    }
+
+    for (e = 0; checksum_engines[e].name; ++e) {
+        struct timespec start;
+        double single, batch;
+        uint32_t sink = 0;
+        unsigned r;
+
+        if (checksum_engines[e].supported && !checksum_engines[e].supported()) {
+            printf("%-14s not supported on this CPU\n", checksum_engines[e].name);
+            continue;
+        }
+
+        for (i = 0; i < BENCH_MESSAGES; ++i) {
+            if (checksum_engines[e].checksum(msgs[i], bits[i]) != expected[i]) {
+                fprintf(stderr, "%s: checksum mismatch on message %d\n", checksum_engines[e].name, i);
+                return 1;
+            }
+        }
+
+        checksum_engines[e].batch(&msgs[0][0], MODES_LONG_MSG_BYTES, bits, BENCH_MESSAGES, out);
+        if (memcmp(out, expected, sizeof (out))) {
+            fprintf(stderr, "%s: batch checksum mismatch\n", checksum_engines[e].name);
+            return 1;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (r = 0; r < rounds; ++r) {
+            for (i = 0; i < BENCH_MESSAGES; ++i)
+                sink ^= checksum_engines[e].checksum(msgs[i], bits[i]);
+        }
+        single = bench_elapsed(&start);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (r = 0; r < rounds; ++r) {
+            checksum_engines[e].batch(&msgs[0][0], MODES_LONG_MSG_BYTES, bits, BENCH_MESSAGES, out);
+            sink ^= out[r % BENCH_MESSAGES];
+        }
+        batch = bench_elapsed(&start);
+
+        printf("%-14s %8.2f Mmsg/s single %8.2f Mmsg/s batch (%08x)\n", checksum_engines[e].name,
+                (double) rounds * BENCH_MESSAGES / single / 1e6,
+                (double) rounds * BENCH_MESSAGES / batch / 1e6,
+                sink);
+    }
+
+    return 0;
+}
+#endif
@@ -24,6 +24,7 @@
 #ifndef CRC_H
 #define CRC_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 // Global max for fixable bit erros
@@ -38,6 +39,8 @@ struct errorinfo {
 
 void modesChecksumInit(int fixBits);
 uint32_t modesChecksum(uint8_t *msg, int bitlen);
+void modesChecksumBatch(uint8_t *msgs, size_t stride, const int *bitlen, unsigned count, uint32_t *out);
+const char *modesChecksumEngine(void);
 struct errorinfo *modesChecksumDiagnose(uint32_t syndrome, int bitlen);
 void modesChecksumFix(uint8_t *msg, struct errorinfo *info);
 void crcCleanupTables(void);
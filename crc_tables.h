@@ -0,0 +1,95 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// crc_tables.h: Precomputed error correction collisions.
+//
+// Generated by crcgen (make crc-tables), do not edit.
+//
+// One bit per 1- or 2-bit error pattern, see errorPatternIndex() in crc.c.
+// A set bit means the pattern's syndrome collides with another pattern of
+// up to 4 bits and must not be used for correction.
+
+#ifndef CRC_TABLES_H
+#define CRC_TABLES_H
+
+static const uint8_t flaggedErrors_short[166] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const uint8_t flaggedErrors_long[723] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0xd8, 0xbb, 0x85, 0x04, 0x40, 0x99, 0xf8, 0x32, 0x34, 0x22, 0x0a,
+    0x05, 0x96, 0x71, 0xef, 0x16, 0x12, 0x80, 0x45, 0xe2, 0x8a, 0xd0, 0x88,
+    0x28, 0x16, 0x58, 0xc6, 0xde, 0x2d, 0x24, 0x00, 0x8b, 0xc5, 0x15, 0xa1,
+    0x51, 0x51, 0x2c, 0xb0, 0xcc, 0xde, 0x2d, 0x24, 0x00, 0x8b, 0xc5, 0x15,
+    0xa1, 0x51, 0x51, 0x2c, 0xb0, 0x6c, 0xef, 0x17, 0x13, 0x80, 0xc5, 0xe2,
+    0x8a, 0xd0, 0xa8, 0x68, 0x96, 0x58, 0xde, 0xf3, 0xc5, 0x04, 0x62, 0xa1,
+    0xa8, 0x22, 0x34, 0x2a, 0x9a, 0x25, 0x96, 0x7b, 0xba, 0x98, 0x40, 0x2c,
+    0x14, 0x54, 0x86, 0x06, 0x45, 0xb3, 0xc4, 0xf2, 0xa7, 0x8b, 0x09, 0xc5,
+    0xc2, 0x41, 0x75, 0x68, 0x50, 0x34, 0x4b, 0xac, 0x3f, 0x5d, 0x4c, 0x28,
+    0x16, 0x0e, 0xaa, 0x43, 0x83, 0xa2, 0x59, 0x62, 0xff, 0x74, 0x31, 0xa1,
+    0x5b, 0x3a, 0xaa, 0x0e, 0x0d, 0x82, 0x66, 0xa9, 0xff, 0xe9, 0x62, 0x42,
+    0xb5, 0x74, 0xd0, 0x1d, 0x1a, 0x04, 0xcd, 0x52, 0xff, 0xe9, 0x62, 0x42,
+    0xb5, 0x6c, 0x90, 0x3d, 0x1a, 0x00, 0xcd, 0x5a, 0xff, 0x74, 0x30, 0xa1,
+    0x5a, 0x36, 0xc8, 0x1e, 0x0d, 0x80, 0x66, 0xad, 0x3f, 0x1f, 0x4c, 0xa8,
+    0x96, 0x0d, 0xba, 0x47, 0x03, 0xa0, 0x59, 0xfb, 0xe7, 0x83, 0x09, 0xc5,
+    0xb2, 0xc1, 0xf3, 0x78, 0x00, 0x34, 0x6b, 0x7f, 0x3e, 0x98, 0x50, 0x2c,
+    0x1b, 0x3c, 0x8f, 0x07, 0x40, 0xb3, 0xfe, 0xb7, 0x81, 0x84, 0x62, 0xd9,
+    0xe0, 0x79, 0x3c, 0x01, 0x8a, 0xf5, 0xdf, 0x06, 0x12, 0x8a, 0x25, 0x83,
+    0xe7, 0xf0, 0x04, 0x28, 0xd6, 0xbf, 0x0d, 0x24, 0x14, 0x4b, 0x06, 0xcf,
+    0xe1, 0x09, 0x50, 0xec, 0xbf, 0x0d, 0x20, 0x14, 0x43, 0x06, 0xcf, 0xe0,
+    0x08, 0x50, 0xec, 0xdf, 0x06, 0x10, 0x8a, 0x21, 0x83, 0x67, 0x70, 0x04,
+    0x28, 0x7e, 0xb7, 0x0b, 0x84, 0x22, 0xc9, 0xe1, 0x59, 0x3c, 0x21, 0x8a,
+    0xef, 0x76, 0x81, 0x50, 0x20, 0x39, 0x3c, 0x8b, 0x27, 0x44, 0xf1, 0x6e,
+    0x17, 0x08, 0x05, 0x92, 0xc3, 0xb3, 0x78, 0x42, 0x94, 0x77, 0xbb, 0x40,
+    0x28, 0x90, 0x1d, 0xbe, 0xd5, 0x33, 0xa2, 0xde, 0xed, 0x02, 0xa1, 0x40,
+    0x76, 0xf8, 0x56, 0xcf, 0x88, 0xb6, 0xdb, 0x05, 0x42, 0x80, 0xec, 0xf0,
+    0xad, 0x9e, 0x11, 0xb5, 0xdb, 0x05, 0x42, 0x80, 0xec, 0xf0, 0xad, 0x9e,
+    0x11, 0xdb, 0x8c, 0x02, 0x00, 0x40, 0x76, 0xf8, 0x56, 0x8f, 0x88, 0x36,
+    0xa3, 0x00, 0x00, 0x90, 0x1d, 0xbe, 0xd5, 0x23, 0xd2, 0x66, 0x14, 0x00,
+    0x00, 0xb2, 0xc3, 0xb7, 0x7a, 0x44, 0x6d, 0x46, 0x01, 0x00, 0x20, 0x3b,
+    0x7c, 0xab, 0x47, 0x6c, 0x33, 0x08, 0x00, 0x00, 0xd9, 0xe1, 0x1b, 0x3d,
+    0xa2, 0xcd, 0x20, 0x00, 0x00, 0x64, 0x87, 0x6f, 0xf4, 0x48, 0x9b, 0x41,
+    0x00, 0x00, 0xc8, 0x0e, 0xdf, 0xe8, 0x51, 0x9b, 0x41, 0x00, 0x00, 0xc8,
+    0x0e, 0xdf, 0xe8, 0xb1, 0xcd, 0x20, 0x00, 0x04, 0x64, 0xc7, 0x6f, 0xf1,
+    0x68, 0x33, 0x08, 0x00, 0x01, 0xd9, 0xf1, 0x5b, 0x3c, 0x6d, 0x06, 0x11,
+    0x30, 0x20, 0x3b, 0x7e, 0x8b, 0xd7, 0x66, 0x10, 0x01, 0x03, 0xb2, 0xe3,
+    0xb7, 0xf8, 0x36, 0x03, 0x08, 0x18, 0x80, 0x0d, 0xbf, 0xc5, 0xdb, 0x0c,
+    0x22, 0x60, 0x00, 0x36, 0xdc, 0x16, 0xb7, 0x0b, 0xc0, 0xc0, 0x00, 0x6c,
+    0x98, 0x2d, 0x36, 0x02, 0xc0, 0xc0, 0x00, 0x6c, 0x88, 0x2d, 0x1a, 0x01,
+    0x60, 0x60, 0x00, 0x36, 0xc4, 0x96, 0x46, 0x01, 0x18, 0x18, 0x80, 0x0d,
+    0xb9, 0xd5, 0x28, 0x00, 0x03, 0x03, 0xb0, 0x21, 0xb7, 0x0d, 0x02, 0x10,
+    0x30, 0x00, 0x1b, 0x72, 0x6b, 0x10, 0x80, 0x80, 0x01, 0xd8, 0x90, 0x9b,
+    0x41, 0x00, 0x06, 0x06, 0x60, 0x41, 0x2f, 0x82, 0x08, 0x0c, 0x0c, 0xc0,
+    0x80, 0x1e, 0x82, 0x0c, 0x0c, 0x0c, 0xc0, 0x80, 0x1e, 0x45, 0x06, 0x06,
+    0x06, 0x20, 0x40, 0x47, 0x90, 0x91, 0x81, 0x01, 0x00, 0xd4, 0x08, 0x30,
+    0x32, 0x10, 0x00, 0x80, 0x0a, 0x00, 0xa1, 0x01, 0x01, 0x40, 0x28, 0x00,
+    0x08, 0x0d, 0x08, 0x00, 0x42, 0x01, 0x20, 0x14, 0x00, 0x00, 0x08, 0x01,
+    0x40, 0x28, 0x00, 0x00, 0x10, 0x02, 0x42, 0x20, 0x40, 0x00, 0x10, 0x00,
+    0x21, 0x10, 0x20, 0x00, 0x08, 0x40, 0x08, 0x04, 0x08, 0x00, 0x02, 0x08,
+    0x81, 0x00, 0x01, 0x40, 0x80, 0x10, 0x08, 0x10, 0x00, 0x04, 0x84, 0x00,
+    0x80, 0x00, 0x01, 0x10, 0x02, 0x00, 0x02, 0x04, 0x20, 0x14, 0x00, 0x0c,
+    0x08, 0x20, 0x14, 0x04, 0x0c, 0x08, 0x10, 0x0a, 0x02, 0x06, 0x04, 0x84,
+    0x82, 0x80, 0x01, 0x80, 0x50, 0x10, 0x30, 0x00, 0x08, 0x05, 0x01, 0x03,
+    0x40, 0x28, 0x08, 0x18, 0x00, 0xa1, 0x20, 0x60, 0x00, 0x42, 0x41, 0xc0,
+    0x00, 0x42, 0x41, 0xc1, 0x00, 0xa1, 0xa0, 0x60, 0x40, 0x08, 0x28, 0x08,
+    0x00, 0x01, 0x05, 0x00, 0x10, 0x50, 0x00, 0x80, 0x80, 0x02, 0x00, 0x0a,
+    0x0a, 0x00, 0x14, 0x14, 0x00, 0x14, 0x14, 0x00, 0x0a, 0x02, 0x80, 0x82,
+    0x00, 0x51, 0x00, 0x10, 0x05, 0x80, 0x28, 0x00, 0xa2, 0x00, 0x44, 0x01,
+    0x44, 0x01, 0x22, 0x80, 0x08, 0x10, 0x00, 0x01, 0x08, 0x20, 0x00, 0x00,
+    0x00, 0x00, 0x00
+};
+
+#endif
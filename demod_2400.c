@@ -176,21 +176,19 @@ static inline __attribute__ ((always_inline)) uint8_t slice_byte(uint16_t **pPtr
     return theByte;
 }
 
-// score a phase using data from the magnitude buffers
-// if the score is better than the existing one passed via bestscore,
-// update bestmsg, bestscore and bestphase
-
-static void score_phase(int try_phase, uint16_t *m, int j, unsigned char **bestmsg, int *bestscore, int *bestphase, unsigned char **msg, unsigned char *msg1, unsigned char *msg2) {
-    Modes.stats_current.demod_preamblePhase[try_phase - 4]++;
+// Slice the data bits of one phase candidate into msg. Returns the message
+// length in bits, or 0 if the downlink format is unknown.
+static int slice_phase(struct stats *stats, int try_phase, uint16_t *m, int j, unsigned char *msg) {
+    stats->demod_preamblePhase[try_phase - 4]++;
     uint16_t *pPtr;
-    int phase, i, score, bytelen;
+    int phase, i, bytelen;
 
     pPtr = &m[j + 19] + (try_phase / 5);
     phase = try_phase % 5;
 
-    (*msg)[0] = slice_byte(&pPtr, &phase);
+    msg[0] = slice_byte(&pPtr, &phase);
 
-    switch ((*msg)[0] >> 3) {
+    switch (msg[0] >> 3) {
         case 0: case 4: case 5: case 11:
             bytelen = MODES_SHORT_MSG_BYTES;
             break;
@@ -200,32 +198,350 @@ static void score_phase(int try_phase, uint16_t *m, int j, unsigned char **bestm
             break;
 
         default:
-            bytelen = 1; // unknown DF, give up immediately
-            break;
+            return 0; // unknown DF, give up immediately
     }
 
     for (i = 1; i < bytelen; ++i) {
-        (*msg)[i] = slice_byte(&pPtr, &phase);
+        msg[i] = slice_byte(&pPtr, &phase);
     }
 
-    // Score the mode S message and see if it's any good.
-    if (bytelen > 1) {
-        score = scoreModesMessage(*msg, i * 8);
-    } else {
-        score = -2;
+    return bytelen * 8;
+}
+
+//
+// Preamble candidate search
+//
+// The pre-check and the three preamble correlations below only depend on the
+// magnitude samples around the candidate offset and on the reference level,
+// so they can be evaluated for many offsets at once. The search functions scan
+// samples [from, to) and write every offset where the pre-check passes and at
+// least one correlation reaches the reference level into 'out' (which must
+// have room for to - from entries). Only those offsets are handed to
+// slice_phase() by demodulate2400().
+//
+// All implementations must produce exactly the same candidate list as
+// preamble_search_generic().
+//
+
+// Samples per search block, bounds the size of the candidate list
+#define PREAMBLE_SEARCH_BLOCK 4096
+
+typedef unsigned (*preamble_search_fn)(const uint16_t *m, uint32_t from, uint32_t to, uint32_t threshold, uint32_t *out);
+
+static inline __attribute__ ((always_inline)) int preamble_candidate(const uint16_t *pa, uint32_t threshold) {
+    int32_t base_noise, ref_level;
+
+    // do a pre-check to reduce CPU usage
+    if (!(pa[1] > pa[7] && pa[12] > pa[14] && pa[12] > pa[15]))
+        return 0;
+
+    // 5 noise samples
+    base_noise = pa[5] + pa[8] + pa[16] + pa[17] + pa[18];
+    ref_level = (base_noise * threshold) >> 5; // divide by 32
+
+    int32_t diff_2_3 = pa[2] - pa[3];
+    int32_t sum_1_4 = pa[1] + pa[4];
+    int32_t diff_10_11 = pa[10] - pa[11];
+    int32_t common3456 = sum_1_4 - diff_2_3 + pa[9] + pa[12];
+
+    return (common3456 - diff_10_11 >= ref_level ||
+            common3456 + diff_10_11 >= ref_level ||
+            sum_1_4 + 2 * diff_2_3 + diff_10_11 + pa[12] >= ref_level);
+}
+
+static unsigned preamble_search_generic(const uint16_t *m, uint32_t from, uint32_t to, uint32_t threshold, uint32_t *out) {
+    unsigned n = 0;
+
+    for (uint32_t j = from; j < to; ++j) {
+        if (preamble_candidate(&m[j], threshold))
+            out[n++] = j;
     }
 
-    if (score > *bestscore) {
-        // new high score!
-        *bestmsg = *msg;
-        *bestscore = score;
-        *bestphase = try_phase;
+    return n;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// 8 offsets per iteration, 32 bit lanes
+
+__attribute__ ((target("avx2")))
+static unsigned preamble_search_avx2(const uint16_t *m, uint32_t from, uint32_t to, uint32_t threshold, uint32_t *out) {
+    const __m256i thr = _mm256_set1_epi32((int32_t) threshold);
+    unsigned n = 0;
+    uint32_t j;
+
+#define LOAD8(k) _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (pa + (k))))
+    for (j = from; j + 8 <= to; j += 8) {
+        const uint16_t *pa = &m[j];
+        __m256i p1 = LOAD8(1), p12 = LOAD8(12);
+
+        __m256i pre = _mm256_and_si256(_mm256_cmpgt_epi32(p1, LOAD8(7)),
+                _mm256_and_si256(_mm256_cmpgt_epi32(p12, LOAD8(14)), _mm256_cmpgt_epi32(p12, LOAD8(15))));
+        if (_mm256_testz_si256(pre, pre))
+            continue;
 
-        // swap to using the other buffer so we don't clobber our demodulated data
-        // (if we find a better result then we'll swap back, but that's OK because
-        // we no longer need this copy if we found a better one)
-        *msg = (*msg == msg1) ? msg2 : msg1;
+        __m256i base_noise = _mm256_add_epi32(_mm256_add_epi32(LOAD8(5), LOAD8(8)),
+                _mm256_add_epi32(_mm256_add_epi32(LOAD8(16), LOAD8(17)), LOAD8(18)));
+        __m256i ref_level = _mm256_srai_epi32(_mm256_mullo_epi32(base_noise, thr), 5);
+
+        __m256i diff_2_3 = _mm256_sub_epi32(LOAD8(2), LOAD8(3));
+        __m256i sum_1_4 = _mm256_add_epi32(p1, LOAD8(4));
+        __m256i diff_10_11 = _mm256_sub_epi32(LOAD8(10), LOAD8(11));
+        __m256i common3456 = _mm256_add_epi32(_mm256_sub_epi32(sum_1_4, diff_2_3), _mm256_add_epi32(LOAD8(9), p12));
+        __m256i phase7 = _mm256_add_epi32(_mm256_add_epi32(sum_1_4, _mm256_add_epi32(diff_2_3, diff_2_3)),
+                _mm256_add_epi32(diff_10_11, p12));
+
+        // x >= ref_level  <=>  !(ref_level > x)
+        __m256i below = _mm256_and_si256(_mm256_cmpgt_epi32(ref_level, _mm256_sub_epi32(common3456, diff_10_11)),
+                _mm256_and_si256(_mm256_cmpgt_epi32(ref_level, _mm256_add_epi32(common3456, diff_10_11)),
+                _mm256_cmpgt_epi32(ref_level, phase7)));
+        unsigned bits = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_andnot_si256(below, pre)));
+
+        while (bits) {
+            out[n++] = j + __builtin_ctz(bits);
+            bits &= bits - 1;
+        }
     }
+#undef LOAD8
+
+    return n + preamble_search_generic(m, j, to, threshold, out + n);
+}
+
+// 4 offsets per iteration, 32 bit lanes
+
+__attribute__ ((target("sse4.1")))
+static unsigned preamble_search_sse41(const uint16_t *m, uint32_t from, uint32_t to, uint32_t threshold, uint32_t *out) {
+    const __m128i thr = _mm_set1_epi32((int32_t) threshold);
+    unsigned n = 0;
+    uint32_t j;
+
+#define LOAD4(k) _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *) (pa + (k))))
+    for (j = from; j + 4 <= to; j += 4) {
+        const uint16_t *pa = &m[j];
+        __m128i p1 = LOAD4(1), p12 = LOAD4(12);
+
+        __m128i pre = _mm_and_si128(_mm_cmpgt_epi32(p1, LOAD4(7)),
+                _mm_and_si128(_mm_cmpgt_epi32(p12, LOAD4(14)), _mm_cmpgt_epi32(p12, LOAD4(15))));
+        if (_mm_testz_si128(pre, pre))
+            continue;
+
+        __m128i base_noise = _mm_add_epi32(_mm_add_epi32(LOAD4(5), LOAD4(8)),
+                _mm_add_epi32(_mm_add_epi32(LOAD4(16), LOAD4(17)), LOAD4(18)));
+        __m128i ref_level = _mm_srai_epi32(_mm_mullo_epi32(base_noise, thr), 5);
+
+        __m128i diff_2_3 = _mm_sub_epi32(LOAD4(2), LOAD4(3));
+        __m128i sum_1_4 = _mm_add_epi32(p1, LOAD4(4));
+        __m128i diff_10_11 = _mm_sub_epi32(LOAD4(10), LOAD4(11));
+        __m128i common3456 = _mm_add_epi32(_mm_sub_epi32(sum_1_4, diff_2_3), _mm_add_epi32(LOAD4(9), p12));
+        __m128i phase7 = _mm_add_epi32(_mm_add_epi32(sum_1_4, _mm_add_epi32(diff_2_3, diff_2_3)),
+                _mm_add_epi32(diff_10_11, p12));
+
+        __m128i below = _mm_and_si128(_mm_cmpgt_epi32(ref_level, _mm_sub_epi32(common3456, diff_10_11)),
+                _mm_and_si128(_mm_cmpgt_epi32(ref_level, _mm_add_epi32(common3456, diff_10_11)),
+                _mm_cmpgt_epi32(ref_level, phase7)));
+        unsigned bits = _mm_movemask_ps(_mm_castsi128_ps(_mm_andnot_si128(below, pre)));
+
+        while (bits) {
+            out[n++] = j + __builtin_ctz(bits);
+            bits &= bits - 1;
+        }
+    }
+#undef LOAD4
+
+    return n + preamble_search_generic(m, j, to, threshold, out + n);
+}
+#endif /* x86 */
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+
+// 4 offsets per iteration, 32 bit lanes
+
+static unsigned preamble_search_neon(const uint16_t *m, uint32_t from, uint32_t to, uint32_t threshold, uint32_t *out) {
+    static const uint32_t lane_bits[4] = {1, 2, 4, 8};
+    const uint32x4_t lanes = vld1q_u32(lane_bits);
+    const int32x4_t thr = vdupq_n_s32((int32_t) threshold);
+    unsigned n = 0;
+    uint32_t j;
+
+#define LOAD4(k) vreinterpretq_s32_u32(vmovl_u16(vld1_u16(pa + (k))))
+    for (j = from; j + 4 <= to; j += 4) {
+        const uint16_t *pa = &m[j];
+        int32x4_t p1 = LOAD4(1), p12 = LOAD4(12);
+
+        uint32x4_t pre = vandq_u32(vcgtq_s32(p1, LOAD4(7)),
+                vandq_u32(vcgtq_s32(p12, LOAD4(14)), vcgtq_s32(p12, LOAD4(15))));
+#ifdef __aarch64__
+        if (!vmaxvq_u32(pre))
+            continue;
+#endif
+
+        int32x4_t base_noise = vaddq_s32(vaddq_s32(LOAD4(5), LOAD4(8)),
+                vaddq_s32(vaddq_s32(LOAD4(16), LOAD4(17)), LOAD4(18)));
+        int32x4_t ref_level = vshrq_n_s32(vmulq_s32(base_noise, thr), 5);
+
+        int32x4_t diff_2_3 = vsubq_s32(LOAD4(2), LOAD4(3));
+        int32x4_t sum_1_4 = vaddq_s32(p1, LOAD4(4));
+        int32x4_t diff_10_11 = vsubq_s32(LOAD4(10), LOAD4(11));
+        int32x4_t common3456 = vaddq_s32(vsubq_s32(sum_1_4, diff_2_3), vaddq_s32(LOAD4(9), p12));
+        int32x4_t phase7 = vaddq_s32(vaddq_s32(sum_1_4, vshlq_n_s32(diff_2_3, 1)), vaddq_s32(diff_10_11, p12));
+
+        uint32x4_t pass = vorrq_u32(vcgeq_s32(vsubq_s32(common3456, diff_10_11), ref_level),
+                vorrq_u32(vcgeq_s32(vaddq_s32(common3456, diff_10_11), ref_level),
+                vcgeq_s32(phase7, ref_level)));
+        uint32x4_t sel = vandq_u32(vandq_u32(pre, pass), lanes);
+#ifdef __aarch64__
+        unsigned bits = vaddvq_u32(sel);
+#else
+        uint32x2_t half = vadd_u32(vget_low_u32(sel), vget_high_u32(sel));
+        unsigned bits = vget_lane_u32(vpadd_u32(half, half), 0);
+#endif
+
+        while (bits) {
+            out[n++] = j + __builtin_ctz(bits);
+            bits &= bits - 1;
+        }
+    }
+#undef LOAD4
+
+    return n + preamble_search_generic(m, j, to, threshold, out + n);
+}
+#endif /* NEON */
+
+static preamble_search_fn preamble_search = preamble_search_generic;
+
+// Select the fastest preamble search supported by this CPU
+
+void demod2400Init(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        preamble_search = preamble_search_avx2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        preamble_search = preamble_search_sse41;
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    preamble_search = preamble_search_neon;
+#endif
+    demod2400UpdateThreshold();
+}
+
+// Preamble threshold for the next buffer, published by the main thread
+static atomic_uint demod_threshold;
+
+// Recompute the preamble threshold. The 15 minute statistics are rebuilt by the
+// main thread, so it evaluates them here and the demodulator threads only read
+// the result.
+void demod2400UpdateThreshold(void) {
+    uint32_t threshold = Modes.preambleThreshold;
+
+    // reduce number of preamble detections if we recently dropped samples
+    if (Modes.stats_15min.samples_dropped)
+        threshold = max(PREAMBLE_THRESHOLD_PIZERO, threshold);
+
+    atomic_store_explicit(&demod_threshold, threshold, memory_order_relaxed);
+}
+
+static uint32_t preamble_threshold(void) {
+    return atomic_load_explicit(&demod_threshold, memory_order_relaxed);
+}
+
+//
+// Fused conversion and preamble screening (--demod-fused)
+//
+// Convert IQ samples into the magnitude buffer in cache-sized blocks and run
+// the preamble search over each block right after converting it, while the
+// samples are still in cache. The demodulator then only revisits the samples
+// around the candidates instead of streaming the whole buffer from memory
+// again. Runs on the SDR thread.
+//
+
+// Samples converted per step, small enough to stay in L1/L2 cache
+#define FUSED_BLOCK 8192
+// Samples read by the preamble search at each offset
+#define PREAMBLE_WINDOW 19
+
+void demod2400Convert(struct mag_buf *mag, iq_convert_fn convert, struct converter_state *state,
+        void *iq_data, unsigned bytes_per_sample, unsigned nsamples) {
+    uint32_t candidates[PREAMBLE_SEARCH_BLOCK];
+    uint16_t *m = mag->data;
+    uint8_t *in = iq_data;
+    double sum_level = 0, sum_power = 0;
+    uint32_t threshold = 0, screened = mag->overlap;
+
+    mag->candidateCount = 0;
+    mag->candidateThreshold = 0;
+
+    if (!Modes.demod_fused) {
+        convert(iq_data, &m[mag->overlap], nsamples, state, &mag->mean_level, &mag->mean_power);
+        return;
+    }
+
+    threshold = preamble_threshold();
+
+    for (unsigned done = 0; done < nsamples;) {
+        unsigned n = min(FUSED_BLOCK, nsamples - done);
+        double level, power;
+
+        convert(in + done * bytes_per_sample, &m[mag->overlap + done], n, state, &level, &power);
+        sum_level += level * n;
+        sum_power += power * n;
+        done += n;
+
+        // offsets whose whole preamble window has been converted; the
+        // demodulator looks at offsets below nsamples only
+        uint32_t limit = (done == nsamples ? nsamples : mag->overlap + done - PREAMBLE_WINDOW);
+        if (limit > nsamples)
+            limit = nsamples;
+
+        while (threshold && screened < limit) {
+            uint32_t to = min(screened + PREAMBLE_SEARCH_BLOCK, limit);
+            unsigned found = preamble_search(m, screened, to, threshold, candidates);
+
+            if (found > mag->candidateSize - mag->candidateCount) {
+                threshold = 0; // too noisy, leave this buffer to the demodulator
+                break;
+            }
+
+            memcpy(mag->candidates + mag->candidateCount, candidates, found * sizeof (candidates[0]));
+            mag->candidateCount += found;
+            screened = to;
+        }
+    }
+
+    mag->mean_level = nsamples ? sum_level / nsamples : 0;
+    mag->mean_power = nsamples ? sum_power / nsamples : 0;
+    mag->candidateThreshold = threshold;
+}
+
+//
+// Messages and demodulator statistics from one magnitude buffer are collected
+// in a batch instead of being passed straight to useModesMessage(). This lets
+// --demod-threads demodulate several buffers concurrently while the main
+// thread still hands the messages on in buffer (and timestamp) order.
+//
+
+struct demod_batch {
+    struct modesMessage *msgs; // decoded messages: Mode S, followed by Mode A/C
+    unsigned count; // number of messages in msgs
+    unsigned modes_count; // number of leading Mode S messages in msgs
+    unsigned alloc; // allocated size of msgs
+    struct stats stats; // demodulator statistics for this buffer
+};
+
+static void demodBatchAdd(struct demod_batch *batch, const struct modesMessage *mm) {
+    if (batch->count == batch->alloc) {
+        unsigned alloc = batch->alloc ? batch->alloc * 2 : 64;
+        struct modesMessage *msgs = realloc(batch->msgs, alloc * sizeof (*msgs));
+        if (!msgs) {
+            fprintf(stderr, "demod: out of memory, message dropped\n");
+            return;
+        }
+        batch->msgs = msgs;
+        batch->alloc = alloc;
+    }
+    batch->msgs[batch->count++] = *mm;
 }
 
 //
@@ -233,11 +549,15 @@ static void score_phase(int try_phase, uint16_t *m, int j, unsigned char **bestm
 // try to demodulate some Mode S messages.
 //
 
-void demodulate2400(struct mag_buf *mag) {
+void demodulate2400(struct mag_buf *mag, struct demod_batch *batch) {
     static struct modesMessage zeroMessage;
+    struct stats *stats = &batch->stats;
     struct modesMessage mm;
-    unsigned char msg1[MODES_LONG_MSG_BYTES], msg2[MODES_LONG_MSG_BYTES], *msg;
-    uint32_t j;
+    unsigned char phase_msgs[5][MODES_LONG_MSG_BYTES];
+    int phase_try[5], phase_bits[5];
+    uint32_t phase_crc[5];
+    uint32_t candidates[PREAMBLE_SEARCH_BLOCK];
+    uint32_t block, search_end, next, threshold, j;
 
     unsigned char *bestmsg;
     int bestscore, bestphase;
@@ -247,183 +567,219 @@ void demodulate2400(struct mag_buf *mag) {
 
     uint64_t sum_scaled_signal_power = 0;
 
-    msg = msg1;
-
-    // advance ifile artificial clock even if we don't receive anything
-    if (Modes.sdr_type == SDR_IFILE) {
-        Modes.ifile_now = mag->sysTimestamp;
-    }
+    threshold = preamble_threshold();
 
-    for (j = 0; j < mlen; j++) {
-        uint16_t *pa = &m[j];
-        int32_t pa_mag, base_noise, ref_level;
-        int msglen;
+    // first sample not covered by a previously decoded message
+    next = 0;
 
-        // Look for a message starting at around sample 0 with phase offset 3..7
-
-        // Ideal sample values for preambles with different phase
-        // Xn is the first data symbol with phase offset N
-        //
-        // sample#: 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0
-        // phase 3: 2/4\0/5\1 0 0 0 0/5\1/3 3\0 0 0 0 0 0 X4
-        // phase 4: 1/5\0/4\2 0 0 0 0/4\2 2/4\0 0 0 0 0 0 0 X0
-        // phase 5: 0/5\1/3 3\0 0 0 0/3 3\1/5\0 0 0 0 0 0 0 X1
-        // phase 6: 0/4\2 2/4\0 0 0 0 2/4\0/5\1 0 0 0 0 0 0 X2
-        // phase 7: 0/3 3\1/5\0 0 0 0 1/5\0/4\2 0 0 0 0 0 0 X3
-        //
-
-        // do a pre-check to reduce CPU usage
-        if (!(pa[1] > pa[7] && pa[12] > pa[14] && pa[12] > pa[15])) {
-            continue;
-        }
+    // If demod2400Convert() already screened this buffer, only the leading
+    // overlap samples (copied in from the previous buffer) are searched here
+    search_end = mlen;
+    if (mag->candidateThreshold == threshold) {
+        search_end = min(mag->overlap, mlen);
+    }
 
-        // 5 noise samples
-        base_noise = pa[5] + pa[8] + pa[16] + pa[17] + pa[18];
-        // pa_mag is the sum of the 4 preamble high bits
-        // minus 2 low bits between each of high bit pairs
+    for (block = 0; block < mlen;) {
+        const uint32_t *block_candidates = candidates;
+        unsigned ncandidates = 0, c;
 
-        // reduce number of preamble detections if we recently dropped samples
-        if (Modes.stats_15min.samples_dropped) {
-            ref_level = base_noise * max(PREAMBLE_THRESHOLD_PIZERO, Modes.preambleThreshold);
+        if (block >= search_end) {
+            // the rest of the buffer was screened during conversion
+            block_candidates = mag->candidates;
+            ncandidates = mag->candidateCount;
+            block = mlen;
         } else {
-            ref_level = base_noise * Modes.preambleThreshold;
+            uint32_t block_end = min(block + PREAMBLE_SEARCH_BLOCK, search_end);
+            if (next < block_end)
+                ncandidates = preamble_search(m, max(block, next), block_end, threshold, candidates);
+            block = block_end;
         }
 
-        ref_level >>= 5; // divide by 32
-
-        bestmsg = NULL;
-        bestscore = -42;
-        bestphase = -1;
-
-        int32_t diff_2_3 = pa[2] - pa[3];
-        int32_t sum_1_4 = pa[1] + pa[4];
-        int32_t diff_10_11 = pa[10] - pa[11];
-        int32_t common3456 = sum_1_4 - diff_2_3 + pa[9] + pa[12];
-
-        // sample#: 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0
-        // phase 3: 2/4\0/5\1 0 0 0 0/5\1/3 3\0 0 0 0 0 0 X4
-        // phase 4: 1/5\0/4\2 0 0 0 0/4\2 2/4\0 0 0 0 0 0 0 X0
-        pa_mag = common3456 - diff_10_11;
-        if (pa_mag >= ref_level) {
-            // peaks at 1,3,9,11-12: phase 3
-            score_phase(4, m, j, &bestmsg, &bestscore, &bestphase, &msg, msg1, msg2);
-            // peaks at 1,3,9,12: phase 4
-            score_phase(5, m, j, &bestmsg, &bestscore, &bestphase, &msg, msg1, msg2);
-        }
-        // sample#: 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0
-        // phase 5: 0/5\1/3 3\0 0 0 0/3 3\1/5\0 0 0 0 0 0 0 X1
-        // phase 6: 0/4\2 2/4\0 0 0 0 2/4\0/5\1 0 0 0 0 0 0 X2
-        pa_mag = common3456 + diff_10_11;
-        if (pa_mag >= ref_level) {
-            // peaks at 1,3-4,9-10,12: phase 5
-            score_phase(6, m, j, &bestmsg, &bestscore, &bestphase, &msg, msg1, msg2);
-            // peaks at 1,4,10,12: phase 6
-            score_phase(7, m, j, &bestmsg, &bestscore, &bestphase, &msg, msg1, msg2);
-        }
-
-        // peaks at 1-2,4,10,12: phase 7
-        // sample#: 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0
-        // phase 7: 0/3 3\1/5\0 0 0 0 1/5\0/4\2 0 0 0 0 0 0 X3
-        pa_mag = sum_1_4 + 2 * diff_2_3 + diff_10_11 + pa[12];
-        if (pa_mag >= ref_level) {
-            score_phase(8, m, j, &bestmsg, &bestscore, &bestphase, &msg, msg1, msg2);
-        }
-
-        // no preamble detected
-        if (bestscore == -42) {
-            continue;
-        }
+        for (c = 0; c < ncandidates; ++c) {
+            j = block_candidates[c];
+            if (j < next)
+                continue; // inside a message we already decoded
+
+            uint16_t *pa = &m[j];
+            int32_t pa_mag, base_noise, ref_level;
+            int msglen;
+
+            // Look for a message starting at around sample 0 with phase offset 3..7
+
+            // Ideal sample values for preambles with different phase
+            // Xn is the first data symbol with phase offset N
+            //
+            // sample#: 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0
+            // phase 3: 2/4\0/5\1 0 0 0 0/5\1/3 3\0 0 0 0 0 0 X4
+            // phase 4: 1/5\0/4\2 0 0 0 0/4\2 2/4\0 0 0 0 0 0 0 X0
+            // phase 5: 0/5\1/3 3\0 0 0 0/3 3\1/5\0 0 0 0 0 0 0 X1
+            // phase 6: 0/4\2 2/4\0 0 0 0 2/4\0/5\1 0 0 0 0 0 0 X2
+            // phase 7: 0/3 3\1/5\0 0 0 0 1/5\0/4\2 0 0 0 0 0 0 X3
+            //
+
+            // the pre-check already passed in preamble_search()
+
+            // 5 noise samples
+            base_noise = pa[5] + pa[8] + pa[16] + pa[17] + pa[18];
+            // pa_mag is the sum of the 4 preamble high bits
+            // minus 2 low bits between each of high bit pairs
+
+            ref_level = base_noise * threshold;
+            ref_level >>= 5; // divide by 32
+
+            int ntried = 0, nvalid = 0, p;
+
+            int32_t diff_2_3 = pa[2] - pa[3];
+            int32_t sum_1_4 = pa[1] + pa[4];
+            int32_t diff_10_11 = pa[10] - pa[11];
+            int32_t common3456 = sum_1_4 - diff_2_3 + pa[9] + pa[12];
+
+            // sample#: 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0
+            // phase 3: 2/4\0/5\1 0 0 0 0/5\1/3 3\0 0 0 0 0 0 X4
+            // phase 4: 1/5\0/4\2 0 0 0 0/4\2 2/4\0 0 0 0 0 0 0 X0
+            pa_mag = common3456 - diff_10_11;
+            if (pa_mag >= ref_level) {
+                // peaks at 1,3,9,11-12: phase 3
+                phase_try[ntried++] = 4;
+                // peaks at 1,3,9,12: phase 4
+                phase_try[ntried++] = 5;
+            }
+            // sample#: 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0
+            // phase 5: 0/5\1/3 3\0 0 0 0/3 3\1/5\0 0 0 0 0 0 0 X1
+            // phase 6: 0/4\2 2/4\0 0 0 0 2/4\0/5\1 0 0 0 0 0 0 X2
+            pa_mag = common3456 + diff_10_11;
+            if (pa_mag >= ref_level) {
+                // peaks at 1,3-4,9-10,12: phase 5
+                phase_try[ntried++] = 6;
+                // peaks at 1,4,10,12: phase 6
+                phase_try[ntried++] = 7;
+            }
 
-        // we had at least one phase greater than the preamble threshold
-        // and used scoremodesmessage on those bytes
-        Modes.stats_current.demod_preambles++;
-
-        // Do we have a candidate?
-        if (bestscore < 0) {
-            if (bestscore == -1)
-                Modes.stats_current.demod_rejected_unknown_icao++;
-            else
-                Modes.stats_current.demod_rejected_bad++;
-            continue; // nope.
-        }
+            // peaks at 1-2,4,10,12: phase 7
+            // sample#: 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0
+            // phase 7: 0/3 3\1/5\0 0 0 0 1/5\0/4\2 0 0 0 0 0 0 X3
+            pa_mag = sum_1_4 + 2 * diff_2_3 + diff_10_11 + pa[12];
+            if (pa_mag >= ref_level) {
+                phase_try[ntried++] = 8;
+            }
 
-        msglen = modesMessageLenByType(bestmsg[0] >> 3);
+            // no preamble detected
+            if (!ntried) {
+                continue;
+            }
 
-        // Set initial mm structure details
-        mm = zeroMessage;
+            // Slice every phase candidate, checksum them together and keep
+            // the best scoring one. Unknown DFs score -2.
+            for (p = 0; p < ntried; ++p) {
+                int bits = slice_phase(stats, phase_try[p], m, j, phase_msgs[nvalid]);
+                if (bits) {
+                    phase_try[nvalid] = phase_try[p];
+                    phase_bits[nvalid++] = bits;
+                }
+            }
 
-        // For consistency with how the Beast / Radarcape does it,
-        // we report the timestamp at the end of bit 56 (even if
-        // the frame is a 112-bit frame)
-        mm.timestampMsg = mag->sampleTimestamp + j * 5 + (8 + 56) * 12 + bestphase;
+            modesChecksumBatch(&phase_msgs[0][0], MODES_LONG_MSG_BYTES, phase_bits, nvalid, phase_crc);
 
-        // compute message receive time as block-start-time + difference in the 12MHz clock
-        mm.sysTimestampMsg = mag->sysTimestamp + receiveclock_ms_elapsed(mag->sampleTimestamp, mm.timestampMsg);
+            bestmsg = NULL;
+            bestscore = -2;
+            bestphase = -1;
 
-        // advance ifile artifical clock for every message received
-        if (Modes.sdr_type == SDR_IFILE) {
-            Modes.ifile_now = mm.sysTimestampMsg;
-        }
+            for (p = 0; p < nvalid; ++p) {
+                int score = scoreModesMessageChecksum(phase_msgs[p], phase_bits[p], phase_crc[p]);
+                if (score > bestscore) {
+                    // new high score!
+                    bestmsg = phase_msgs[p];
+                    bestscore = score;
+                    bestphase = phase_try[p];
+                }
+            }
 
-        mm.score = bestscore;
+            // we had at least one phase greater than the preamble threshold
+            // and used scoremodesmessage on those bytes
+            stats->demod_preambles++;
 
-        // Decode the received message
-        {
-            int result = decodeModesMessage(&mm, bestmsg);
-            if (result < 0) {
-                if (result == -1)
-                    Modes.stats_current.demod_rejected_unknown_icao++;
+            // Do we have a candidate?
+            if (bestscore < 0) {
+                if (bestscore == -1)
+                    stats->demod_rejected_unknown_icao++;
                 else
-                    Modes.stats_current.demod_rejected_bad++;
-                continue;
-            } else {
-                Modes.stats_current.demod_accepted[mm.correctedbits]++;
+                    stats->demod_rejected_bad++;
+                continue; // nope.
             }
-        }
 
-        Modes.stats_current.demod_bestPhase[bestphase - 4]++;
-        
-        // measure signal power
-        {
-            double signal_power;
-            uint64_t scaled_signal_power = 0;
-            int signal_len = msglen * 12 / 5;
-            int k;
-
-            for (k = 0; k < signal_len; ++k) {
-                uint32_t mag = m[j + 19 + k];
-                scaled_signal_power += mag * mag;
+            msglen = modesMessageLenByType(bestmsg[0] >> 3);
+
+            // Set initial mm structure details
+            mm = zeroMessage;
+
+            // For consistency with how the Beast / Radarcape does it,
+            // we report the timestamp at the end of bit 56 (even if
+            // the frame is a 112-bit frame)
+            mm.timestampMsg = mag->sampleTimestamp + j * 5 + (8 + 56) * 12 + bestphase;
+
+            // compute message receive time as block-start-time + difference in the 12MHz clock
+            mm.sysTimestampMsg = mag->sysTimestamp + receiveclock_ms_elapsed(mag->sampleTimestamp, mm.timestampMsg);
+
+            mm.score = bestscore;
+
+            // Decode the received message
+            {
+                int result = decodeModesMessage(&mm, bestmsg);
+                if (result < 0) {
+                    if (result == -1)
+                        stats->demod_rejected_unknown_icao++;
+                    else
+                        stats->demod_rejected_bad++;
+                    continue;
+                } else {
+                    stats->demod_accepted[mm.correctedbits]++;
+                }
             }
 
-            signal_power = scaled_signal_power / 65535.0 / 65535.0;
-            mm.signalLevel = signal_power / signal_len;
-            Modes.stats_current.signal_power_sum += signal_power;
-            Modes.stats_current.signal_power_count += signal_len;
-            sum_scaled_signal_power += scaled_signal_power;
-
-            if (mm.signalLevel > Modes.stats_current.peak_signal_power)
-                Modes.stats_current.peak_signal_power = mm.signalLevel;
-            if (mm.signalLevel > 0.50119)
-                Modes.stats_current.strong_signal_count++; // signal power above -3dBFS
-        }
+            stats->demod_bestPhase[bestphase - 4]++;
+
+            // measure signal power
+            {
+                double signal_power;
+                uint64_t scaled_signal_power = 0;
+                int signal_len = msglen * 12 / 5;
+                int k;
+
+                for (k = 0; k < signal_len; ++k) {
+                    uint32_t mag = m[j + 19 + k];
+                    scaled_signal_power += mag * mag;
+                }
+
+                signal_power = scaled_signal_power / 65535.0 / 65535.0;
+                mm.signalLevel = signal_power / signal_len;
+                stats->signal_power_sum += signal_power;
+                stats->signal_power_count += signal_len;
+                sum_scaled_signal_power += scaled_signal_power;
+
+                if (mm.signalLevel > stats->peak_signal_power)
+                    stats->peak_signal_power = mm.signalLevel;
+                if (mm.signalLevel > 0.50119)
+                    stats->strong_signal_count++; // signal power above -3dBFS
+            }
 
-        // Skip over the message:
-        // (we actually skip to 8 bits before the end of the message,
-        //  because we can often decode two messages that *almost* collide,
-        //  where the preamble of the second message clobbered the last
-        //  few bits of the first message, but the message bits didn't
-        //  overlap)
-        j += msglen * 12 / 5;
+            // Skip over the message:
+            // (we actually skip to 8 bits before the end of the message,
+            //  because we can often decode two messages that *almost* collide,
+            //  where the preamble of the second message clobbered the last
+            //  few bits of the first message, but the message bits didn't
+            //  overlap)
+            next = j + msglen * 12 / 5 + 1;
 
-        // Pass data to the next layer
-        useModesMessage(&mm);
+            // Queue for the next layer
+            demodBatchAdd(batch, &mm);
+        }
     }
 
     /* update noise power */
     {
         double sum_signal_power = sum_scaled_signal_power / 65535.0 / 65535.0;
-        Modes.stats_current.noise_power_sum += (mag->mean_power * mlen - sum_signal_power);
-        Modes.stats_current.noise_power_count += mlen;
+        stats->noise_power_sum += (mag->mean_power * mlen - sum_signal_power);
+        stats->noise_power_count += mlen;
     }
 }
 
@@ -519,7 +875,7 @@ static void draw_modeac(uint16_t *m, unsigned modeac, unsigned f1_clock, unsigne
 //
 // one 2.4MHz sample = 25 cycles
 
-void demodulate2400AC(struct mag_buf *mag) {
+void demodulate2400AC(struct mag_buf *mag, struct demod_batch *batch) {
     struct modesMessage mm;
     uint16_t *m = mag->data;
     uint32_t mlen = mag->validLength - mag->overlap;
@@ -699,10 +1055,199 @@ void demodulate2400AC(struct mag_buf *mag) {
 
         decodeModeAMessage(&mm, modeac);
 
-        // Pass data to the next layer
-        useModesMessage(&mm);
+        // Queue for the next layer
+        demodBatchAdd(batch, &mm);
 
         f1_sample += (20 * 87 / 25);
-        Modes.stats_current.demod_modeac++;
+        batch->stats.demod_modeac++;
+    }
+}
+
+//
+// Demodulator worker threads
+//
+// Each worker takes the next buffer off the FIFO and demodulates it into the
+// batch slot for its FIFO sequence number. The main thread delivers finished
+// batches strictly in sequence, so the rest of the program sees exactly one
+// ordered message stream regardless of the number of workers.
+//
+
+struct demod_job {
+    struct mag_buf *buf; // buffer that was demodulated, released after delivery
+    bool done; // batch is complete and waiting for delivery
+    struct demod_batch batch;
+};
+
+// At most MODES_MAG_BUFFERS buffers can be in flight, and buffers are only
+// released once delivered, so one job slot per magnitude buffer is enough.
+static struct demod_job demod_jobs[MODES_MAG_BUFFERS];
+static pthread_t demod_threads[DEMOD_MAX_THREADS];
+static int demod_thread_count; // 0 if demodulating on the main thread
+static pthread_mutex_t demod_done_mutex = PTHREAD_MUTEX_INITIALIZER; // protects demod_jobs[].done
+static pthread_cond_t demod_done_cond = PTHREAD_COND_INITIALIZER; // signalled when a job completes
+static uint64_t demod_deliver_seq; // FIFO sequence number of the next buffer to deliver
+
+static void demodulateBuffer(struct mag_buf *buf, struct demod_batch *batch) {
+    struct stats *saved_stats = decode_stats;
+    struct timespec start_time;
+
+    start_cpu_timing(&start_time);
+
+    batch->count = 0;
+    memset(&batch->stats, 0, sizeof (batch->stats));
+    decode_stats = &batch->stats;
+
+    demodulate2400(buf, batch);
+    batch->modes_count = batch->count;
+    if (Modes.mode_ac) {
+        demodulate2400AC(buf, batch);
+    }
+
+    batch->stats.samples_processed += buf->validLength;
+    batch->stats.samples_dropped += buf->dropped;
+    batch->stats.fifo_buffers++;
+    batch->stats.fifo_depth_sum += buf->queueDepth;
+    batch->stats.fifo_depth_max = buf->queueDepth;
+    end_cpu_timing(&start_time, &batch->stats.demod_cpu);
+    decode_stats = saved_stats;
+}
+
+// Pass the messages of a batch to useModesMessage() and account its statistics
+
+static void deliverBatch(struct mag_buf *buf, struct demod_batch *batch) {
+    struct timespec start_time;
+    unsigned s = 0, ac = batch->modes_count;
+
+    start_cpu_timing(&start_time);
+
+    // advance ifile artificial clock even if we don't receive anything
+    if (Modes.sdr_type == SDR_IFILE) {
+        __atomic_store_n(&Modes.ifile_now, buf->sysTimestamp, __ATOMIC_RELAXED);
+    }
+
+    // Mode S and Mode A/C messages are each in timestamp order; merge them
+    while (s < batch->modes_count || ac < batch->count) {
+        struct modesMessage *mm;
+        if (ac == batch->count || (s < batch->modes_count && batch->msgs[s].timestampMsg <= batch->msgs[ac].timestampMsg))
+            mm = &batch->msgs[s++];
+        else
+            mm = &batch->msgs[ac++];
+
+        // advance ifile artifical clock for every message received
+        if (Modes.sdr_type == SDR_IFILE) {
+            __atomic_store_n(&Modes.ifile_now, mm->sysTimestampMsg, __ATOMIC_RELAXED);
+        }
+
+        // Pass data to the next layer
+        useModesMessage(mm);
+    }
+
+    add_stats(&Modes.stats_current, &batch->stats, &Modes.stats_current);
+    end_cpu_timing(&start_time, &Modes.stats_current.demod_cpu);
+}
+
+static void *demodThreadEntryPoint(void *arg) {
+    MODES_NOTUSED(arg);
+
+    while (!Modes.exit) {
+        struct mag_buf *buf = fifo_dequeue(100 /* milliseconds */);
+        if (!buf)
+            continue;
+
+        struct demod_job *job = &demod_jobs[buf->seq % MODES_MAG_BUFFERS];
+        demodulateBuffer(buf, &job->batch);
+
+        pthread_mutex_lock(&demod_done_mutex);
+        job->buf = buf;
+        job->done = true;
+        pthread_cond_broadcast(&demod_done_cond);
+        pthread_mutex_unlock(&demod_done_mutex);
+    }
+
+    pthread_exit(NULL);
+}
+
+// Start Modes.demod_threads worker threads. With a single thread, buffers are
+// demodulated on the calling thread by demod2400Process() instead.
+
+void demod2400StartThreads(void) {
+    if (Modes.demod_threads <= 1)
+        return;
+
+    for (int i = 0; i < Modes.demod_threads; ++i) {
+        if (pthread_create(&demod_threads[i], NULL, demodThreadEntryPoint, NULL)) {
+            fprintf(stderr, "demod: failed to create demodulator thread: %s\n", strerror(errno));
+            break;
+        }
+        ++demod_thread_count;
     }
 }
+
+// Wait for the worker threads to exit and deliver whatever they had
+// demodulated by then. Call after Modes.exit is set and the FIFO is halted.
+
+void demod2400StopThreads(void) {
+    for (int i = 0; i < demod_thread_count; ++i) {
+        pthread_join(demod_threads[i], NULL);
+    }
+
+    if (demod_thread_count) {
+        while (demod2400Process(0))
+            ;
+    }
+    demod_thread_count = 0;
+
+    for (int i = 0; i < MODES_MAG_BUFFERS; ++i) {
+        free(demod_jobs[i].batch.msgs);
+        memset(&demod_jobs[i], 0, sizeof (demod_jobs[i]));
+    }
+}
+
+// Process the next magnitude buffer, waiting up to timeout_ms for it:
+// demodulate it (or pick up the result from the worker threads), pass the
+// messages to useModesMessage() and return the buffer to the FIFO.
+// Returns false if no buffer was ready in time.
+
+bool demod2400Process(uint32_t timeout_ms) {
+    struct mag_buf *buf;
+    struct demod_job *job;
+
+    if (!demod_thread_count) {
+        if (!(buf = fifo_dequeue(timeout_ms)))
+            return false;
+
+        job = &demod_jobs[0];
+        demodulateBuffer(buf, &job->batch);
+        deliverBatch(buf, &job->batch);
+        fifo_release(buf);
+        return true;
+    }
+
+    struct timespec deadline;
+    get_deadline(timeout_ms, &deadline);
+
+    job = &demod_jobs[demod_deliver_seq % MODES_MAG_BUFFERS];
+
+    pthread_mutex_lock(&demod_done_mutex);
+    while (!job->done) {
+        if (pthread_cond_timedwait(&demod_done_cond, &demod_done_mutex, &deadline) == ETIMEDOUT)
+            break;
+    }
+    bool ready = job->done;
+    pthread_mutex_unlock(&demod_done_mutex);
+
+    if (!ready)
+        return false;
+
+    buf = job->buf;
+    deliverBatch(buf, &job->batch);
+
+    pthread_mutex_lock(&demod_done_mutex);
+    job->done = false;
+    job->buf = NULL;
+    pthread_mutex_unlock(&demod_done_mutex);
+
+    ++demod_deliver_seq;
+    fifo_release(buf);
+    return true;
+}
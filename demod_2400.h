@@ -24,17 +24,30 @@
 #ifndef DEMOD_2400_H
 #define DEMOD_2400_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "convert.h"
+
 #define PREAMBLE_THRESHOLD_MIN 40
 #define PREAMBLE_THRESHOLD_HOT 42
 #define PREAMBLE_THRESHOLD_DEFAULT 58
 #define PREAMBLE_THRESHOLD_PIZERO 75
 #define PREAMBLE_THRESHOLD_MAX 400
 
+#define DEMOD_MAX_THREADS 8
+
 struct mag_buf;
+struct demod_batch;
 
-void demodulate2400(struct mag_buf *mag);
-void demodulate2400AC(struct mag_buf *mag);
+void demod2400Init(void);
+void demod2400UpdateThreshold(void);
+void demod2400Convert(struct mag_buf *mag, iq_convert_fn convert, struct converter_state *state,
+        void *iq_data, unsigned bytes_per_sample, unsigned nsamples);
+void demod2400StartThreads(void);
+void demod2400StopThreads(void);
+bool demod2400Process(uint32_t timeout_ms);
+void demodulate2400(struct mag_buf *mag, struct demod_batch *batch);
+void demodulate2400AC(struct mag_buf *mag, struct demod_batch *batch);
 
 #endif
@@ -26,21 +26,137 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
-#include <pthread.h>
+#include <limits.h>
+#include <stdatomic.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Buffers circulate between two fixed-capacity rings: the queue of filled
+// buffers (SDR reader -> demodulators) and the freelist (demodulator -> SDR
+// reader). Each ring has exactly one producer, so pushing only needs atomic
+// loads and stores of the head/tail indexes. Consumers claim the head with a
+// compare-and-swap, so several demodulator threads can pop the queue at once.
+// A thread only sleeps, on a futex, when the ring it needs is empty.
+//
+// Every buffer is always in one of the rings or held by a user of the FIFO,
+// so a ring with room for all buffers can never be full.
+
+// Wakeup channel for threads waiting on a ring
+struct fifo_event {
+    atomic_uint seq; // futex word, bumped whenever waiters should re-check
+    atomic_uint waiters; // number of threads waiting (or about to wait)
+};
+
+struct fifo_ring {
+    _Alignas(64) atomic_uint head; // next slot to pop, written by the consumer only
+    struct fifo_event popped; // signalled after a pop
+
+    _Alignas(64) atomic_uint tail; // next slot to push, written by the producer only
+    struct fifo_event pushed; // signalled after a push
+
+    _Alignas(64) struct mag_buf **slots;
+    unsigned mask; // capacity - 1, capacity is a power of two
+};
 
-static pthread_mutex_t fifo_mutex = PTHREAD_MUTEX_INITIALIZER; // mutex protecting the queues
-static pthread_cond_t fifo_notempty_cond = PTHREAD_COND_INITIALIZER; // condition used to signal FIFO-not-empty
-static pthread_cond_t fifo_empty_cond = PTHREAD_COND_INITIALIZER; // condition used to signal FIFO-empty
-static pthread_cond_t fifo_free_cond = PTHREAD_COND_INITIALIZER; // condition used to signal freelist-not-empty
-static struct mag_buf *fifo_head; // head of queued buffers awaiting demodulation
-static struct mag_buf *fifo_tail; // tail of queued buffers awaiting demodulation
-static struct mag_buf *fifo_freelist; // freelist of preallocated buffers
-static bool fifo_halted; // true if queue has been halted
+static struct fifo_ring fifo_queue; // queued buffers awaiting demodulation
+static struct fifo_ring fifo_freelist; // preallocated buffers ready to be filled
+static struct mag_buf **fifo_allocated; // every allocated buffer, for fifo_destroy()
+static unsigned fifo_allocated_count;
+static atomic_bool fifo_halted; // true if queue has been halted
+static uint64_t fifo_enqueued; // number of buffers enqueued, numbers the next one
 
 static unsigned overlap_length; // desired overlap size in samples (size of overlap_buffer)
 static uint16_t *overlap_buffer; // buffer used to save overlapping data
 
+static bool fifo_ring_init(struct fifo_ring *ring, unsigned capacity) {
+    unsigned size = 1;
+    while (size < capacity)
+        size <<= 1;
+
+    if (!(ring->slots = calloc(size, sizeof (ring->slots[0]))))
+        return false;
+
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return true;
+}
+
+static unsigned fifo_ring_count(struct fifo_ring *ring) {
+    return atomic_load(&ring->tail) - atomic_load(&ring->head);
+}
+
+// Producer side. The ring can't be full, see above.
+
+static void fifo_ring_push(struct fifo_ring *ring, struct mag_buf *buf) {
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    assert(tail - atomic_load_explicit(&ring->head, memory_order_acquire) <= ring->mask);
+    ring->slots[tail & ring->mask] = buf;
+    atomic_store(&ring->tail, tail + 1); // release, and ordered before the waiters check
+}
+
+// Consumer side, safe for several consumers. Returns NULL if the ring is empty.
+// The producer only reuses a slot once head has moved past it, so the slot
+// read before a successful compare-and-swap still holds the claimed buffer.
+
+static struct mag_buf *fifo_ring_pop(struct fifo_ring *ring) {
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    struct mag_buf *buf;
+
+    do {
+        if (head == atomic_load_explicit(&ring->tail, memory_order_acquire))
+            return NULL;
+        buf = ring->slots[head & ring->mask];
+    } while (!atomic_compare_exchange_weak(&ring->head, &head, head + 1));
+
+    return buf;
+}
+
+static void fifo_event_signal(struct fifo_event *ev) {
+    // Fast path: nobody is waiting, no syscall needed
+    if (!atomic_load(&ev->waiters))
+        return;
+
+    atomic_fetch_add(&ev->seq, 1);
+    syscall(SYS_futex, &ev->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+// Announce that the caller is about to wait on ev. The caller must re-check
+// its wait condition after this, and then either call fifo_event_wait() with
+// the returned sequence number or fifo_event_cancel().
+
+static unsigned fifo_event_prepare(struct fifo_event *ev) {
+    unsigned seq = atomic_load(&ev->seq);
+    atomic_fetch_add(&ev->waiters, 1);
+    return seq;
+}
+
+static void fifo_event_cancel(struct fifo_event *ev) {
+    atomic_fetch_sub(&ev->waiters, 1);
+}
+
+// Sleep until ev is signalled after fifo_event_prepare() returned seq, or
+// until the absolute CLOCK_REALTIME deadline (NULL to wait forever).
+// Returns false if the deadline passed.
+
+static bool fifo_event_wait(struct fifo_event *ev, unsigned seq, const struct timespec *deadline) {
+    bool timed_out = false;
+
+    if (syscall(SYS_futex, &ev->seq, FUTEX_WAIT_BITSET_PRIVATE | FUTEX_CLOCK_REALTIME, seq, deadline, NULL, FUTEX_BITSET_MATCH_ANY) < 0)
+        timed_out = (errno == ETIMEDOUT);
+
+    atomic_fetch_sub(&ev->waiters, 1);
+    return !timed_out;
+}
+
+static void fifo_ring_destroy(struct fifo_ring *ring) {
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
 // Create the queue structures. Not threadsafe.
 
 bool fifo_create(unsigned buffer_count, unsigned buffer_size, unsigned overlap) {
@@ -50,6 +166,14 @@ bool fifo_create(unsigned buffer_count, unsigned buffer_size, unsigned overlap)
 
     overlap_length = overlap;
 
+    if (!fifo_ring_init(&fifo_queue, buffer_count) || !fifo_ring_init(&fifo_freelist, buffer_count)) {
+        goto nomem;
+    }
+
+    if (!(fifo_allocated = calloc(buffer_count, sizeof (fifo_allocated[0])))) {
+        goto nomem;
+    }
+
     for (unsigned i = 0; i < buffer_count; ++i) {
         struct mag_buf *newbuf;
         if (!(newbuf = calloc(1, sizeof (*newbuf)))) {
@@ -61,11 +185,20 @@ bool fifo_create(unsigned buffer_count, unsigned buffer_size, unsigned overlap)
             goto nomem;
         }
 
+        newbuf->candidateSize = buffer_size / 16;
+        if (!(newbuf->candidates = calloc(newbuf->candidateSize, sizeof (newbuf->candidates[0])))) {
+            free(newbuf->data);
+            free(newbuf);
+            goto nomem;
+        }
+
         newbuf->totalLength = buffer_size;
-        newbuf->next = fifo_freelist;
-        fifo_freelist = newbuf;
+        fifo_allocated[fifo_allocated_count++] = newbuf;
+        fifo_ring_push(&fifo_freelist, newbuf);
     }
 
+    fifo_enqueued = 0;
+    atomic_store(&fifo_halted, false);
     return true;
 
 nomem:
@@ -73,93 +206,85 @@ nomem:
     return false;
 }
 
-static void free_buffer_list(struct mag_buf *head) {
-    while (head) {
-        struct mag_buf *next = head->next;
-        free(head->data);
-        free(head);
-        head = next;
+void fifo_destroy() {
+    for (unsigned i = 0; i < fifo_allocated_count; ++i) {
+        free(fifo_allocated[i]->data);
+        free(fifo_allocated[i]->candidates);
+        free(fifo_allocated[i]);
     }
-}
+    free(fifo_allocated);
+    fifo_allocated = NULL;
+    fifo_allocated_count = 0;
 
-void fifo_destroy() {
-    free_buffer_list(fifo_head);
-    free_buffer_list(fifo_freelist);
-    fifo_freelist = NULL;
-    fifo_head = fifo_tail = NULL;
+    fifo_ring_destroy(&fifo_queue);
+    fifo_ring_destroy(&fifo_freelist);
 
     free(overlap_buffer);
     overlap_buffer = NULL;
 }
 
 void fifo_drain() {
-    pthread_mutex_lock(&fifo_mutex);
-    while (fifo_head && !fifo_halted) {
-        pthread_cond_wait(&fifo_empty_cond, &fifo_mutex);
+    while (!atomic_load(&fifo_halted) && fifo_ring_count(&fifo_queue)) {
+        unsigned seq = fifo_event_prepare(&fifo_queue.popped);
+        if (atomic_load(&fifo_halted) || !fifo_ring_count(&fifo_queue)) {
+            fifo_event_cancel(&fifo_queue.popped);
+            break;
+        }
+        fifo_event_wait(&fifo_queue.popped, seq, NULL);
     }
-    pthread_mutex_unlock(&fifo_mutex);
 }
 
 void fifo_halt() {
-    pthread_mutex_lock(&fifo_mutex);
+    atomic_store(&fifo_halted, true);
 
-    // Drain all enqueued buffers to the freelist
-    while (fifo_head) {
-        struct mag_buf *freebuf = fifo_head;
-        fifo_head = freebuf->next;
-
-        freebuf->next = fifo_freelist;
-        fifo_freelist = freebuf;
-    }
-
-    fifo_tail = NULL;
-    fifo_halted = true;
-
-    // wake all waiters
-    pthread_cond_broadcast(&fifo_notempty_cond);
-    pthread_cond_broadcast(&fifo_empty_cond);
-    pthread_cond_broadcast(&fifo_free_cond);
-    pthread_mutex_unlock(&fifo_mutex);
+    // wake all waiters; queued buffers stay where they are until fifo_destroy()
+    fifo_event_signal(&fifo_queue.pushed);
+    fifo_event_signal(&fifo_queue.popped);
+    fifo_event_signal(&fifo_freelist.pushed);
 }
 
-struct mag_buf *fifo_acquire(uint32_t timeout_ms) {
+// Pop from ring, waiting up to timeout_ms for a buffer to be pushed.
+
+static struct mag_buf *fifo_wait_pop(struct fifo_ring *ring, uint32_t timeout_ms) {
     struct timespec deadline;
     if (timeout_ms) {
         get_deadline(timeout_ms, &deadline);
     }
 
-    pthread_mutex_lock(&fifo_mutex);
-
-    struct mag_buf *result = NULL;
-    while (!fifo_halted && !fifo_freelist) {
-        if (!timeout_ms) {
-            // Non-blocking
-            goto done;
-        }
+    for (;;) {
+        if (atomic_load(&fifo_halted))
+            return NULL;
 
-        // No free buffers, wait for one
-        if (pthread_cond_timedwait(&fifo_free_cond, &fifo_mutex, &deadline) < 0) {
-            if (errno != ETIMEDOUT)
-                return NULL; // unexpected error, mutex no longer held!
+        struct mag_buf *result = fifo_ring_pop(ring);
+        if (result || !timeout_ms)
+            return result;
 
-            goto done; // timed out
+        // Ring empty, wait for a push
+        unsigned seq = fifo_event_prepare(&ring->pushed);
+        if (atomic_load(&fifo_halted) || fifo_ring_count(ring)) {
+            fifo_event_cancel(&ring->pushed);
+            continue;
         }
+
+        if (!fifo_event_wait(&ring->pushed, seq, &deadline))
+            return NULL; // timed out
     }
+}
 
-    if (!fifo_halted) {
-        result = fifo_freelist;
-        fifo_freelist = result->next;
+struct mag_buf *fifo_acquire(uint32_t timeout_ms) {
+    struct mag_buf *result = fifo_wait_pop(&fifo_freelist, timeout_ms);
 
+    if (result) {
         result->overlap = overlap_length;
         result->validLength = result->overlap;
         result->sampleTimestamp = 0;
         result->sysTimestamp = 0;
         result->flags = 0;
-        result->next = NULL;
+        result->queueDepth = 0;
+        result->candidateCount = 0;
+        result->candidateThreshold = 0;
     }
 
-done:
-    pthread_mutex_unlock(&fifo_mutex);
     return result;
 }
 
@@ -167,13 +292,9 @@ void fifo_enqueue(struct mag_buf *buf) {
     assert(buf->validLength <= buf->totalLength);
     assert(buf->validLength >= overlap_length);
 
-    pthread_mutex_lock(&fifo_mutex);
-
-    if (fifo_halted) {
-        // Shutting down, just return the buffer to the freelist.
-        buf->next = fifo_freelist;
-        fifo_freelist = buf;
-        goto done;
+    if (atomic_load(&fifo_halted)) {
+        // Shutting down, just drop the buffer; fifo_destroy() frees it.
+        return;
     }
 
     // Populate the overlap region
@@ -187,65 +308,24 @@ void fifo_enqueue(struct mag_buf *buf) {
     // Save the tail of the buffer for next time
     memcpy(overlap_buffer, &buf->data[buf->validLength - overlap_length], overlap_length * sizeof (overlap_buffer[0]));
 
-    // enqueue and tell the main thread
-    buf->next = NULL;
-    if (!fifo_head) {
-        fifo_head = fifo_tail = buf;
-        pthread_cond_signal(&fifo_notempty_cond);
-    } else {
-        fifo_tail->next = buf;
-    }
-
-done:
-    pthread_mutex_unlock(&fifo_mutex);
+    // enqueue and tell the demodulator
+    buf->seq = fifo_enqueued++;
+    buf->queueDepth = fifo_ring_count(&fifo_queue) + 1;
+    fifo_ring_push(&fifo_queue, buf);
+    fifo_event_signal(&fifo_queue.pushed);
 }
 
 struct mag_buf *fifo_dequeue(uint32_t timeout_ms) {
-    struct timespec deadline;
-    if (timeout_ms) {
-        get_deadline(timeout_ms, &deadline);
-    }
-
-    pthread_mutex_lock(&fifo_mutex);
+    struct mag_buf *result = fifo_wait_pop(&fifo_queue, timeout_ms);
 
-    struct mag_buf *result = NULL;
-    while (!fifo_head && !fifo_halted) {
-        if (!timeout_ms) {
-            // Non-blocking
-            goto done;
-        }
-
-        // No data pending, wait for some
-        if (pthread_cond_timedwait(&fifo_notempty_cond, &fifo_mutex, &deadline) < 0) {
-            if (errno != ETIMEDOUT)
-                return NULL; // unexpected error, mutex no longer held!
-
-            goto done; // timed out
-        }
+    if (result) {
+        fifo_event_signal(&fifo_queue.popped);
     }
 
-    if (!fifo_halted) {
-        result = fifo_head;
-        fifo_head = result->next;
-        result->next = NULL;
-        if (!fifo_head) {
-            fifo_tail = NULL;
-            pthread_cond_broadcast(&fifo_empty_cond);
-        }
-    }
-
-done:
-    pthread_mutex_unlock(&fifo_mutex);
     return result;
 }
 
 void fifo_release(struct mag_buf *buf) {
-    pthread_mutex_lock(&fifo_mutex);
-    if (!fifo_freelist) {
-        pthread_cond_signal(&fifo_free_cond);
-    }
-    buf->next = fifo_freelist;
-    fifo_freelist = buf;
-    pthread_mutex_unlock(&fifo_mutex);
+    fifo_ring_push(&fifo_freelist, buf);
+    fifo_event_signal(&fifo_freelist.pushed);
 }
-
@@ -68,8 +68,13 @@ struct mag_buf {
     double mean_level; // Mean of normalized (0..1) signal level
     double mean_power; // Mean of normalized (0..1) power level
     unsigned dropped; // (approx) number of dropped samples
+    unsigned queueDepth; // number of queued buffers, including this one, when it was enqueued
+    uint64_t seq; // position in the FIFO, numbered by fifo_enqueue()
 
-    struct mag_buf *next; // linked list forward link
+    uint32_t *candidates; // preamble candidates found while converting, see demod2400Convert()
+    unsigned candidateCount; // number of entries in candidates
+    unsigned candidateSize; // allocated size of candidates
+    uint32_t candidateThreshold; // preamble threshold used for screening, 0 if not screened
 };
 
 // Create the queue structures. Not threadsafe. Returns true on success.
@@ -86,13 +91,19 @@ void fifo_destroy();
 // Block until the FIFO is empty.
 void fifo_drain();
 
-// Mark the FIFO as halted. Move any buffers in FIFO to the freelist immediately.
-// Future calls to magbuf_acquire() will immediately return NULL.
-// Future calls to magbuf_produce() will immediately put the produced buffer on the freelist.
-// Future alls to magbuf_consume() will immediately return NULL; if there are
+// Mark the FIFO as halted. Buffers still queued are discarded.
+// Future calls to fifo_acquire() will immediately return NULL.
+// Future calls to fifo_enqueue() will immediately discard the produced buffer.
+// Future calls to fifo_dequeue() will immediately return NULL; if there are
 //   existing calls waiting on data, they will be immediately awoken and return NULL.
+// Safe to call from any thread.
 void fifo_halt();
 
+// The FIFO is lock-free and supports one producer and several consumers:
+//   fifo_acquire() and fifo_enqueue() must only be called by one thread at a time (the SDR reader),
+//   fifo_dequeue() may be called by several threads at once (the demodulators),
+//   fifo_release() must only be called by one thread at a time.
+
 // Get an unused buffer from the freelist and return it.
 // Block up to timeout_ms waiting for a free buffer. Return NULL if there are no
 // free buffers available within the timeout, or if the FIFO is halted.
@@ -116,7 +127,7 @@ void fifo_enqueue(struct mag_buf *buf);
 //   for more data; return NULL if no data arrives within the timeout.
 struct mag_buf *fifo_dequeue(uint32_t timeout_ms);
 
-// Release a buffer previously returned by fifo_acquire() or fifo_pop() back to the freelist.
+// Release a buffer previously returned by fifo_dequeue() back to the freelist.
 void fifo_release(struct mag_buf *buf);
 
 #endif
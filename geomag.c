@@ -74,6 +74,7 @@
 #include <string.h>
 #include <math.h>
 #include <time.h>
+#include <pthread.h>
 #include "geomag.h"
 
 #define NaN log(-1.0)
@@ -403,3 +404,157 @@ S50:
     }
     return 0;
 }
+
+/*
+ * Declination grid
+ *
+ * The model is evaluated on a 1 degree lat/lon grid at a few altitude levels
+ * and looked up by interpolation. The grid is split into 10x10 degree tiles
+ * built on first use, so only the area with traffic is evaluated. Tiles are
+ * rebuilt when the UTC day changes, the model itself only moves by day.
+ * Cells whose corners differ by more than GEOMAG_MAX_SPREAD, around the
+ * magnetic poles, are evaluated directly instead.
+ *
+ * Lookups run without locks on published tiles. Building is serialized since
+ * geomag_calc() works on static scratch arrays. A replaced tile is kept until
+ * the next rebuild of its slot a day later, no lookup holds it that long.
+ */
+
+#define TILE_DEG 10
+#define TILE_POINTS (TILE_DEG + 1)
+#define TILE_ROWS (180 / TILE_DEG)
+#define TILE_COLS (360 / TILE_DEG)
+#define ALT_LEVELS 4
+#define ALT_STEP 6.0 // km, levels at 0, 6, 12 and 18 km
+#define GEOMAG_MAX_SPREAD 2.0 // degrees between the corners of a grid cell, beyond that the model is evaluated directly
+
+struct geomag_tile {
+    long day;
+    float dec[ALT_LEVELS][TILE_POINTS][TILE_POINTS];
+};
+
+static struct geomag_tile *tiles[TILE_ROWS][TILE_COLS];
+static struct geomag_tile *retired[TILE_ROWS][TILE_COLS];
+static pthread_mutex_t tiles_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct geomag_tile *geomag_tile_build(int row, int col, long day) {
+    struct geomag_tile *tile = malloc(sizeof (*tile));
+    double dip, ti, gv, dec;
+
+    if (!tile)
+        return NULL;
+    tile->day = day;
+    for (int h = 0; h < ALT_LEVELS; h++) {
+        for (int i = 0; i < TILE_POINTS; i++) {
+            for (int j = 0; j < TILE_POINTS; j++) {
+                geomag_calc(h * ALT_STEP, row * TILE_DEG - 90 + i, col * TILE_DEG - 180 + j, -1.0, &dec, &dip, &ti, &gv);
+                tile->dec[h][i][j] = (float) dec;
+            }
+        }
+    }
+    return tile;
+}
+
+static struct geomag_tile *geomag_tile_get(int row, int col, long day) {
+    struct geomag_tile *tile = __atomic_load_n(&tiles[row][col], __ATOMIC_ACQUIRE);
+
+    if (tile && tile->day == day)
+        return tile;
+
+    pthread_mutex_lock(&tiles_lock);
+    tile = tiles[row][col];
+    if (!tile || tile->day != day) {
+        struct geomag_tile *fresh = geomag_tile_build(row, col, day);
+        if (fresh) {
+            free(retired[row][col]);
+            retired[row][col] = tile;
+            tile = fresh;
+            __atomic_store_n(&tiles[row][col], tile, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&tiles_lock);
+    return tile;
+}
+
+// Declination straight from the model, for where the grid cannot be used
+static double geomag_declination_direct(double alt, double lat, double lon) {
+    double dec, dip, ti, gv;
+
+    pthread_mutex_lock(&tiles_lock);
+    geomag_calc(alt, lat, lon, -1.0, &dec, &dip, &ti, &gv);
+    pthread_mutex_unlock(&tiles_lock);
+    return dec;
+}
+
+/**
+ * Magnetic declination from the cached grid.
+ * @param alt Altitude above WGS84 ellipsoid in km
+ * @param lat Latitude in decimal degrees
+ * @param lon Longitude in decimal degrees
+ * @return Declination in degrees
+ */
+double geomag_declination(double alt, double lat, double lon) {
+    double y = lat + 90.0;
+    double x = lon + 180.0;
+    double z = alt / ALT_STEP;
+
+    if (y < 0.0) y = 0.0;
+    if (y > 180.0) y = 180.0;
+    if (x < 0.0 || x >= 360.0) x -= 360.0 * floor(x / 360.0);
+    if (z < 0.0) z = 0.0;
+    if (z > ALT_LEVELS - 1) z = ALT_LEVELS - 1;
+
+    int row = (int) (y / TILE_DEG);
+    int col = (int) (x / TILE_DEG);
+    if (row >= TILE_ROWS) row = TILE_ROWS - 1;
+    if (col >= TILE_COLS) col = TILE_COLS - 1;
+
+    struct geomag_tile *tile = geomag_tile_get(row, col, (long) (time(NULL) / 86400));
+    if (!tile)
+        return geomag_declination_direct(alt, lat, lon);
+
+    // grid cell within the tile and position within the cell
+    y -= row * TILE_DEG;
+    x -= col * TILE_DEG;
+    int i = (int) y;
+    int j = (int) x;
+    int h = (int) z;
+    if (i >= TILE_DEG) i = TILE_DEG - 1;
+    if (j >= TILE_DEG) j = TILE_DEG - 1;
+    if (h >= ALT_LEVELS - 1) h = ALT_LEVELS - 2;
+    double fy = y - i;
+    double fx = x - j;
+    double fz = z - h;
+
+    double v[2];
+    for (int k = 0; k < 2; k++) {
+        const float *r0 = tile->dec[h + k][i];
+        const float *r1 = tile->dec[h + k][i + 1];
+        double d00 = r0[j], d01 = r0[j + 1], d10 = r1[j], d11 = r1[j + 1];
+        // keep the interpolation continuous where declination wraps around +-180
+        d01 += 360.0 * round((d00 - d01) / 360.0);
+        d10 += 360.0 * round((d00 - d10) / 360.0);
+        d11 += 360.0 * round((d00 - d11) / 360.0);
+        // near the magnetic poles declination turns too fast to interpolate
+        if (fmax(fmax(d00, d01), fmax(d10, d11)) - fmin(fmin(d00, d01), fmin(d10, d11)) > GEOMAG_MAX_SPREAD)
+            return geomag_declination_direct(alt, lat, lon);
+        v[k] = (d00 * (1.0 - fx) + d01 * fx) * (1.0 - fy) + (d10 * (1.0 - fx) + d11 * fx) * fy;
+    }
+    double dec = v[0] * (1.0 - fz) + v[1] * fz;
+    if (dec > 180.0) dec -= 360.0;
+    if (dec <= -180.0) dec += 360.0;
+    return dec;
+}
+
+/**
+ * Free the declination grid.
+ */
+void geomag_cleanup() {
+    for (int row = 0; row < TILE_ROWS; row++) {
+        for (int col = 0; col < TILE_COLS; col++) {
+            free(tiles[row][col]);
+            free(retired[row][col]);
+            tiles[row][col] = retired[row][col] = NULL;
+        }
+    }
+}
@@ -55,6 +55,9 @@ static struct argp_option options[] = {
     {"interactive", OptInteractive, 0, 0, "Interactive mode refreshing data on screen. Implies --throttle", 1},
     {"raw", OptRaw, 0, 0, "Show only messages hex values", 1},
     {"preamble-threshold", OptPreambleThreshold, "<"stringize(PREAMBLE_THRESHOLD_MIN)"-"stringize(PREAMBLE_THRESHOLD_MAX)">", 0, "lower threshold --> more CPU usage (default: "stringize(PREAMBLE_THRESHOLD_DEFAULT)", pi zero / pi 1: "stringize(PREAMBLE_THRESHOLD_PIZERO)", hot CPU "stringize(PREAMBLE_THRESHOLD_HOT)")", 1},
+    {"demod-threads", OptDemodThreads, "<1-"stringize(DEMOD_MAX_THREADS)">", 0, "Number of threads demodulating sample buffers (default: 1)", 1},
+    {"demod-fused", OptDemodFused, 0, 0, "Convert samples and search for preambles in a single pass (saves memory bandwidth)", 1},
+    {"track-threads", OptTrackThreads, "<1-"stringize(TRACK_MAX_THREADS)">", 0, "Number of threads tracking aircraft, by address (default: 1)", 1},
     {"no-modeac-auto", OptNoModeAcAuto, 0, 0, "Don't enable Mode A/C if requested by a Beast connection", 1},
     {"forward-mlat", OptForwardMlat, 0, 0, "Allow forwarding of received mlat results to output ports", 1},
     {"mlat", OptMlat, 0, 0, "Display raw messages in Beast ASCII mode", 1},
@@ -86,14 +89,19 @@ static struct argp_option options[] = {
     {"net-bi-port", OptNetBiPorts, "<ports>", 0, "TCP Beast input listen ports  (default: 30004,30104)", 2},
     {"net-vrs-port", OptNetVRSPorts, "<ports>", 0, "TCP VRS json output listen ports (default: 0)", 2},
     {"net-beast-reduce-out-port", OptNetBeastReducePorts, "<ports>", 0, "TCP BeastReduce output listen ports (default: 0)", 2},
+    {"net-beast-deflate-out-port", OptNetBeastDeflatePorts, "<ports>", 0, "TCP compressed Beast output listen ports, for readsb Beast inputs (default: 0)", 2},
     {"net-beast-reduce-interval", OptNetBeastReduceInterval, "<seconds>", 0, "BeastReduce position update interval, longer means less data (default: 0.125, valid range: 0.000 - 14.999)", 2},
     {"net-ro-size", OptNetRoSize, "<size>", 0, "TCP output flush size (maximum amount of internally buffered data before writing to network) (default: 1200)", 2},
     {"net-ro-interval", OptNetRoIntervall, "<rate>", 0, "TCP output flush interval in seconds (maximum interval between two network writes of accumulated data)(default: 0.05)", 2},
-    {"net-connector", OptNetConnector, "<ip,port,protocol>", 0, "Establish connection, can be specified multiple times (e.g. 127.0.0.1,23004,beast_out) Protocols: beast_out, beast_in, raw_out, raw_in, sbs_out, vrs_out", 2},
+    {"net-connector", OptNetConnector, "<ip,port,protocol>", 0, "Establish connection, can be specified multiple times (e.g. 127.0.0.1,23004,beast_out) Protocols: beast_out, beast_deflate_out, beast_in, raw_out, raw_in, sbs_out, vrs_out", 2},
     {"net-connector-delay", OptNetConnectorDelay, "<seconds>", 0, "Outbound re-connection delay (default: 30)", 2},
+    {"net-udp", OptNetUdp, "<ip,port,protocol>", 0, "UDP stream, can be specified multiple times (e.g. 239.2.3.4,30005,beast_out) Protocols: beast_out, raw_out to send to ip (unicast or multicast), beast_in to receive on ip (local address or multicast group to join)", 2},
     {"net-heartbeat", OptNetHeartbeat, "<rate>", 0, "TCP heartbeat rate in seconds (default: 60 sec; 0 to disable)", 2},
     {"net-buffer", OptNetBuffer, "<n>", 0, "TCP buffer size 64Kb * (2^n) (default: n=2, 256Kb)", 2},
+    {"net-slow-policy", OptNetSlowPolicy, "<[protocol=]policy,...>", 0, "Handling of output clients that can't keep up: disconnect, drop (skip to the newest data) or reduce (beast_out only: switch to BeastReduce output) (default: disconnect)", 2},
     {"net-verbatim", OptNetVerbatim, 0, 0, "Forward messages unchanged", 2},
+    {"net-no-io-uring", OptNetNoUring, 0, 0, "Use epoll even if the kernel supports io_uring", 2},
+    {"net-dedup-window", OptNetDedupWindow, "<ms>", 0, "Drop Beast input messages already received within <ms> milliseconds, for overlapping feeds (default: 0, disabled)", 2},
 #ifdef ENABLE_RTLSDR
     {0, 0, 0, 0, "RTL-SDR options:", 3},
     {0, 0, 0, OPTION_DOC, "use with --device-type rtlsdr", 3},
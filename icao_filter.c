@@ -23,23 +23,46 @@
 
 #include "readsb.h"
 
-// hash table size, must be a power of two:
+// initial (and minimum) hash table size, must be a power of two:
 #define ICAO_FILTER_SIZE 8192
 
-// Millis between filter expiry flips:
+// Millis between filter epochs:
 #define MODES_ICAO_FILTER_TTL 60000
 
-// Open-addressed hash table with linear probing.
+// Minimum millis between table rebuilds, a replaced table is kept
+// around this long before it is freed
+#define ICAO_FILTER_REBUILD_INTERVAL 1000
+
+// Open-addressed hash table with linear probing over buckets of four slots.
 // We store each address twice to handle Data/Parity
-// which need to match on a partial address (top 16 bits only).
+// which need to match on a partial address (bottom 16 bits only).
+//
+// Each slot holds the address in the low 32 bits and the epoch it was last
+// added in in the high 32 bits; a zero slot is empty. The epoch advances
+// every MODES_ICAO_FILTER_TTL, and entries from the current and previous
+// epoch match, so an address ages out 1-2 TTLs after it was last added.
+//
+// Slots are only ever changed from empty to an entry, or to a newer epoch
+// of the same key, so compare-and-swap is enough to make concurrent adds
+// from several demodulator threads safe. Expired entries are dropped when
+// icaoFilterExpire() rebuilds the table once it is half full; the rebuilt
+// table is sized to the live entries, so busy sites grow it as needed.
+
+#define ICAO_FILTER_BUCKET 4
 
-// Maintain two tables and switch between them to age out entries.
+struct icao_filter_table {
+    uint32_t mask; // slots - 1
+    uint32_t used; // non-empty slots
+    uint64_t slots[] __attribute__ ((aligned(64)));
+};
 
-static uint32_t icao_filter_a[ICAO_FILTER_SIZE];
-static uint32_t icao_filter_b[ICAO_FILTER_SIZE];
-static uint32_t *icao_filter_active;
+static struct icao_filter_table *icao_filter;
+static struct icao_filter_table *icao_filter_retired;
+static uint32_t icao_filter_epoch;
 
-#define ICAO_FILTER_EMPTY 0xFFFFFFFF
+static inline uint64_t icaoFilterEntry(uint32_t epoch, uint32_t addr) {
+    return ((uint64_t) epoch << 32) | addr;
+}
 
 static uint32_t icaoHash(uint32_t a) {
     // Jenkins one-at-a-time hash, unrolled for 3 bytes
@@ -61,104 +84,222 @@ static uint32_t icaoHash(uint32_t a) {
     hash ^= (hash >> 11);
     hash += (hash << 15);
 
-    return hash & (ICAO_FILTER_SIZE - 1);
+    return hash;
 }
 
-void icaoFilterInit() {
-    memset(icao_filter_a, 0xFF, sizeof (icao_filter_a));
-    memset(icao_filter_b, 0xFF, sizeof (icao_filter_b));
-    icao_filter_active = icao_filter_a;
+static struct icao_filter_table *icaoFilterAlloc(uint32_t size) {
+    struct icao_filter_table *table;
+    size_t bytes = sizeof (struct icao_filter_table) + size * sizeof (uint64_t);
+
+    // round up to a whole number of cache lines for aligned_alloc()
+    table = aligned_alloc(64, (bytes + 63) & ~(size_t) 63);
+    if (!table) {
+        fprintf(stderr, "icao_filter: out of memory allocating %u entries\n", size);
+        return NULL;
+    }
+    memset(table, 0, bytes);
+    table->mask = size - 1;
+    return table;
 }
 
-void icaoFilterAdd(uint32_t addr) {
-    uint32_t h, h0;
-    h0 = h = icaoHash(addr);
-    while (icao_filter_active[h] != ICAO_FILTER_EMPTY && icao_filter_active[h] != addr) {
-        h = (h + 1) & (ICAO_FILTER_SIZE - 1);
-        if (h == h0) {
-            fprintf(stderr, "ICAO hash table full, increase ICAO_FILTER_SIZE\n");
-            return;
+//
+// Bucket probing: returns a bitmask of the slots in the bucket that hold a
+// live entry matching key under mask, and sets *empty if any slot is empty
+// (which ends the probe sequence).
+//
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+
+static inline uint32_t icaoFilterProbeBucket(const uint64_t *bucket, uint32_t key, uint32_t mask, uint32_t min_epoch, bool *empty) {
+    __m128i lo = _mm_load_si128((const __m128i *) bucket);
+    __m128i hi = _mm_load_si128((const __m128i *) (bucket + 2));
+    // gather the four addresses and the four epochs
+    __m128i addrs = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(2, 0, 2, 0)));
+    __m128i epochs = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(3, 1, 3, 1)));
+
+    __m128i match = _mm_cmpeq_epi32(_mm_and_si128(addrs, _mm_set1_epi32(mask)), _mm_set1_epi32(key & mask));
+    __m128i live = _mm_cmpgt_epi32(epochs, _mm_set1_epi32(min_epoch - 1));
+
+    *empty = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(epochs, _mm_setzero_si128()))) != 0;
+    return _mm_movemask_ps(_mm_castsi128_ps(_mm_and_si128(match, live)));
+}
+#elif defined(__aarch64__) && defined(__ARM_NEON) && !defined(__ARM_BIG_ENDIAN)
+#include <arm_neon.h>
+
+static inline uint32_t icaoFilterProbeBucket(const uint64_t *bucket, uint32_t key, uint32_t mask, uint32_t min_epoch, bool *empty) {
+    // deinterleave into the four addresses and the four epochs
+    uint32x4x2_t v = vld2q_u32((const uint32_t *) bucket);
+    static const uint32_t lane_bits[4] = {1, 2, 4, 8};
+
+    uint32x4_t match = vceqq_u32(vandq_u32(v.val[0], vdupq_n_u32(mask)), vdupq_n_u32(key & mask));
+    uint32x4_t live = vcgeq_u32(v.val[1], vdupq_n_u32(min_epoch));
+
+    *empty = vmaxvq_u32(vceqq_u32(v.val[1], vdupq_n_u32(0))) != 0;
+    return vaddvq_u32(vandq_u32(vandq_u32(match, live), vld1q_u32(lane_bits)));
+}
+#else
+static inline uint32_t icaoFilterProbeBucket(const uint64_t *bucket, uint32_t key, uint32_t mask, uint32_t min_epoch, bool *empty) {
+    uint32_t hits = 0;
+    int i;
+
+    *empty = false;
+    for (i = 0; i < ICAO_FILTER_BUCKET; ++i) {
+        uint64_t entry = bucket[i];
+        if (!entry)
+            *empty = true;
+        else if (((uint32_t) entry & mask) == (key & mask) && (entry >> 32) >= min_epoch)
+            hits |= 1 << i;
+    }
+    return hits;
+}
+#endif
+
+// Find a live entry matching key under mask; returns the full address
+// in *addr_out
+
+static bool icaoFilterFind(uint32_t key, uint32_t mask, uint32_t *addr_out) {
+    struct icao_filter_table *table = __atomic_load_n(&icao_filter, __ATOMIC_ACQUIRE);
+    uint32_t min_epoch = __atomic_load_n(&icao_filter_epoch, __ATOMIC_RELAXED) - 1;
+    uint32_t h, n;
+
+    h = icaoHash(key & mask) & table->mask & ~(ICAO_FILTER_BUCKET - 1);
+    for (n = 0; n <= table->mask; n += ICAO_FILTER_BUCKET) {
+        bool empty;
+        uint32_t hits = icaoFilterProbeBucket(&table->slots[h], key, mask, min_epoch, &empty);
+
+        if (hits) {
+            *addr_out = (uint32_t) table->slots[h + __builtin_ctz(hits)];
+            return true;
         }
+        if (empty)
+            return false;
+
+        h = (h + ICAO_FILTER_BUCKET) & table->mask;
     }
-    if (icao_filter_active[h] == ICAO_FILTER_EMPTY)
-        icao_filter_active[h] = addr;
 
-    // also add with a zeroed top byte, for handling DF20/21 with Data Parity
-    h0 = h = icaoHash(addr & 0x00ffff);
-    while (icao_filter_active[h] != ICAO_FILTER_EMPTY && (icao_filter_active[h] & 0x00ffff) != (addr & 0x00ffff)) {
-        h = (h + 1) & (ICAO_FILTER_SIZE - 1);
-        if (h == h0) {
-            fprintf(stderr, "ICAO hash table full, increase ICAO_FILTER_SIZE\n");
-            return;
+    return false;
+}
+
+// Add or refresh addr under key / mask. Returns false if the table is full.
+
+static bool icaoFilterInsert(struct icao_filter_table *table, uint32_t key, uint32_t mask, uint32_t addr, uint32_t epoch) {
+    uint32_t h, n;
+
+    h = icaoHash(key & mask) & table->mask & ~(ICAO_FILTER_BUCKET - 1);
+    for (n = 0; n <= table->mask; ++n, h = (h + 1) & table->mask) {
+        uint64_t entry = __atomic_load_n(&table->slots[h], __ATOMIC_RELAXED);
+
+        for (;;) {
+            if (!entry) {
+                if (__atomic_compare_exchange_n(&table->slots[h], &entry, icaoFilterEntry(epoch, addr), false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                    __atomic_add_fetch(&table->used, 1, __ATOMIC_RELAXED);
+                    return true;
+                }
+            } else if (((uint32_t) entry & mask) == (key & mask)) {
+                if ((entry >> 32) >= epoch)
+                    return true;
+                if (__atomic_compare_exchange_n(&table->slots[h], &entry, icaoFilterEntry(epoch, addr), false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                    return true;
+            } else {
+                break; // taken by another key, try the next slot
+            }
         }
     }
-    if (icao_filter_active[h] == ICAO_FILTER_EMPTY)
-        icao_filter_active[h] = addr;
+
+    return false;
+}
+
+void icaoFilterInit() {
+    icao_filter = icaoFilterAlloc(ICAO_FILTER_SIZE);
+    icao_filter_retired = NULL;
+    // epoch 0 marks empty slots, start high enough that epoch - 1 > 0
+    icao_filter_epoch = 2;
+}
+
+void icaoFilterAdd(uint32_t addr) {
+    struct icao_filter_table *table = __atomic_load_n(&icao_filter, __ATOMIC_ACQUIRE);
+    uint32_t epoch = __atomic_load_n(&icao_filter_epoch, __ATOMIC_RELAXED);
+
+    // A full table drops the address until the next icaoFilterExpire() rebuild
+    if (!icaoFilterInsert(table, addr, 0xffffffff, addr, epoch))
+        return;
+
+    // also add with a zeroed top byte, for handling DF20/21 with Data Parity
+    icaoFilterInsert(table, addr, 0x00ffff, addr, epoch);
 }
 
 int icaoFilterTest(uint32_t addr) {
-    uint32_t h, h0;
+    uint32_t found;
+    return icaoFilterFind(addr, 0xffffffff, &found);
+}
 
-    h0 = h = icaoHash(addr);
-    while (icao_filter_a[h] != ICAO_FILTER_EMPTY && icao_filter_a[h] != addr) {
-        h = (h + 1) & (ICAO_FILTER_SIZE - 1);
-        if (h == h0)
-            break;
-    }
-    if (icao_filter_a[h] == addr)
-        return 1;
-
-    h = h0;
-    while (icao_filter_b[h] != ICAO_FILTER_EMPTY && icao_filter_b[h] != addr) {
-        h = (h + 1) & (ICAO_FILTER_SIZE - 1);
-        if (h == h0)
-            break;
-    }
-    if (icao_filter_b[h] == addr)
-        return 1;
+uint32_t icaoFilterTestFuzzy(uint32_t partial) {
+    uint32_t found;
 
+    if (icaoFilterFind(partial, 0x00ffff, &found))
+        return found;
     return 0;
 }
 
-uint32_t icaoFilterTestFuzzy(uint32_t partial) {
-    uint32_t h, h0;
-
-    partial &= 0x00ffff;
-    h0 = h = icaoHash(partial);
-    while (icao_filter_a[h] != ICAO_FILTER_EMPTY && (icao_filter_a[h] & 0x00ffff) != partial) {
-        h = (h + 1) & (ICAO_FILTER_SIZE - 1);
-        if (h == h0)
-            break;
+// Copy the live entries into a table sized for them and swap it in.
+// Readers may still be probing the old table, so it is only freed on the
+// next rebuild, at least ICAO_FILTER_REBUILD_INTERVAL later.
+
+static void icaoFilterRebuild() {
+    struct icao_filter_table *old = icao_filter, *table;
+    uint32_t min_epoch = icao_filter_epoch - 1;
+    uint32_t live = 0, size = ICAO_FILTER_SIZE, i;
+
+    for (i = 0; i <= old->mask; ++i) {
+        if ((old->slots[i] >> 32) >= min_epoch)
+            ++live;
     }
-    if (icao_filter_a[h] != ICAO_FILTER_EMPTY && (icao_filter_a[h] & 0x00ffff) == partial)
-        return icao_filter_a[h];
-
-    h = h0;
-    while (icao_filter_b[h] != ICAO_FILTER_EMPTY && (icao_filter_b[h] & 0x00ffff) != partial) {
-        h = (h + 1) & (ICAO_FILTER_SIZE - 1);
-        if (h == h0)
-            break;
+
+    // keep the load factor below 1/4 after the rebuild
+    while (size < live * 4)
+        size <<= 1;
+
+    if (!(table = icaoFilterAlloc(size)))
+        return;
+
+    for (i = 0; i <= old->mask; ++i) {
+        uint64_t entry = __atomic_load_n(&old->slots[i], __ATOMIC_RELAXED);
+        uint32_t addr = (uint32_t) entry;
+
+        if ((entry >> 32) < min_epoch)
+            continue;
+        // full and partial entries both hold the full address; re-adding
+        // under both keys is harmless, a duplicate just refreshes the slot
+        icaoFilterInsert(table, addr, 0xffffffff, addr, entry >> 32);
+        icaoFilterInsert(table, addr, 0x00ffff, addr, entry >> 32);
     }
-    if (icao_filter_b[h] != ICAO_FILTER_EMPTY && (icao_filter_b[h] & 0x00ffff) == partial)
-        return icao_filter_b[h];
 
-    return 0;
+    free(icao_filter_retired);
+    icao_filter_retired = old;
+    __atomic_store_n(&icao_filter, table, __ATOMIC_RELEASE);
 }
 
 // call this periodically:
 
 void icaoFilterExpire() {
     static uint64_t next_flip = 0;
+    static uint64_t next_rebuild = 0;
     uint64_t now = mstime();
 
     if (now >= next_flip) {
-        if (icao_filter_active == icao_filter_a) {
-            memset(icao_filter_b, 0xFF, sizeof (icao_filter_b));
-            icao_filter_active = icao_filter_b;
-        } else {
-            memset(icao_filter_a, 0xFF, sizeof (icao_filter_a));
-            icao_filter_active = icao_filter_a;
-        }
+        __atomic_add_fetch(&icao_filter_epoch, 1, __ATOMIC_RELAXED);
         next_flip = now + MODES_ICAO_FILTER_TTL;
     }
+
+    if (now >= next_rebuild && __atomic_load_n(&icao_filter->used, __ATOMIC_RELAXED) > (icao_filter->mask + 1) / 2) {
+        icaoFilterRebuild();
+        next_rebuild = now + ICAO_FILTER_REBUILD_INTERVAL;
+    }
+}
+
+void icaoFilterCleanup() {
+    free(icao_filter);
+    free(icao_filter_retired);
+    icao_filter = icao_filter_retired = NULL;
 }
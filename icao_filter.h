@@ -42,4 +42,7 @@ uint32_t icaoFilterTestFuzzy(uint32_t partial);
 // old entries.
 void icaoFilterExpire();
 
+// Free the filter tables on exit
+void icaoFilterCleanup();
+
 #endif
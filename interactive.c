@@ -113,9 +113,11 @@ void interactiveShowData(void) {
     int rows = getmaxy(stdscr);
     int row = 2;
 
-    for (int j = 0; j < AIRCRAFTS_BUCKETS; j++) {
-        struct aircraft *a = Modes.aircrafts[j];
-        while (a && row < rows) {
+    for (int s = 0; s < Modes.track_threads && row < rows; s++) {
+        struct track_shard *sh = &Modes.track_shards[s];
+
+        for (unsigned j = 0; j < sh->aircraft_count && row < rows; j++) {
+            struct aircraft *a = &sh->aircrafts[j];
 
             if ((now - a->meta.seen) < Modes.interactive_display_ttl) {
                 int msgs = a->meta.messages;
@@ -177,7 +179,6 @@ void interactiveShowData(void) {
                     ++row;
                 }
             }
-            a = a->next;
         }
     }
 
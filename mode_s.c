@@ -69,6 +69,10 @@
  */
 #define MAGIC_MLAT_TIMESTAMP 0xFF004D4C4154ULL
 
+// Statistics counted while decoding. Demodulator threads point this at the
+// statistics of the buffer they work on, which the main thread adds up.
+_Thread_local struct stats *decode_stats = &Modes.stats_current;
+
 //=========================================================================
 //
 // Given the Downlink Format (DF) of the message, return the message length in bits.
@@ -309,6 +313,23 @@ static int correct_aa_field(uint32_t *addr, struct errorinfo *ei) {
 static unsigned char all_zeros[14] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
 int scoreModesMessage(unsigned char *msg, int validbits) {
+    int msgbits;
+
+    if (validbits < 56)
+        return -2;
+
+    msgbits = modesMessageLenByType(getbits(msg, 1, 5));
+
+    if (validbits < msgbits)
+        return -2;
+
+    return scoreModesMessageChecksum(msg, validbits, modesChecksum(msg, msgbits));
+}
+
+// As scoreModesMessage(), with the checksum of the message already computed
+// by the caller (e.g. via modesChecksumBatch())
+
+int scoreModesMessageChecksum(unsigned char *msg, int validbits, uint32_t checksum) {
     int msgtype, msgbits, crc, iid;
     uint32_t addr;
     struct errorinfo *ei;
@@ -325,7 +346,7 @@ int scoreModesMessage(unsigned char *msg, int validbits) {
     if (!memcmp(all_zeros, msg, msgbits / 8))
         return -2;
 
-    crc = modesChecksum(msg, msgbits);
+    crc = checksum;
 
     switch (msgtype) {
         case 0: // short air-air surveillance
@@ -995,7 +1016,7 @@ static void decodeESAirbornePosition(struct modesMessage *mm, int check_imf) {
             //   400648 (BAE ATP) - Atlantic Airlines
             // altitude == 0, longitude == 0, type == 15 and zeros in latitude LSB.
             // Can alternate with valid reports having type == 14
-            Modes.stats_current.cpr_filtered++;
+            decode_stats->cpr_filtered++;
         } else {
             // Otherwise, assume it's valid.
             mm->cpr_valid = 1;
@@ -2148,9 +2169,22 @@ void useModesMessage(struct modesMessage *mm) {
 
     ++Modes.stats_current.messages_total;
 
+    // Tracking threads track and output it on their own
+    if (Modes.track_threads > 1) {
+        trackQueueMessage(mm);
+        return;
+    }
+
     // Track aircraft state
     a = trackUpdateFromMessage(mm);
+    outputModesMessage(mm, a);
+}
+
+//
+// Display and forward a message after tracking it, a is its aircraft or NULL
+//
 
+void outputModesMessage(struct modesMessage *mm, struct aircraft *a) {
     // In non-interactive non-quiet mode, display messages on standard output
     if (!Modes.interactive && !Modes.quiet && (!Modes.show_only || mm->addr == Modes.show_only) && !mm->sbs_in) {
         displayModesMessage(mm);
@@ -32,9 +32,14 @@
 //
 int modesMessageLenByType(int type);
 int scoreModesMessage(unsigned char *msg, int validbits);
+int scoreModesMessageChecksum(unsigned char *msg, int validbits, uint32_t checksum);
 int decodeModesMessage(struct modesMessage *mm, unsigned char *msg);
 void displayModesMessage(struct modesMessage *mm);
 void useModesMessage(struct modesMessage *mm);
+void outputModesMessage(struct modesMessage *mm, struct aircraft *a);
+
+// Statistics decodeModesMessage() counts into, per thread
+extern _Thread_local struct stats *decode_stats;
 
 // datafield extraction helpers
 
@@ -64,9 +64,17 @@
 #include <netdb.h>
 #include <poll.h>
 #include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <zlib.h>
 
 #include <linux/serial.h>
 
+#ifdef ENABLE_IOURING
+#include "net_uring.h"
+#endif
+
 //
 // ============================= Networking =============================
 //
@@ -75,13 +83,26 @@
 //
 // 1) We only rely on the kernel buffers for our I/O without any kind of
 //    user space buffering.
-// 2) We don't register any kind of event handler, from time to time a
-//    function gets called and we accept new connections. All the rest is
-//    handled via non-blocking I/O and manually polling clients to see if
-//    they have something new to share with us when reading is needed.
+// 2) Listeners, clients and pending connects are registered edge-triggered
+//    with a single epoll instance. Reads and accepts happen only on readiness,
+//    a client is armed for EPOLLOUT only while its SendQ is non-empty, and a
+//    timerfd fires at the next accept retry/reconnect deadline. The cost
+//    of an idle pass is therefore independent of the number of clients.
+// 3) In readsb, the event loop runs on its own thread (modesNetStartThread).
+//    It owns all clients and sockets; services, writers and aircraft stay
+//    with the decoding thread. Framed remote input is handed to the decoder
+//    and writer output to the network thread through lock-free queues, so
+//    slow sockets or bursts of input never stall demodulation. viewadsb runs
+//    everything inline on one thread.
+// 4) Where the kernel supports it, client and listener I/O goes through
+//    io_uring instead (see "io_uring backend" below); the ring's fd is just
+//    another epoll source. Timers, connects and the queues stay on epoll.
 
 static int handleBeastCommand(struct client *c, char *p, int remote);
-static int decodeBinMessage(struct client *c, char *p, int remote);
+static int decodeBinMessages(struct client *c, char *p, int remote);
+static void beastScanInit(void);
+static void netDedupInit(void);
+static void serviceDeflate(struct net_service *s);
 static int decodeHexMessage(struct client *c, char *hex, int remote);
 static int decodeSbsLine(struct client *c, char *line, int remote);
 
@@ -96,6 +117,163 @@ static void autoset_modeac();
 static int hexDigitVal(int c);
 static void *pthreadGetaddrinfo(void *param);
 static void flushClient(struct client *c, uint64_t now);
+static void flushUdpClient(struct client *c, uint64_t now);
+static int netUdpReadClient(struct client *c);
+static void modesCloseClient(struct client *c);
+static void clientDropSendQ(struct client *c);
+static void clientCloseSendQ(struct client *c);
+static void clientFree(struct client *c);
+static void serviceAccepted(struct net_service *s, int fd, struct sockaddr *saddr, socklen_t slen);
+static void netUringStart(void);
+static void netUringListen(struct net_service *service);
+static void netUringClient(struct client *c);
+static void netUringSend(struct client *c);
+static void netUringCancel(struct client *c, bool recv);
+static void netUringFlush(void);
+static void netUringWork(uint64_t now);
+static void netReadClient(struct client *c);
+static int clientParseInput(struct client *c);
+
+#define NET_MAX_EVENTS 64
+
+static int net_epfd = -1;
+static int net_timerfd = -1;
+static uint64_t net_timer_deadline; // deadline the timerfd is armed for, 0 if disarmed
+static struct net_event_tag net_timer_tag = {NET_EVENT_TIMER, NULL};
+static unsigned net_read_pending; // number of clients with read_pending set
+static uint64_t next_accept_retry; // nonzero while accept() is suspended after EMFILE
+static uint64_t next_tcp_json;
+
+static bool net_threaded; // network I/O runs on net_thread
+static bool net_input_blocked; // net_input_queue was full, the decoder is behind
+static struct stats net_stats; // counted by the network thread, see modesNetMergeStats()
+static pthread_mutex_t net_stats_mutex = PTHREAD_MUTEX_INITIALIZER; // protects net_stats
+static pthread_t net_thread;
+static atomic_bool net_thread_stop;
+static struct net_queue net_input_queue; // framed remote input, network -> decoding thread
+static struct net_queue net_output_queue; // writer output, decoding -> network thread
+static struct net_event_tag net_output_tag = {NET_EVENT_QUEUE, NULL};
+static atomic_size_t net_output_bytes; // chunk data queued in net_output_queue
+static atomic_bool net_output_room_wanted; // a writer waits in netOutputPush()
+static pthread_mutex_t net_output_room_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t net_output_room_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t net_output_held; // output is held back for a full SendQ until then, 0 if not
+static bool net_uring; // client and listener I/O uses io_uring
+
+#define NET_STALL_TIMEOUT 5000 // disconnect after so long without sending anything
+#define NET_STALL_TIMEOUT_SLOW 60000 // the same for clients that shed output instead
+#define NET_LAG_REPORT_INTERVAL 60000
+
+#define NET_INPUT_QUEUE_SIZE (1024 * 1024)
+#define NET_OUTPUT_QUEUE_SIZE (4 * 1024 * 1024)
+#define NET_OUTPUT_DRAIN_MAX 16 // chunks handed to the clients per netDispatch() pass
+#define NET_OUTPUT_WAIT 1000 // milliseconds a writer waits for room in net_output_queue
+#define NET_OUTPUT_HIGH_WATER (512 * 1024) // queued output bytes before writers wait
+#define NET_OUTPUT_HOLD 250 // milliseconds output waits for a client to make room in its SendQ
+
+static inline int serviceConnections(struct net_service *s) {
+    return __atomic_load_n(&s->connections, __ATOMIC_RELAXED);
+}
+
+//
+//=========================================================================
+//
+// Event loop plumbing
+//
+
+static void netEventInit(void) {
+    struct epoll_event ev;
+
+    if (net_epfd >= 0)
+        return;
+
+    if ((net_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        fprintf(stderr, "Unable to create epoll instance: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    if ((net_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+        fprintf(stderr, "Unable to create network timer: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &net_timer_tag;
+    if (epoll_ctl(net_epfd, EPOLL_CTL_ADD, net_timerfd, &ev) < 0) {
+        fprintf(stderr, "Unable to register network timer: %s\n", strerror(errno));
+        exit(1);
+    }
+    net_timer_deadline = 0;
+
+    beastScanInit();
+    netUringStart();
+}
+
+static void netEventCtl(int op, int fd, uint32_t events, struct net_event_tag *tag) {
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.ptr = tag;
+    if (epoll_ctl(net_epfd, op, fd, &ev) < 0) {
+        fprintf(stderr, "epoll_ctl failed on fd %d: %s\n", fd, strerror(errno));
+    }
+}
+
+static void netEventDel(int fd) {
+    // Closing the fd would drop it too, this just makes it explicit; not being
+    // registered is fine.
+    epoll_ctl(net_epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+// Arm or disarm write readiness notification for a client
+
+static void netClientWantWrite(struct client *c, int on) {
+    if (c->epollout == on)
+        return;
+    c->epollout = on;
+    netEventCtl(EPOLL_CTL_MOD, c->fd, EPOLLIN | EPOLLET | (on ? EPOLLOUT : 0), &c->tag);
+}
+
+static inline uint64_t earliest(uint64_t deadline, uint64_t t) {
+    return (!deadline || t < deadline) ? t : deadline;
+}
+
+// Earliest point in time at which netTimerWork has something to do, 0 if none
+
+static uint64_t netNextDeadline(void) {
+    uint64_t deadline = 0;
+
+    if (next_accept_retry)
+        deadline = earliest(deadline, next_accept_retry);
+
+    for (int i = 0; i < Modes.net_connectors_count; i++) {
+        struct net_connector *con = Modes.net_connectors[i];
+        if (!con->connected)
+            deadline = earliest(deadline, con->connecting ? con->connect_timeout : con->next_reconnect);
+    }
+
+    return deadline;
+}
+
+static void netArmTimer(uint64_t now) {
+    struct itimerspec its;
+    uint64_t deadline = netNextDeadline();
+
+    if (deadline == net_timer_deadline)
+        return;
+    net_timer_deadline = deadline;
+
+    memset(&its, 0, sizeof (its));
+    if (deadline) {
+        // a zero it_value would disarm, so fire overdue deadlines after 1 ms
+        uint64_t delay = (deadline > now) ? deadline - now : 1;
+        its.it_value.tv_sec = delay / 1000;
+        its.it_value.tv_nsec = (delay % 1000) * 1000 * 1000;
+    }
+    if (timerfd_settime(net_timerfd, 0, &its, NULL) < 0) {
+        fprintf(stderr, "Unable to arm network timer: %s\n", strerror(errno));
+    }
+}
 
 //
 //=========================================================================
@@ -118,6 +296,8 @@ struct net_service *serviceInit(const char *descr, struct net_writer *writer, he
         exit(1);
     }
 
+    netEventInit();
+
     service->next = Modes.services;
     Modes.services = service;
 
@@ -131,6 +311,8 @@ struct net_service *serviceInit(const char *descr, struct net_writer *writer, he
     service->read_mode = mode;
     service->read_handler = handler;
     service->clients = NULL;
+    service->listener_tag.type = NET_EVENT_LISTENER;
+    service->listener_tag.owner = service;
 
     if (service->writer) {
         if (!service->writer->data) {
@@ -186,20 +368,27 @@ struct client *createGenericClient(struct net_service *service, int fd) {
     c->sendq_len = 0;
     c->sendq_max = 0;
     c->sendq = NULL;
+    c->sendq_offset = 0;
     c->con = NULL;
+    c->epollout = 0;
+    c->read_pending = 0;
+    c->input_blocked = 0;
+    c->tag.type = NET_EVENT_CLIENT;
+    c->tag.owner = c;
+    c->uring_buf = -1;
+    c->udp = service->udp;
 
     if (service->writer) {
-        if (!(c->sendq = malloc(MODES_NET_SNDBUF_SIZE << Modes.net_sndbuf_size))) {
-            fprintf(stderr, "Out of memory allocating client SendQ\n");
-            exit(1);
-        }
-        // Have to keep track of this manually
         c->sendq_max = MODES_NET_SNDBUF_SIZE << Modes.net_sndbuf_size;
     }
     service->clients = c;
+    if (net_uring && !c->udp)
+        netUringClient(c);
+    else
+        netEventCtl(EPOLL_CTL_ADD, fd, EPOLLIN | EPOLLET, &c->tag);
 
-    ++service->connections;
-    if (service->writer && service->connections == 1) {
+    // the writer belongs to the decoding thread when threaded
+    if (__atomic_add_fetch(&service->connections, 1, __ATOMIC_RELAXED) == 1 && service->writer && !net_threaded) {
         service->writer->lastWrite = now; // suppress heartbeat initially
     }
 
@@ -277,6 +466,8 @@ struct client *checkServiceConnected(struct net_connector *con) {
     // If we're able to create this "client", save the sockaddr info and print a msg
     struct client *c;
 
+    // the fd is handed over to the client, which registers it again
+    netEventDel(con->fd);
     c = createSocketClient(con->service, con->fd);
     if (!c) {
         con->connecting = 0;
@@ -383,17 +574,90 @@ struct client *serviceConnect(struct net_connector *con) {
     con->connecting = 1;
     con->connect_timeout = mstime() + 10 * 1000; // 10 sec TODO: Move to var
     con->fd = fd;
+    con->tag.type = NET_EVENT_CONNECTOR;
+    con->tag.owner = con;
+    netEventCtl(EPOLL_CTL_ADD, fd, EPOLLOUT | EPOLLET, &con->tag);
 
     if (anetTcpKeepAlive(Modes.aneterr, fd) != ANET_OK) {
         fprintf(stderr, "%s: Unable to set keepalive: connection to %s port %s ...\n", con->service->descr, con->address, con->port);
     }
 
     // Since this is a non-blocking connect, it will always return right away.
-    // We'll need to periodically check to see if it did, in fact, connect, but do it once here.
+    // Writability of the fd tells us when it completed, but check once here.
 
     return checkServiceConnected(con);
 }
 
+// Open the UDP stream u as a client of the given service. Output streams
+// send to the address, input streams receive on it and join it if it is a
+// multicast group.
+// _exits_ on failure!
+
+static void serviceUdp(struct net_service *service, struct net_udp *u) {
+    struct addrinfo hints, *res;
+    struct client *c;
+    bool multicast;
+    int fd, err;
+
+    memset(&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    if ((err = getaddrinfo(u->address, u->port, &hints, &res))) {
+        fprintf(stderr, "%s: Name resolution for %s failed: %s\n", service->descr, u->address, gai_strerror(err));
+        exit(1);
+    }
+
+    if (res->ai_family == AF_INET6)
+        multicast = IN6_IS_ADDR_MULTICAST(&((struct sockaddr_in6 *) res->ai_addr)->sin6_addr);
+    else
+        multicast = IN_MULTICAST(ntohl(((struct sockaddr_in *) res->ai_addr)->sin_addr.s_addr));
+
+    if ((fd = socket(res->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0)
+        goto fail;
+
+    if (service->writer) {
+        if (connect(fd, res->ai_addr, res->ai_addrlen) < 0)
+            goto fail;
+    } else {
+        int on = 1;
+        int size = MODES_NET_SNDBUF_SIZE << Modes.net_sndbuf_size;
+
+        // other receivers on this host may join the same group
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on)) < 0 ||
+                bind(fd, res->ai_addr, res->ai_addrlen) < 0)
+            goto fail;
+        if (multicast && res->ai_family == AF_INET6) {
+            struct ipv6_mreq mreq;
+
+            memset(&mreq, 0, sizeof (mreq));
+            mreq.ipv6mr_multiaddr = ((struct sockaddr_in6 *) res->ai_addr)->sin6_addr;
+            if (setsockopt(fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof (mreq)) < 0)
+                goto fail;
+        } else if (multicast) {
+            struct ip_mreq mreq;
+
+            memset(&mreq, 0, sizeof (mreq));
+            mreq.imr_multiaddr = ((struct sockaddr_in *) res->ai_addr)->sin_addr;
+            mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+            if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof (mreq)) < 0)
+                goto fail;
+        }
+        // datagrams arriving while the decoder is behind wait here
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
+    }
+
+    c = createSocketClient(service, fd);
+    getnameinfo(res->ai_addr, res->ai_addrlen, c->host, sizeof (c->host), c->port, sizeof (c->port),
+            NI_NUMERICHOST | NI_NUMERICSERV);
+    freeaddrinfo(res);
+    return;
+
+fail:
+    fprintf(stderr, "%s: Unable to set up UDP stream %s port %s: %s\n",
+            service->descr, u->address, u->port, strerror(errno));
+    exit(1);
+}
+
 // Set up the given service to listen on an address/port.
 // _exits_ on failure!
 
@@ -447,16 +711,20 @@ void serviceListen(struct net_service *service, char *bind_addr, char *bind_port
             if (anetNonBlock(Modes.aneterr, newfds[i]) == ANET_ERR) {
                 fprintf(stderr, "%s port %s: Failed to set non-block: %s\n", service->descr, buf, Modes.aneterr);
             }
+            if (!net_uring)
+                netEventCtl(EPOLL_CTL_ADD, newfds[i], EPOLLIN | EPOLLET, &service->listener_tag);
             fds[n++] = newfds[i];
         }
     }
 
     service->listener_count = n;
     service->listener_fds = fds;
+    if (net_uring)
+        netUringListen(service);
 }
 
 struct net_service *makeBeastInputService(void) {
-    return serviceInit("Beast TCP input", NULL, NULL, READ_MODE_BEAST, NULL, decodeBinMessage);
+    return serviceInit("Beast TCP input", NULL, NULL, READ_MODE_BEAST, NULL, decodeBinMessages);
 }
 
 struct net_service *makeFatsvOutputService(void) {
@@ -466,16 +734,23 @@ struct net_service *makeFatsvOutputService(void) {
 void modesInitNet(void) {
     struct net_service *beast_out;
     struct net_service *beast_reduce_out;
+    struct net_service *beast_deflate_out;
     struct net_service *beast_in;
     struct net_service *raw_out;
     struct net_service *raw_in;
     struct net_service *vrs_out;
     struct net_service *sbs_out;
     struct net_service *sbs_in;
+    struct net_service *raw_udp_out;
+    struct net_service *beast_udp_out;
+    struct net_service *beast_udp_in;
 
     uint64_t now = mstime();
 
     signal(SIGPIPE, SIG_IGN);
+
+    if (Modes.net_dedup_window)
+        netDedupInit();
     Modes.services = NULL;
 
 
@@ -489,6 +764,10 @@ void modesInitNet(void) {
     beast_reduce_out = serviceInit("BeastReduce TCP output", &Modes.beast_reduce_out, send_beast_heartbeat, READ_MODE_IGNORE, NULL, NULL);
     serviceListen(beast_reduce_out, Modes.net_bind_address, Modes.net_output_beast_reduce_ports);
 
+    beast_deflate_out = serviceInit("Beast compressed TCP output", &Modes.beast_deflate_out, send_beast_heartbeat, READ_MODE_BEAST_COMMAND, NULL, handleBeastCommand);
+    serviceDeflate(beast_deflate_out);
+    serviceListen(beast_deflate_out, Modes.net_bind_address, Modes.net_output_beast_deflate_ports);
+
     vrs_out = serviceInit("VRS json output", &Modes.vrs_out, NULL, READ_MODE_IGNORE, NULL, NULL);
     serviceListen(vrs_out, Modes.net_bind_address, Modes.net_output_vrs_ports);
 
@@ -510,6 +789,24 @@ void modesInitNet(void) {
         createGenericClient(beast_in, Modes.beast_fd);
     }
 
+    /* UDP streams */
+    raw_udp_out = serviceInit("Raw UDP output", &Modes.raw_udp_out, send_raw_heartbeat, READ_MODE_IGNORE, NULL, NULL);
+    beast_udp_out = serviceInit("Beast UDP output", &Modes.beast_udp_out, send_beast_heartbeat, READ_MODE_IGNORE, NULL, NULL);
+    beast_udp_in = serviceInit("Beast UDP input", NULL, NULL, READ_MODE_BEAST, NULL, decodeBinMessages);
+    raw_udp_out->udp = beast_udp_out->udp = beast_udp_in->udp = 1;
+    // there is nobody to disconnect, lose datagrams instead
+    raw_udp_out->slow_policy = beast_udp_out->slow_policy = NET_SLOW_DROP;
+
+    for (int i = 0; i < Modes.net_udp_count; i++) {
+        struct net_udp *u = Modes.net_udp[i];
+        if (strcmp(u->protocol, "beast_out") == 0)
+            serviceUdp(beast_udp_out, u);
+        else if (strcmp(u->protocol, "raw_out") == 0)
+            serviceUdp(raw_udp_out, u);
+        else if (strcmp(u->protocol, "beast_in") == 0)
+            serviceUdp(beast_udp_in, u);
+    }
+
     for (int i = 0; i < Modes.net_connectors_count; i++) {
         struct net_connector *con = Modes.net_connectors[i];
         if (strcmp(con->protocol, "beast_out") == 0)
@@ -518,6 +815,8 @@ void modesInitNet(void) {
             con->service = beast_in;
         if (strcmp(con->protocol, "beast_reduce_out") == 0)
             con->service = beast_reduce_out;
+        else if (strcmp(con->protocol, "beast_deflate_out") == 0)
+            con->service = beast_deflate_out;
         else if (strcmp(con->protocol, "raw_out") == 0)
             con->service = raw_out;
         else if (strcmp(con->protocol, "raw_in") == 0)
@@ -537,59 +836,150 @@ void modesInitNet(void) {
         pthread_mutex_lock(con->mutex);
     }
     serviceReconnectCallback(now);
+
+    netParseSlowPolicy(Modes.net_slow_policy, "raw_out", &raw_out->slow_policy);
+    netParseSlowPolicy(Modes.net_slow_policy, "beast_out", &beast_out->slow_policy);
+    netParseSlowPolicy(Modes.net_slow_policy, "beast_reduce_out", &beast_reduce_out->slow_policy);
+    netParseSlowPolicy(Modes.net_slow_policy, "vrs_out", &vrs_out->slow_policy);
+    netParseSlowPolicy(Modes.net_slow_policy, "sbs_out", &sbs_out->slow_policy);
+    beast_out->reduce_to = beast_reduce_out;
+}
+
+// Parse a --net-slow-policy argument: a comma separated list of policies,
+// each optionally prefixed with the output protocol it applies to.
+// With a protocol, store the policy for it in *policy. Returns false on
+// a syntax error.
+
+bool netParseSlowPolicy(const char *arg, const char *protocol, net_slow_policy_t *policy) {
+    static const char *outputs[] = {"beast_out", "beast_reduce_out", "raw_out", "sbs_out", "vrs_out", NULL};
+    static const char *names[] = {"disconnect", "drop", "reduce", NULL};
+    net_slow_policy_t fallback = NET_SLOW_DISCONNECT, found = NET_SLOW_DISCONNECT;
+    bool have = false;
+    char *copy, *item, *save;
+
+    if (!arg)
+        arg = "";
+    if (!(copy = strdup(arg)))
+        return false;
+
+    for (item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        char *name = strchr(item, '=');
+        const char *proto = NULL;
+        int i, j;
+
+        if (name) {
+            *name++ = 0;
+            for (j = 0; outputs[j] && strcmp(outputs[j], item); j++);
+            if (!outputs[j]) {
+                fprintf(stderr, "--net-slow-policy: Unknown output protocol: %s\n", item);
+                free(copy);
+                return false;
+            }
+            proto = outputs[j];
+        } else {
+            name = item;
+        }
+        for (i = 0; names[i] && strcmp(names[i], name); i++);
+        if (!names[i]) {
+            fprintf(stderr, "--net-slow-policy: Unknown policy: %s\n", name);
+            fprintf(stderr, "Supported policies: disconnect, drop, reduce\n");
+            free(copy);
+            return false;
+        }
+        if (i == NET_SLOW_REDUCE && proto && strcmp(proto, "beast_out")) {
+            fprintf(stderr, "--net-slow-policy: reduce is only supported for beast_out\n");
+            free(copy);
+            return false;
+        }
+
+        if (!proto) {
+            fallback = i;
+        } else if (protocol && !strcmp(proto, protocol)) {
+            found = i;
+            have = true;
+        }
+    }
+    free(copy);
+
+    if (protocol) {
+        if (!have) {
+            // a plain "reduce" means dropping for outputs other than Beast
+            found = (fallback == NET_SLOW_REDUCE && strcmp(protocol, "beast_out")) ? NET_SLOW_DROP : fallback;
+        }
+        *policy = found;
+    }
+    return true;
 }
 
 
 //
 //=========================================================================
 //
-// This function gets called from time to time when the decoding thread is
-// awakened by new data arriving. This usually happens a few times every second
+// Accept all pending connections on the listeners of a service.
+// Returns 1 if we ran out of file descriptors.
 //
 
-static uint64_t modesAcceptClients(uint64_t now) {
+static int serviceAccept(struct net_service *s) {
     int fd;
-    struct net_service *s;
-    struct client *c;
 
-    for (s = Modes.services; s; s = s->next) {
-        int i;
-        for (i = 0; i < s->listener_count; ++i) {
-            struct sockaddr_storage storage;
-            struct sockaddr *saddr = (struct sockaddr *) &storage;
-            socklen_t slen = sizeof (storage);
-
-            while ((fd = anetGenericAccept(Modes.aneterr, s->listener_fds[i], saddr, &slen)) >= 0) {
-                c = createSocketClient(s, fd);
-                if (c) {
-                    // We created the client, save the sockaddr info and 'hostport'
-                    getnameinfo(saddr, slen,
-                            c->host, sizeof (c->host),
-                            c->port, sizeof (c->port),
-                            NI_NUMERICHOST | NI_NUMERICSERV);
-
-                    if (anetTcpKeepAlive(Modes.aneterr, fd) != ANET_OK) {
-                        fprintf(stderr, "%s: Unable to set keepalive on connection from %s port %s (fd %d)\n", c->service->descr, c->host, c->port, fd);
-                    }
-                } else {
-                    fprintf(stderr, "%s: Fatal: createSocketClient shouldn't fail!\n", s->descr);
-                    exit(1);
-                }
-            }
+    for (int i = 0; i < s->listener_count; ++i) {
+        struct sockaddr_storage storage;
+        struct sockaddr *saddr = (struct sockaddr *) &storage;
+        socklen_t slen = sizeof (storage);
 
-            if (errno != EMFILE && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
-                fprintf(stderr, "%s: Error accepting new connection: %s\n", s->descr, Modes.aneterr);
-            }
+        while ((fd = anetGenericAccept(Modes.aneterr, s->listener_fds[i], saddr, &slen)) >= 0) {
+            serviceAccepted(s, fd, saddr, slen);
+            slen = sizeof (storage);
         }
+
+        if (errno == EMFILE) {
+            return 1;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+            fprintf(stderr, "%s: Error accepting new connection: %s\n", s->descr, Modes.aneterr);
+        }
+    }
+    return 0;
+}
+
+// Set up a client for a newly accepted connection. Without saddr, the peer
+// address is looked up.
+
+static void serviceAccepted(struct net_service *s, int fd, struct sockaddr *saddr, socklen_t slen) {
+    struct sockaddr_storage storage;
+    struct client *c;
+
+    if (!saddr) {
+        saddr = (struct sockaddr *) &storage;
+        slen = sizeof (storage);
+        if (getpeername(fd, saddr, &slen) < 0)
+            slen = 0;
     }
-    // temporarily stop trying to accept new clients if we are limited by file descriptors
-    if (errno == EMFILE) {
-        fprintf(stderr, "Accepting new connections suspended for 3 seconds: %s\n", Modes.aneterr);
-        return (now + 3000);
+
+    c = createSocketClient(s, fd);
+    if (c) {
+        // We created the client, save the sockaddr info and 'hostport'
+        getnameinfo(saddr, slen,
+                c->host, sizeof (c->host),
+                c->port, sizeof (c->port),
+                NI_NUMERICHOST | NI_NUMERICSERV);
+
+        if (anetTcpKeepAlive(Modes.aneterr, fd) != ANET_OK) {
+            fprintf(stderr, "%s: Unable to set keepalive on connection from %s port %s (fd %d)\n", c->service->descr, c->host, c->port, fd);
+        }
+    } else {
+        fprintf(stderr, "%s: Fatal: createSocketClient shouldn't fail!\n", s->descr);
+        exit(1);
     }
+}
 
-    // only check for new clients not sooner than 150 ms from now
-    return (now + 150);
+// Temporarily stop trying to accept new clients if we are limited by file
+// descriptors. Listeners are edge-triggered, so netTimerWork has to retry
+// as no new readiness event may arrive for connections already pending.
+
+static void suspendAccept(uint64_t now) {
+    fprintf(stderr, "Accepting new connections suspended for 3 seconds: %s\n", Modes.aneterr);
+    next_accept_retry = now + 3000;
 }
 
 //
@@ -598,6 +988,15 @@ static uint64_t modesAcceptClients(uint64_t now) {
 // On error free the client, collect the structure, adjust maxfd if needed.
 //
 
+// Report how far behind a client shedding output is
+
+static void clientLagReport(struct client *c, uint64_t lag) {
+    fprintf(stderr, "%s: Client not keeping up: %s port %s (fd %d): lag %.1f s (max %.1f s), dropped %llu bytes %u times\n",
+            c->service->descr, c->host, c->port, c->fd, lag / 1000.0, c->lag_max / 1000.0,
+            (unsigned long long) c->dropped_bytes, c->dropped_count);
+    c->dropped_reported = c->dropped_count;
+}
+
 static void modesCloseClient(struct client *c) {
     if (!c->service) {
         fprintf(stderr, "warning: double close of net client\n");
@@ -609,8 +1008,12 @@ static void modesCloseClient(struct client *c) {
         Modes.exit = 3;
     }
 
+    if (c->uring)
+        netUringCancel(c, true);
+    else
+        netEventDel(c->fd);
     anetCloseSocket(c->fd);
-    c->service->connections--;
+    __atomic_sub_fetch(&c->service->connections, 1, __ATOMIC_RELAXED);
     if (c->con) {
         // Clean this up and set the next_reconnect timer for another try.
         // If the connection had been established and the connect didn't fail,
@@ -620,190 +1023,769 @@ static void modesCloseClient(struct client *c) {
         c->con->next_reconnect = mstime() + Modes.net_connector_delay / 10;
     }
 
+    if (c->dropped_count != c->dropped_reported)
+        clientLagReport(c, 0);
+
     // mark it as inactive and ready to be freed
     c->fd = -1;
     c->service = NULL;
     c->modeac_requested = 0;
-    c->sendq_len = 0;
-    if (c->sendq) {
-        free(c->sendq);
-        c->sendq = NULL;
+    c->epollout = 0;
+    if (c->read_pending) {
+        c->read_pending = 0;
+        net_read_pending--;
     }
+    clientCloseSendQ(c);
 
     autoset_modeac();
 }
 
 //
-// Send data to clients, if we can...
+//=========================================================================
+//
+// Output chunks
+//
+// A block of writer output is copied once into an immutable chunk, which is
+// shared by all clients of the service. Chunks of a service form a list in
+// output order; each client's SendQ is a cursor into that list (sendq plus
+// sendq_offset) and runs to the end of it. A chunk counts the clients that
+// still have to send it and is freed when the last one is done with it.
+// As clients advance in order, freed chunks are always a prefix of the list.
+// Chunks are only touched by the thread running the event loop.
+//
+// Chunks always end on a message boundary. A slow client that sheds its
+// SendQ keeps the unsent rest of a partly sent chunk in a private copy
+// (sendq_copy), which leads back into the list, so its stream stays framed.
 //
 
-static void flushClient(struct client *c, uint64_t now) {
-    int towrite = c->sendq_len;
-    char *psendq = c->sendq;
-    int loops = 0;
-    int max_loops = 2;
-    int total_nwritten = 0;
-    int done = 0;
+struct net_chunk {
+    struct net_chunk *next; // next chunk of the same service
+    struct net_service *service;
+    uint64_t created; // for measuring client lag
+    int refcount;
+    int len;
+    uint32_t seq; // datagram sequence number on UDP services
+    int sync; // offset of a compressed stream start in data, -1 if none
+    char data[];
+};
+
+#define NET_MAX_IOV 64
+#define NET_UDP_READ_MAX 64 // datagrams read per readiness event
+#define NET_UDP_MAX_GAP 65536 // larger jumps in a sequence mean the sender restarted
+#define NET_UDP_REORDER 64 // sequence numbers further back than this mean the same
+
+static struct net_chunk *netChunkCreate(struct net_service *service, const void *data, int len) {
+    struct net_chunk *chunk = malloc(sizeof (*chunk) + len);
+    if (!chunk)
+        return NULL;
 
-    do {
-        int nwritten = write(c->fd, psendq, towrite);
-        int err = errno;
-        loops++;
-        // If we get -1, it's only fatal if it's not EAGAIN/EWOULDBLOCK
-        if (nwritten < 0) {
-            if (err != EAGAIN && err != EWOULDBLOCK) {
-                fprintf(stderr, "%s: Send Error: %s: %s port %s (fd %d, SendQ %d, RecvQ %d)\n",
-                        c->service->descr, strerror(err), c->host, c->port,
-                        c->fd, c->sendq_len, c->buflen);
-                modesCloseClient(c);
-            }
-            done = 1; // Blocking, just bail, try later.
-        } else {
-            if (nwritten > 0) {
-                // We've written something, add it to the total
-                total_nwritten += nwritten;
-                // Advance buffer
-                psendq += nwritten;
-                towrite -= nwritten;
-            }
-            if (total_nwritten == c->sendq_len) {
-                done = 1;
-            }
-        }
-    } while (!done && (loops < max_loops));
+    chunk->next = NULL;
+    chunk->service = service;
+    chunk->created = mstime();
+    chunk->refcount = 1;
+    chunk->len = len;
+    chunk->sync = -1;
+    if (data)
+        memcpy(chunk->data, data, len);
+    return chunk;
+}
 
-    if (total_nwritten > 0) {
-        c->last_send = now; // If we wrote anything, update this.
-        if (total_nwritten == c->sendq_len) {
-            c->sendq_len = 0;
-        } else {
-            c->sendq_len -= total_nwritten;
-            memmove((void*) c->sendq, c->sendq + total_nwritten, towrite);
+static void netChunkRelease(struct net_chunk *chunk) {
+    if (--chunk->refcount)
+        return;
+    if (chunk->service->chunk_tail == chunk)
+        chunk->service->chunk_tail = NULL;
+    free(chunk);
+}
+
+// Advance the client's SendQ cursor past n sent bytes
+
+static void clientConsumeSendQ(struct client *c, int n) {
+    c->sendq_len -= n;
+    while (n > 0) {
+        struct net_chunk *chunk = c->sendq;
+        int left = chunk->len - c->sendq_offset;
+
+        if (n < left) {
+            c->sendq_offset += n;
+            return;
         }
-        c->last_flush = now;
-    }
+        n -= left;
+        c->sendq = chunk->next;
+        c->sendq_offset = 0;
+        if (chunk == c->sendq_copy)
+            c->sendq_copy = NULL;
+        netChunkRelease(chunk);
+    }
+    // caught up, output may be held back for it again
+    if (!c->sendq)
+        c->sendq_full_since = 0;
+}
 
-    // If writing has failed for 5 seconds, disconnect.
-    if (c->last_flush + 5000 < now) {
-        fprintf(stderr, "%s: Unable to send data, disconnecting: %s port %s (fd %d, SendQ %d)\n", c->service->descr, c->host, c->port, c->fd, c->sendq_len);
-        modesCloseClient(c);
+// Release the chunks from first up to and including last, or the end of the
+// list if last is NULL
+
+static void clientReleaseChunks(struct net_chunk *first, struct net_chunk *last) {
+    struct net_chunk *chunk = first, *next;
+
+    while (chunk) {
+        next = (chunk == last) ? NULL : chunk->next;
+        netChunkRelease(chunk);
+        chunk = next;
     }
 }
 
-//
-//=========================================================================
-//
-// Send the write buffer for the specified writer to all connected clients
-//
+// Release everything still queued for a client
 
-static void flushWrites(struct net_writer *writer) {
-    struct client *c;
-    uint64_t now = mstime();
+static void clientDropSendQ(struct client *c) {
+    // a closed client waiting for its send to complete holds only the
+    // chunks of that send
+    clientReleaseChunks(c->sendq, c->service ? NULL : c->uring_send_last);
+    c->sendq = NULL;
+    c->sendq_copy = NULL;
+    c->sendq_offset = 0;
+    c->sendq_len = 0;
+}
 
-    for (c = writer->service->clients; c; c = c->next) {
-        if (!c->service)
-            continue;
-        if (c->service->writer == writer->service->writer) {
-            uintptr_t psendq_end = (uintptr_t) c->sendq + c->sendq_len; // Pointer to end of sendq
-
-            // Add the buffer to the client's SendQ
-            if ((c->sendq_len + writer->dataUsed) >= c->sendq_max) {
-                // Too much data in client SendQ.  Drop client - SendQ exceeded.
-                fprintf(stderr, "%s: Dropped due to full SendQ: %s port %s (fd %d, SendQ %d, RecvQ %d)\n",
-                        c->service->descr, c->host, c->port,
-                        c->fd, c->sendq_len, c->buflen);
-                modesCloseClient(c);
-                continue; // Go to the next client
-            }
-            // Append the data to the end of the queue, increment len
-            memcpy((void*) psendq_end, writer->data, writer->dataUsed);
-            c->sendq_len += writer->dataUsed;
-            // Try flushing...
-            flushClient(c, now);
-        }
-    }
-    writer->dataUsed = 0;
-    writer->lastWrite = mstime();
-    return;
+// Release the SendQ of a client being closed. A send in flight still reads
+// its chunks, they are released once it completes.
+
+static void clientCloseSendQ(struct client *c) {
+    if (c->uring_send_last)
+        clientReleaseChunks(c->uring_send_last->next, NULL);
+    else
+        clientDropSendQ(c);
 }
 
-// Prepare to write up to 'len' bytes to the given net_writer.
-// Returns a pointer to write to, or NULL to skip this write.
+// Drop all output queued for a client up to the chunk resume (NULL for all
+// of it), except for the rest of a partly sent chunk. Returns false if that
+// couldn't be kept.
+
+static bool clientShedSendQ(struct client *c, struct net_chunk *resume) {
+    struct net_chunk *keep = NULL, *chunk, *next;
+    int dropped = 0;
+
+    // a private copy is the tail of a message even if none of it went out yet
+    if (c->sendq && c->sendq != resume && (c->sendq_offset || c->sendq == c->sendq_copy)) {
+        struct net_chunk *head = c->sendq;
+        if (!(keep = netChunkCreate(c->service, head->data + c->sendq_offset, head->len - c->sendq_offset)))
+            return false;
+        keep->created = head->created;
+    }
+
+    for (chunk = c->sendq; chunk && chunk != resume; chunk = next) {
+        next = chunk->next;
+        dropped += chunk->len - (chunk == c->sendq ? c->sendq_offset : 0);
+        netChunkRelease(chunk);
+    }
+    c->sendq_len -= dropped;
+    c->sendq_offset = 0;
+    c->sendq = resume;
+    c->sendq_copy = NULL;
+    if (keep) {
+        keep->next = resume;
+        c->sendq = c->sendq_copy = keep;
+        c->sendq_len += keep->len;
+        dropped -= keep->len;
+    }
+
+    c->dropped_bytes += dropped;
+    c->dropped_count++;
+    return true;
+}
 
-static void *prepareWrite(struct net_writer *writer, int len) {
-    if (!writer ||
-            !writer->service ||
-            !writer->service->connections ||
-            !writer->data)
-        return NULL;
+// Move a client to another service, dropping its queued output
 
-    if (len > MODES_OUT_BUF_SIZE)
-        return NULL;
+static bool clientMoveService(struct client *c, struct net_service *to) {
+    struct net_service *from = c->service;
+    struct client **prev;
 
-    if (writer->dataUsed + len >= MODES_OUT_BUF_SIZE) {
-        // Flush now to free some space
-        flushWrites(writer);
-    }
+    if (!clientShedSendQ(c, NULL))
+        return false;
 
-    return writer->data + writer->dataUsed;
+    for (prev = &from->clients; *prev != c; prev = &(*prev)->next);
+    *prev = c->next;
+    c->next = to->clients;
+    to->clients = c;
+    c->service = to;
+    __atomic_sub_fetch(&from->connections, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&to->connections, 1, __ATOMIC_RELAXED);
+    return true;
 }
 
-// Complete a write previously begun by prepareWrite.
-// endptr should point one byte past the last byte written
-// to the buffer returned from prepareWrite.
+// Apply the slow consumer policy to a client whose SendQ is over its limit
+// after queueing chunk. Returns false if the client had to be closed.
 
-static void completeWrite(struct net_writer *writer, void *endptr) {
-    writer->dataUsed = endptr - writer->data;
+static bool clientSendQFull(struct client *c, struct net_chunk *chunk) {
+    struct net_service *s = c->service;
 
-    if (writer->dataUsed >= Modes.net_output_flush_size) {
-        flushWrites(writer);
+    if (c->uring_send_last) {
+        // The send in flight uses the queued chunks, cancel it and apply the
+        // policy once it is done
+        netUringCancel(c, false);
+        return true;
+    }
+
+    if (s->slow_policy == NET_SLOW_REDUCE && s->reduce_to) {
+        fprintf(stderr, "%s: Client not keeping up, switching to %s: %s port %s (fd %d, SendQ %d)\n",
+                s->descr, s->reduce_to->descr, c->host, c->port, c->fd, c->sendq_len);
+        if (clientMoveService(c, s->reduce_to))
+            return true;
+    } else if (s->slow_policy != NET_SLOW_DISCONNECT && chunk->len < c->sendq_max / 2) {
+        if (clientShedSendQ(c, chunk) && c->sendq_len < c->sendq_max)
+            return true;
     }
+
+    // Too much data in client SendQ.  Drop client - SendQ exceeded.
+    fprintf(stderr, "%s: Dropped due to full SendQ: %s port %s (fd %d, SendQ %d, RecvQ %d)\n",
+            s->descr, c->host, c->port, c->fd, c->sendq_len, c->buflen);
+    modesCloseClient(c);
+    return false;
+}
+
+static uint64_t clientStallTimeout(struct client *c) {
+    return c->service->slow_policy == NET_SLOW_DISCONNECT ? NET_STALL_TIMEOUT : NET_STALL_TIMEOUT_SLOW;
 }
 
 //
 //=========================================================================
 //
-// Write raw output in Beast Binary format with Timestamp to TCP clients
+// Compressed Beast streams
+//
+// A compressed output service deflates each chunk once and all its clients
+// share the result. Every chunk ends with a sync flush, so the receiver can
+// decode it right away. After NET_DEFLATE_SEGMENT bytes or milliseconds,
+// whichever comes first, the zlib stream is finished and a new one starts
+// within the same chunk. New clients wait for such a start, they couldn't
+// decode from the middle of a stream.
+//
+// Beast inputs look for a zlib header at the start of a stream. The
+// compressed bytes are moved aside as they are read and inflated back into
+// the client buffer for the Beast framer, as far as it has room.
 //
 
-static void modesSendBeastOutput(struct modesMessage *mm, struct net_writer *writer) {
-    int msgLen = mm->msgbits / 8;
-    char *p = prepareWrite(writer, 2 + 2 * (7 + msgLen));
-    char ch;
-    int j;
-    int sig;
-    unsigned char *msg = (Modes.net_verbatim ? mm->verbatim : mm->msg);
+#define NET_DEFLATE_SEGMENT (256 * 1024)
+#define NET_DEFLATE_SEGMENT_TIME 2000
 
-    if (!p)
-        return;
+struct net_deflate {
+    z_stream z;
+    bool started; // a zlib stream is open
+    int segment_in; // bytes compressed into it
+    uint64_t segment_start;
+};
 
-    *p++ = 0x1a;
-    if (msgLen == MODES_SHORT_MSG_BYTES) {
-        *p++ = '2';
-    } else if (msgLen == MODES_LONG_MSG_BYTES) {
-        *p++ = '3';
-    } else if (msgLen == MODEAC_MSG_BYTES) {
-        *p++ = '1';
-    } else {
-        return;
-    }
+struct net_inflate {
+    z_stream z;
+    int len; // compressed bytes waiting in buf
+    unsigned char buf[MODES_CLIENT_BUF_SIZE];
+};
 
-    /* timestamp, big-endian */
-    *p++ = (ch = (mm->timestampMsg >> 40));
-    if (0x1A == ch) {
-        *p++ = ch;
+// Make the output of a service compressed
+// _exits_ on failure!
+
+static void serviceDeflate(struct net_service *s) {
+    if (!(s->deflate = calloc(1, sizeof (*s->deflate))) ||
+            deflateInit(&s->deflate->z, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        fprintf(stderr, "%s: Unable to set up compression\n", s->descr);
+        exit(1);
     }
-    *p++ = (ch = (mm->timestampMsg >> 32));
-    if (0x1A == ch) {
-        *p++ = ch;
+}
+
+static void serviceDeflateEnd(struct net_service *s) {
+    if (s->deflate) {
+        deflateEnd(&s->deflate->z);
+        free(s->deflate);
+        s->deflate = NULL;
     }
-    *p++ = (ch = (mm->timestampMsg >> 24));
-    if (0x1A == ch) {
-        *p++ = ch;
+}
+
+// Replace a chunk of a compressed service by its compressed form.
+// Returns NULL if out of memory.
+
+static struct net_chunk *netDeflateChunk(struct net_chunk *chunk, uint64_t now) {
+    struct net_deflate *d = chunk->service->deflate;
+    // room for the end of the previous stream and the sync flush
+    int size = deflateBound(&d->z, chunk->len) + 64;
+    struct net_chunk *out = netChunkCreate(chunk->service, NULL, size);
+
+    if (!out) {
+        fprintf(stderr, "%s: Out of memory compressing output\n", chunk->service->descr);
+        netChunkRelease(chunk);
+        return NULL;
     }
-    *p++ = (ch = (mm->timestampMsg >> 16));
-    if (0x1A == ch) {
-        *p++ = ch;
+    out->created = chunk->created;
+
+    d->z.next_out = (Bytef *) out->data;
+    d->z.avail_out = size;
+    if (!d->started || d->segment_in >= NET_DEFLATE_SEGMENT || now >= d->segment_start + NET_DEFLATE_SEGMENT_TIME) {
+        if (d->started) {
+            d->z.avail_in = 0;
+            deflate(&d->z, Z_FINISH);
+            deflateReset(&d->z);
+        }
+        out->sync = size - d->z.avail_out;
+        d->started = true;
+        d->segment_in = 0;
+        d->segment_start = now;
+    }
+    d->z.next_in = (Bytef *) chunk->data;
+    d->z.avail_in = chunk->len;
+    deflate(&d->z, Z_SYNC_FLUSH);
+    d->segment_in += chunk->len;
+    out->len = size - d->z.avail_out;
+
+    netChunkRelease(chunk);
+    return out;
+}
+
+// Inflate waiting compressed input into the free space of the client
+// buffer. Returns false if the stream was corrupt and the client closed.
+
+static bool clientInflate(struct client *c) {
+    struct net_inflate *in = c->inflate;
+    int rv = Z_OK;
+
+    // If our buffer is full discard it, this is some badly formatted shit
+    if (c->buflen >= MODES_CLIENT_BUF_SIZE - 1)
+        c->buflen = 0;
+
+    in->z.next_in = in->buf;
+    in->z.avail_in = in->len;
+    while (in->z.avail_in && c->buflen < MODES_CLIENT_BUF_SIZE - 1) {
+        in->z.next_out = (Bytef *) c->buf + c->buflen;
+        in->z.avail_out = MODES_CLIENT_BUF_SIZE - 1 - c->buflen;
+        rv = inflate(&in->z, Z_NO_FLUSH);
+        c->buflen = MODES_CLIENT_BUF_SIZE - 1 - in->z.avail_out;
+        if (rv == Z_STREAM_END) {
+            // the sender started a new stream
+            inflateReset(&in->z);
+        } else if (rv != Z_OK) {
+            break;
+        }
+    }
+    if (rv != Z_OK && rv != Z_STREAM_END && rv != Z_BUF_ERROR) {
+        fprintf(stderr, "%s: Decompression Error: %s: %s port %s (fd %d)\n",
+                c->service->descr, in->z.msg ? in->z.msg : "corrupt stream", c->host, c->port, c->fd);
+        modesCloseClient(c);
+        return false;
+    }
+
+    in->len = in->z.avail_in;
+    memmove(in->buf, in->z.next_in, in->len);
+    return true;
+}
+
+// Account for n bytes just read to the end of the client buffer. A Beast
+// input stream that starts with a zlib header is inflated from there on.
+// The header is checked once two bytes are in, clientParseInput() leaves a
+// lone first byte alone until then.
+// Returns false if the client was closed.
+
+static bool clientReceived(struct client *c, int n) {
+    unsigned char *p = (unsigned char *) c->buf;
+    uint64_t before = c->received;
+
+    c->received += n;
+
+    if (c->inflate) {
+        // Input is only read once the last of it is inflated, so this fits
+        memcpy(c->inflate->buf + c->inflate->len, p + c->buflen, n);
+        c->inflate->len += n;
+        return clientInflate(c);
+    }
+    c->buflen += n;
+
+    if (before < 2 && c->received >= 2 && c->service->read_mode == READ_MODE_BEAST &&
+            p[0] == 0x78 && (p[0] << 8 | p[1]) % 31 == 0) {
+        if ((c->inflate = calloc(1, sizeof (*c->inflate))) && inflateInit(&c->inflate->z) != Z_OK) {
+            free(c->inflate);
+            c->inflate = NULL;
+        }
+        if (!c->inflate) {
+            fprintf(stderr, "%s: Unable to set up decompression: %s port %s (fd %d)\n",
+                    c->service->descr, c->host, c->port, c->fd);
+            modesCloseClient(c);
+            return false;
+        }
+        // Nothing was parsed yet, all of the buffer is compressed
+        memcpy(c->inflate->buf, p, c->buflen);
+        c->inflate->len = c->buflen;
+        c->buflen = 0;
+        return clientInflate(c);
+    }
+    return true;
+}
+
+// Send the SendQ of a UDP stream, one datagram per chunk
+
+static void flushUdpClient(struct client *c, uint64_t now) {
+    int sent = 0;
+
+    while (c->sendq) {
+        struct net_chunk *chunk = c->sendq;
+        unsigned char seq[4] = {chunk->seq >> 24, chunk->seq >> 16, chunk->seq >> 8, chunk->seq};
+        struct iovec iov[2];
+
+        iov[0].iov_base = seq;
+        iov[0].iov_len = sizeof (seq);
+        iov[1].iov_base = chunk->data;
+        iov[1].iov_len = chunk->len;
+        if (writev(c->fd, iov, 2) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            // Unless nobody listens on a unicast destination, the
+            // datagram is dropped; receivers see a gap in the sequence
+            if (errno != ECONNREFUSED) {
+                c->dropped_bytes += chunk->len;
+                c->dropped_count++;
+            }
+        }
+        sent++;
+        clientConsumeSendQ(c, chunk->len);
+    }
+
+    if (sent) {
+        c->last_send = now;
+        c->last_flush = now;
+    }
+    netClientWantWrite(c, c->sendq_len > 0);
+}
+
+//
+// Send data to clients, if we can...
+// Writes until the SendQ is empty or the socket would block; in the latter
+// case the client is armed for EPOLLOUT, which is edge-triggered and thus
+// relies on us having seen EAGAIN.
+//
+
+static void flushClient(struct client *c, uint64_t now) {
+    struct iovec iov[NET_MAX_IOV];
+    int total_nwritten = 0;
+
+    if (c->udp) {
+        flushUdpClient(c, now);
+        return;
+    }
+    if (c->uring) {
+        netUringSend(c);
+        return;
+    }
+
+    while (c->sendq) {
+        struct net_chunk *chunk = c->sendq;
+        int n = 0;
+
+        iov[n].iov_base = chunk->data + c->sendq_offset;
+        iov[n].iov_len = chunk->len - c->sendq_offset;
+        for (chunk = chunk->next, n++; chunk && n < NET_MAX_IOV; chunk = chunk->next, n++) {
+            iov[n].iov_base = chunk->data;
+            iov[n].iov_len = chunk->len;
+        }
+
+        ssize_t nwritten = writev(c->fd, iov, n);
+        int err = errno;
+        // If we get -1, it's only fatal if it's not EAGAIN/EWOULDBLOCK
+        if (nwritten < 0) {
+            if (err != EAGAIN && err != EWOULDBLOCK) {
+                fprintf(stderr, "%s: Send Error: %s: %s port %s (fd %d, SendQ %d, RecvQ %d)\n",
+                        c->service->descr, strerror(err), c->host, c->port,
+                        c->fd, c->sendq_len, c->buflen);
+                modesCloseClient(c);
+                return;
+            }
+            break; // Blocking, just bail, try later.
+        }
+        if (nwritten == 0)
+            break;
+
+        total_nwritten += nwritten;
+        clientConsumeSendQ(c, nwritten);
+    }
+
+    if (total_nwritten > 0) {
+        c->last_send = now; // If we wrote anything, update this.
+        c->last_flush = now;
+    }
+
+    // If writing has failed for too long, disconnect.
+    if (c->sendq_len && c->last_flush + clientStallTimeout(c) < now) {
+        fprintf(stderr, "%s: Unable to send data, disconnecting: %s port %s (fd %d, SendQ %d)\n", c->service->descr, c->host, c->port, c->fd, c->sendq_len);
+        modesCloseClient(c);
+        return;
+    }
+
+    netClientWantWrite(c, c->sendq_len > 0);
+}
+
+//
+//=========================================================================
+//
+// Append a chunk of output to the SendQ of all clients of its service and
+// drop the caller's reference. Network thread side of flushWrites().
+//
+
+static void netDeliver(struct net_chunk *chunk) {
+    struct net_service *service = chunk->service;
+    struct client *c, *next;
+    uint64_t now = mstime();
+
+    if (service->deflate && !(chunk = netDeflateChunk(chunk, now)))
+        return;
+    if (service->udp)
+        chunk->seq = service->udp_seq++;
+    if (service->chunk_tail)
+        service->chunk_tail->next = chunk;
+    service->chunk_tail = chunk;
+
+    // clients may move to another service on the way
+    for (c = service->clients; c; c = next) {
+        next = c->next;
+        if (c->service != service)
+            continue;
+
+        int start = 0;
+        if (service->deflate && !c->synced) {
+            // a compressed stream can only be joined where it starts
+            if (chunk->sync < 0)
+                continue;
+            start = chunk->sync;
+            c->synced = 1;
+        }
+
+        // Add the chunk to the client's SendQ. It is linked from the end of
+        // the SendQ already, so take the reference before anything else.
+        chunk->refcount++;
+        if (!c->sendq) {
+            c->sendq = chunk;
+            c->sendq_offset = start;
+            c->last_flush = now; // start the stall timer from here
+        } else if (c->sendq_copy && !c->sendq_copy->next) {
+            c->sendq_copy->next = chunk; // moved here by NET_SLOW_REDUCE
+        }
+        c->sendq_len += chunk->len - start;
+        if (c->sendq_len >= c->sendq_max && !clientSendQFull(c, chunk))
+            continue; // Go to the next client
+        // Try flushing, unless the socket is known to be full and
+        // EPOLLOUT will tell us when it drains
+        if (!c->epollout)
+            flushClient(c, now);
+    }
+
+    netChunkRelease(chunk);
+}
+
+// Whether to hold back a chunk that would overflow the SendQ of a client of
+// its service. The client gets up to NET_OUTPUT_HOLD to send some first,
+// meanwhile the queue fills and the writers wait in netOutputPush(). This
+// keeps the writers from outrunning a client that is only briefly behind.
+// A client that makes no room in time is left to its slow consumer policy,
+// and isn't waited for again until it has sent all of its SendQ.
+
+static bool netOutputHold(struct net_chunk *chunk, uint64_t now) {
+    struct net_service *service = chunk->service;
+
+    net_output_held = 0;
+    if (atomic_load(&net_thread_stop))
+        return false;
+
+    for (struct client *c = service->clients; c; c = c->next) {
+        if (c->service != service || c->sendq_len + chunk->len < c->sendq_max)
+            continue;
+        if (!c->sendq_full_since)
+            c->sendq_full_since = now;
+        if (now < c->sendq_full_since + NET_OUTPUT_HOLD) {
+            net_output_held = c->sendq_full_since + NET_OUTPUT_HOLD;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Hand up to max chunks of queued writer output to the clients, then wake a
+// writer waiting for room. Returns true if output remains queued and can be
+// handed on right away.
+
+static bool netDrainOutput(unsigned max) {
+    void *chunk;
+    uint32_t flags, len;
+    unsigned n = 0;
+
+    while (netQueuePeek(&net_output_queue, &chunk, &flags, &len)) {
+        int bytes = ((struct net_chunk *) chunk)->len;
+
+        if (n++ == max || netOutputHold(chunk, mstime()))
+            break;
+        netDeliver(chunk);
+        netQueueRelease(&net_output_queue);
+        atomic_fetch_sub(&net_output_bytes, bytes);
+        // io_uring sends only go out on submission, let them complete
+        // before the next chunk piles onto the SendQs
+        netUringFlush();
+        netUringWork(mstime());
+    }
+
+    // pairs with the fence in netOutputPush(), either the writer sees the
+    // room made or we see net_output_room_wanted
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&net_output_room_wanted)) {
+        pthread_mutex_lock(&net_output_room_mutex);
+        pthread_cond_signal(&net_output_room_cond);
+        pthread_mutex_unlock(&net_output_room_mutex);
+    }
+    return n > max && !net_output_held;
+}
+
+// Queue a chunk for the network thread, unless NET_OUTPUT_HIGH_WATER bytes
+// are queued already. Returns false if the chunk wasn't queued.
+
+static bool netOutputTryPush(struct net_chunk *chunk) {
+    if (atomic_load(&net_output_bytes) >= NET_OUTPUT_HIGH_WATER)
+        return false;
+    // counted first, the network thread may take the chunk right away
+    atomic_fetch_add(&net_output_bytes, chunk->len);
+    if (netQueuePush(&net_output_queue, chunk, 0, NULL, 0))
+        return true;
+    atomic_fetch_sub(&net_output_bytes, chunk->len);
+    return false;
+}
+
+// Queue a chunk for the network thread. If too much output is queued, wait
+// for the thread to make room, which holds up the writer the way sending
+// inline would. Returns false if no room was made within NET_OUTPUT_WAIT.
+
+static bool netOutputPush(struct net_chunk *chunk) {
+    struct timespec deadline;
+    bool pushed;
+
+    if (netOutputTryPush(chunk))
+        return true;
+
+    get_deadline(NET_OUTPUT_WAIT, &deadline);
+    pthread_mutex_lock(&net_output_room_mutex);
+    atomic_store(&net_output_room_wanted, true);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (!(pushed = netOutputTryPush(chunk))) {
+        if (pthread_cond_timedwait(&net_output_room_cond, &net_output_room_mutex, &deadline) == ETIMEDOUT)
+            break;
+    }
+    atomic_store(&net_output_room_wanted, false);
+    pthread_mutex_unlock(&net_output_room_mutex);
+    return pushed;
+}
+
+//
+//=========================================================================
+//
+// Send a block of output to all clients of the writer's service
+//
+
+static void netSendChunk(struct net_writer *writer, const void *data, int len) {
+    struct net_chunk *chunk;
+
+    if (!len) {
+        // nothing to send
+    } else if (!(chunk = netChunkCreate(writer->service, data, len))) {
+        fprintf(stderr, "%s: Out of memory allocating output chunk\n", writer->service->descr);
+    } else if (!net_threaded) {
+        netDeliver(chunk);
+        netUringFlush();
+    } else if (!netOutputPush(chunk)) {
+        // the network thread is stuck, modesNetSecondWork reports it
+        free(chunk);
+        writer->service->output_dropped++;
+    }
+}
+
+// Send the write buffer for the specified writer to all connected clients
+
+static void flushWrites(struct net_writer *writer) {
+    netSendChunk(writer, writer->data, writer->dataUsed);
+    writer->dataUsed = 0;
+    writer->lastWrite = mstime();
+}
+
+// Prepare to write up to 'len' bytes to the given net_writer.
+// Returns a pointer to write to, or NULL to skip this write.
+
+static void *prepareWrite(struct net_writer *writer, int len) {
+    int size;
+
+    if (!writer ||
+            !writer->service ||
+            !serviceConnections(writer->service) ||
+            !writer->data)
+        return NULL;
+
+    // a UDP stream sends each flush as one datagram, keep it to the MTU
+    size = writer->service->udp ? MODES_OUT_UDP_SIZE + 1 : MODES_OUT_BUF_SIZE;
+    if (len > size)
+        return NULL;
+
+    if (writer->dataUsed + len >= size) {
+        // Flush now to free some space
+        flushWrites(writer);
+    }
+
+    return writer->data + writer->dataUsed;
+}
+
+// Complete a write previously begun by prepareWrite.
+// endptr should point one byte past the last byte written
+// to the buffer returned from prepareWrite.
+
+static void completeWrite(struct net_writer *writer, void *endptr) {
+    writer->dataUsed = endptr - writer->data;
+
+    // UDP datagrams are filled up to the MTU, --net-ro-interval bounds the delay
+    if (writer->dataUsed >= Modes.net_output_flush_size && !writer->service->udp) {
+        flushWrites(writer);
+    }
+}
+
+//
+//=========================================================================
+//
+// Write raw output in Beast Binary format with Timestamp to TCP clients
+//
+
+static void modesSendBeastOutput(struct modesMessage *mm, struct net_writer *writer) {
+    int msgLen = mm->msgbits / 8;
+    char *p = prepareWrite(writer, 2 + 2 * (7 + msgLen));
+    char ch;
+    int j;
+    int sig;
+    unsigned char *msg = (Modes.net_verbatim ? mm->verbatim : mm->msg);
+
+    if (!p)
+        return;
+
+    *p++ = 0x1a;
+    if (msgLen == MODES_SHORT_MSG_BYTES) {
+        *p++ = '2';
+    } else if (msgLen == MODES_LONG_MSG_BYTES) {
+        *p++ = '3';
+    } else if (msgLen == MODEAC_MSG_BYTES) {
+        *p++ = '1';
+    } else {
+        return;
+    }
+
+    /* timestamp, big-endian */
+    *p++ = (ch = (mm->timestampMsg >> 40));
+    if (0x1A == ch) {
+        *p++ = ch;
+    }
+    *p++ = (ch = (mm->timestampMsg >> 32));
+    if (0x1A == ch) {
+        *p++ = ch;
+    }
+    *p++ = (ch = (mm->timestampMsg >> 24));
+    if (0x1A == ch) {
+        *p++ = ch;
+    }
+    *p++ = (ch = (mm->timestampMsg >> 16));
+    if (0x1A == ch) {
+        *p++ = ch;
     }
     *p++ = (ch = (mm->timestampMsg >> 8));
     if (0x1A == ch) {
@@ -867,9 +1849,9 @@ static void printHexDigit(char *p, unsigned char c) {
 // Write raw output to TCP clients
 //
 
-static void modesSendRawOutput(struct modesMessage *mm) {
+static void modesSendRawOutput(struct modesMessage *mm, struct net_writer *writer) {
     int msgLen = mm->msgbits / 8;
-    char *p = prepareWrite(&Modes.raw_out, msgLen * 2 + 15);
+    char *p = prepareWrite(writer, msgLen * 2 + 15);
     int j;
     unsigned char *msg = (Modes.net_verbatim ? mm->verbatim : mm->msg);
 
@@ -892,7 +1874,7 @@ static void modesSendRawOutput(struct modesMessage *mm) {
     *p++ = ';';
     *p++ = '\n';
 
-    completeWrite(&Modes.raw_out, p);
+    completeWrite(writer, p);
 }
 
 static void send_raw_heartbeat(struct net_service *service) {
@@ -1029,6 +2011,125 @@ static int decodeSbsLine(struct client *c, char *line, int remote) {
 
     return 0;
 }
+//
+//=========================================================================
+//
+// SBS field formatting. Lines are written straight into the writer buffer
+// without going through printf, output is the same as with the printf formats
+// noted on each helper.
+//
+
+// Date and time of one second, "YYYY/MM/DD,HH:MM:SS"
+struct sbs_time {
+    time_t second;
+    char text[19];
+};
+
+// SBS output is written by the main thread or, with --track-threads, by one
+// tracking thread at a time under track_output_mutex, so these caches need no
+// locking of their own. Neighbouring messages mostly fall into the same second.
+static struct sbs_time sbs_time_receive = { .second = -1 };
+static struct sbs_time sbs_time_now = { .second = -1 };
+
+static inline char *sbsWriteStr(char *p, const char *s) {
+    size_t len = strlen(s);
+    memcpy(p, s, len);
+    return p + len;
+}
+
+// "%0<digits>u", v must fit into digits
+static inline char *sbsWriteDigits(char *p, unsigned v, int digits) {
+    for (int i = digits - 1; i >= 0; i--) {
+        p[i] = '0' + v % 10;
+        v /= 10;
+    }
+    return p + digits;
+}
+
+// "%u"
+static char *sbsWriteUint(char *p, unsigned v) {
+    char tmp[10];
+    int n = 0;
+
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n)
+        *p++ = tmp[--n];
+    return p;
+}
+
+// "%d"
+static char *sbsWriteInt(char *p, int v) {
+    if (v < 0) {
+        *p++ = '-';
+        return sbsWriteUint(p, 0U - (unsigned) v);
+    }
+    return sbsWriteUint(p, (unsigned) v);
+}
+
+// "%0<digits>x" or "%0<digits>X", v must fit into digits
+static char *sbsWriteHex(char *p, unsigned v, int digits, bool upper) {
+    const char *hex = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+
+    for (int i = digits - 1; i >= 0; i--) {
+        p[i] = hex[v & 0xF];
+        v >>= 4;
+    }
+    return p + digits;
+}
+
+// "%.0f" or "%.5f" for values below 40000
+static char *sbsWriteFixed(char *p, double v, int decimals) {
+    static const double scale[] = { 1, 1e1, 1e2, 1e3, 1e4, 1e5 };
+    static const unsigned div[] = { 1, 10, 100, 1000, 10000, 100000 };
+
+    if (signbit(v)) {
+        *p++ = '-';
+        v = -v;
+    }
+    double scaled = v * scale[decimals];
+    // scaling is off by a few ulp, leave values next to a tie to printf
+    if (fabs(scaled - floor(scaled) - 0.5) < 1e-6)
+        return p + sprintf(p, "%.*f", decimals, v);
+    unsigned fixed = (unsigned) nearbyint(scaled);
+    p = sbsWriteUint(p, fixed / div[decimals]);
+    if (decimals) {
+        *p++ = '.';
+        p = sbsWriteDigits(p, fixed % div[decimals], decimals);
+    }
+    return p;
+}
+
+// "YYYY/MM/DD,HH:MM:SS.mmm" in local time, only formats a new second
+static char *sbsWriteTime(char *p, struct sbs_time *t, uint64_t ms) {
+    time_t second = (time_t) (ms / 1000);
+
+    if (second != t->second) {
+        struct tm tm;
+        char *q = t->text;
+
+        localtime_r(&second, &tm);
+        q = sbsWriteDigits(q, tm.tm_year + 1900, 4);
+        *q++ = '/';
+        q = sbsWriteDigits(q, tm.tm_mon + 1, 2);
+        *q++ = '/';
+        q = sbsWriteDigits(q, tm.tm_mday, 2);
+        *q++ = ',';
+        q = sbsWriteDigits(q, tm.tm_hour, 2);
+        *q++ = ':';
+        q = sbsWriteDigits(q, tm.tm_min, 2);
+        *q++ = ':';
+        sbsWriteDigits(q, tm.tm_sec, 2);
+        t->second = second;
+    }
+    memcpy(p, t->text, sizeof (t->text));
+    p += sizeof (t->text);
+    *p++ = '.';
+    return sbsWriteDigits(p, (unsigned) (ms % 1000), 3);
+}
+
 //
 //=========================================================================
 //
@@ -1038,7 +2139,6 @@ static int decodeSbsLine(struct client *c, char *line, int remote) {
 static void modesSendSBSOutput(struct modesMessage *mm, struct aircraft *a) {
     char *p;
     struct timespec now;
-    struct tm stTime_receive, stTime_now;
     int msgType;
 
     // For now, suppress non-ICAO addresses
@@ -1096,146 +2196,161 @@ static void modesSendSBSOutput(struct modesMessage *mm, struct aircraft *a) {
     }
 
     // Fields 1 to 6 : SBS message type and ICAO address of the aircraft and some other stuff
-    p += sprintf(p, "MSG,%d,1,1,%06X,1,", msgType, mm->addr);
-
-    // Find current system time
-    clock_gettime(CLOCK_REALTIME, &now);
-    localtime_r(&now.tv_sec, &stTime_now);
-
-    // Find message reception time
-    time_t received = (time_t) (mm->sysTimestampMsg / 1000);
-    localtime_r(&received, &stTime_receive);
+    p = sbsWriteStr(p, "MSG,");
+    p = sbsWriteInt(p, msgType);
+    p = sbsWriteStr(p, ",1,1,");
+    p = sbsWriteHex(p, mm->addr, 6, true);
+    p = sbsWriteStr(p, ",1,");
 
     // Fields 7 & 8 are the message reception time and date
-    p += sprintf(p, "%04d/%02d/%02d,", (stTime_receive.tm_year + 1900), (stTime_receive.tm_mon + 1), stTime_receive.tm_mday);
-    p += sprintf(p, "%02d:%02d:%02d.%03u,", stTime_receive.tm_hour, stTime_receive.tm_min, stTime_receive.tm_sec, (unsigned) (mm->sysTimestampMsg % 1000));
+    p = sbsWriteTime(p, &sbs_time_receive, mm->sysTimestampMsg);
+    *p++ = ',';
 
     // Fields 9 & 10 are the current time and date
-    p += sprintf(p, "%04d/%02d/%02d,", (stTime_now.tm_year + 1900), (stTime_now.tm_mon + 1), stTime_now.tm_mday);
-    p += sprintf(p, "%02d:%02d:%02d.%03u", stTime_now.tm_hour, stTime_now.tm_min, stTime_now.tm_sec, (unsigned) (now.tv_nsec / 1000000U));
+    clock_gettime(CLOCK_REALTIME, &now);
+    p = sbsWriteTime(p, &sbs_time_now, (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000);
 
     // Field 11 is the callsign (if we have it)
     if (mm->callsign_valid) {
-        p += sprintf(p, ",%s", mm->callsign);
+        *p++ = ',';
+        p = sbsWriteStr(p, mm->callsign);
     } else {
-        p += sprintf(p, ",");
+        *p++ = ',';
     }
 
     // Field 12 is the altitude (if we have it)
     if (Modes.use_gnss) {
         if (mm->altitude_geom_valid) {
-            p += sprintf(p, ",%dH", mm->altitude_geom);
+            *p++ = ',';
+            p = sbsWriteInt(p, mm->altitude_geom);
+            *p++ = 'H';
         } else if (mm->altitude_baro_valid && trackDataValid(&a->geom_delta_valid)) {
-            p += sprintf(p, ",%dH", mm->altitude_baro + a->geom_delta);
+            *p++ = ',';
+            p = sbsWriteInt(p, mm->altitude_baro + a->geom_delta);
+            *p++ = 'H';
         } else if (mm->altitude_baro_valid) {
-            p += sprintf(p, ",%d", mm->altitude_baro);
+            *p++ = ',';
+            p = sbsWriteInt(p, mm->altitude_baro);
         } else {
-            p += sprintf(p, ",");
+            *p++ = ',';
         }
     } else {
         if (mm->altitude_baro_valid) {
-            p += sprintf(p, ",%d", mm->altitude_baro);
+            *p++ = ',';
+            p = sbsWriteInt(p, mm->altitude_baro);
         } else if (mm->altitude_geom_valid && trackDataValid(&a->geom_delta_valid)) {
-            p += sprintf(p, ",%d", mm->altitude_geom - a->geom_delta);
+            *p++ = ',';
+            p = sbsWriteInt(p, mm->altitude_geom - a->geom_delta);
         } else {
-            p += sprintf(p, ",");
+            *p++ = ',';
         }
     }
 
     // Field 13 is the ground Speed (if we have it)
     if (mm->gs_valid) {
-        p += sprintf(p, ",%.0f", mm->gs.selected);
+        *p++ = ',';
+        p = sbsWriteFixed(p, mm->gs.selected, 0);
     } else {
-        p += sprintf(p, ",");
+        *p++ = ',';
     }
 
     // Field 14 is the ground Heading (if we have it)
     if (mm->heading_valid && mm->heading_type == HEADING_GROUND_TRACK) {
-        p += sprintf(p, ",%.0f", mm->heading);
+        *p++ = ',';
+        p = sbsWriteFixed(p, mm->heading, 0);
     } else {
-        p += sprintf(p, ",");
+        *p++ = ',';
     }
 
     // Fields 15 and 16 are the Lat/Lon (if we have it)
     if (mm->cpr_decoded) {
-        p += sprintf(p, ",%1.5f,%1.5f", mm->decoded_lat, mm->decoded_lon);
+        *p++ = ',';
+        p = sbsWriteFixed(p, mm->decoded_lat, 5);
+        *p++ = ',';
+        p = sbsWriteFixed(p, mm->decoded_lon, 5);
     } else {
-        p += sprintf(p, ",,");
+        p = sbsWriteStr(p, ",,");
     }
 
     // Field 17 is the VerticalRate (if we have it)
     if (Modes.use_gnss) {
         if (mm->geom_rate_valid) {
-            p += sprintf(p, ",%dH", mm->geom_rate);
+            *p++ = ',';
+            p = sbsWriteInt(p, mm->geom_rate);
+            *p++ = 'H';
         } else if (mm->baro_rate_valid) {
-            p += sprintf(p, ",%d", mm->baro_rate);
+            *p++ = ',';
+            p = sbsWriteInt(p, mm->baro_rate);
         } else {
-            p += sprintf(p, ",");
+            *p++ = ',';
         }
     } else {
         if (mm->baro_rate_valid) {
-            p += sprintf(p, ",%d", mm->baro_rate);
+            *p++ = ',';
+            p = sbsWriteInt(p, mm->baro_rate);
         } else if (mm->geom_rate_valid) {
-            p += sprintf(p, ",%d", mm->geom_rate);
+            *p++ = ',';
+            p = sbsWriteInt(p, mm->geom_rate);
         } else {
-            p += sprintf(p, ",");
+            *p++ = ',';
         }
     }
 
     // Field 18 is  the Squawk (if we have it)
     if (mm->squawk_valid) {
-        p += sprintf(p, ",%04x", mm->squawk);
+        *p++ = ',';
+        p = sbsWriteHex(p, mm->squawk, 4, false);
     } else {
-        p += sprintf(p, ",");
+        *p++ = ',';
     }
 
     // Field 19 is the Squawk Changing Alert flag (if we have it)
     if (mm->alert_valid) {
         if (mm->alert) {
-            p += sprintf(p, ",-1");
+            p = sbsWriteStr(p, ",-1");
         } else {
-            p += sprintf(p, ",0");
+            p = sbsWriteStr(p, ",0");
         }
     } else {
-        p += sprintf(p, ",");
+        *p++ = ',';
     }
 
     // Field 20 is the Squawk Emergency flag (if we have it)
     if (mm->squawk_valid) {
         if ((mm->squawk == 0x7500) || (mm->squawk == 0x7600) || (mm->squawk == 0x7700)) {
-            p += sprintf(p, ",-1");
+            p = sbsWriteStr(p, ",-1");
         } else {
-            p += sprintf(p, ",0");
+            p = sbsWriteStr(p, ",0");
         }
     } else {
-        p += sprintf(p, ",");
+        *p++ = ',';
     }
 
     // Field 21 is the Squawk Ident flag (if we have it)
     if (mm->spi_valid) {
         if (mm->spi) {
-            p += sprintf(p, ",-1");
+            p = sbsWriteStr(p, ",-1");
         } else {
-            p += sprintf(p, ",0");
+            p = sbsWriteStr(p, ",0");
         }
     } else {
-        p += sprintf(p, ",");
+        *p++ = ',';
     }
 
     // Field 22 is the OnTheGround flag (if we have it)
     switch (mm->airground) {
         case AIRCRAFT_META__AIR_GROUND__AG_GROUND:
-            p += sprintf(p, ",-1");
+            p = sbsWriteStr(p, ",-1");
             break;
         case AIRCRAFT_META__AIR_GROUND__AG_AIRBORNE:
-            p += sprintf(p, ",0");
+            p = sbsWriteStr(p, ",0");
             break;
         default:
-            p += sprintf(p, ",");
+            *p++ = ',';
             break;
     }
 
-    p += sprintf(p, "\r\n");
+    p = sbsWriteStr(p, "\r\n");
 
     completeWrite(&Modes.sbs_out, p);
 }
@@ -1272,13 +2387,16 @@ void modesQueueOutput(struct modesMessage *mm, struct aircraft *a) {
     if (!is_mlat && (Modes.net_verbatim || mm->correctedbits < 2)) {
         // Forward 2-bit-corrected messages via raw output only if --net-verbatim is set
         // Don't ever forward mlat messages via raw output.
-        modesSendRawOutput(mm);
+        modesSendRawOutput(mm, &Modes.raw_out);
+        modesSendRawOutput(mm, &Modes.raw_udp_out);
     }
 
     if ((!is_mlat || Modes.forward_mlat) && (Modes.net_verbatim || mm->correctedbits < 2)) {
         // Forward 2-bit-corrected messages via beast output only if --net-verbatim is set
         // Forward mlat messages via beast output only if --forward-mlat is set
         modesSendBeastOutput(mm, &Modes.beast_out);
+        modesSendBeastOutput(mm, &Modes.beast_udp_out);
+        modesSendBeastOutput(mm, &Modes.beast_deflate_out);
         if (mm->reduce_forward) {
             modesSendBeastOutput(mm, &Modes.beast_reduce_out);
         }
@@ -1328,6 +2446,8 @@ static void handle_radarcape_position(float lat, float lon, float alt) {
     if (!isfinite(lat) || lat < -90 || lat > 90 || !isfinite(lon) || lon < -180 || lon > 180 || !isfinite(alt))
         return;
 
+    // the receiver location is used by the tracking threads
+    trackLockShards();
     writeFATSVPositionUpdate(lat, lon, alt);
 
     if (!(Modes.bUserFlags & MODES_USER_LATLON_VALID)) {
@@ -1336,6 +2456,7 @@ static void handle_radarcape_position(float lat, float lon, float alt) {
         Modes.bUserFlags |= MODES_USER_LATLON_VALID;
         generateReceiverProtoBuf(); // location changed
     }
+    trackUnlockShards();
 }
 
 // recompute global Mode A/C setting
@@ -1429,10 +2550,6 @@ static void decodeHulcMessage(char *p) {
         // HULC Status message
         for (int j = 0; j < len; j++) {
             hsm.buf[j] = *p++;
-            // unescape
-            if (*p == 0x1A) {
-                p++;
-            }
         }
         // Antenna serial
         Modes.receiver.antenna_serial = __bswap_32(hsm.status.serial);
@@ -1456,10 +2573,13 @@ static void decodeHulcMessage(char *p) {
             if (!isfinite(lat) || lat < -90 || lat > 90 || !isfinite(lon) || lon < -180 || lon > 180) {
                 return;
             }
+            // the receiver location is used by the tracking threads
+            trackLockShards();
             Modes.receiver.latitude = lat;
             Modes.receiver.longitude = lon;
             Modes.receiver.altitude = alt;
             Modes.bUserFlags |= MODES_USER_LATLON_VALID;
+            trackUnlockShards();
         }
     } else if (id == 0x01 && len > 0x18) {
         // Future use planed.
@@ -1472,7 +2592,8 @@ static void decodeHulcMessage(char *p) {
 //
 //=========================================================================
 //
-// This function decodes a Beast binary format message
+// This function decodes a Beast binary format message, already unescaped
+// and starting with its type. now is the time it was read.
 //
 // The message is passed to the higher level layers, so it feeds
 // the selected screen output, the network output and so forth.
@@ -1483,15 +2604,14 @@ static void decodeHulcMessage(char *p) {
 // case where we want broken messages here to close the client connection.
 //
 
-static int decodeBinMessage(struct client *c, char *p, int remote) {
+static int decodeBinMessage(struct client *c, unsigned char *p, int remote, uint64_t now) {
     int msgLen = 0;
     int j;
-    char ch;
+    unsigned char ch;
     unsigned char msg[MODES_LONG_MSG_BYTES + 7];
     static struct modesMessage zeroMessage;
     struct modesMessage mm;
     MODES_NOTUSED(c);
-    memset(&mm, 0, sizeof (mm));
 
     ch = *p++; /// Get the message type
 
@@ -1513,21 +2633,14 @@ static int decodeBinMessage(struct client *c, char *p, int remote) {
         // Special case for Radarcape position messages.
         float lat, lon, alt;
 
-        for (j = 0; j < 21; j++) { // and the data
-            msg[j] = ch = *p++;
-            if (0x1A == ch) {
-                p++;
-            }
-        }
-
-        lat = ieee754_binary32_le_to_float(msg + 4);
-        lon = ieee754_binary32_le_to_float(msg + 8);
-        alt = ieee754_binary32_le_to_float(msg + 12);
+        lat = ieee754_binary32_le_to_float(p + 4);
+        lon = ieee754_binary32_le_to_float(p + 8);
+        alt = ieee754_binary32_le_to_float(p + 12);
 
         handle_radarcape_position(lat, lon, alt);
         return 0;
     } else if (ch == 'H') {
-        decodeHulcMessage(p);
+        decodeHulcMessage((char *) p);
         return 0;
     } else {
         // Ignore this.
@@ -1546,18 +2659,14 @@ static int decodeBinMessage(struct client *c, char *p, int remote) {
         // Grab the timestamp (big endian format)
         mm.timestampMsg = 0;
         for (j = 0; j < 6; j++) {
-            ch = *p++;
-            mm.timestampMsg = mm.timestampMsg << 8 | (ch & 255);
-            if (0x1A == ch) {
-                p++;
-            }
+            mm.timestampMsg = mm.timestampMsg << 8 | *p++;
         }
 
         // record reception time as the time we read it.
-        mm.sysTimestampMsg = mstime();
+        mm.sysTimestampMsg = now;
 
         ch = *p++; // Grab the signal level
-        mm.signalLevel = ((unsigned char) ch / 255.0);
+        mm.signalLevel = (ch / 255.0);
         mm.signalLevel = mm.signalLevel * mm.signalLevel;
 
         /* In case of Mode-S Beast use the signal level per message for statistics */
@@ -1571,16 +2680,7 @@ static int decodeBinMessage(struct client *c, char *p, int remote) {
                 Modes.stats_current.strong_signal_count++; // signal power above -3dBFS
         }
 
-        if (0x1A == ch) {
-            p++;
-        }
-
-        for (j = 0; j < msgLen; j++) { // and the data
-            msg[j] = ch = *p++;
-            if (0x1A == ch) {
-                p++;
-            }
-        }
+        memcpy(msg, p, msgLen); // and the data
 
         if (msgLen == MODEAC_MSG_BYTES) { // ModeA or ModeC
             if (remote) {
@@ -1625,9 +2725,20 @@ static int decodeBinMessage(struct client *c, char *p, int remote) {
     }
     return (0);
 }
-//
-//=========================================================================
-//
+// Decode a batch of Beast binary messages as framed by beastParseInput
+
+static int decodeBinMessages(struct client *c, char *p, int remote) {
+    unsigned char *frame = (unsigned char *) p;
+    uint64_t now = mstime(); // all of them arrived with the same read
+
+    for (; *frame; frame += *frame + 1)
+        decodeBinMessage(c, frame + 1, remote, now);
+    return 0;
+}
+
+//
+//=========================================================================
+//
 // Turn an hex digit into its 4 bit decimal value.
 // Returns -1 if the digit is not in the 0-F range.
 //
@@ -2006,8 +3117,11 @@ void generateAircraftProtoBuf(void) {
     Modes.stats_current.mlat_positions = 0;
     Modes.stats_current.tisb_positions = 0;
 
-    for (j = 0; j < AIRCRAFTS_BUCKETS; j++) {
-        for (a = Modes.aircrafts[j]; a; a = a->next) {
+    for (int s = 0; s < Modes.track_threads; s++) {
+        struct track_shard *sh = &Modes.track_shards[s];
+
+        for (j = 0; j < sh->aircraft_count; j++) {
+            a = &sh->aircrafts[j];
             if ((a->meta.messages < 2) || (now > (a->meta.seen + 90E3))) {
                 // Basic filter for bad decodes and
                 // don't include stale aircraft.
@@ -2030,7 +3144,7 @@ void generateAircraftProtoBuf(void) {
                 msg.aircraft[msg.n_aircraft]->nav_modes = &a->nav_modes;
             }
             if (trackDataValid(&a->position_valid)) {
-                msg.aircraft[msg.n_aircraft]->seen_pos = (now - a->position_valid.updated) / 1000.0;
+                msg.aircraft[msg.n_aircraft]->seen_pos = (now - trackDataUpdated(&a->position_valid)) / 1000.0;
                 // Update position statistics.
                 Modes.stats_current.with_positions += 1;
                 if (a->position_valid.source == SOURCE_MLAT) {
@@ -2110,8 +3224,11 @@ void generateHistoryProtoBuf(const char *file) {
     msg.n_history = 0;
     msg.now = (uint64_t) (now / 1000);
 
-    for (j = 0; j < AIRCRAFTS_BUCKETS; j++) {
-        for (a = Modes.aircrafts[j]; a; a = a->next) {
+    for (int s = 0; s < Modes.track_threads; s++) {
+        struct track_shard *sh = &Modes.track_shards[s];
+
+        for (j = 0; j < sh->aircraft_count; j++) {
+            a = &sh->aircrafts[j];
             if ((a->meta.messages < 2) || (now > (a->meta.seen + 90E3))) {
                 // Basic filter for bad decodes and
                 // don't include stale aircraft.
@@ -2403,350 +3520,907 @@ void generateReceiverProtoBuf() {
     }
 }
 
-static void periodicReadFromClient(struct client *c) {
+// Pass one framed input message to the service's read handler. When threaded,
+// data input is decoded by the decoding thread: the message is queued and the
+// handler later called without a client, which the data handlers don't use.
+// Returns the handler result, or -1 if the queue is full and the message has
+// to be kept for later.
+
+static int netHandleInput(struct client *c, char *msg, int len, int remote) {
+    if (!net_threaded)
+        return c->service->read_handler(c, msg, remote);
+
+    if (!netQueuePush(&net_input_queue, c->service, remote, msg, len)) {
+        net_input_blocked = true;
+        return -1;
+    }
+    return 0;
+}
+
+// Run queued input through the read handlers, on the decoding thread
+
+static void netDrainInput(void) {
+    char *msg;
+    void *owner;
+    uint32_t remote, len;
+
+    while ((msg = netQueuePeek(&net_input_queue, &owner, &remote, &len))) {
+        struct net_service *s = owner;
+        s->read_handler(NULL, msg, remote);
+        netQueueRelease(&net_input_queue);
+    }
+}
+
+// Clients of services without a read handler: read and discard whatever they
+// send, mostly to notice EOF and socket errors.
+// Returns 1 if input may remain after the loop limit.
+
+static int discardFromClient(struct client *c) {
     int nread, err;
     char buf[512];
 
-    nread = read(c->fd, buf, sizeof (buf));
-    err = errno;
+    for (int loop = 0; loop < 10; loop++) {
+        nread = read(c->fd, buf, sizeof (buf));
+        err = errno;
 
-    if (nread < 0 && (err == EAGAIN || err == EWOULDBLOCK)) {
-        return;
-    }
-    if (nread <= 0) { // Other errors, or EOF
-        fprintf(stderr, "%s: Socket Error: %s: %s port %s (fd %d)\n",
-                c->service->descr, nread < 0 ? strerror(err) : "EOF", c->host, c->port,
-                c->fd);
-        modesCloseClient(c);
-        return;
+        if (nread < 0 && (err == EAGAIN || err == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (nread <= 0) { // Other errors, or EOF
+            fprintf(stderr, "%s: Socket Error: %s: %s port %s (fd %d)\n",
+                    c->service->descr, nread < 0 ? strerror(err) : "EOF", c->host, c->port,
+                    c->fd);
+            modesCloseClient(c);
+            return 0;
+        }
+        if (nread < (int) sizeof (buf)) {
+            return 0;
+        }
     }
+    return 1;
 }
 
 //
 //=========================================================================
 //
-// This function polls the clients using read() in order to receive new
-// messages from the net.
-//
-// The message is supposed to be separated from the next message by the
-// separator 'sep', which is a null-terminated C string.
-//
-// Every full message received is decoded and passed to the higher layers
-// calling the function's 'handler'.
+// Beast binary framing
 //
-// The handler returns 0 on success, or 1 to signal this function we should
-// close the connection with the client in case of non-recoverable errors.
+// A vectorized scan records where the 0x1a bytes of the client buffer are
+// in a bitmap, a block ahead of the framing; framing then jumps from one
+// 0x1a to the next, so the payload bytes in between are never looked at one
+// by one. Complete frames are unescaped and handed to the read handler in
+// batches: each frame is preceded by its length and a zero length ends the
+// batch.
 //
 
-static void modesReadFromClient(struct client *c) {
-    int left;
-    int nread;
-    int bContinue = 1;
-    int loop = 0;
-
-    while (bContinue && loop++ < 10) {
-        left = MODES_CLIENT_BUF_SIZE - c->buflen - 1; // leave 1 extra byte for NUL termination in the ASCII case
-
-        // If our buffer is full discard it, this is some badly formatted shit
-        if (left <= 0) {
-            c->buflen = 0;
-            left = MODES_CLIENT_BUF_SIZE;
-            // If there is garbage, read more to discard it ASAP
-        }
+#define BEAST_BATCH_FRAMES 64
+#define BEAST_FRAME_MAX 28 // 'H' frame of 24 data bytes, unescaped
+#define BEAST_SCAN_BLOCK 1024
 
-        nread = read(c->fd, c->buf + c->buflen, left);
-        int err = errno;
+typedef void (*beast_scan_fn)(const unsigned char *buf, int len, uint64_t *bits);
 
-        // If we didn't get all the data we asked for, then return once we've processed what we did get.
-        if (nread != left) {
-            bContinue = 0;
-        }
+// Only the thread running the event loop frames input
+static uint64_t beast_bits[MODES_CLIENT_BUF_SIZE / 64 + 1];
+static const unsigned char *beast_buf; // buffer being framed
+static int beast_len; // its length
+static int beast_scanned; // bitmap is valid up to here
+static unsigned char beast_batch[BEAST_BATCH_FRAMES * (BEAST_FRAME_MAX + 1) + 1];
 
-        if (nread == 0) { // End of file
-            if (c->con) {
-                fprintf(stderr, "%s: Remote server disconnected: %s port %s (fd %d, SendQ %d, RecvQ %d)\n",
-                        c->service->descr, c->con->address, c->con->port, c->fd, c->sendq_len, c->buflen);
-            }
-            modesCloseClient(c);
-            return;
-        }
+// Bits of the 0x1a bytes in buf[from..len), into bits[] which is cleared
+// from word from / 64 onward. from must be a multiple of 64.
 
-        if (nread < 0 && (err == EAGAIN || err == EWOULDBLOCK)) {
-            // No data available (not really an error)
-            return;
-        }
+static void beast_scan_tail(const unsigned char *buf, int from, int len, uint64_t *bits) {
+    for (int w = from >> 6; w <= (len - 1) >> 6; ++w)
+        bits[w] = 0;
+    for (int i = from; i < len; ++i) {
+        if (buf[i] == 0x1a)
+            bits[i >> 6] |= 1ULL << (i & 63);
+    }
+}
 
-        if (nread < 0) { // Other errors
-            fprintf(stderr, "%s: Receive Error: %s: %s port %s (fd %d, SendQ %d, RecvQ %d)\n",
-                    c->service->descr, strerror(err), c->host, c->port,
-                    c->fd, c->sendq_len, c->buflen);
-            modesCloseClient(c);
-            return;
-        }
+// 8 bytes at a time: flag the bytes equal to 0x1a in their top bit, then
+// gather the flags with a multiply
 
-        c->buflen += nread;
+static void beast_scan_generic(const unsigned char *buf, int len, uint64_t *bits) {
+    const uint64_t low7 = 0x7f7f7f7f7f7f7f7fULL;
+    int i;
 
-        char *som = c->buf; // first byte of next message
-        char *eod = som + c->buflen; // one byte past end of data
-        char *p;
-        int remote = 1; // Messages will be marked remote by default
-        if ((c->fd == Modes.beast_fd) && (Modes.sdr_type == SDR_MODESBEAST || Modes.sdr_type == SDR_GNS)) {
-            /* Message from a local connected Modes-S beast or GNS5894 are passed off the internet */
-            remote = 0;
+    for (i = 0; i + 64 <= len; i += 64) {
+        uint64_t word = 0;
+        for (int k = 0; k < 8; ++k) {
+            uint64_t x;
+            memcpy(&x, buf + i + 8 * k, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            x = __builtin_bswap64(x);
+#endif
+            x ^= 0x1a1a1a1a1a1a1a1aULL;
+            x = ~(((x & low7) + low7) | x) & ~low7;
+            word |= ((x >> 7) * 0x0102040810204080ULL >> 56) << (8 * k);
         }
+        bits[i >> 6] = word;
+    }
+    beast_scan_tail(buf, i, len, bits);
+}
 
-        switch (c->service->read_mode) {
-            case READ_MODE_IGNORE:
-                // drop the bytes on the floor
-                som = eod;
-                break;
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
 
-            case READ_MODE_BEAST:
-                // This is the Beast Binary scanning case.
-                // If there is a complete message still in the buffer, there must be the separator 'sep'
-                // in the buffer, note that we full-scan the buffer at every read for simplicity.
+__attribute__ ((target("avx2")))
+static void beast_scan_avx2(const unsigned char *buf, int len, uint64_t *bits) {
+    const __m256i esc = _mm256_set1_epi8(0x1a);
+    int i;
 
-                while (som < eod && ((p = memchr(som, (char) 0x1a, eod - som)) != NULL)) { // The first byte of buffer 'should' be 0x1a
+    for (i = 0; i + 64 <= len; i += 64) {
+        uint32_t lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (buf + i)), esc));
+        uint32_t hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (buf + i + 32)), esc));
+        bits[i >> 6] = (uint64_t) hi << 32 | lo;
+    }
+    beast_scan_tail(buf, i, len, bits);
+}
 
-                    Modes.stats_current.remote_rejected_bad += ((p - som) / (8 + MODES_SHORT_MSG_BYTES));
-                    som = p; // consume garbage up to the 0x1a
-                    ++p; // skip 0x1a
+__attribute__ ((target("sse2")))
+static void beast_scan_sse2(const unsigned char *buf, int len, uint64_t *bits) {
+    const __m128i esc = _mm_set1_epi8(0x1a);
+    int i;
 
-                    if (p >= eod) {
-                        // Incomplete message in buffer, retry later
-                        break;
-                    }
+    for (i = 0; i + 64 <= len; i += 64) {
+        uint64_t word = 0;
+        for (int k = 0; k < 4; ++k) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (buf + i + 16 * k));
+            word |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, esc)) << (16 * k);
+        }
+        bits[i >> 6] = word;
+    }
+    beast_scan_tail(buf, i, len, bits);
+}
+#endif /* x86 */
 
-                    char *eom; // one byte past end of message
-                    if (*p == '1') {
-                        eom = p + MODEAC_MSG_BYTES + 8; // point past remainder of message
-                    } else if (*p == '2') {
-                        eom = p + MODES_SHORT_MSG_BYTES + 8;
-                    } else if (*p == '3') {
-                        eom = p + MODES_LONG_MSG_BYTES + 8;
-                    } else if (*p == '4') {
-                        eom = p + MODES_LONG_MSG_BYTES + 8;
-                    } else if (*p == '5') {
-                        eom = p + MODES_LONG_MSG_BYTES + 8;
-                    } else if (*p == 'H') {
-                        // GNS HULC protocol message
-                        if (p + 2 >= eod) { // Incomplete message in buffer, retry later
-                            break;
-                        }
-                        int len = *(unsigned char *) (p + 2);
-                        if (len > 24) {
-                            ++som; // Length doesn't match, skip message
-                            continue;
-                        }
-                        eom = p + len + 3;
-                    } else {
-                        // Not a valid beast message, skip 0x1a and try again
-                        ++som;
-                        continue;
-                    }
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
 
-                    // we need to be careful of double escape characters in the message body
-                    for (p = som + 1; p < eod && p < eom; p++) {
-                        if (0x1A == *p) {
-                            p++;
-                            eom++;
-                        }
-                    }
+static void beast_scan_neon(const unsigned char *buf, int len, uint64_t *bits) {
+    static const uint8_t lane_bits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    const uint8x16_t lanes = vld1q_u8(lane_bits);
+    const uint8x16_t esc = vdupq_n_u8(0x1a);
+    int i;
 
-                    if (eom > eod) { // Incomplete message in buffer, retry later
-                        break;
-                    }
+    for (i = 0; i + 64 <= len; i += 64) {
+        uint64_t word = 0;
+        for (int k = 0; k < 4; ++k) {
+            uint8x16_t sel = vandq_u8(vceqq_u8(vld1q_u8(buf + i + 16 * k), esc), lanes);
+#ifdef __aarch64__
+            unsigned mask = vaddv_u8(vget_low_u8(sel)) | (unsigned) vaddv_u8(vget_high_u8(sel)) << 8;
+#else
+            uint8x8_t sum = vpadd_u8(vget_low_u8(sel), vget_high_u8(sel));
+            sum = vpadd_u8(sum, sum);
+            sum = vpadd_u8(sum, sum);
+            unsigned mask = vget_lane_u8(sum, 0) | (unsigned) vget_lane_u8(sum, 1) << 8;
+#endif
+            word |= (uint64_t) mask << (16 * k);
+        }
+        bits[i >> 6] = word;
+    }
+    beast_scan_tail(buf, i, len, bits);
+}
+#endif /* NEON */
 
-                    // Have a 0x1a followed by 1/2/3/4/5 - pass message to handler.
-                    if (c->service->read_handler(c, som + 1, remote)) {
-                        modesCloseClient(c);
-                        return;
-                    }
+static beast_scan_fn beast_scan = beast_scan_generic;
 
-                    // advance to next message
-                    som = eom;
-                }
-                break;
+// Select the fastest 0x1a scan supported by this CPU
 
-            case READ_MODE_BEAST_COMMAND:
-                while (som < eod && ((p = memchr(som, (char) 0x1a, eod - som)) != NULL)) { // The first byte of buffer 'should' be 0x1a
-                    char *eom; // one byte past end of message
+static void beastScanInit(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        beast_scan = beast_scan_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        beast_scan = beast_scan_sse2;
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    beast_scan = beast_scan_neon;
+#endif
+}
 
-                    som = p; // consume garbage up to the 0x1a
-                    ++p; // skip 0x1a
+// Position of the first 0x1a at or after i, or the end of the buffer if
+// there is none
 
-                    if (p >= eod) {
-                        // Incomplete message in buffer, retry later
-                        break;
-                    }
+static inline int beastNextEscape(int i) {
+    while (i < beast_len) {
+        if (i >= beast_scanned) {
+            int to = min(beast_scanned + BEAST_SCAN_BLOCK, beast_len);
+            beast_scan(beast_buf + beast_scanned, to - beast_scanned, beast_bits + (beast_scanned >> 6));
+            beast_scanned = to;
+        }
+        uint64_t word = beast_bits[i >> 6] >> (i & 63);
+        if (word)
+            return i + __builtin_ctzll(word);
+        i = (i | 63) + 1;
+    }
+    return beast_len;
+}
 
-                    if (*p == '1') {
-                        eom = p + 2;
-                    } else {
-                        // Not a valid beast command, skip 0x1a and try again
-                        ++som;
-                        continue;
-                    }
+//
+//=========================================================================
+//
+// Duplicate suppression
+//
+// With --net-dedup-window, a Mode S message that a Beast input delivered
+// within the window is dropped while framing, before it is queued for the
+// decoder, so overlapping feeds cost a hash lookup per extra copy.
+//
+// The cache maps a hash of the message bytes to the time the message was
+// first seen, in buckets of four slots; a new message replaces the oldest
+// slot of its bucket. Copies don't extend the window, so a message that
+// is legitimately repeated still gets through once per window.
+//
 
-                    // we need to be careful of double escape characters in the message body
-                    for (p = som + 1; p < eod && p < eom; p++) {
-                        if (0x1A == *p) {
-                            p++;
-                            eom++;
-                        }
-                    }
+#define NET_DEDUP_SLOTS 32768 // a power of two
+#define NET_DEDUP_BUCKET 4
+
+struct net_dedup_slot {
+    uint64_t hash; // 0 if unused
+    uint64_t seen;
+};
+
+struct net_dedup_undo {
+    struct net_dedup_slot *slot;
+    struct net_dedup_slot old;
+};
+
+// Only the thread running the event loop frames input
+static struct net_dedup_slot *net_dedup;
+// Slots changed for the frames of the current batch, reverted if the
+// batch can't be queued and is framed again later
+static struct net_dedup_undo net_dedup_undo[BEAST_BATCH_FRAMES];
+static int net_dedup_changed;
+
+static void netDedupInit(void) {
+    if (!(net_dedup = calloc(NET_DEDUP_SLOTS, sizeof (*net_dedup)))) {
+        fprintf(stderr, "Out of memory allocating duplicate cache\n");
+        exit(1);
+    }
+}
 
-                    if (eom > eod) { // Incomplete message in buffer, retry later
-                        break;
-                    }
+// Mode S messages are 7 or 14 bytes
 
-                    // Have a 0x1a followed by 1 - pass message to handler.
-                    if (c->service->read_handler(c, som + 1, remote)) {
-                        modesCloseClient(c);
-                        return;
-                    }
+static inline uint64_t netDedupHash(const unsigned char *msg, int len) {
+    uint64_t a = 0, b = 0, h;
 
-                    // advance to next message
-                    som = eom;
-                }
-                break;
+    memcpy(&a, msg, 7);
+    memcpy(&b, msg + 7, len - 7);
+    h = (a ^ (uint64_t) len << 56) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 29;
+    h = (h ^ b) * 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 32;
+    return h ? h : 1;
+}
 
-            case READ_MODE_ASCII:
-                //
-                // This is the ASCII scanning case, AVR RAW or HTTP at present
-                // If there is a complete message still in the buffer, there must be the separator 'sep'
-                // in the buffer, note that we full-scan the buffer at every read for simplicity.
-
-                // Always NUL-terminate so we are free to use strstr()
-                // nb: we never fill the last byte of the buffer with read data (see above) so this is safe
-                *eod = '\0';
-
-                while (som < eod && (p = strstr(som, c->service->read_sep)) != NULL) { // end of first message if found
-                    *p = '\0'; // The handler expects null terminated strings
-                    if (c->service->read_handler(c, som, remote)) { // Pass message to handler.
-                        modesCloseClient(c); // Handler returns 1 on error to signal we .
-                        return; // should close the client connection
-                    }
-                    som = p + c->service->read_sep_len; // Move to start of next message
-                }
+// Returns true if msg was seen within the window, otherwise records it as
+// seen now
 
-                break;
-        }
+static bool netDedupSeen(const unsigned char *msg, int len, uint64_t now) {
+    uint64_t hash = netDedupHash(msg, len);
+    struct net_dedup_slot *bucket = net_dedup + (hash & (NET_DEDUP_SLOTS - 1) & ~(NET_DEDUP_BUCKET - 1));
+    struct net_dedup_slot *slot = bucket;
 
-        if (som > c->buf) { // We processed something - so
-            c->buflen = eod - som; // Update the unprocessed buffer length
-            if (c->buflen <= 0) {
-                c->buflen = 0;
-            } else {
-                memmove(c->buf, som, c->buflen); // Move what's remaining to the start of the buffer
-            }
-        } else { // If no message was decoded process the next client
-            return;
+    for (int i = 0; i < NET_DEDUP_BUCKET; ++i) {
+        if (bucket[i].hash == hash) {
+            if (now - bucket[i].seen <= Modes.net_dedup_window)
+                return true;
+            slot = &bucket[i];
+            break;
         }
+        if (bucket[i].seen < slot->seen)
+            slot = &bucket[i];
     }
+
+    net_dedup_undo[net_dedup_changed].slot = slot;
+    net_dedup_undo[net_dedup_changed].old = *slot;
+    net_dedup_changed++;
+    slot->hash = hash;
+    slot->seen = now;
+    return false;
 }
 
-__attribute__ ((format(printf, 4, 5))) static char *appendFATSV(char *p, char *end, const char *field, const char *format, ...) {
-    va_list ap;
-    va_start(ap, format);
+// Revert the changes made for the current batch, latest first
 
-    p = safe_snprintf(p, end, "%s\t", field);
-    p = safe_vsnprintf(p, end, format, ap);
-    p = safe_snprintf(p, end, "\t");
+static void netDedupUndo(void) {
+    while (net_dedup_changed > 0) {
+        struct net_dedup_undo *u = &net_dedup_undo[--net_dedup_changed];
+        *u->slot = u->old;
+    }
+}
 
-    va_end(ap);
-    return p;
+// Pass a batch of n bytes in beast_batch on, see netHandleInput
+
+static int beastHandleBatch(struct client *c, int n, int remote) {
+    beast_batch[n] = 0;
+    return netHandleInput(c, (char *) beast_batch, n, remote);
 }
 
-#define TSV_MAX_PACKET_SIZE 800
-#define TSV_VERSION "6E"
+// Frame the Beast binary input buffered for a client. Returns the number of
+// bytes consumed; *status is set to -1 if the client was closed, 1 if the
+// input queue is full and the rest has to wait, 0 otherwise.
+
+static int beastParseInput(struct client *c, int remote, int *status) {
+    const unsigned char *buf = (const unsigned char *) c->buf;
+    int len = c->buflen;
+    int som = 0; // first byte of next message
+    int batch_som = 0; // first byte of the messages in the batch
+    int batch_len = 0;
+    int batch_frames = 0;
+    int garbage = 0, batch_garbage = 0;
+    int messages = 0, batch_messages = 0;
+    int duplicates = 0, batch_duplicates = 0;
+    uint64_t now = net_dedup ? mstime() : 0;
+    int rv;
 
-static void writeFATSVPositionUpdate(float lat, float lon, float alt) {
-    static float last_lat, last_lon, last_alt;
+    // the decoder is behind, don't frame what can't be passed on
+    if (net_input_blocked) {
+        *status = 1;
+        return 0;
+    }
 
-    if (lat == last_lat && lon == last_lon && alt == last_alt)
-        return;
+    *status = 0;
+    beast_buf = buf;
+    beast_len = len;
+    beast_scanned = 0;
 
-    last_lat = lat;
-    last_lon = lon;
-    last_alt = alt;
+    for (;;) {
+        int p = beastNextEscape(som);
+        int eom; // one byte past end of message
+        int escaped = 0;
 
-    char *p = prepareWrite(&Modes.fatsv_out, TSV_MAX_PACKET_SIZE);
-    if (!p)
-        return;
+        if (p == len)
+            break;
+        batch_garbage += (p - som) / (8 + MODES_SHORT_MSG_BYTES);
+        som = p; // consume garbage up to the 0x1a
+        ++p; // skip 0x1a
 
-    char *end = p + TSV_MAX_PACKET_SIZE;
+        if (p >= len) {
+            // Incomplete message in buffer, retry later
+            break;
+        }
 
-    p = appendFATSV(p, end, "_v", "%s", TSV_VERSION);
-    p = appendFATSV(p, end, "clock", "%" PRIu64, messageNow() / 1000);
-    p = appendFATSV(p, end, "type", "%s", "location_update");
-    p = appendFATSV(p, end, "lat", "%.5f", lat);
-    p = appendFATSV(p, end, "lon", "%.5f", lon);
-    p = appendFATSV(p, end, "alt", "%.0f", alt);
-    p = appendFATSV(p, end, "altref", "%s", "egm96_meters");
-    --p; // remove last tab
-    p = safe_snprintf(p, end, "\n");
+        switch (buf[p]) {
+            case '1':
+                eom = p + MODEAC_MSG_BYTES + 8;
+                break;
+            case '2':
+                eom = p + MODES_SHORT_MSG_BYTES + 8;
+                break;
+            case '3':
+            case '4':
+            case '5':
+                eom = p + MODES_LONG_MSG_BYTES + 8;
+                break;
+            case 'H':
+                // GNS HULC protocol message
+                if (p + 2 >= len) { // Incomplete message in buffer, retry later
+                    eom = -1;
+                } else if (buf[p + 2] > 24) {
+                    eom = 0; // Length doesn't match, skip message
+                } else {
+                    eom = p + buf[p + 2] + 3;
+                }
+                break;
+            default:
+                // Not a valid beast message, skip 0x1a and try again
+                eom = 0;
+                break;
+        }
+        if (eom < 0)
+            break;
+        if (eom == 0) {
+            ++som;
+            continue;
+        }
 
-    if (p < end)
-        completeWrite(&Modes.fatsv_out, p);
-    else
-        fprintf(stderr, "fatsv: output too large (max %d, overran by %d)\n", TSV_MAX_PACKET_SIZE, (int) (p - end));
-}
+        // Each 0x1a in the message body is doubled
+        for (int q = beastNextEscape(p); q < eom && q < len; q = beastNextEscape(q + 2)) {
+            eom++;
+            escaped = 1;
+        }
+        if (eom > len) { // Incomplete message in buffer, retry later
+            break;
+        }
 
-static void writeFATSVEventMessage(struct modesMessage *mm, const char *datafield, unsigned char *data, size_t len) {
-    char *p = prepareWrite(&Modes.fatsv_out, TSV_MAX_PACKET_SIZE);
-    if (!p)
-        return;
+        // Unescape the message into the batch
+        unsigned char *out = beast_batch + batch_len + 1;
+        int n;
+        if (!escaped) {
+            n = eom - p;
+            memcpy(out, buf + p, n);
+        } else {
+            for (n = 0; p < eom; ++p) {
+                out[n++] = buf[p];
+                if (buf[p] == 0x1a)
+                    ++p;
+            }
+        }
 
-    char *end = p + TSV_MAX_PACKET_SIZE;
+        // advance to next message
+        som = eom;
 
-    p = appendFATSV(p, end, "_v", "%s", TSV_VERSION);
-    p = appendFATSV(p, end, "clock", "%" PRIu64, messageNow() / 1000);
-    p = appendFATSV(p, end, (mm->addr & MODES_NON_ICAO_ADDRESS) ? "otherid" : "hexid", "%06X", mm->addr & 0xFFFFFF);
-    if (mm->addrtype != AIRCRAFT_META__ADDR_TYPE__ADDR_ADSB_ICAO) {
-        p = appendFATSV(p, end, "addrtype", "%s", addrtype_enum_string(mm->addrtype));
+        if (net_dedup && (out[0] == '2' || out[0] == '3')) {
+            batch_messages++;
+            if (netDedupSeen(out + 8, n - 8, now)) {
+                batch_duplicates++;
+                continue;
+            }
+        }
+
+        beast_batch[batch_len] = n;
+        batch_len += n + 1;
+        batch_frames++;
+
+        if (batch_frames == BEAST_BATCH_FRAMES) {
+            if ((rv = beastHandleBatch(c, batch_len, remote)) < 0) {
+                *status = 1;
+                batch_len = 0;
+                break;
+            } else if (rv) {
+                modesCloseClient(c);
+                *status = -1;
+                return 0;
+            }
+            garbage += batch_garbage;
+            messages += batch_messages;
+            duplicates += batch_duplicates;
+            net_dedup_changed = 0;
+            batch_som = som;
+            batch_len = batch_frames = batch_garbage = batch_messages = batch_duplicates = 0;
+        }
     }
 
-    p = safe_snprintf(p, end, "%s\t", datafield);
-    for (size_t i = 0; i < len; ++i) {
-        p = safe_snprintf(p, end, "%02X", data[i]);
+    if (batch_len && (rv = beastHandleBatch(c, batch_len, remote)) != 0) {
+        if (rv > 0) {
+            modesCloseClient(c);
+            *status = -1;
+            return 0;
+        }
+        *status = 1;
+    }
+    if (*status) {
+        // framed again when the input queue has room
+        som = batch_som;
+        netDedupUndo();
+    } else {
+        garbage += batch_garbage;
+        messages += batch_messages;
+        duplicates += batch_duplicates;
+        net_dedup_changed = 0;
     }
-    p = safe_snprintf(p, end, "\n");
 
-    if (p <= end)
-        completeWrite(&Modes.fatsv_out, p);
-    else
-        fprintf(stderr, "fatsv: output too large (max %d, overran by %d)\n", TSV_MAX_PACKET_SIZE, (int) (p - end));
-#undef bufsize
+    if (garbage || duplicates) {
+        pthread_mutex_lock(&net_stats_mutex);
+        net_stats.remote_rejected_bad += garbage;
+        net_stats.remote_duplicates += duplicates;
+        pthread_mutex_unlock(&net_stats_mutex);
+    }
+    if (messages && c->con) {
+        __atomic_add_fetch(&c->con->messages, messages, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&c->con->duplicates, duplicates, __ATOMIC_RELAXED);
+    }
+    return som;
 }
 
-static void writeFATSVEvent(struct modesMessage *mm, struct aircraft *a) {
-    // Write event records for a couple of message types.
+//
+//=========================================================================
+//
+// Split the buffered input of a client into messages and pass them on.
+//
+// The message is supposed to be separated from the next message by the
+// separator 'sep', which is a null-terminated C string.
+//
+// Every full message received is decoded and passed to the higher layers
+// calling the function's 'handler'.
+//
+// The handler returns 0 on success, or 1 to signal this function we should
+// close the connection with the client in case of non-recoverable errors.
+//
+// Returns -1 if the client was closed, 0 if no message was complete,
+// 1 if some input was consumed and 2 if the input queue is full and the
+// rest has to wait.
+//
 
-    if (!Modes.fatsv_out.service || !Modes.fatsv_out.service->connections) {
-        return; // not enabled or no active connections
+static int clientParseInput(struct client *c) {
+    char *som = c->buf; // first byte of next message
+    char *eod = som + c->buflen; // one byte past end of data
+    char *p;
+    int rv;
+    int blocked = 0; // input queue full, leave the rest in the buffer
+    int remote = 1; // Messages will be marked remote by default
+    if ((c->fd == Modes.beast_fd) && (Modes.sdr_type == SDR_MODESBEAST || Modes.sdr_type == SDR_GNS)) {
+        /* Message from a local connected Modes-S beast or GNS5894 are passed off the internet */
+        remote = 0;
     }
 
-    if (a->meta.messages < 2) // basic filter for bad decodes
-        return;
+    switch (c->service->read_mode) {
+        case READ_MODE_IGNORE:
+            // drop the bytes on the floor
+            som = eod;
+            break;
 
-    switch (mm->msgtype) {
-        case 20:
-        case 21:
-            // DF 20/21: Comm-B: emit if they've changed since we last sent them
-            switch (mm->commb_format) {
-                case COMMB_DATALINK_CAPS:
-                    // BDS 1,0: data link capability report
-                    if (memcmp(mm->MB, a->fatsv_emitted_bds_10, 7) != 0) {
-                        memcpy(a->fatsv_emitted_bds_10, mm->MB, 7);
-                        writeFATSVEventMessage(mm, "datalink_caps", mm->MB, 7);
-                    }
-                    break;
+        case READ_MODE_BEAST:
+            // Keep a lone first byte until clientReceived() can tell whether
+            // the stream is compressed
+            if (!c->udp && c->received < 2)
+                break;
+            // This is the Beast Binary scanning case, see beastParseInput
+            som += beastParseInput(c, remote, &rv);
+            if (rv < 0)
+                return -1;
+            blocked = rv;
+            break;
+
+        case READ_MODE_BEAST_COMMAND:
+            while (som < eod && ((p = memchr(som, (char) 0x1a, eod - som)) != NULL)) { // The first byte of buffer 'should' be 0x1a
+                char *eom; // one byte past end of message
+
+                som = p; // consume garbage up to the 0x1a
+                ++p; // skip 0x1a
+
+                if (p >= eod) {
+                    // Incomplete message in buffer, retry later
+                    break;
+                }
+
+                if (*p == '1') {
+                    eom = p + 2;
+                } else {
+                    // Not a valid beast command, skip 0x1a and try again
+                    ++som;
+                    continue;
+                }
+
+                // we need to be careful of double escape characters in the message body
+                for (p = som + 1; p < eod && p < eom; p++) {
+                    if (0x1A == *p) {
+                        p++;
+                        eom++;
+                    }
+                }
+
+                if (eom > eod) { // Incomplete message in buffer, retry later
+                    break;
+                }
+
+                // Have a 0x1a followed by 1 - pass message to handler.
+                if (c->service->read_handler(c, som + 1, remote)) {
+                    modesCloseClient(c);
+                    return -1;
+                }
+
+                // advance to next message
+                som = eom;
+            }
+            break;
+
+        case READ_MODE_ASCII:
+            //
+            // This is the ASCII scanning case, AVR RAW or HTTP at present
+            // If there is a complete message still in the buffer, there must be the separator 'sep'
+            // in the buffer, note that we full-scan the buffer at every read for simplicity.
+
+            // Always NUL-terminate so we are free to use strstr()
+            // nb: we never fill the last byte of the buffer with read data (see above) so this is safe
+            *eod = '\0';
+
+            while (som < eod && (p = strstr(som, c->service->read_sep)) != NULL) { // end of first message if found
+                *p = '\0'; // The handler expects null terminated strings
+                if ((rv = netHandleInput(c, som, p - som, remote)) < 0) {
+                    *p = c->service->read_sep[0]; // retry this message later
+                    blocked = 1;
+                    break;
+                } else if (rv) { // Pass message to handler.
+                    modesCloseClient(c); // Handler returns 1 on error to signal we .
+                    return -1; // should close the client connection
+                }
+                som = p + c->service->read_sep_len; // Move to start of next message
+            }
+
+            break;
+    }
+
+    if (som > c->buf) { // We processed something - so
+        c->buflen = eod - som; // Update the unprocessed buffer length
+        if (c->buflen <= 0) {
+            c->buflen = 0;
+        } else {
+            memmove(c->buf, som, c->buflen); // Move what's remaining to the start of the buffer
+        }
+        return blocked ? 2 : 1;
+    }
+    return blocked ? 2 : 0;
+}
+
+//
+//=========================================================================
+//
+// This function polls the clients using read() in order to receive new
+// messages from the net, and passes them on with clientParseInput().
+//
+// Returns 1 if input may remain unread; as the fd is edge-triggered the
+// caller has to come back without waiting for another readiness event.
+//
+
+static int modesReadFromClient(struct client *c) {
+    int left;
+    int nread;
+    int bContinue = 1;
+    int loop = 0;
+
+    while (bContinue && loop++ < 10) {
+        if (c->input_blocked) {
+            // The decoder was behind last time, hand on what is buffered
+            // before reading more. The buffer may well be full.
+            c->input_blocked = 0;
+        } else if (c->inflate && c->inflate->len) {
+            // Inflate the rest of the compressed input before reading more
+            if (!clientInflate(c))
+                return 0;
+        } else {
+            left = MODES_CLIENT_BUF_SIZE - c->buflen - 1; // leave 1 extra byte for NUL termination in the ASCII case
+
+            // If our buffer is full discard it, this is some badly formatted shit
+            if (left <= 0) {
+                c->buflen = 0;
+                left = MODES_CLIENT_BUF_SIZE;
+                // If there is garbage, read more to discard it ASAP
+            }
+
+            nread = read(c->fd, c->buf + c->buflen, left);
+            int err = errno;
+
+            // If we didn't get all the data we asked for, then return once we've processed what we did get.
+            if (nread != left) {
+                bContinue = 0;
+            }
+
+            if (nread == 0) { // End of file
+                if (c->con) {
+                    fprintf(stderr, "%s: Remote server disconnected: %s port %s (fd %d, SendQ %d, RecvQ %d)\n",
+                            c->service->descr, c->con->address, c->con->port, c->fd, c->sendq_len, c->buflen);
+                }
+                modesCloseClient(c);
+                return 0;
+            }
+
+            if (nread < 0 && (err == EAGAIN || err == EWOULDBLOCK)) {
+                // No data available (not really an error)
+                return 0;
+            }
+
+            if (nread < 0) { // Other errors
+                fprintf(stderr, "%s: Receive Error: %s: %s port %s (fd %d, SendQ %d, RecvQ %d)\n",
+                        c->service->descr, strerror(err), c->host, c->port,
+                        c->fd, c->sendq_len, c->buflen);
+                modesCloseClient(c);
+                return 0;
+            }
+
+            if (!clientReceived(c, nread))
+                return 0;
+        }
+
+        switch (clientParseInput(c)) {
+            case -1: // closed
+                return 0;
+            case 0: // If no message was decoded process the next client
+                return bContinue || (c->inflate && c->inflate->len);
+            case 2: // come back once the decoder caught up
+                c->input_blocked = 1;
+                return 1;
+        }
+    }
+    return bContinue;
+}
+
+// Count the datagrams missing before one with sequence number seq. Each
+// sender keeps its own sequence, the least recently heard of gives way to a
+// new one. A new sender, or one that restarted, begins a new sequence; a
+// datagram that arrives late was counted as lost already.
+
+static void netUdpSequence(struct client *c, uint32_t seq, const struct sockaddr_storage *from, socklen_t len) {
+    struct net_udp_sender *sender = &c->udp_senders[0];
+    uint64_t now = mstime();
+    int32_t gap;
+
+    for (int i = 0; i < NET_UDP_SENDERS; i++) {
+        struct net_udp_sender *s = &c->udp_senders[i];
+        if (s->addrlen == len && memcmp(&s->addr, from, len) == 0) {
+            sender = s;
+            break;
+        }
+        if (s->last < sender->last)
+            sender = s;
+    }
+    sender->last = now;
+
+    gap = (int32_t) (seq - sender->seq);
+    if (sender->addrlen != len || memcmp(&sender->addr, from, len) != 0) {
+        memset(&sender->addr, 0, sizeof (sender->addr));
+        memcpy(&sender->addr, from, len);
+        sender->addrlen = len;
+    } else if (gap < 0 && gap >= -NET_UDP_REORDER) {
+        return;
+    } else if (gap > 0 && gap <= NET_UDP_MAX_GAP) {
+        pthread_mutex_lock(&net_stats_mutex);
+        net_stats.remote_udp_lost += gap;
+        pthread_mutex_unlock(&net_stats_mutex);
+    }
+    sender->seq = seq + 1;
+}
+
+// Read the datagrams of a UDP stream. Input datagrams hold whole messages,
+// anything left unframed at the end of one is dropped. For output streams
+// reading just clears errors reported back by the network.
+//
+// Returns 1 if input may remain unread, see modesReadFromClient.
+
+static int netUdpReadClient(struct client *c) {
+    char discard;
+    int loop;
+
+    if (!c->service->read_handler) {
+        for (loop = 0; loop < NET_UDP_READ_MAX; loop++) {
+            if (recv(c->fd, &discard, sizeof (discard), 0) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+        }
+        return 0;
+    }
+
+    for (loop = 0; loop < NET_UDP_READ_MAX; loop++) {
+        if (c->input_blocked) {
+            // The decoder was behind last time, hand on the rest of the datagram
+            c->input_blocked = 0;
+        } else {
+            unsigned char seq[4];
+            struct sockaddr_storage from;
+            struct iovec iov[2];
+            struct msghdr msg;
+            ssize_t nread;
+
+            iov[0].iov_base = seq;
+            iov[0].iov_len = sizeof (seq);
+            iov[1].iov_base = c->buf;
+            iov[1].iov_len = MODES_CLIENT_BUF_SIZE - 1;
+            memset(&msg, 0, sizeof (msg));
+            msg.msg_name = &from;
+            msg.msg_namelen = sizeof (from);
+            msg.msg_iov = iov;
+            msg.msg_iovlen = 2;
+
+            if ((nread = recvmsg(c->fd, &msg, 0)) < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    fprintf(stderr, "%s: Receive Error: %s: %s port %s (fd %d)\n",
+                            c->service->descr, strerror(errno), c->host, c->port, c->fd);
+                }
+                return 0;
+            }
+            if (nread < (ssize_t) sizeof (seq))
+                continue;
+
+            netUdpSequence(c, (uint32_t) seq[0] << 24 | seq[1] << 16 | seq[2] << 8 | seq[3], &from, msg.msg_namelen);
+            c->buflen = nread - sizeof (seq);
+        }
+
+        switch (clientParseInput(c)) {
+            case -1: // closed
+                return 0;
+            case 2: // come back once the decoder caught up
+                c->input_blocked = 1;
+                return 1;
+        }
+        c->buflen = 0;
+    }
+    return 1;
+}
+
+__attribute__ ((format(printf, 4, 5))) static char *appendFATSV(char *p, char *end, const char *field, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+
+    p = safe_snprintf(p, end, "%s\t", field);
+    p = safe_vsnprintf(p, end, format, ap);
+    p = safe_snprintf(p, end, "\t");
+
+    va_end(ap);
+    return p;
+}
+
+#define TSV_MAX_PACKET_SIZE 800
+#define TSV_VERSION "6E"
+
+static void writeFATSVPositionUpdate(float lat, float lon, float alt) {
+    static float last_lat, last_lon, last_alt;
+
+    if (lat == last_lat && lon == last_lon && alt == last_alt)
+        return;
+
+    last_lat = lat;
+    last_lon = lon;
+    last_alt = alt;
+
+    char *p = prepareWrite(&Modes.fatsv_out, TSV_MAX_PACKET_SIZE);
+    if (!p)
+        return;
+
+    char *end = p + TSV_MAX_PACKET_SIZE;
+
+    p = appendFATSV(p, end, "_v", "%s", TSV_VERSION);
+    p = appendFATSV(p, end, "clock", "%" PRIu64, messageNow() / 1000);
+    p = appendFATSV(p, end, "type", "%s", "location_update");
+    p = appendFATSV(p, end, "lat", "%.5f", lat);
+    p = appendFATSV(p, end, "lon", "%.5f", lon);
+    p = appendFATSV(p, end, "alt", "%.0f", alt);
+    p = appendFATSV(p, end, "altref", "%s", "egm96_meters");
+    --p; // remove last tab
+    p = safe_snprintf(p, end, "\n");
+
+    if (p < end)
+        completeWrite(&Modes.fatsv_out, p);
+    else
+        fprintf(stderr, "fatsv: output too large (max %d, overran by %d)\n", TSV_MAX_PACKET_SIZE, (int) (p - end));
+}
+
+static void writeFATSVEventMessage(struct modesMessage *mm, const char *datafield, unsigned char *data, size_t len) {
+    char *p = prepareWrite(&Modes.fatsv_out, TSV_MAX_PACKET_SIZE);
+    if (!p)
+        return;
+
+    char *end = p + TSV_MAX_PACKET_SIZE;
+
+    p = appendFATSV(p, end, "_v", "%s", TSV_VERSION);
+    p = appendFATSV(p, end, "clock", "%" PRIu64, messageNow() / 1000);
+    p = appendFATSV(p, end, (mm->addr & MODES_NON_ICAO_ADDRESS) ? "otherid" : "hexid", "%06X", mm->addr & 0xFFFFFF);
+    if (mm->addrtype != AIRCRAFT_META__ADDR_TYPE__ADDR_ADSB_ICAO) {
+        p = appendFATSV(p, end, "addrtype", "%s", addrtype_enum_string(mm->addrtype));
+    }
+
+    p = safe_snprintf(p, end, "%s\t", datafield);
+    for (size_t i = 0; i < len; ++i) {
+        p = safe_snprintf(p, end, "%02X", data[i]);
+    }
+    p = safe_snprintf(p, end, "\n");
+
+    if (p <= end)
+        completeWrite(&Modes.fatsv_out, p);
+    else
+        fprintf(stderr, "fatsv: output too large (max %d, overran by %d)\n", TSV_MAX_PACKET_SIZE, (int) (p - end));
+#undef bufsize
+}
+
+static void writeFATSVEvent(struct modesMessage *mm, struct aircraft *a) {
+    // Write event records for a couple of message types.
+
+    if (!Modes.fatsv_out.service || !serviceConnections(Modes.fatsv_out.service)) {
+        return; // not enabled or no active connections
+    }
+
+    if (a->meta.messages < 2 || !a->fatsv) // basic filter for bad decodes
+        return;
+
+    switch (mm->msgtype) {
+        case 20:
+        case 21:
+            // DF 20/21: Comm-B: emit if they've changed since we last sent them
+            switch (mm->commb_format) {
+                case COMMB_DATALINK_CAPS:
+                    // BDS 1,0: data link capability report
+                    if (memcmp(mm->MB, a->fatsv->emitted_bds_10, 7) != 0) {
+                        memcpy(a->fatsv->emitted_bds_10, mm->MB, 7);
+                        writeFATSVEventMessage(mm, "datalink_caps", mm->MB, 7);
+                    }
+                    break;
 
                 case COMMB_ACAS_RA:
                     // BDS 3,0: ACAS RA report
-                    if (memcmp(mm->MB, a->fatsv_emitted_bds_30, 7) != 0) {
-                        memcpy(a->fatsv_emitted_bds_30, mm->MB, 7);
+                    if (memcmp(mm->MB, a->fatsv->emitted_bds_30, 7) != 0) {
+                        memcpy(a->fatsv->emitted_bds_30, mm->MB, 7);
                         writeFATSVEventMessage(mm, "commb_acas_ra", mm->MB, 7);
                     }
                     break;
@@ -2760,14 +4434,14 @@ static void writeFATSVEvent(struct modesMessage *mm, struct aircraft *a) {
         case 17:
         case 18:
             // DF 17/18: extended squitter
-            if (mm->metype == 28 && mm->mesub == 2 && memcmp(mm->ME, &a->fatsv_emitted_es_acas_ra, 7) != 0) {
+            if (mm->metype == 28 && mm->mesub == 2 && memcmp(mm->ME, &a->fatsv->emitted_es_acas_ra, 7) != 0) {
                 // type 28 subtype 2: ACAS RA report
                 // first byte has the type/subtype, remaining bytes match the BDS 3,0 format
-                memcpy(a->fatsv_emitted_es_acas_ra, mm->ME, 7);
+                memcpy(a->fatsv->emitted_es_acas_ra, mm->ME, 7);
                 writeFATSVEventMessage(mm, "es_acas_ra", mm->ME, 7);
-            } else if (mm->metype == 31 && (mm->mesub == 0 || mm->mesub == 1) && memcmp(mm->ME, a->fatsv_emitted_es_status, 7) != 0) {
+            } else if (mm->metype == 31 && (mm->mesub == 0 || mm->mesub == 1) && memcmp(mm->ME, a->fatsv->emitted_es_status, 7) != 0) {
                 // aircraft operational status
-                memcpy(a->fatsv_emitted_es_status, mm->ME, 7);
+                memcpy(a->fatsv->emitted_es_status, mm->ME, 7);
                 writeFATSVEventMessage(mm, "es_op_status", mm->ME, 7);
             }
             break;
@@ -2811,17 +4485,18 @@ __attribute__ ((format(printf, 6, 7))) static char *appendFATSVMeta(char *p, cha
         return p;
     }
 
-    if (source->updated > messageNow()) {
+    uint64_t updated = trackDataUpdated(source);
+    if (updated > messageNow()) {
         // data in the future
         return p;
     }
 
-    if (source->updated < a->fatsv_last_emitted) {
+    if (updated < a->fatsv->last_emitted) {
         // not updated since last time
         return p;
     }
 
-    uint64_t age = (messageNow() - source->updated) / 1000;
+    uint64_t age = (messageNow() - updated) / 1000;
     if (age > 255) {
         // too old
         return p;
@@ -2853,7 +4528,7 @@ static void writeFATSV() {
     struct aircraft *a;
     static uint64_t next_update;
 
-    if (!Modes.fatsv_out.service || !Modes.fatsv_out.service->connections) {
+    if (!Modes.fatsv_out.service || !serviceConnections(Modes.fatsv_out.service)) {
         return; // not enabled or no active connections
     }
 
@@ -2865,13 +4540,16 @@ static void writeFATSV() {
     // scan once a second at most
     next_update = now + 1000;
 
-    for (int j = 0; j < AIRCRAFTS_BUCKETS; j++) {
-        for (a = Modes.aircrafts[j]; a; a = a->next) {
-            if (a->meta.messages < 2) // basic filter for bad decodes
+    for (int s = 0; s < Modes.track_threads; s++) {
+        struct track_shard *sh = &Modes.track_shards[s];
+
+        for (unsigned j = 0; j < sh->aircraft_count; j++) {
+            a = &sh->aircrafts[j];
+            if (a->meta.messages < 2 || !a->fatsv) // basic filter for bad decodes
                 continue;
 
             // don't emit if it hasn't updated since last time
-            if (a->meta.seen < a->fatsv_last_emitted) {
+            if (a->meta.seen < a->fatsv->last_emitted) {
                 continue;
             }
 
@@ -2905,32 +4583,32 @@ static void writeFATSV() {
             // if it hasn't changed altitude, heading, or speed much,
             // don't update so often
             int changed =
-                    (altValid && abs(a->meta.alt_baro - a->fatsv_emitted_altitude_baro) >= 50) ||
-                    (trackDataValid(&a->altitude_geom_valid) && abs(a->meta.alt_geom - a->fatsv_emitted_altitude_geom) >= 50) ||
-                    (trackDataValid(&a->baro_rate_valid) && abs(a->meta.baro_rate - a->fatsv_emitted_baro_rate) > 500) ||
-                    (trackDataValid(&a->geom_rate_valid) && abs(a->meta.geom_rate - a->fatsv_emitted_geom_rate) > 500) ||
-                    (trackDataValid(&a->track_valid) && heading_difference(a->meta.track, a->fatsv_emitted_track) >= 2) ||
-                    (trackDataValid(&a->track_rate_valid) && fabs(a->meta.track_rate - a->fatsv_emitted_track_rate) >= 0.5) ||
-                    (trackDataValid(&a->roll_valid) && fabs(a->meta.roll - a->fatsv_emitted_roll) >= 5.0) ||
-                    (trackDataValid(&a->mag_heading_valid) && heading_difference(a->meta.mag_heading, a->fatsv_emitted_mag_heading) >= 2) ||
-                    (trackDataValid(&a->true_heading_valid) && heading_difference(a->meta.true_heading, a->fatsv_emitted_true_heading) >= 2) ||
-                    (gsValid && fabs(a->meta.gs - a->fatsv_emitted_gs) >= 25) ||
-                    (trackDataValid(&a->ias_valid) && unsigned_difference(a->meta.ias, a->fatsv_emitted_ias) >= 25) ||
-                    (trackDataValid(&a->tas_valid) && unsigned_difference(a->meta.tas, a->fatsv_emitted_tas) >= 25) ||
-                    (trackDataValid(&a->mach_valid) && fabs(a->meta.mach - a->fatsv_emitted_mach) >= 0.02);
+                    (altValid && abs(a->meta.alt_baro - a->fatsv->emitted_altitude_baro) >= 50) ||
+                    (trackDataValid(&a->altitude_geom_valid) && abs(a->meta.alt_geom - a->fatsv->emitted_altitude_geom) >= 50) ||
+                    (trackDataValid(&a->baro_rate_valid) && abs(a->meta.baro_rate - a->fatsv->emitted_baro_rate) > 500) ||
+                    (trackDataValid(&a->geom_rate_valid) && abs(a->meta.geom_rate - a->fatsv->emitted_geom_rate) > 500) ||
+                    (trackDataValid(&a->track_valid) && heading_difference(a->meta.track, a->fatsv->emitted_track) >= 2) ||
+                    (trackDataValid(&a->track_rate_valid) && fabs(a->meta.track_rate - a->fatsv->emitted_track_rate) >= 0.5) ||
+                    (trackDataValid(&a->roll_valid) && fabs(a->meta.roll - a->fatsv->emitted_roll) >= 5.0) ||
+                    (trackDataValid(&a->mag_heading_valid) && heading_difference(a->meta.mag_heading, a->fatsv->emitted_mag_heading) >= 2) ||
+                    (trackDataValid(&a->true_heading_valid) && heading_difference(a->meta.true_heading, a->fatsv->emitted_true_heading) >= 2) ||
+                    (gsValid && fabs(a->meta.gs - a->fatsv->emitted_gs) >= 25) ||
+                    (trackDataValid(&a->ias_valid) && unsigned_difference(a->meta.ias, a->fatsv->emitted_ias) >= 25) ||
+                    (trackDataValid(&a->tas_valid) && unsigned_difference(a->meta.tas, a->fatsv->emitted_tas) >= 25) ||
+                    (trackDataValid(&a->mach_valid) && fabs(a->meta.mach - a->fatsv->emitted_mach) >= 0.02);
 
             int immediate =
-                    (trackDataValid(&a->nav_altitude_mcp_valid) && unsigned_difference(a->meta.nav_altitude_mcp, a->fatsv_emitted_nav_altitude_mcp) > 50) ||
-                    (trackDataValid(&a->nav_altitude_fms_valid) && unsigned_difference(a->meta.nav_altitude_fms, a->fatsv_emitted_nav_altitude_fms) > 50) ||
-                    (trackDataValid(&a->nav_altitude_src_valid) && a->nav_altitude_src != a->fatsv_emitted_nav_altitude_src) ||
-                    (trackDataValid(&a->nav_heading_valid) && heading_difference(a->meta.nav_heading, a->fatsv_emitted_nav_heading) > 2) ||
-                    (trackDataValid(&a->nav_modes_valid) && nm != a->fatsv_emitted_nav_modes) ||
-                    (trackDataValid(&a->nav_qnh_valid) && fabs(a->meta.nav_qnh - a->fatsv_emitted_nav_qnh) > 0.8) || // 0.8 is the ES message resolution
-                    (callsignValid && strcmp(a->callsign, a->fatsv_emitted_callsign) != 0) ||
-                    (airgroundValid && a->meta.air_ground == AIRCRAFT_META__AIR_GROUND__AG_AIRBORNE && a->fatsv_emitted_airground == AIRCRAFT_META__AIR_GROUND__AG_GROUND) ||
-                    (airgroundValid && a->meta.air_ground == AIRCRAFT_META__AIR_GROUND__AG_GROUND && a->fatsv_emitted_airground == AIRCRAFT_META__AIR_GROUND__AG_AIRBORNE) ||
-                    (squawkValid && a->meta.squawk != a->fatsv_emitted_squawk) ||
-                    (trackDataValid(&a->emergency_valid) && a->meta.emergency != a->fatsv_emitted_emergency);
+                    (trackDataValid(&a->nav_altitude_mcp_valid) && unsigned_difference(a->meta.nav_altitude_mcp, a->fatsv->emitted_nav_altitude_mcp) > 50) ||
+                    (trackDataValid(&a->nav_altitude_fms_valid) && unsigned_difference(a->meta.nav_altitude_fms, a->fatsv->emitted_nav_altitude_fms) > 50) ||
+                    (trackDataValid(&a->nav_altitude_src_valid) && a->nav_altitude_src != a->fatsv->emitted_nav_altitude_src) ||
+                    (trackDataValid(&a->nav_heading_valid) && heading_difference(a->meta.nav_heading, a->fatsv->emitted_nav_heading) > 2) ||
+                    (trackDataValid(&a->nav_modes_valid) && nm != a->fatsv->emitted_nav_modes) ||
+                    (trackDataValid(&a->nav_qnh_valid) && fabs(a->meta.nav_qnh - a->fatsv->emitted_nav_qnh) > 0.8) || // 0.8 is the ES message resolution
+                    (callsignValid && strcmp(a->callsign, a->fatsv->emitted_callsign) != 0) ||
+                    (airgroundValid && a->meta.air_ground == AIRCRAFT_META__AIR_GROUND__AG_AIRBORNE && a->fatsv->emitted_airground == AIRCRAFT_META__AIR_GROUND__AG_GROUND) ||
+                    (airgroundValid && a->meta.air_ground == AIRCRAFT_META__AIR_GROUND__AG_GROUND && a->fatsv->emitted_airground == AIRCRAFT_META__AIR_GROUND__AG_AIRBORNE) ||
+                    (squawkValid && a->meta.squawk != a->fatsv->emitted_squawk) ||
+                    (trackDataValid(&a->emergency_valid) && a->meta.emergency != a->fatsv->emitted_emergency);
 
             uint64_t minAge;
             if (immediate) {
@@ -2952,179 +4630,630 @@ static void writeFATSV() {
                 minAge = (changed ? 10000 : 30000);
             }
 
-            if ((now - a->fatsv_last_emitted) < minAge)
+            if ((now - a->fatsv->last_emitted) < minAge)
                 continue;
 
-            char *p = prepareWrite(&Modes.fatsv_out, TSV_MAX_PACKET_SIZE);
-            if (!p)
-                return;
-            char *end = p + TSV_MAX_PACKET_SIZE;
+            char *p = prepareWrite(&Modes.fatsv_out, TSV_MAX_PACKET_SIZE);
+            if (!p)
+                return;
+            char *end = p + TSV_MAX_PACKET_SIZE;
+
+            p = appendFATSV(p, end, "_v", "%s", TSV_VERSION);
+            p = appendFATSV(p, end, "clock", "%" PRIu64, messageNow() / 1000);
+            p = appendFATSV(p, end, (a->meta.addr & MODES_NON_ICAO_ADDRESS) ? "otherid" : "hexid", "%06X", a->meta.addr & 0xFFFFFF);
+
+            // for fields we only emit on change,
+            // occasionally re-emit them all
+            int forceEmit = (now - a->fatsv->last_force_emit) > 600000;
+
+            // these don't change often / at all, only emit when they change
+            if (forceEmit || a->meta.addr_type != a->fatsv->emitted_addrtype) {
+                p = appendFATSV(p, end, "addrtype", "%s", addrtype_enum_string(a->meta.addr_type));
+            }
+            if (forceEmit || a->adsb_version != a->fatsv->emitted_adsb_version) {
+                p = appendFATSV(p, end, "adsb_version", "%d", a->adsb_version);
+            }
+            if (forceEmit || a->meta.category != a->fatsv->emitted_category) {
+                p = appendFATSV(p, end, "category", "%02X", a->meta.category);
+            }
+            if (trackDataValid(&a->nac_p_valid) && (forceEmit || a->meta.nac_p != a->fatsv->emitted_nac_p)) {
+                p = appendFATSVMeta(p, end, "nac_p", a, &a->nac_p_valid, "%u", a->meta.nac_p);
+            }
+            if (trackDataValid(&a->nac_v_valid) && (forceEmit || a->meta.nac_v != a->fatsv->emitted_nac_v)) {
+                p = appendFATSVMeta(p, end, "nac_v", a, &a->nac_v_valid, "%u", a->meta.nac_v);
+            }
+            if (trackDataValid(&a->sil_valid) && (forceEmit || a->meta.sil != a->fatsv->emitted_sil)) {
+                p = appendFATSVMeta(p, end, "sil", a, &a->sil_valid, "%u", a->meta.sil);
+            }
+            if (trackDataValid(&a->sil_valid) && (forceEmit || a->meta.sil_type != a->fatsv->emitted_sil_type)) {
+                p = appendFATSVMeta(p, end, "sil_type", a, &a->sil_valid, "%s", sil_type_enum_string(a->meta.sil_type));
+            }
+            if (trackDataValid(&a->nic_baro_valid) && (forceEmit || a->meta.nic_baro != a->fatsv->emitted_nic_baro)) {
+                p = appendFATSVMeta(p, end, "nic_baro", a, &a->nic_baro_valid, "%u", a->meta.nic_baro);
+            }
+
+            // only emit alt, speed, latlon, track etc if they have been received since the last time
+            // and are not stale
+
+            char *dataStart = p;
+
+            // special cases
+            if (airgroundValid)
+                p = appendFATSVMeta(p, end, "airGround", a, &a->airground_valid, "%s", airground_enum_string(a->meta.air_ground));
+            if (squawkValid)
+                p = appendFATSVMeta(p, end, "squawk", a, &a->squawk_valid, "%04x", a->meta.squawk);
+            if (callsignValid)
+                p = appendFATSVMeta(p, end, "ident", a, &a->callsign_valid, "{%s}", a->callsign);
+            if (altValid)
+                p = appendFATSVMeta(p, end, "alt", a, &a->altitude_baro_valid, "%d", a->meta.alt_baro);
+            if (positionValid) {
+                p = appendFATSVMeta(p, end, "position", a, &a->position_valid, "{%.5f %.5f %u %u}", a->meta.lat, a->meta.lon, a->meta.nic, a->meta.rc);
+            }
+
+            p = appendFATSVMeta(p, end, "alt_gnss", a, &a->altitude_geom_valid, "%d", a->meta.alt_geom);
+            p = appendFATSVMeta(p, end, "vrate", a, &a->baro_rate_valid, "%d", a->meta.baro_rate);
+            p = appendFATSVMeta(p, end, "vrate_geom", a, &a->geom_rate_valid, "%d", a->meta.geom_rate);
+            p = appendFATSVMeta(p, end, "speed", a, &a->gs_valid, "%d", a->meta.gs);
+            p = appendFATSVMeta(p, end, "speed_ias", a, &a->ias_valid, "%u", a->meta.ias);
+            p = appendFATSVMeta(p, end, "speed_tas", a, &a->tas_valid, "%u", a->meta.tas);
+            p = appendFATSVMeta(p, end, "mach", a, &a->mach_valid, "%.3f", a->meta.mach);
+            p = appendFATSVMeta(p, end, "track", a, &a->track_valid, "%d", a->meta.track);
+            p = appendFATSVMeta(p, end, "track_rate", a, &a->track_rate_valid, "%.2f", a->meta.track_rate);
+            p = appendFATSVMeta(p, end, "roll", a, &a->roll_valid, "%.1f", a->meta.roll);
+            p = appendFATSVMeta(p, end, "heading_magnetic", a, &a->mag_heading_valid, "%d", a->meta.mag_heading);
+            p = appendFATSVMeta(p, end, "heading_true", a, &a->true_heading_valid, "%d", a->meta.true_heading);
+            p = appendFATSVMeta(p, end, "nav_alt_mcp", a, &a->nav_altitude_mcp_valid, "%u", a->meta.nav_altitude_mcp);
+            p = appendFATSVMeta(p, end, "nav_alt_fms", a, &a->nav_altitude_fms_valid, "%u", a->meta.nav_altitude_fms);
+            p = appendFATSVMeta(p, end, "nav_alt_src", a, &a->nav_altitude_src_valid, "%s", nav_altitude_source_enum_string(a->nav_altitude_src));
+            p = appendFATSVMeta(p, end, "nav_heading", a, &a->nav_heading_valid, "%d", a->meta.nav_heading);
+            p = appendFATSVMeta(p, end, "nav_modes", a, &a->nav_modes_valid, "{%s}", nav_modes_flags_string(a->nav_modes));
+            p = appendFATSVMeta(p, end, "nav_qnh", a, &a->nav_qnh_valid, "%.1f", a->meta.nav_qnh);
+            p = appendFATSVMeta(p, end, "emergency", a, &a->emergency_valid, "%s", emergency_enum_string(a->meta.emergency));
+
+            // if we didn't get anything interesting, bail out.
+            // We don't need to do anything special to unwind prepareWrite().
+            if (p == dataStart) {
+                continue;
+            }
+
+            --p; // remove last tab
+            p = safe_snprintf(p, end, "\n");
+
+            if (p < end)
+                completeWrite(&Modes.fatsv_out, p);
+            else
+                fprintf(stderr, "fatsv: output too large (max %d, overran by %d)\n", TSV_MAX_PACKET_SIZE, (int) (p - end));
+
+            a->fatsv->emitted_altitude_baro = a->meta.alt_baro;
+            a->fatsv->emitted_altitude_geom = a->meta.alt_geom;
+            a->fatsv->emitted_baro_rate = a->meta.baro_rate;
+            a->fatsv->emitted_geom_rate = a->meta.geom_rate;
+            a->fatsv->emitted_gs = a->meta.gs;
+            a->fatsv->emitted_ias = a->meta.ias;
+            a->fatsv->emitted_tas = a->meta.tas;
+            a->fatsv->emitted_mach = a->meta.mach;
+            a->fatsv->emitted_track = a->meta.track;
+            a->fatsv->emitted_track_rate = a->meta.track_rate;
+            a->fatsv->emitted_roll = a->meta.roll;
+            a->fatsv->emitted_mag_heading = a->meta.mag_heading;
+            a->fatsv->emitted_true_heading = a->meta.true_heading;
+            a->fatsv->emitted_airground = a->meta.air_ground;
+            a->fatsv->emitted_nav_altitude_mcp = a->meta.nav_altitude_mcp;
+            a->fatsv->emitted_nav_altitude_fms = a->meta.nav_altitude_fms;
+            a->fatsv->emitted_nav_altitude_src = a->nav_altitude_src;
+            a->fatsv->emitted_nav_heading = a->meta.nav_heading;
+            a->fatsv->emitted_nav_modes = nm;
+            a->fatsv->emitted_nav_qnh = a->meta.nav_qnh;
+            memcpy(a->fatsv->emitted_callsign, a->callsign, sizeof (a->fatsv->emitted_callsign));
+            a->fatsv->emitted_addrtype = a->meta.addr_type;
+            a->fatsv->emitted_adsb_version = a->adsb_version;
+            a->fatsv->emitted_category = a->meta.category;
+            a->fatsv->emitted_squawk = a->meta.squawk;
+            a->fatsv->emitted_nac_p = a->meta.nac_p;
+            a->fatsv->emitted_nac_v = a->meta.nac_v;
+            a->fatsv->emitted_sil = a->meta.sil;
+            a->fatsv->emitted_sil_type = a->meta.sil_type;
+            a->fatsv->emitted_nic_baro = a->meta.nic_baro;
+            a->fatsv->emitted_emergency = a->meta.emergency;
+            a->fatsv->last_emitted = now;
+            if (forceEmit) {
+                a->fatsv->last_force_emit = now;
+            }
+        }
+    }
+}
+
+//
+//=========================================================================
+//
+// io_uring backend
+//
+// With io_uring, clients are not polled for readiness. Each one always has a
+// read in flight, into its own buffer, which is registered with the ring if
+// a slot is free. Output goes out as a single SENDMSG per client covering
+// its SendQ, so each chunk is still written by the kernel straight from the
+// shared copy. Listeners use a multishot accept. Completions are handled
+// whenever the ring fd, registered with epoll, signals them.
+//
+// A client closed with I/O in flight stays on the list of its service until
+// the cancelled requests have completed, see netSecondWork.
+//
+
+#ifdef ENABLE_IOURING
+
+#define NET_URING_ENTRIES 256
+#define NET_URING_BUFFERS 1024
+
+// The low bits of an SQE's user_data tell what it was for, the rest is the
+// address of its owner's event tag. Cancellations use 0.
+#define URING_ACCEPT 1
+#define URING_RECV 2
+#define URING_SEND 3
+#define URING_KIND_MASK 3
+
+struct net_listener {
+    struct net_event_tag tag; // owner is the service
+    int fd;
+    int armed; // 1 while an accept is pending, -1 if left to epoll
+};
+
+struct net_uring_msg {
+    struct msghdr msg;
+    struct iovec iov[NET_MAX_IOV];
+};
+
+static struct net_uring net_ring;
+static struct net_event_tag net_uring_tag = {NET_EVENT_URING, NULL};
+static bool net_uring_rearm; // some listener needs a new accept
+static unsigned char *net_uring_buf_used; // slots of the registered buffer table in use
+
+static inline uint64_t uringData(struct net_event_tag *tag, int kind) {
+    return (uint64_t) (uintptr_t) tag | kind;
+}
+
+static struct io_uring_sqe *uringSqe(void) {
+    struct io_uring_sqe *sqe = netUringGetSqe(&net_ring);
+    if (!sqe)
+        fprintf(stderr, "io_uring: submission queue full\n");
+    return sqe;
+}
+
+static void netUringStart(void) {
+    static const int ops[] = {IORING_OP_ACCEPT, IORING_OP_READ, IORING_OP_READ_FIXED,
+        IORING_OP_SENDMSG, IORING_OP_ASYNC_CANCEL, -1};
+
+    if (!Modes.net_uring)
+        return;
+    if (!netUringInit(&net_ring, NET_URING_ENTRIES, NET_URING_BUFFERS, ops)) {
+        fprintf(stderr, "io_uring not available (%s), using epoll for network I/O\n", strerror(errno));
+        return;
+    }
+    if (net_ring.nr_buffers && !(net_uring_buf_used = calloc(net_ring.nr_buffers, 1))) {
+        fprintf(stderr, "Out of memory allocating io_uring buffer table\n");
+        exit(1);
+    }
+    netEventCtl(EPOLL_CTL_ADD, net_ring.fd, EPOLLIN | EPOLLET, &net_uring_tag);
+    net_uring = true;
+}
+
+static void netUringStop(void) {
+    if (!net_uring)
+        return;
+    netEventDel(net_ring.fd);
+    netUringDestroy(&net_ring);
+    free(net_uring_buf_used);
+    net_uring_buf_used = NULL;
+    net_uring = false;
+}
+
+static void netUringListen(struct net_service *service) {
+    if (!(service->uring_listeners = calloc(service->listener_count, sizeof (struct net_listener)))) {
+        fprintf(stderr, "Out of memory allocating listeners for %s\n", service->descr);
+        exit(1);
+    }
+    for (int i = 0; i < service->listener_count; ++i) {
+        struct net_listener *l = &service->uring_listeners[i];
+        l->tag.type = NET_EVENT_LISTENER;
+        l->tag.owner = service;
+        l->fd = service->listener_fds[i];
+    }
+    net_uring_rearm = true;
+}
+
+// Accepting resumes after a pause for lack of file descriptors
+
+static void netUringRearm(void) {
+    net_uring_rearm = net_uring;
+}
+
+static void netUringArmListeners(void) {
+    if (!net_uring_rearm || next_accept_retry)
+        return;
+    net_uring_rearm = false;
+
+    for (struct net_service *s = Modes.services; s; s = s->next) {
+        if (!s->uring_listeners)
+            continue;
+        for (int i = 0; i < s->listener_count; ++i) {
+            struct net_listener *l = &s->uring_listeners[i];
+            struct io_uring_sqe *sqe;
+
+            if (l->armed)
+                continue;
+            if (!(sqe = uringSqe())) {
+                net_uring_rearm = true;
+                return;
+            }
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = l->fd;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags = SOCK_CLOEXEC;
+            sqe->user_data = uringData(&l->tag, URING_ACCEPT);
+            l->armed = 1;
+        }
+    }
+}
+
+static void netUringRecv(struct client *c) {
+    struct io_uring_sqe *sqe = uringSqe();
+
+    if (!sqe) {
+        modesCloseClient(c);
+        return;
+    }
+    if (c->uring_buf >= 0) {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->buf_index = c->uring_buf;
+    } else {
+        sqe->opcode = IORING_OP_READ;
+    }
+    sqe->fd = c->fd;
+    sqe->off = (uint64_t) -1; // no file position
+    sqe->addr = (uint64_t) (uintptr_t) (c->buf + c->buflen);
+    // leave 1 extra byte for NUL termination in the ASCII case
+    sqe->len = MODES_CLIENT_BUF_SIZE - c->buflen - 1;
+    sqe->user_data = uringData(&c->tag, URING_RECV);
+    c->uring_recv = 1;
+}
+
+static void netUringClient(struct client *c) {
+    c->uring = 1;
+    if (net_uring_buf_used) {
+        for (unsigned i = 0; i < net_ring.nr_buffers; ++i) {
+            if (net_uring_buf_used[i])
+                continue;
+            if (netUringSetBuffer(&net_ring, i, c->buf, sizeof (c->buf))) {
+                net_uring_buf_used[i] = 1;
+                c->uring_buf = i;
+            }
+            break;
+        }
+    }
+    netUringRecv(c);
+}
+
+static void netUringRelease(struct client *c) {
+    if (c->uring_buf >= 0 && net_uring) {
+        netUringSetBuffer(&net_ring, c->uring_buf, NULL, 0);
+        net_uring_buf_used[c->uring_buf] = 0;
+    }
+    free(c->uring_msg);
+}
+
+// Pass on buffered input and read more, unless the decoder is behind.
+// Returns 1 if input is left waiting.
+
+static int netUringReadClient(struct client *c) {
+    if (c->buflen) {
+        switch (clientParseInput(c)) {
+            case -1:
+                return 0;
+            case 2:
+                c->input_blocked = 1;
+                return 1;
+        }
+    }
+    c->input_blocked = 0;
+
+    if (c->inflate && c->inflate->len) {
+        // Inflate the rest of the compressed input before reading more
+        return clientInflate(c);
+    }
+    // If our buffer is full discard it, this is some badly formatted shit
+    if (c->buflen >= MODES_CLIENT_BUF_SIZE - 1)
+        c->buflen = 0;
+    if (!c->uring_recv)
+        netUringRecv(c);
+    return 0;
+}
+
+// Write the client's SendQ, unless a send is still in flight
+
+static void netUringSend(struct client *c) {
+    struct net_chunk *chunk = c->sendq, *last;
+    struct io_uring_sqe *sqe;
+    struct iovec *iov;
+    int n;
+
+    if (c->uring_send_last || !chunk)
+        return;
+    if (!c->uring_msg && !(c->uring_msg = malloc(sizeof (*c->uring_msg)))) {
+        fprintf(stderr, "%s: Out of memory sending to %s port %s (fd %d)\n", c->service->descr, c->host, c->port, c->fd);
+        modesCloseClient(c);
+        return;
+    }
+
+    iov = c->uring_msg->iov;
+    iov[0].iov_base = chunk->data + c->sendq_offset;
+    iov[0].iov_len = chunk->len - c->sendq_offset;
+    for (last = chunk, chunk = chunk->next, n = 1; chunk && n < NET_MAX_IOV; last = chunk, chunk = chunk->next, n++) {
+        iov[n].iov_base = chunk->data;
+        iov[n].iov_len = chunk->len;
+    }
+
+    if (!(sqe = uringSqe())) {
+        modesCloseClient(c);
+        return;
+    }
+    memset(&c->uring_msg->msg, 0, sizeof (c->uring_msg->msg));
+    c->uring_msg->msg.msg_iov = iov;
+    c->uring_msg->msg.msg_iovlen = n;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = c->fd;
+    sqe->addr = (uint64_t) (uintptr_t) &c->uring_msg->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = uringData(&c->tag, URING_SEND);
+    c->uring_send_last = last;
+}
+
+static void uringCancel(uint64_t data) {
+    struct io_uring_sqe *sqe = uringSqe();
+
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = data;
+    sqe->user_data = 0;
+}
+
+// Cancel the client's send in flight, and its read if recv is set
+
+static void netUringCancel(struct client *c, bool recv) {
+    if (recv && c->uring_recv)
+        uringCancel(uringData(&c->tag, URING_RECV));
+    if (c->uring_send_last && !c->uring_cancel) {
+        uringCancel(uringData(&c->tag, URING_SEND));
+        c->uring_cancel = 1;
+    }
+}
+
+static void netUringFlush(void) {
+    int ret;
+
+    if (!net_uring)
+        return;
+    netUringArmListeners();
+    if ((ret = netUringSubmit(&net_ring)) < 0 && ret != -EAGAIN && ret != -EBUSY)
+        fprintf(stderr, "io_uring: submit failed: %s\n", strerror(-ret));
+}
+
+static void netUringAccepted(struct net_listener *l, int res, unsigned flags, uint64_t now) {
+    struct net_service *s = l->tag.owner;
+
+    if (!(flags & IORING_CQE_F_MORE) && l->armed > 0) {
+        l->armed = 0;
+        net_uring_rearm = true;
+    }
+    if (res >= 0) {
+        serviceAccepted(s, res, NULL, 0);
+        return;
+    }
+
+    switch (-res) {
+        case EINVAL:
+            // no multishot accept before Linux 5.19, leave this one to epoll
+            if (l->armed == 0) {
+                l->armed = -1;
+                netEventCtl(EPOLL_CTL_ADD, l->fd, EPOLLIN | EPOLLET, &s->listener_tag);
+                if (!next_accept_retry && serviceAccept(s))
+                    suspendAccept(now);
+            }
+            break;
+        case EMFILE:
+        case ENFILE:
+            snprintf(Modes.aneterr, ANET_ERR_LEN, "accept: %s", strerror(-res));
+            if (!next_accept_retry)
+                suspendAccept(now);
+            break;
+        case ECANCELED:
+        case EINTR:
+        case EAGAIN:
+            break;
+        default:
+            fprintf(stderr, "%s: Error accepting new connection: %s\n", s->descr, strerror(-res));
+    }
+}
+
+static void netUringReceived(struct client *c, int res) {
+    c->uring_recv = 0;
+    if (!c->service) // closed
+        return;
+
+    if (res == -EINTR || res == -EAGAIN) {
+        netUringRecv(c);
+        return;
+    }
+    if (res <= 0) {
+        if (res == 0 && c->con) {
+            fprintf(stderr, "%s: Remote server disconnected: %s port %s (fd %d, SendQ %d, RecvQ %d)\n",
+                    c->service->descr, c->con->address, c->con->port, c->fd, c->sendq_len, c->buflen);
+        } else if (res < 0 || !c->service->read_handler) {
+            fprintf(stderr, "%s: Socket Error: %s: %s port %s (fd %d)\n",
+                    c->service->descr, res < 0 ? strerror(-res) : "EOF", c->host, c->port, c->fd);
+        }
+        modesCloseClient(c);
+        return;
+    }
+
+    if (clientReceived(c, res))
+        netReadClient(c);
+}
+
+static void netUringSent(struct client *c, int res, uint64_t now) {
+    if (!c->service) { // closed, give back what the send was using
+        clientDropSendQ(c);
+        c->uring_send_last = NULL;
+        c->uring_cancel = 0;
+        return;
+    }
+    c->uring_send_last = NULL;
+    c->uring_cancel = 0;
+
+    if (res > 0) {
+        clientConsumeSendQ(c, res);
+        c->last_send = now;
+        c->last_flush = now;
+    } else if (res < 0 && res != -ECANCELED && res != -EINTR && res != -EAGAIN) {
+        fprintf(stderr, "%s: Send Error: %s: %s port %s (fd %d, SendQ %d, RecvQ %d)\n",
+                c->service->descr, strerror(-res), c->host, c->port, c->fd, c->sendq_len, c->buflen);
+        modesCloseClient(c);
+        return;
+    }
+
+    if (c->sendq_len >= c->sendq_max && c->service->chunk_tail && !clientSendQFull(c, c->service->chunk_tail))
+        return;
+    netUringSend(c);
+}
+
+static void netUringWork(uint64_t now) {
+    struct io_uring_cqe *cqe;
+
+    if (!net_uring)
+        return;
+    while ((cqe = netUringPeekCqe(&net_ring))) {
+        uint64_t data = cqe->user_data;
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+        struct net_event_tag *tag = (struct net_event_tag *) (uintptr_t) (data & ~(uint64_t) URING_KIND_MASK);
+
+        netUringCqeSeen(&net_ring);
+        switch (data & URING_KIND_MASK) {
+            case URING_ACCEPT:
+                netUringAccepted((struct net_listener *) tag, res, flags, now);
+                break;
+            case URING_RECV:
+                netUringReceived(tag->owner, res);
+                break;
+            case URING_SEND:
+                netUringSent(tag->owner, res, now);
+                break;
+            default: // cancellations
+                break;
+        }
+    }
+}
+
+#else
+
+static void netUringStart(void) {
+}
+
+static void netUringStop(void) {
+}
+
+static void netUringListen(struct net_service *service) {
+    MODES_NOTUSED(service);
+}
+
+static void netUringRearm(void) {
+}
+
+static void netUringClient(struct client *c) {
+    MODES_NOTUSED(c);
+}
+
+static void netUringRelease(struct client *c) {
+    MODES_NOTUSED(c);
+}
 
-            p = appendFATSV(p, end, "_v", "%s", TSV_VERSION);
-            p = appendFATSV(p, end, "clock", "%" PRIu64, messageNow() / 1000);
-            p = appendFATSV(p, end, (a->meta.addr & MODES_NON_ICAO_ADDRESS) ? "otherid" : "hexid", "%06X", a->meta.addr & 0xFFFFFF);
+static int netUringReadClient(struct client *c) {
+    MODES_NOTUSED(c);
+    return 0;
+}
 
-            // for fields we only emit on change,
-            // occasionally re-emit them all
-            int forceEmit = (now - a->fatsv_last_force_emit) > 600000;
+static void netUringSend(struct client *c) {
+    MODES_NOTUSED(c);
+}
 
-            // these don't change often / at all, only emit when they change
-            if (forceEmit || a->meta.addr_type != a->fatsv_emitted_addrtype) {
-                p = appendFATSV(p, end, "addrtype", "%s", addrtype_enum_string(a->meta.addr_type));
-            }
-            if (forceEmit || a->adsb_version != a->fatsv_emitted_adsb_version) {
-                p = appendFATSV(p, end, "adsb_version", "%d", a->adsb_version);
-            }
-            if (forceEmit || a->meta.category != a->fatsv_emitted_category) {
-                p = appendFATSV(p, end, "category", "%02X", a->meta.category);
-            }
-            if (trackDataValid(&a->nac_p_valid) && (forceEmit || a->meta.nac_p != a->fatsv_emitted_nac_p)) {
-                p = appendFATSVMeta(p, end, "nac_p", a, &a->nac_p_valid, "%u", a->meta.nac_p);
-            }
-            if (trackDataValid(&a->nac_v_valid) && (forceEmit || a->meta.nac_v != a->fatsv_emitted_nac_v)) {
-                p = appendFATSVMeta(p, end, "nac_v", a, &a->nac_v_valid, "%u", a->meta.nac_v);
-            }
-            if (trackDataValid(&a->sil_valid) && (forceEmit || a->meta.sil != a->fatsv_emitted_sil)) {
-                p = appendFATSVMeta(p, end, "sil", a, &a->sil_valid, "%u", a->meta.sil);
-            }
-            if (trackDataValid(&a->sil_valid) && (forceEmit || a->meta.sil_type != a->fatsv_emitted_sil_type)) {
-                p = appendFATSVMeta(p, end, "sil_type", a, &a->sil_valid, "%s", sil_type_enum_string(a->meta.sil_type));
-            }
-            if (trackDataValid(&a->nic_baro_valid) && (forceEmit || a->meta.nic_baro != a->fatsv_emitted_nic_baro)) {
-                p = appendFATSVMeta(p, end, "nic_baro", a, &a->nic_baro_valid, "%u", a->meta.nic_baro);
-            }
+static void netUringCancel(struct client *c, bool recv) {
+    MODES_NOTUSED(c);
+    MODES_NOTUSED(recv);
+}
 
-            // only emit alt, speed, latlon, track etc if they have been received since the last time
-            // and are not stale
+static void netUringFlush(void) {
+}
 
-            char *dataStart = p;
+static void netUringWork(uint64_t now) {
+    MODES_NOTUSED(now);
+}
 
-            // special cases
-            if (airgroundValid)
-                p = appendFATSVMeta(p, end, "airGround", a, &a->airground_valid, "%s", airground_enum_string(a->meta.air_ground));
-            if (squawkValid)
-                p = appendFATSVMeta(p, end, "squawk", a, &a->squawk_valid, "%04x", a->meta.squawk);
-            if (callsignValid)
-                p = appendFATSVMeta(p, end, "ident", a, &a->callsign_valid, "{%s}", a->callsign);
-            if (altValid)
-                p = appendFATSVMeta(p, end, "alt", a, &a->altitude_baro_valid, "%d", a->meta.alt_baro);
-            if (positionValid) {
-                p = appendFATSVMeta(p, end, "position", a, &a->position_valid, "{%.5f %.5f %u %u}", a->meta.lat, a->meta.lon, a->meta.nic, a->meta.rc);
-            }
+#endif
 
-            p = appendFATSVMeta(p, end, "alt_gnss", a, &a->altitude_geom_valid, "%d", a->meta.alt_geom);
-            p = appendFATSVMeta(p, end, "vrate", a, &a->baro_rate_valid, "%d", a->meta.baro_rate);
-            p = appendFATSVMeta(p, end, "vrate_geom", a, &a->geom_rate_valid, "%d", a->meta.geom_rate);
-            p = appendFATSVMeta(p, end, "speed", a, &a->gs_valid, "%d", a->meta.gs);
-            p = appendFATSVMeta(p, end, "speed_ias", a, &a->ias_valid, "%u", a->meta.ias);
-            p = appendFATSVMeta(p, end, "speed_tas", a, &a->tas_valid, "%u", a->meta.tas);
-            p = appendFATSVMeta(p, end, "mach", a, &a->mach_valid, "%.3f", a->meta.mach);
-            p = appendFATSVMeta(p, end, "track", a, &a->track_valid, "%d", a->meta.track);
-            p = appendFATSVMeta(p, end, "track_rate", a, &a->track_rate_valid, "%.2f", a->meta.track_rate);
-            p = appendFATSVMeta(p, end, "roll", a, &a->roll_valid, "%.1f", a->meta.roll);
-            p = appendFATSVMeta(p, end, "heading_magnetic", a, &a->mag_heading_valid, "%d", a->meta.mag_heading);
-            p = appendFATSVMeta(p, end, "heading_true", a, &a->true_heading_valid, "%d", a->meta.true_heading);
-            p = appendFATSVMeta(p, end, "nav_alt_mcp", a, &a->nav_altitude_mcp_valid, "%u", a->meta.nav_altitude_mcp);
-            p = appendFATSVMeta(p, end, "nav_alt_fms", a, &a->nav_altitude_fms_valid, "%u", a->meta.nav_altitude_fms);
-            p = appendFATSVMeta(p, end, "nav_alt_src", a, &a->nav_altitude_src_valid, "%s", nav_altitude_source_enum_string(a->nav_altitude_src));
-            p = appendFATSVMeta(p, end, "nav_heading", a, &a->nav_heading_valid, "%d", a->meta.nav_heading);
-            p = appendFATSVMeta(p, end, "nav_modes", a, &a->nav_modes_valid, "{%s}", nav_modes_flags_string(a->nav_modes));
-            p = appendFATSVMeta(p, end, "nav_qnh", a, &a->nav_qnh_valid, "%.1f", a->meta.nav_qnh);
-            p = appendFATSVMeta(p, end, "emergency", a, &a->emergency_valid, "%s", emergency_enum_string(a->meta.emergency));
+// Free a closed client
 
-            // if we didn't get anything interesting, bail out.
-            // We don't need to do anything special to unwind prepareWrite().
-            if (p == dataStart) {
-                continue;
-            }
+static void clientFree(struct client *c) {
+    netUringRelease(c);
+    if (c->inflate) {
+        inflateEnd(&c->inflate->z);
+        free(c->inflate);
+    }
+    free(c);
+}
 
-            --p; // remove last tab
-            p = safe_snprintf(p, end, "\n");
+// Track how far behind a client is
 
-            if (p < end)
-                completeWrite(&Modes.fatsv_out, p);
-            else
-                fprintf(stderr, "fatsv: output too large (max %d, overran by %d)\n", TSV_MAX_PACKET_SIZE, (int) (p - end));
+static void clientLagWork(struct client *c, uint64_t now) {
+    uint64_t lag = c->sendq ? now - c->sendq->created : 0;
 
-            a->fatsv_emitted_altitude_baro = a->meta.alt_baro;
-            a->fatsv_emitted_altitude_geom = a->meta.alt_geom;
-            a->fatsv_emitted_baro_rate = a->meta.baro_rate;
-            a->fatsv_emitted_geom_rate = a->meta.geom_rate;
-            a->fatsv_emitted_gs = a->meta.gs;
-            a->fatsv_emitted_ias = a->meta.ias;
-            a->fatsv_emitted_tas = a->meta.tas;
-            a->fatsv_emitted_mach = a->meta.mach;
-            a->fatsv_emitted_track = a->meta.track;
-            a->fatsv_emitted_track_rate = a->meta.track_rate;
-            a->fatsv_emitted_roll = a->meta.roll;
-            a->fatsv_emitted_mag_heading = a->meta.mag_heading;
-            a->fatsv_emitted_true_heading = a->meta.true_heading;
-            a->fatsv_emitted_airground = a->meta.air_ground;
-            a->fatsv_emitted_nav_altitude_mcp = a->meta.nav_altitude_mcp;
-            a->fatsv_emitted_nav_altitude_fms = a->meta.nav_altitude_fms;
-            a->fatsv_emitted_nav_altitude_src = a->nav_altitude_src;
-            a->fatsv_emitted_nav_heading = a->meta.nav_heading;
-            a->fatsv_emitted_nav_modes = nm;
-            a->fatsv_emitted_nav_qnh = a->meta.nav_qnh;
-            memcpy(a->fatsv_emitted_callsign, a->callsign, sizeof (a->fatsv_emitted_callsign));
-            a->fatsv_emitted_addrtype = a->meta.addr_type;
-            a->fatsv_emitted_adsb_version = a->adsb_version;
-            a->fatsv_emitted_category = a->meta.category;
-            a->fatsv_emitted_squawk = a->meta.squawk;
-            a->fatsv_emitted_nac_p = a->meta.nac_p;
-            a->fatsv_emitted_nac_v = a->meta.nac_v;
-            a->fatsv_emitted_sil = a->meta.sil;
-            a->fatsv_emitted_sil_type = a->meta.sil_type;
-            a->fatsv_emitted_nic_baro = a->meta.nic_baro;
-            a->fatsv_emitted_emergency = a->meta.emergency;
-            a->fatsv_last_emitted = now;
-            if (forceEmit) {
-                a->fatsv_last_force_emit = now;
-            }
-        }
+    if (lag > c->lag_max)
+        c->lag_max = lag;
+    if (c->dropped_count != c->dropped_reported && now >= c->next_lag_report) {
+        clientLagReport(c, lag);
+        c->next_lag_report = now + NET_LAG_REPORT_INTERVAL;
     }
 }
 
-void modesNetSecondWork(void) {
+// Once a second housekeeping of the clients, on the thread running the event loop
+
+static void netSecondWork(uint64_t now) {
     struct client *c, **prev;
     struct net_service *s;
-    uint64_t now = mstime();
 
+    // Clients waiting on EPOLLOUT are not written to until the socket drains,
+    // so catch the ones that never do here.
     for (s = Modes.services; s; s = s->next) {
-        if (s->read_handler)
+        if (!s->writer)
             continue;
         for (c = s->clients; c; c = c->next) {
             if (!c->service)
                 continue;
-            if (c->last_read + 30000 < now) {
-                // This is called if there is no read handler - we just read and discard to try to trigger socket errors
-                // (if 30 sec have passed)
-                periodicReadFromClient(c);
-                c->last_read = now;
-            }
-        }
-    }
-
-    // If we have generated no messages for a while, send
-    // a heartbeat
-    if (Modes.net_heartbeat_interval) {
-        for (s = Modes.services; s; s = s->next) {
-            if (s->writer &&
-                    s->connections &&
-                    s->writer->send_heartbeat &&
-                    (s->writer->lastWrite + Modes.net_heartbeat_interval) <= now) {
-                s->writer->send_heartbeat(s);
+            if (c->sendq_len && c->last_flush + clientStallTimeout(c) < now) {
+                fprintf(stderr, "%s: Unable to send data, disconnecting: %s port %s (fd %d, SendQ %d)\n", c->service->descr, c->host, c->port, c->fd, c->sendq_len);
+                modesCloseClient(c);
+                continue;
             }
+            clientLagWork(c, now);
         }
     }
 
     // Unlink and free closed clients
     for (s = Modes.services; s; s = s->next) {
         for (prev = &s->clients, c = *prev; c; c = *prev) {
-            if (c->fd == -1) {
-                // Recently closed, prune from list
+            if (c->fd == -1 && !c->uring_recv && !c->uring_send_last) {
+                // Recently closed and no I/O in flight, prune from list
                 *prev = c->next;
-                free(c);
+                clientFree(c);
             } else {
                 prev = &c->next;
             }
@@ -3133,47 +5262,211 @@ void modesNetSecondWork(void) {
 }
 
 //
-// Perform periodic network work
+// Add the statistics counted while reading network input to Modes.stats_current.
+// The network thread keeps its own, the decoding thread merges and resets
+// Modes.stats_current without atomics.
 //
 
-void modesNetPeriodicWork(void) {
-    struct client *c;
-    struct net_service *s;
-    uint64_t now = mstime();
-    static uint64_t next_tcp_json;
-    static uint64_t next_accept;
+void modesNetMergeStats(void) {
+    pthread_mutex_lock(&net_stats_mutex);
+    add_stats(&Modes.stats_current, &net_stats, &Modes.stats_current);
+    reset_stats(&net_stats);
+    pthread_mutex_unlock(&net_stats_mutex);
+}
+
+void modesNetSecondWork(void) {
+    if (!net_threaded) {
+        netSecondWork(mstime());
+        return;
+    }
 
-    // Accept new connections
-    if (now > next_accept) {
-        next_accept = modesAcceptClients(now);
+    trackLockOutput();
+    for (struct net_service *s = Modes.services; s; s = s->next) {
+        if (s->output_dropped) {
+            fprintf(stderr, "%s: Network thread not keeping up, dropped %u blocks of output\n", s->descr, s->output_dropped);
+            s->output_dropped = 0;
+        }
     }
+    trackUnlockOutput();
+}
 
-    // Read from clients, and if any need flushing, do so.
-    for (s = Modes.services; s; s = s->next) {
-        for (c = s->clients; c; c = c->next) {
-            if (!c->service)
-                continue;
+// Read from a client that signalled readiness or still has input pending
+
+static void netReadClient(struct client *c) {
+    int more;
+
+    if (c->udp) {
+        more = netUdpReadClient(c);
+    } else if (c->uring) {
+        more = netUringReadClient(c);
+    } else if (c->service->read_handler) {
+        more = modesReadFromClient(c);
+    } else {
+        more = discardFromClient(c);
+    }
+
+    if (!c->service) // closed, modesCloseClient dropped any pending state
+        return;
 
-            if (s->read_handler) {
-                modesReadFromClient(c);
+    if (more && !c->read_pending) {
+        c->read_pending = 1;
+        net_read_pending++;
+    } else if (!more && c->read_pending) {
+        c->read_pending = 0;
+        net_read_pending--;
+    }
+}
+
+// Deadline driven work, run when the timerfd fires
+
+static void netTimerWork(uint64_t now) {
+    if (next_accept_retry && next_accept_retry <= now) {
+        next_accept_retry = 0;
+        for (struct net_service *s = Modes.services; s; s = s->next) {
+            if (serviceAccept(s)) {
+                suspendAccept(now);
+                break;
             }
+        }
+        netUringRearm();
+    }
 
-            // If there is a sendq, try to flush it
-            if (s->writer) {
-                if (c->sendq_len == 0) {
-                    c->last_flush = now;
-                    continue;
+    serviceReconnectCallback(now);
+}
+
+// Wait up to timeout milliseconds for network events and handle them
+
+static void netDispatch(int timeout) {
+    struct epoll_event events[NET_MAX_EVENTS];
+    uint64_t now;
+    int n;
+
+    if (net_epfd < 0)
+        return;
+
+    // With input pending, only back off briefly while the decoder catches up
+    if (net_read_pending)
+        timeout = net_input_blocked ? 1 : 0;
+    net_input_blocked = false;
+
+    // Output held back for a full SendQ is retried when a client could send,
+    // or when the hold is over
+    if (net_output_held) {
+        uint64_t now = mstime();
+        int left = net_output_held > now ? (int) (net_output_held - now) : 0;
+        if (timeout < 0 || left < timeout)
+            timeout = left;
+    }
+
+    netUringFlush();
+
+    n = epoll_wait(net_epfd, events, NET_MAX_EVENTS, timeout);
+    if (n < 0) {
+        if (errno != EINTR)
+            fprintf(stderr, "epoll_wait failed: %s\n", strerror(errno));
+        n = 0;
+    }
+
+    now = mstime();
+    for (int i = 0; i < n; i++) {
+        struct net_event_tag *tag = events[i].data.ptr;
+        uint32_t ev = events[i].events;
+
+        switch (tag->type) {
+            case NET_EVENT_LISTENER:
+                if (!next_accept_retry && serviceAccept(tag->owner))
+                    suspendAccept(now);
+                break;
+
+            case NET_EVENT_CLIENT:
+            {
+                // closed clients stay allocated until netSecondWork,
+                // so stale events from this batch are safe to skip
+                struct client *c = tag->owner;
+                if (c->service && (ev & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                    netReadClient(c);
+                if (c->service && (ev & EPOLLOUT) && c->epollout)
+                    flushClient(c, now);
+                break;
+            }
+
+            case NET_EVENT_CONNECTOR:
+            {
+                struct net_connector *con = tag->owner;
+                if (con->connecting)
+                    checkServiceConnected(con);
+                break;
+            }
+
+            case NET_EVENT_TIMER:
+            {
+                uint64_t expirations;
+                if (read(net_timerfd, &expirations, sizeof (expirations)) < 0 && errno != EAGAIN) {
+                    fprintf(stderr, "Network timer read failed: %s\n", strerror(errno));
                 }
-                flushClient(c, now);
+                net_timer_deadline = 0;
+                netTimerWork(now);
+                break;
+            }
+
+            case NET_EVENT_QUEUE:
+                // leave the rest for the next pass, so clients waiting
+                // on EPOLLOUT get written to in between
+                netQueueClearEvent(&net_output_queue);
+                if (netDrainOutput(NET_OUTPUT_DRAIN_MAX))
+                    netQueueRearm(&net_output_queue);
+                break;
+
+            case NET_EVENT_URING:
+                netUringWork(now);
+                break;
+        }
+    }
+
+    // Clients that hit the read limit get another turn without a new edge
+    if (net_read_pending) {
+        for (struct net_service *s = Modes.services; s; s = s->next) {
+            for (struct client *c = s->clients; c; c = c->next) {
+                if (c->service && c->read_pending)
+                    netReadClient(c);
             }
         }
     }
 
-    // Generate FATSV output
-    writeFATSV();
+    if (net_output_held && netDrainOutput(NET_OUTPUT_DRAIN_MAX))
+        netQueueRearm(&net_output_queue);
+
+    netUringFlush();
+    netArmTimer(mstime());
+}
+
+// Earliest deadline of netWriterWork, 0 if none
+
+static uint64_t netWriterDeadline(void) {
+    uint64_t deadline = 0;
+
+    for (struct net_service *s = Modes.services; s; s = s->next) {
+        if (!s->writer || !serviceConnections(s))
+            continue;
+        if (s->writer->dataUsed)
+            deadline = earliest(deadline, s->writer->lastWrite + Modes.net_output_flush_interval);
+        if (Modes.net_heartbeat_interval && s->writer->send_heartbeat)
+            deadline = earliest(deadline, s->writer->lastWrite + Modes.net_heartbeat_interval);
+    }
+
+    if (Modes.vrs_out.service && serviceConnections(Modes.vrs_out.service))
+        deadline = earliest(deadline, next_tcp_json);
+
+    return deadline;
+}
+
+// Writer side deadlines, on the decoding thread which owns the writers
+
+static void netWriterWork(uint64_t now) {
+    struct net_service *s;
 
     // supply JSON to vrs_out writer
-    if (Modes.vrs_out.service && Modes.vrs_out.service->connections && now >= next_tcp_json) {
+    if (Modes.vrs_out.service && serviceConnections(Modes.vrs_out.service) && now >= next_tcp_json) {
         static int part;
         int n_parts = 1 << 3; // must be power of 2
         writeJsonToNet(&Modes.vrs_out, generateVRS(part, n_parts));
@@ -3192,39 +5485,143 @@ void modesNetPeriodicWork(void) {
         }
     }
 
-    serviceReconnectCallback(now);
+    // If we have generated no messages for a while, send
+    // a heartbeat
+    if (Modes.net_heartbeat_interval) {
+        for (s = Modes.services; s; s = s->next) {
+            if (s->writer &&
+                    serviceConnections(s) &&
+                    s->writer->send_heartbeat &&
+                    (s->writer->lastWrite + Modes.net_heartbeat_interval) <= now) {
+                s->writer->send_heartbeat(s);
+            }
+        }
+    }
 }
 
-void writeJsonToNet(struct net_writer *writer, struct char_buffer cb) {
-    int len = cb.len;
-    int written = 0;
-    char *content = cb.buffer;
-    char *pos;
-    int bytes = MODES_OUT_BUF_SIZE / 2;
-
-    char *p = prepareWrite(writer, bytes);
-    if (!p) {
-        free(content);
+//
+// Perform periodic network work
+//
+
+void modesNetPeriodicWork(void) {
+    if (net_threaded) {
+        netDrainInput();
+    } else {
+        netDispatch(0);
+    }
+
+    // input above was only queued for the tracking threads, if any
+    trackLockShards();
+    netWriterWork(mstime());
+
+    // Generate FATSV output
+    writeFATSV();
+    trackUnlockShards();
+}
+
+//
+// Block until network events arrive or timeout milliseconds have passed,
+// handling whatever is ready. Used instead of sleeping by the idle loops.
+//
+
+void modesNetWait(int timeout) {
+    uint64_t now = mstime();
+    uint64_t deadline;
+
+    trackLockOutput();
+    deadline = netWriterDeadline();
+    trackUnlockOutput();
+
+    // don't oversleep output flushes and heartbeats
+    if (deadline && deadline < now + timeout)
+        timeout = (deadline > now) ? (int) (deadline - now) : 0;
+
+    if (!net_threaded) {
+        netDispatch(timeout);
         return;
     }
 
-    pos = content;
+    struct pollfd pfd = {net_input_queue.eventfd, POLLIN, 0};
+    if (poll(&pfd, 1, timeout) > 0)
+        netQueueClearEvent(&net_input_queue);
+    netDrainInput();
+}
+
+static void *netThreadEntryPoint(void *arg) {
+    uint64_t next_second = 0;
+    MODES_NOTUSED(arg);
 
-    while (p && written < len) {
-        if (bytes > len - written) {
-            bytes = len - written;
+    while (!atomic_load(&net_thread_stop)) {
+        netDispatch(1000);
+
+        uint64_t now = mstime();
+        if (now >= next_second) {
+            netSecondWork(now);
+            next_second = now + 1000;
         }
-        memcpy(p, pos, bytes);
-        p += bytes;
-        pos += bytes;
-        written += bytes;
-        completeWrite(writer, p);
+    }
+
+    // hand on what the writers flushed last
+    netDrainOutput(UINT_MAX);
+    return NULL;
+}
+
+//
+// Move the event loop onto its own thread. Called once after modesInitNet().
+//
+
+void modesNetStartThread(void) {
+    if (net_threaded || net_epfd < 0)
+        return;
+
+    if (!netQueueInit(&net_input_queue, NET_INPUT_QUEUE_SIZE) || !netQueueInit(&net_output_queue, NET_OUTPUT_QUEUE_SIZE)) {
+        fprintf(stderr, "Out of memory allocating network queues\n");
+        exit(1);
+    }
+    netEventCtl(EPOLL_CTL_ADD, net_output_queue.eventfd, EPOLLIN | EPOLLET, &net_output_tag);
+
+    atomic_store(&net_thread_stop, false);
+    net_threaded = true;
+    if (pthread_create(&net_thread, NULL, netThreadEntryPoint, NULL)) {
+        fprintf(stderr, "Unable to create network thread: %s\n", strerror(errno));
+        exit(1);
+    }
+}
+
+void modesNetStopThread(void) {
+    uint64_t one = 1;
+    struct net_service *s;
+
+    if (!net_threaded)
+        return;
+
+    // send what was output since the last flush, tracking threads may
+    // have added to it after the last background pass
+    for (s = Modes.services; s; s = s->next) {
+        if (s->writer && s->writer->dataUsed)
+            flushWrites(s->writer);
+    }
 
-        p = prepareWrite(writer, bytes);
+    atomic_store(&net_thread_stop, true);
+    // wake the event loop
+    if (write(net_output_queue.eventfd, &one, sizeof (one)) < 0) {
+        fprintf(stderr, "Unable to wake network thread: %s\n", strerror(errno));
     }
+    pthread_join(net_thread, NULL);
+    net_threaded = false;
+
+    netQueueDestroy(&net_input_queue);
+    netQueueDestroy(&net_output_queue);
+}
 
-    flushWrites(writer);
-    free(content);
+void writeJsonToNet(struct net_writer *writer, struct char_buffer cb) {
+    // Send the document as one chunk, so it is never split by a client
+    // shedding its SendQ
+    if (prepareWrite(writer, 0)) {
+        flushWrites(writer);
+        netSendChunk(writer, cb.buffer, cb.len);
+    }
+    free(cb.buffer);
 }
 
 struct char_buffer generateVRS(int part, int n_parts) {
@@ -3235,16 +5632,23 @@ struct char_buffer generateVRS(int part, int n_parts) {
     char *buf = (char *) malloc(buflen), *p = buf, *end = buf + buflen;
     char *line_start;
     int first = 1;
-    int part_len = AIRCRAFTS_BUCKETS / n_parts;
-    int part_start = part * part_len;
 
     _messageNow = now;
 
     p = safe_snprintf(p, end,
             "{\"acList\":[");
 
-    for (int j = part_start; j < part_start + part_len; j++) {
-        for (a = Modes.aircrafts[j]; a; a = a->next) {
+    for (int s = 0; s < Modes.track_threads; s++) {
+        struct track_shard *sh = &Modes.track_shards[s];
+        // Each part is a range of every shard of the aircraft table. An aircraft
+        // moved by a removal in between parts may be skipped or repeated for one
+        // cycle.
+        unsigned part_len = (sh->aircraft_count + n_parts - 1) / n_parts;
+        unsigned part_start = part * part_len;
+        unsigned part_end = min(part_start + part_len, sh->aircraft_count);
+
+        for (unsigned j = part_start; j < part_end; j++) {
+            a = &sh->aircrafts[j];
             if (a->meta.messages < 2) { // basic filter for bad decodes
                 continue;
             }
@@ -3260,7 +5664,7 @@ struct char_buffer generateVRS(int part, int n_parts) {
             else
                 *p++ = ',';
 
-retry:
+    retry:
             line_start = p;
             p = safe_snprintf(p, end, "{\"Sig\":%.0f",
                     255 * ((a->signalLevel[0] + a->signalLevel[1] + a->signalLevel[2] + a->signalLevel[3] +
@@ -3292,7 +5696,7 @@ retry:
 
             if (trackDataValid(&a->position_valid)) {
                 p = safe_snprintf(p, end, ",\"Lat\":%f,\"Long\":%f", a->meta.lat, a->meta.lon);
-                p = safe_snprintf(p, end, ",\"PosTime\":%"PRIu64, a->position_valid.updated);
+                p = safe_snprintf(p, end, ",\"PosTime\":%"PRIu64, trackDataUpdated(&a->position_valid));
             }
 
             if (a->position_valid.source == SOURCE_MLAT)
@@ -3401,18 +5805,19 @@ static void *pthreadGetaddrinfo(void *param) {
 }
 
 inline void cleanupNetwork(void) {
+    modesNetStopThread();
+    // cancels all I/O in flight
+    netUringStop();
+
     for (struct net_service *s = Modes.services; s; s = s->next) {
         struct client *c = s->clients, *nc;
         while (c) {
             nc = c->next;
 
             anetCloseSocket(c->fd);
-            c->sendq_len = 0;
-            if (c->sendq) {
-                free(c->sendq);
-                c->sendq = NULL;
-            }
-            free(c);
+            clientDropSendQ(c);
+            c->uring_buf = -1; // the buffer table is gone with the ring
+            clientFree(c);
 
             c = nc;
         }
@@ -3422,6 +5827,8 @@ inline void cleanupNetwork(void) {
     while (s) {
         ns = s->next;
         free(s->listener_fds);
+        free(s->uring_listeners);
+        serviceDeflateEnd(s);
         if (s->writer && s->writer->data) {
             free(s->writer->data);
             s->writer->data = NULL;
@@ -3445,4 +5852,22 @@ inline void cleanupNetwork(void) {
         free(con);
     }
     free(Modes.net_connectors);
+
+    for (int i = 0; i < Modes.net_udp_count; i++) {
+        free(Modes.net_udp[i]->address);
+        free(Modes.net_udp[i]);
+    }
+    free(Modes.net_udp);
+
+    free(net_dedup);
+    net_dedup = NULL;
+
+    if (net_timerfd >= 0) {
+        close(net_timerfd);
+        net_timerfd = -1;
+    }
+    if (net_epfd >= 0) {
+        close(net_epfd);
+        net_epfd = -1;
+    }
 }
@@ -32,12 +32,15 @@ struct aircraft;
 struct modesMessage;
 struct client;
 struct net_service;
+struct net_chunk;
+struct net_listener;
+struct net_uring_msg;
 typedef int (*read_fn)(struct client *, char *, int);
 typedef void (*heartbeat_fn)(struct net_service *);
 
 typedef enum {
     READ_MODE_IGNORE,
-    READ_MODE_BEAST,
+    READ_MODE_BEAST, // handler gets batches of unescaped frames
     READ_MODE_BEAST_COMMAND,
     READ_MODE_ASCII
 } read_mode_t;
@@ -49,12 +52,36 @@ typedef enum {
     PUSH_MODE_SBS,
 } push_mode_t;
 
+// Tags an epoll registration with the object owning the fd
+
+typedef enum {
+    NET_EVENT_LISTENER,
+    NET_EVENT_CLIENT,
+    NET_EVENT_CONNECTOR,
+    NET_EVENT_TIMER,
+    NET_EVENT_QUEUE,
+    NET_EVENT_URING
+} net_event_t;
+
+struct net_event_tag {
+    net_event_t type;
+    void *owner;
+};
+
+// What to do with an output client whose SendQ overflows
+
+typedef enum {
+    NET_SLOW_DISCONNECT = 0, // close the connection
+    NET_SLOW_DROP, // drop the queued output and carry on with the newest
+    NET_SLOW_REDUCE // move the client to the reduced Beast output
+} net_slow_policy_t;
+
 // Describes one network service (a group of clients with common behaviour)
 
 struct net_service {
     int listener_count; // number of listeners
     int pusher_count; // Number of push servers connected to
-    int connections; // number of active clients
+    int connections; // number of active clients, updated atomically
     read_mode_t read_mode;
     read_fn read_handler;
     struct net_writer *writer; // shared writer state
@@ -64,6 +91,15 @@ struct net_service {
     int read_sep_len;
     const char *descr;
     struct client *clients; // linked list of clients connected to this service
+    struct net_event_tag listener_tag; // shared by all listener FDs
+    struct net_chunk *chunk_tail; // newest output chunk still referenced by a client
+    net_slow_policy_t slow_policy; // SendQ overflow handling for clients
+    struct net_service *reduce_to; // service NET_SLOW_REDUCE moves clients to
+    struct net_listener *uring_listeners; // io_uring accept state, one per listener FD
+    struct net_deflate *deflate; // compressor, NULL unless the output is compressed
+    int udp; // 1 if the clients are UDP streams
+    uint32_t udp_seq; // sequence number of the next datagram, output only
+    unsigned output_dropped; // blocks of output the network thread had no room for, writer side
 };
 
 // Client connection
@@ -85,6 +121,29 @@ struct net_connector {
     int gai_request_in_progress;
     pthread_t thread;
     pthread_mutex_t *mutex;
+    struct net_event_tag tag; // registered while connecting
+    uint64_t messages; // Beast Mode S messages received, accessed atomically
+    uint64_t duplicates; // of those, dropped by --net-dedup-window
+};
+
+// UDP stream. Each datagram starts with a 32 bit big-endian sequence number
+// followed by whole messages, so receivers can tell when some went missing.
+
+struct net_udp {
+    char *address; // destination, or local address or multicast group to receive on
+    char *port;
+    char *protocol; // beast_out, raw_out or beast_in
+};
+
+// Sequence state of one sender to a UDP input
+
+#define NET_UDP_SENDERS 8 // senders tracked per UDP input
+
+struct net_udp_sender {
+    struct sockaddr_storage addr;
+    socklen_t addrlen; // 0 for an unused entry
+    uint32_t seq; // next datagram sequence number expected
+    uint64_t last; // time of the last datagram
 };
 
 // Structure used to describe a networking client
@@ -97,14 +156,36 @@ struct client {
     int modeac_requested; // 1 if this Beast output connection has asked for A/C
     uint64_t last_flush;
     uint64_t last_send;
-    uint64_t last_read; // This is used on write-only clients to help check for dead connections
+    int epollout; // 1 if waiting for the socket to become writable
+    int read_pending; // 1 if input may remain after hitting the per-event read limit
+    int input_blocked; // 1 if buffered input is waiting for room in the input queue
+    struct net_event_tag tag;
+    int uring; // 1 if I/O goes through io_uring instead of epoll
+    int uring_buf; // registered buffer index of buf, -1 if none
+    int uring_recv; // 1 while a read is in flight
+    int uring_cancel; // 1 once the send in flight has been cancelled
+    struct net_chunk *uring_send_last; // last chunk of the send in flight, NULL if none
+    struct net_uring_msg *uring_msg; // msghdr of the send in flight
     char buf[MODES_CLIENT_BUF_SIZE + 4]; // Read buffer+padding
-    void *sendq; // Write buffer - allocated later
+    struct net_chunk *sendq; // Oldest output chunk not yet fully sent, NULL if none
+    int sendq_offset; // Bytes of sendq already sent
     int sendq_len; // Amount of data in SendQ
     int sendq_max; // Max size of SendQ
+    uint64_t sendq_full_since; // when output was first held back for this client, 0 since it caught up
+    struct net_chunk *sendq_copy; // Private copy of a partly sent chunk heading the SendQ, or NULL
+    uint64_t lag_max; // Highest age of unsent output seen (milliseconds)
+    uint64_t dropped_bytes; // Output dropped by the slow consumer policy
+    unsigned dropped_count; // Number of times output was dropped
+    unsigned dropped_reported; // dropped_count at the last lag report
+    uint64_t next_lag_report;
     char host[NI_MAXHOST]; // For logging
     char port[NI_MAXSERV];
     struct net_connector *con;
+    struct net_inflate *inflate; // decompressor of a compressed Beast input, NULL if plain
+    uint64_t received; // input bytes read so far
+    int synced; // 1 once output began at a stream start, compressed output only
+    int udp; // 1 for a UDP stream
+    struct net_udp_sender udp_senders[NET_UDP_SENDERS]; // recent senders, input only
 };
 
 // Common writer state for all output sockets of one type
@@ -156,10 +237,15 @@ struct char_buffer {
 };
 
 void sendBeastSettings(int fd, const char *settings);
+bool netParseSlowPolicy(const char *arg, const char *protocol, net_slow_policy_t *policy);
 
 void modesInitNet(void);
+void modesNetWait(int timeout);
+void modesNetStartThread(void);
+void modesNetStopThread(void);
 void modesQueueOutput(struct modesMessage *mm, struct aircraft *a);
 void modesNetSecondWork(void);
+void modesNetMergeStats(void);
 void modesNetPeriodicWork(void);
 void cleanupNetwork(void);
 
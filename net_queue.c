@@ -0,0 +1,154 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// net_queue.c: Cross-thread queues between network I/O and decoding
+//
+// Copyright (c) 2020 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "net_queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+// Records are 8 byte aligned. A record that doesn't fit before the end of the
+// ring is placed at its start; the unused tail is marked with a wrap header,
+// or left unmarked if it is too short to hold one.
+
+struct net_queue_record {
+    void *owner;
+    uint32_t flags;
+    uint32_t len; // payload length, NET_QUEUE_WRAP for a wrap marker
+};
+
+#define NET_QUEUE_WRAP UINT32_MAX
+#define NET_QUEUE_ALIGN(n) (((n) + 7) & ~(size_t) 7)
+
+bool netQueueInit(struct net_queue *q, size_t size) {
+    size_t sz = 4096;
+    while (sz < size)
+        sz <<= 1;
+
+    if (!(q->data = aligned_alloc(64, sz)))
+        return false;
+
+    if ((q->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        free(q->data);
+        q->data = NULL;
+        return false;
+    }
+
+    q->mask = sz - 1;
+    q->peeked = 0;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    return true;
+}
+
+void netQueueDestroy(struct net_queue *q) {
+    if (q->data) {
+        free(q->data);
+        q->data = NULL;
+    }
+    if (q->eventfd >= 0) {
+        close(q->eventfd);
+        q->eventfd = -1;
+    }
+}
+
+bool netQueuePush(struct net_queue *q, void *owner, uint32_t flags, const void *data, uint32_t len) {
+    size_t size = q->mask + 1;
+    size_t need = NET_QUEUE_ALIGN(sizeof (struct net_queue_record) + (size_t) len + 1);
+    size_t old_tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+    size_t tail = old_tail;
+    size_t room = size - (tail & q->mask);
+
+    if (room < need) {
+        // skip the rest of the ring and start over at offset 0
+        if (tail + room + need - head > size)
+            return false;
+        if (room >= sizeof (struct net_queue_record)) {
+            struct net_queue_record *wrap = (struct net_queue_record *) (q->data + (tail & q->mask));
+            wrap->len = NET_QUEUE_WRAP;
+        }
+        tail += room;
+    } else if (tail + need - head > size) {
+        return false;
+    }
+
+    struct net_queue_record *rec = (struct net_queue_record *) (q->data + (tail & q->mask));
+    rec->owner = owner;
+    rec->flags = flags;
+    rec->len = len;
+    if (len)
+        memcpy(rec + 1, data, len);
+    ((char *) (rec + 1))[len] = 0;
+
+    // Publish, then check whether the consumer had already caught up with us.
+    // Both sides use sequentially consistent accesses here, so either the
+    // consumer sees the new tail or we see its head and wake it.
+    atomic_store(&q->tail, tail + need);
+    if (atomic_load(&q->head) == old_tail) {
+        uint64_t one = 1;
+        if (write(q->eventfd, &one, sizeof (one)) < 0) {
+            // counter saturated, the consumer is awake anyway
+        }
+    }
+    return true;
+}
+
+char *netQueuePeek(struct net_queue *q, void **owner, uint32_t *flags, uint32_t *len) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load(&q->tail);
+    size_t skip = 0;
+
+    if (head == tail)
+        return NULL;
+
+    size_t room = q->mask + 1 - (head & q->mask);
+    struct net_queue_record *rec = (struct net_queue_record *) (q->data + (head & q->mask));
+    if (room < sizeof (struct net_queue_record) || rec->len == NET_QUEUE_WRAP) {
+        skip = room;
+        rec = (struct net_queue_record *) q->data;
+    }
+
+    q->peeked = skip + NET_QUEUE_ALIGN(sizeof (struct net_queue_record) + (size_t) rec->len + 1);
+    *owner = rec->owner;
+    *flags = rec->flags;
+    *len = rec->len;
+    return (char *) (rec + 1);
+}
+
+void netQueueRelease(struct net_queue *q) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    atomic_store(&q->head, head + q->peeked);
+    q->peeked = 0;
+}
+
+void netQueueClearEvent(struct net_queue *q) {
+    uint64_t count;
+    if (read(q->eventfd, &count, sizeof (count)) < 0) {
+        // not signalled
+    }
+}
+
+void netQueueRearm(struct net_queue *q) {
+    uint64_t one = 1;
+    if (write(q->eventfd, &one, sizeof (one)) < 0) {
+        // counter saturated, it is readable anyway
+    }
+}
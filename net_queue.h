@@ -0,0 +1,65 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// net_queue.h: Cross-thread queues between network I/O and decoding
+//
+// Copyright (c) 2020 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef NET_QUEUE_H
+#define NET_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Single producer, single consumer byte ring carrying variable length
+// records. Each record has an owner pointer, a flags word and a payload,
+// which is always followed by a NUL byte so text can be handed on as is.
+//
+// The producer never blocks: a push that doesn't fit fails.
+// The eventfd becomes readable when a record is pushed into an empty queue,
+// so the consumer can sleep in poll/epoll; it should read the eventfd to
+// rearm it and then drain the queue completely.
+
+struct net_queue {
+    _Alignas(64) atomic_size_t head; // consumer position, written by the consumer only
+    size_t peeked; // consumer only: bytes the record returned by netQueuePeek() occupies
+    _Alignas(64) atomic_size_t tail; // producer position, written by the producer only
+    _Alignas(64) char *data;
+    size_t mask; // size - 1, size is a power of two
+    int eventfd;
+};
+
+// Create a queue of at least size bytes. Returns false on failure.
+bool netQueueInit(struct net_queue *q, size_t size);
+void netQueueDestroy(struct net_queue *q);
+
+// Producer side. Copies len bytes from data; returns false if the queue is full.
+bool netQueuePush(struct net_queue *q, void *owner, uint32_t flags, const void *data, uint32_t len);
+
+// Consumer side. Returns the payload of the oldest record, or NULL if the queue
+// is empty. The payload stays valid and writable until netQueueRelease().
+char *netQueuePeek(struct net_queue *q, void **owner, uint32_t *flags, uint32_t *len);
+void netQueueRelease(struct net_queue *q);
+
+// Consumer side. Clear the eventfd after a wakeup.
+void netQueueClearEvent(struct net_queue *q);
+
+// Consumer side. Make the eventfd readable again, for a consumer that stops
+// before the queue is empty and wants to be woken to carry on.
+void netQueueRearm(struct net_queue *q);
+
+#endif
@@ -0,0 +1,222 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// net_uring.c: Minimal io_uring ring handling for network I/O
+//
+// Copyright (c) 2020 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "net_uring.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+static int uringSetup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uringRegister(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// Check the kernel knows all opcodes in ops
+
+static bool uringProbe(struct net_uring *r, const int *ops) {
+    size_t size = sizeof (struct io_uring_probe) + 256 * sizeof (struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    bool ok = true;
+
+    if (!probe)
+        return false;
+    if (uringRegister(r->fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        free(probe);
+        return false;
+    }
+    for (; *ops >= 0; ops++) {
+        if (*ops > probe->last_op || !(probe->ops[*ops].flags & IO_URING_OP_SUPPORTED)) {
+            errno = EOPNOTSUPP;
+            ok = false;
+        }
+    }
+    free(probe);
+    return ok;
+}
+
+bool netUringInit(struct net_uring *r, unsigned entries, unsigned nr_buffers, const int *ops) {
+    struct io_uring_params p;
+
+    memset(r, 0, sizeof (*r));
+    memset(&p, 0, sizeof (p));
+    // completions of all clients may pile up between two passes
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 8;
+
+    if ((r->fd = uringSetup(entries, &p)) < 0)
+        return false;
+
+    r->features = p.features;
+    r->sq_entries = p.sq_entries;
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+    r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+    r->sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+
+    if (r->features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_ring_size > r->sq_ring_size)
+            r->sq_ring_size = r->cq_ring_size;
+        r->cq_ring_size = r->sq_ring_size;
+    }
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED)
+        goto fail;
+    if (r->features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ring = r->sq_ring;
+    } else {
+        r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED)
+            goto fail;
+    }
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        goto fail;
+
+    r->sq_head = (unsigned *) ((char *) r->sq_ring + p.sq_off.head);
+    r->sq_tail = (unsigned *) ((char *) r->sq_ring + p.sq_off.tail);
+    r->sq_mask = (unsigned *) ((char *) r->sq_ring + p.sq_off.ring_mask);
+    r->sq_flags = (unsigned *) ((char *) r->sq_ring + p.sq_off.flags);
+    r->sq_array = (unsigned *) ((char *) r->sq_ring + p.sq_off.array);
+    r->cq_head = (unsigned *) ((char *) r->cq_ring + p.cq_off.head);
+    r->cq_tail = (unsigned *) ((char *) r->cq_ring + p.cq_off.tail);
+    r->cq_mask = (unsigned *) ((char *) r->cq_ring + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *) ((char *) r->cq_ring + p.cq_off.cqes);
+    r->sq_queued = *r->sq_tail;
+
+    if (!uringProbe(r, ops))
+        goto fail;
+
+    if (nr_buffers) {
+        struct io_uring_rsrc_register reg;
+
+        memset(&reg, 0, sizeof (reg));
+        reg.nr = nr_buffers;
+        reg.flags = IORING_RSRC_REGISTER_SPARSE;
+        if (uringRegister(r->fd, IORING_REGISTER_BUFFERS2, &reg, sizeof (reg)) == 0)
+            r->nr_buffers = nr_buffers;
+    }
+    return true;
+
+fail:
+    {
+        int err = errno;
+        netUringDestroy(r);
+        errno = err;
+    }
+    return false;
+}
+
+void netUringDestroy(struct net_uring *r) {
+    if (r->sqes && r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring && r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring)
+        munmap(r->cq_ring, r->cq_ring_size);
+    if (r->sq_ring && r->sq_ring != MAP_FAILED)
+        munmap(r->sq_ring, r->sq_ring_size);
+    if (r->fd >= 0)
+        close(r->fd);
+    memset(r, 0, sizeof (*r));
+    r->fd = -1;
+}
+
+struct io_uring_sqe *netUringGetSqe(struct net_uring *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+
+    if (r->sq_queued - head >= r->sq_entries) {
+        if (netUringSubmit(r) <= 0)
+            return NULL;
+        head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        if (r->sq_queued - head >= r->sq_entries)
+            return NULL;
+    }
+
+    unsigned index = r->sq_queued & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof (*sqe));
+    r->sq_array[index] = index;
+    r->sq_queued++;
+    return sqe;
+}
+
+int netUringSubmit(struct net_uring *r) {
+    // anything the kernel didn't take last time is still in the ring
+    unsigned to_submit = r->sq_queued - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    unsigned flags = 0;
+    int ret;
+
+    if (__atomic_load_n(r->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW)
+        flags |= IORING_ENTER_GETEVENTS;
+    if (!to_submit && !flags)
+        return 0;
+
+    __atomic_store_n(r->sq_tail, r->sq_queued, __ATOMIC_RELEASE);
+    do {
+        ret = uringEnter(r->fd, to_submit, 0, flags);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret < 0 ? -errno : ret;
+}
+
+struct io_uring_cqe *netUringPeekCqe(struct net_uring *r) {
+    unsigned head = *r->cq_head;
+
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        // completions held back on overflow only show up after entering the kernel
+        if (!(__atomic_load_n(r->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW))
+            return NULL;
+        if (uringEnter(r->fd, 0, 0, IORING_ENTER_GETEVENTS) < 0)
+            return NULL;
+        if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+            return NULL;
+    }
+    return &r->cqes[head & *r->cq_mask];
+}
+
+void netUringCqeSeen(struct net_uring *r) {
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+bool netUringSetBuffer(struct net_uring *r, unsigned index, void *base, size_t len) {
+    struct io_uring_rsrc_update2 up;
+    struct iovec iov;
+
+    if (index >= r->nr_buffers)
+        return false;
+
+    iov.iov_base = base;
+    iov.iov_len = base ? len : 0;
+    memset(&up, 0, sizeof (up));
+    up.offset = index;
+    up.data = (uint64_t) (uintptr_t) &iov;
+    up.nr = 1;
+    return uringRegister(r->fd, IORING_REGISTER_BUFFERS_UPDATE, &up, sizeof (up)) == 1;
+}
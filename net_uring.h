@@ -0,0 +1,72 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// net_uring.h: Minimal io_uring ring handling for network I/O
+//
+// Copyright (c) 2020 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef NET_URING_H
+#define NET_URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+// One io_uring instance, used from a single thread. Talks to the kernel
+// through the raw system calls, so there is no dependency on liburing.
+//
+// SQEs taken with netUringGetSqe() are queued locally and handed to the
+// kernel in one system call by netUringSubmit(). The ring fd is pollable,
+// it becomes readable when completions are available.
+
+struct net_uring {
+    int fd;
+    unsigned features; // IORING_FEAT_*
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_flags, *sq_array;
+    unsigned sq_entries;
+    unsigned sq_queued; // local tail, published by netUringSubmit()
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    unsigned nr_buffers; // size of the sparse registered buffer table, 0 if none
+};
+
+// Set up a ring with room for entries SQEs and a sparse table of nr_buffers
+// registered buffers. The buffer table is optional; if the kernel doesn't
+// support it, nr_buffers is 0 afterwards. Returns false if io_uring or one
+// of the operations in ops (terminated by -1) is not available, errno tells
+// why.
+bool netUringInit(struct net_uring *r, unsigned entries, unsigned nr_buffers, const int *ops);
+void netUringDestroy(struct net_uring *r);
+
+// Returns a cleared SQE, submitting queued ones if the ring is full.
+// NULL if that failed.
+struct io_uring_sqe *netUringGetSqe(struct net_uring *r);
+
+// Hand queued SQEs to the kernel. Returns the number submitted or -errno.
+int netUringSubmit(struct net_uring *r);
+
+// Oldest completion, or NULL if there is none. Completions the kernel had to
+// hold back on CQ overflow are fetched as well.
+struct io_uring_cqe *netUringPeekCqe(struct net_uring *r);
+void netUringCqeSeen(struct net_uring *r);
+
+// Point slot index of the registered buffer table at base/len, or clear it
+// with base NULL.
+bool netUringSetBuffer(struct net_uring *r, unsigned index, void *base, size_t len);
+
+#endif
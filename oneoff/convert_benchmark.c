@@ -103,6 +103,8 @@ void test(const char *what, input_format_t format, void **data, double sample_ra
         return;
     }
 
+    fprintf(stderr, "(%s) ", converter_description(converter));
+
     struct timespec total = { 0, 0 };
     int iterations = 0;
 
@@ -146,6 +146,8 @@ static void modesInitConfig(void) {
     }
 
     Modes.preambleThreshold = PREAMBLE_THRESHOLD_DEFAULT;
+    Modes.demod_threads = 1;
+    Modes.track_threads = 1;
     if (nprocs < 2) {
         Modes.preambleThreshold = PREAMBLE_THRESHOLD_PIZERO;
     }
@@ -162,6 +164,7 @@ static void modesInitConfig(void) {
     Modes.net_input_beast_ports = strdup("0");
     Modes.net_output_beast_ports = strdup("0");
     Modes.net_output_beast_reduce_ports = strdup("0");
+    Modes.net_output_beast_deflate_ports = strdup("0");
     Modes.net_output_beast_reduce_interval = 125;
     Modes.net_output_vrs_ports = strdup("0");
     Modes.net_connector_delay = 30 * 1000;
@@ -174,6 +177,7 @@ static void modesInitConfig(void) {
     Modes.biastee = 0;
     Modes.filter_persistence = 2;
     Modes.net_sndbuf_size = 2; // Default to 256 kB network write buffers
+    Modes.net_uring = 1;
     Modes.net_output_flush_size = 1200; // Default to 1200 Bytes
     Modes.net_output_flush_interval = 50; // Default to 50 ms
     Modes.basestation_is_mlat = 1;
@@ -241,6 +245,8 @@ static void modesInit(void) {
     modesChecksumInit(Modes.nfix_crc);
     icaoFilterInit();
     modeACInit();
+    trackInit();
+    demod2400Init();
 
     if (Modes.show_only)
         icaoFilterAdd(Modes.show_only);
@@ -329,7 +335,9 @@ static void backgroundTasks(void) {
     uint64_t now = mstime();
 
     icaoFilterExpire();
+    trackLockShards();
     trackPeriodicUpdate();
+    trackUnlockShards();
 
     if (Modes.net) {
         modesNetPeriodicWork();
@@ -339,6 +347,11 @@ static void backgroundTasks(void) {
         }
     }
 
+    // aircraft and statistics stay still from here on
+    trackLockShards();
+    trackMergeStats();
+    if (Modes.net)
+        modesNetMergeStats();
 
     // Refresh screen when in interactive mode
     if (Modes.interactive) {
@@ -370,6 +383,7 @@ static void backgroundTasks(void) {
             reset_stats(&Modes.stats_15min);
             for (i = 0; i < 15; ++i)
                 add_stats(&Modes.stats_1min[i], &Modes.stats_15min, &Modes.stats_15min);
+            demod2400UpdateThreshold();
 
             reset_stats(&Modes.stats_current);
             Modes.stats_current.start = Modes.stats_current.end = now;
@@ -426,6 +440,8 @@ static void backgroundTasks(void) {
         Modes.aircraft_history_next = (Modes.aircraft_history_next + 1) % HISTORY_SIZE;
         next_history = now + HISTORY_INTERVAL;
     }
+
+    trackUnlockShards();
 }
 
 //=========================================================================
@@ -446,26 +462,23 @@ static void cleanup_and_exit(int code) {
     free(Modes.net_input_beast_ports);
     free(Modes.net_output_beast_ports);
     free(Modes.net_output_beast_reduce_ports);
+    free(Modes.net_output_beast_deflate_ports);
     free(Modes.net_output_vrs_ports);
     free(Modes.net_input_raw_ports);
     free(Modes.net_output_raw_ports);
     free(Modes.net_output_sbs_ports);
     free(Modes.net_input_sbs_ports);
+    free(Modes.net_slow_policy);
     free(Modes.beast_serial);
-    /* Go through tracked aircraft chain and free up any used memory */
-    for (int j = 0; j < AIRCRAFTS_BUCKETS; j++) {
-        struct aircraft *a = Modes.aircrafts[j], *na;
-        while (a) {
-            na = a->next;
-            if (a) free(a);
-            a = na;
-        }
-    }
+    trackCleanup();
+    geomag_cleanup();
 
     fifo_destroy();
 
     crcCleanupTables();
 
+    icaoFilterCleanup();
+
     cleanupNetwork();
 
     exit(code);
@@ -503,6 +516,15 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
         case OptPreambleThreshold:
             Modes.preambleThreshold = (uint32_t) (max(min(strtoll(arg, NULL, 10), PREAMBLE_THRESHOLD_MAX), PREAMBLE_THRESHOLD_MIN));
             break;
+        case OptDemodThreads:
+            Modes.demod_threads = max(min(atoi(arg), DEMOD_MAX_THREADS), 1);
+            break;
+        case OptDemodFused:
+            Modes.demod_fused = 1;
+            break;
+        case OptTrackThreads:
+            Modes.track_threads = max(min(atoi(arg), TRACK_MAX_THREADS), 1);
+            break;
         case OptNet:
             Modes.net = 1;
             break;
@@ -613,6 +635,10 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
             free(Modes.net_output_beast_reduce_ports);
             Modes.net_output_beast_reduce_ports = strdup(arg);
             break;
+        case OptNetBeastDeflatePorts:
+            free(Modes.net_output_beast_deflate_ports);
+            Modes.net_output_beast_deflate_ports = strdup(arg);
+            break;
         case OptNetBeastReduceInterval:
             if (atof(arg) >= 0)
                 Modes.net_output_beast_reduce_interval = (uint64_t) (1000 * atof(arg));
@@ -638,9 +664,21 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
         case OptNetBuffer:
             Modes.net_sndbuf_size = atoi(arg);
             break;
+        case OptNetSlowPolicy:
+            if (!netParseSlowPolicy(arg, NULL, NULL))
+                return 1;
+            free(Modes.net_slow_policy);
+            Modes.net_slow_policy = strdup(arg);
+            break;
         case OptNetVerbatim:
             Modes.net_verbatim = 1;
             break;
+        case OptNetNoUring:
+            Modes.net_uring = 0;
+            break;
+        case OptNetDedupWindow:
+            Modes.net_dedup_window = max(atoi(arg), 0);
+            break;
         case OptNetConnector:
             if (!Modes.net_connectors || Modes.net_connectors_count + 1 > Modes.net_connectors_size) {
                 Modes.net_connectors_size = Modes.net_connectors_count * 2 + 8;
@@ -663,6 +701,7 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
             }
             if (strcmp(con->protocol, "beast_out") != 0
                     && strcmp(con->protocol, "beast_reduce_out") != 0
+                    && strcmp(con->protocol, "beast_deflate_out") != 0
                     && strcmp(con->protocol, "beast_in") != 0
                     && strcmp(con->protocol, "raw_out") != 0
                     && strcmp(con->protocol, "raw_in") != 0
@@ -670,7 +709,7 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
                     && strcmp(con->protocol, "sbs_in") != 0
                     && strcmp(con->protocol, "sbs_out") != 0) {
                 fprintf(stderr, "--net-connector: Unknown protocol: %s\n", con->protocol);
-                fprintf(stderr, "Supported protocols: beast_out, beast_in, beast_reduce_out, raw_out, raw_in, sbs_out, sbs_in, vrs_out\n");
+                fprintf(stderr, "Supported protocols: beast_out, beast_in, beast_reduce_out, beast_deflate_out, raw_out, raw_in, sbs_out, sbs_in, vrs_out\n");
                 return 1;
             }
             if (strcmp(con->address, "") == 0 || strcmp(con->address, "") == 0) {
@@ -683,6 +722,39 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
                 return 1;
             }
             break;
+        case OptNetUdp:
+            if (!Modes.net_udp || Modes.net_udp_count + 1 > Modes.net_udp_size) {
+                Modes.net_udp_size = Modes.net_udp_count * 2 + 8;
+                Modes.net_udp = realloc(Modes.net_udp,
+                        sizeof (struct net_udp *) * Modes.net_udp_size);
+                if (!Modes.net_udp)
+                    return 1;
+            }
+            struct net_udp *udp = calloc(1, sizeof (struct net_udp));
+            if (!udp)
+                return 1;
+            Modes.net_udp[Modes.net_udp_count++] = udp;
+            char *udp_string = strdup(arg);
+            udp->address = strtok(udp_string, ",");
+            udp->port = strtok(NULL, ",");
+            udp->protocol = strtok(NULL, ",");
+            if (!udp->address || !udp->port || !udp->protocol) {
+                fprintf(stderr, "--net-udp: Wrong format: %s\n", arg);
+                fprintf(stderr, "Correct syntax: --net-udp=ip,port,protocol\n");
+                return 1;
+            }
+            if (strcmp(udp->protocol, "beast_out") != 0
+                    && strcmp(udp->protocol, "raw_out") != 0
+                    && strcmp(udp->protocol, "beast_in") != 0) {
+                fprintf(stderr, "--net-udp: Unknown protocol: %s\n", udp->protocol);
+                fprintf(stderr, "Supported protocols: beast_out, raw_out, beast_in\n");
+                return 1;
+            }
+            if (atol(udp->port) > 65535 || atol(udp->port) < 1) {
+                fprintf(stderr, "--net-udp: port must be in range 1 to 65535\n");
+                return 1;
+            }
+            break;
         case OptNetConnectorDelay:
             Modes.net_connector_delay = (uint64_t) 1000 * atof(arg);
             break;
@@ -769,8 +841,12 @@ int main(int argc, char **argv) {
 
     if (Modes.net) {
         modesInitNet();
+        // network I/O gets its own thread so it can't stall demodulation
+        modesNetStartThread();
     }
 
+    trackStartThreads();
+
     // init stats:
     Modes.stats_current.start = Modes.stats_current.end =
             Modes.stats_alltime.start = Modes.stats_alltime.end =
@@ -808,37 +884,27 @@ int main(int argc, char **argv) {
 
             //fprintf(stderr, "%ld\n", sleep_millis);
 
-            slp.tv_nsec = sleep_millis * 1000 * 1000;
-            nanosleep(&slp, NULL);
+            if (Modes.net) {
+                // sleep in the network event loop so client I/O is handled as it arrives
+                modesNetWait(sleep_millis);
+            } else {
+                slp.tv_nsec = sleep_millis * 1000 * 1000;
+                nanosleep(&slp, NULL);
+            }
         }
     } else {
         int watchdogCounter = 10; // about 1 second
 
         // Create the thread that will read the data from the device.
         pthread_create(&Modes.reader_thread, NULL, readerThreadEntryPoint, NULL);
+        demod2400StartThreads();
 
         while (!Modes.exit) {
-            // get the next sample buffer off the FIFO; wait only up to 100ms
+            // process the next sample buffer off the FIFO; wait only up to 100ms
             // this is fairly aggressive as all our network I/O runs out of the background work!
-            struct mag_buf *buf = fifo_dequeue(100 /* milliseconds */);
             struct timespec start_time;
 
-            if (buf) {
-                // Process one buffer
-                start_cpu_timing(&start_time);
-
-                demodulate2400(buf);
-                if (Modes.mode_ac) {
-                    demodulate2400AC(buf);
-                }
-
-                Modes.stats_current.samples_processed += buf->validLength;
-                Modes.stats_current.samples_dropped += buf->dropped;
-                end_cpu_timing(&start_time, &Modes.stats_current.demod_cpu);
-
-                // Return the buffer to the FIFO freelist for reuse
-                fifo_release(buf);
-
+            if (demod2400Process(100 /* milliseconds */)) {
                 // We got something so reset the watchdog
                 watchdogCounter = 10;
             } else {
@@ -857,8 +923,13 @@ int main(int argc, char **argv) {
         log_with_timestamp("Waiting for receive thread termination");
         fifo_halt(); // Reader thread should do this anyway, but just in case..
         pthread_join(Modes.reader_thread, NULL); // Wait on reader thread exit
+        demod2400StopThreads();
     }
 
+    trackStopThreads();
+    if (Modes.net)
+        modesNetMergeStats();
+
     // If --stats were given, print statistics
     if (Modes.stats) {
         display_total_stats();
@@ -124,6 +124,7 @@
 #define MODES_OUT_BUF_SIZE         (16*1024)
 #define MODES_OUT_FLUSH_SIZE       (15*1024)
 #define MODES_OUT_FLUSH_INTERVAL   (60000)
+#define MODES_OUT_UDP_SIZE         (1448) // Ethernet MTU less IPv6, UDP and sequence number headers
 
 #define MODES_USER_LATLON_VALID (1<<0)
 
@@ -212,7 +213,6 @@ typedef enum {
 
 #define MODES_NOTUSED(V) ((void) V)
 
-#define AIRCRAFTS_BUCKETS 2048
 
 // Include subheaders after all the #defines are in place
 
@@ -229,6 +229,7 @@ typedef enum {
 #include "readsb.pb-c.h"
 #include "geomag.h"
 #include "fifo.h"
+#include "net_queue.h"
 
 //======================== structure declarations =========================
 
@@ -247,6 +248,7 @@ struct _Modes { // Internal state
     int fd; // --ifile option file descriptor
     input_format_t input_format; // --iformat option
     iq_convert_fn converter_function;
+    const char *converter_description; // IQ converter in use, for the stats output
     char * dev_name;
     int gain;
     int enable_agc;
@@ -257,13 +259,16 @@ struct _Modes { // Internal state
     int beast_fd; // Local Modes-S Beast handler
     int beast_baudrate; // Mode-S beast and similar baud rate
     struct net_service *services; // Active services
-    struct aircraft *aircrafts[AIRCRAFTS_BUCKETS];
+    struct track_shard *track_shards; // Tracked aircraft by address, see track.c
     struct net_writer raw_out; // Raw output
     struct net_writer beast_out; // Beast-format output
     struct net_writer beast_reduce_out; // Reduced data Beast-format output
+    struct net_writer beast_deflate_out; // Compressed Beast-format output
     struct net_writer sbs_out; // SBS-format output
     struct net_writer vrs_out; // SBS-format output
     struct net_writer fatsv_out; // FATSV-format output
+    struct net_writer raw_udp_out; // Raw output to UDP streams
+    struct net_writer beast_udp_out; // Beast-format output to UDP streams
     sem_t* stats_semptr; // Statistics semaphore to syncronize with readsbrrd
 
     // Configuration
@@ -276,6 +281,9 @@ struct _Modes { // Internal state
     int8_t net; // Enable networking
     int8_t net_only; // Enable just networking
     uint32_t preambleThreshold;
+    int demod_threads; // Number of demodulator threads
+    int8_t demod_fused; // Screen for preambles while converting samples
+    int track_threads; // Number of aircraft tracking threads / shards
     int net_output_flush_size; // Minimum Size of output data
     uint32_t net_connector_delay;
     int filter_persistence; // Maximum number of consecutive implausible positions from global CPR to invalidate a known position.
@@ -286,7 +294,7 @@ struct _Modes { // Internal state
     uint32_t interactive_display_ttl; // Interactive mode: TTL display
     uint64_t stats; // Interval (millis) between stats dumps,
     uint64_t startup_time; // Readsb startup epoch
-    uint64_t ifile_now; // ifile timestamp
+    uint64_t ifile_now; // ifile timestamp, accessed atomically
     uint32_t output_interval; // Interval between rewriting the aircraft file, in milliseconds; also the advertised map refresh interval
     char *net_output_raw_ports; // List of raw output TCP ports
     char *net_input_raw_ports; // List of raw input TCP ports
@@ -295,18 +303,25 @@ struct _Modes { // Internal state
     char *net_input_beast_ports; // List of Beast input TCP ports
     char *net_output_beast_ports; // List of Beast output TCP ports
     char *net_output_beast_reduce_ports; // List of Beast output TCP ports
+    char *net_output_beast_deflate_ports; // List of compressed Beast output TCP ports
     uint32_t net_output_beast_reduce_interval; // Position update interval for data reduction
     char *net_output_vrs_ports; // List of VRS output TCP ports
     int8_t basestation_is_mlat; // Basestation input is from MLAT
     struct net_connector **net_connectors; // client connectors
     int net_connectors_count;
     int net_connectors_size;
+    struct net_udp **net_udp; // UDP streams, --net-udp
+    int net_udp_count;
+    int net_udp_size;
     char *filename; // Input form file, --ifile option
     char *net_bind_address; // Bind address
     char *output_dir; // Path to output base directory, or NULL not to write any output.
     char *beast_serial; // Modes-S Beast device path
     int net_sndbuf_size; // TCP output buffer size (64Kb * 2^n)
+    char *net_slow_policy; // SendQ overflow policies, --net-slow-policy argument
     int8_t net_verbatim; // if true, send the original message, not the CRC-corrected one
+    int8_t net_uring; // use io_uring for network I/O when the kernel supports it
+    uint32_t net_dedup_window; // Drop Beast input messages seen within this many millis, 0 to disable
     int8_t forward_mlat; // allow forwarding of mlat messages to output ports
     int8_t quiet; // Suppress stdout
     int8_t interactive; // Interactive mode
@@ -557,6 +572,9 @@ enum {
     OptInteractiveTTL,
     OptRaw,
     OptPreambleThreshold,
+    OptDemodThreads,
+    OptDemodFused,
+    OptTrackThreads,
     OptModeAc,
     OptNoModeAcAuto,
     OptForwardMlat,
@@ -592,6 +610,7 @@ enum {
     OptNetBiPorts,
     OptNetBoPorts,
     OptNetBeastReducePorts,
+    OptNetBeastDeflatePorts,
     OptNetBeastReduceInterval,
     OptNetVRSPorts,
     OptNetRoSize,
@@ -599,8 +618,12 @@ enum {
     OptNetRoIntervall,
     OptNetConnector,
     OptNetConnectorDelay,
+    OptNetUdp,
     OptNetHeartbeat,
     OptNetBuffer,
+    OptNetSlowPolicy,
+    OptNetNoUring,
+    OptNetDedupWindow,
     OptNetVerbatim,
     OptRtlSdrEnableAgc,
     OptRtlSdrPpm,
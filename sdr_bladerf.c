@@ -266,6 +266,7 @@ bool bladeRFOpen() {
         fprintf(stderr, "can't initialize sample converter\n");
         goto error;
     }
+    Modes.converter_description = converter_description(BladeRF.converter);
 
     return true;
 
@@ -157,6 +157,7 @@ bool ifileOpen(void) {
         ifileClose();
         return false;
     }
+    Modes.converter_description = converter_description(ifile.converter);
 
     return true;
 }
@@ -211,7 +212,7 @@ void ifileRun() {
         unsigned samples_read = bytes_read / ifile.bytes_per_sample;
 
         // Convert the new data
-        ifile.converter(ifile.readbuf, &outbuf->data[outbuf->overlap], samples_read, ifile.converter_state, &outbuf->mean_level, &outbuf->mean_power);
+        demod2400Convert(outbuf, ifile.converter, ifile.converter_state, ifile.readbuf, ifile.bytes_per_sample, samples_read);
         outbuf->validLength = outbuf->overlap + samples_read;
         outbuf->flags = 0;
 
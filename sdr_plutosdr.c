@@ -156,6 +156,7 @@ bool plutosdrOpen() {
         plutosdrClose();
         return false;
     }
+    Modes.converter_description = converter_description(PLUTOSDR.converter);
     return true;
 }
 
@@ -202,7 +203,7 @@ static void plutosdrCallback(int16_t *buf, uint32_t len) {
         dropped = samples_read - to_convert;
     }
 
-    PLUTOSDR.converter(buf, &outbuf->data[outbuf->overlap], to_convert, PLUTOSDR.converter_state, &outbuf->mean_level, &outbuf->mean_power);
+    demod2400Convert(outbuf, PLUTOSDR.converter, PLUTOSDR.converter_state, buf, 4, to_convert);
     outbuf->validLength = outbuf->overlap + to_convert;
 
     // Push to the demodulation thread
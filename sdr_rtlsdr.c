@@ -246,6 +246,7 @@ bool rtlsdrOpen(void) {
         rtlsdrClose();
         return false;
     }
+    Modes.converter_description = converter_description(RTLSDR.converter);
 
 #ifdef USE_BOUNCE_BUFFER
     if (!(RTLSDR.bounce_buffer = malloc(MODES_RTL_BUF_SIZE))) {
@@ -318,7 +319,7 @@ static void rtlsdrCallback(unsigned char *buf, uint32_t len, void *ctx) {
     buf = RTLSDR.bounce_buffer;
 #endif
 
-    RTLSDR.converter(buf, &outbuf->data[outbuf->overlap], to_convert, RTLSDR.converter_state, &outbuf->mean_level, &outbuf->mean_power);
+    demod2400Convert(outbuf, RTLSDR.converter, RTLSDR.converter_state, buf, 2, to_convert);
     outbuf->validLength = outbuf->overlap + to_convert;
 
     // Push to the demodulation thread
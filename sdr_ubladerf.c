@@ -307,6 +307,7 @@ bool ubladeRFOpen() {
         fprintf(stderr, "can't initialize sample converter\n");
         goto error;
     }
+    Modes.converter_description = converter_description(uBladeRF.converter);
 
     return true;
 
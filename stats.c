@@ -79,8 +79,16 @@ void display_stats(struct stats *st) {
 
     if (!Modes.net_only) {
         printf("Local receiver:\n");
+        if (Modes.converter_description) {
+            printf("  IQ conversion: %s\n", Modes.converter_description);
+        }
+        printf("  Mode S checksum: %s\n", modesChecksumEngine());
         printf("  %llu samples processed\n", (unsigned long long) st->samples_processed);
         printf("  %llu samples dropped\n", (unsigned long long) st->samples_dropped);
+        if (st->fifo_buffers > 0) {
+            printf("  %u sample buffers queued, queue depth %.1f mean / %u peak\n",
+                    st->fifo_buffers, (double) st->fifo_depth_sum / st->fifo_buffers, st->fifo_depth_max);
+        }
 
         printf("  %u Mode A/C messages received\n", st->demod_modeac);
         printf("  %u Mode-S message preambles received\n", st->demod_preambles);
@@ -129,6 +137,24 @@ void display_stats(struct stats *st) {
         printf("    %u accepted with correct CRC\n", st->remote_accepted[0]);
         for (j = 1; j <= Modes.nfix_crc; ++j)
             printf("    %u accepted with %d-bit error repaired\n", st->remote_accepted[j], j);
+        for (j = 0; j < Modes.net_udp_count; ++j) {
+            if (strcmp(Modes.net_udp[j]->protocol, "beast_in") == 0) {
+                printf("  %u UDP datagrams lost\n", st->remote_udp_lost);
+                break;
+            }
+        }
+        if (Modes.net_dedup_window) {
+            printf("  %u duplicate Mode S messages dropped\n", st->remote_duplicates);
+            for (j = 0; j < Modes.net_connectors_count; ++j) {
+                struct net_connector *con = Modes.net_connectors[j];
+                uint64_t messages = __atomic_load_n(&con->messages, __ATOMIC_RELAXED);
+                if (messages) {
+                    printf("    %llu of %llu from %s port %s since startup\n",
+                            (unsigned long long) __atomic_load_n(&con->duplicates, __ATOMIC_RELAXED),
+                            (unsigned long long) messages, con->address, con->port);
+                }
+            }
+        }
     }
 
     printf("%u total usable messages\n",
@@ -222,6 +248,10 @@ void add_stats(const struct stats *st1, const struct stats *st2, struct stats *t
     target->samples_processed = st1->samples_processed + st2->samples_processed;
     target->samples_dropped = st1->samples_dropped + st2->samples_dropped;
 
+    target->fifo_buffers = st1->fifo_buffers + st2->fifo_buffers;
+    target->fifo_depth_sum = st1->fifo_depth_sum + st2->fifo_depth_sum;
+    target->fifo_depth_max = st1->fifo_depth_max > st2->fifo_depth_max ? st1->fifo_depth_max : st2->fifo_depth_max;
+
     add_timespecs(&st1->demod_cpu, &st2->demod_cpu, &target->demod_cpu);
     add_timespecs(&st1->reader_cpu, &st2->reader_cpu, &target->reader_cpu);
     add_timespecs(&st1->background_cpu, &st2->background_cpu, &target->background_cpu);
@@ -250,6 +280,8 @@ void add_stats(const struct stats *st1, const struct stats *st2, struct stats *t
     target->remote_rejected_unknown_icao = st1->remote_rejected_unknown_icao + st2->remote_rejected_unknown_icao;
     for (i = 0; i < MODES_MAX_BITERRORS + 1; ++i)
         target->remote_accepted[i] = st1->remote_accepted[i] + st2->remote_accepted[i];
+    target->remote_duplicates = st1->remote_duplicates + st2->remote_duplicates;
+    target->remote_udp_lost = st1->remote_udp_lost + st2->remote_udp_lost;
 
     // total messages:
     target->messages_total = st1->messages_total + st2->messages_total;
@@ -66,6 +66,10 @@ struct stats {
     uint32_t demod_bestPhase[5];
     uint64_t samples_processed;
     uint64_t samples_dropped;
+    // magnitude buffer FIFO:
+    uint32_t fifo_buffers; // buffers passed from the SDR reader to the demodulator
+    uint64_t fifo_depth_sum; // sum of the queue depth seen by each buffer as it was queued
+    uint32_t fifo_depth_max; // high-water mark of the queue depth
     // Mode A/C demodulator counts:
     uint32_t demod_modeac;
     // number of signals with power > -3dBFS
@@ -88,6 +92,8 @@ struct stats {
     uint32_t remote_rejected_bad;
     uint32_t remote_rejected_unknown_icao;
     uint32_t remote_accepted[MODES_MAX_BITERRORS + 1];
+    uint32_t remote_duplicates; // dropped by --net-dedup-window before decoding
+    uint32_t remote_udp_lost; // datagrams missing from UDP input sequences
     // total messages:
     uint32_t messages_total;
     // CPR decoding:
@@ -53,6 +53,7 @@
 
 #include "readsb.h"
 #include <inttypes.h>
+#include <poll.h>
 
 /* #define DEBUG_CPR_CHECKS */
 
@@ -62,15 +63,256 @@ uint32_t modeAC_match[4096];
 uint32_t modeAC_age[4096];
 
 //
-// Return a new aircraft structure for the linked list of tracked
+// Aircraft table
+//
+// Tracked aircraft are split by address over Modes.track_shards. Each shard
+// keeps them in one contiguous array, aircrafts, with entries
+// [0, aircraft_count) in use. Removing an aircraft moves the last entry into
+// its place, so iterating is a linear scan, but pointers to aircraft only
+// stay valid until the next create or remove.
+//
+// An open-addressed index (linear probing, backward shift deletion) maps
+// the address, including the MODES_NON_ICAO_ADDRESS flag, to the array
+// position.
+//
+
+struct aircraft_index_entry {
+    uint32_t addr;
+    uint32_t slot; // position in aircrafts + 1, 0 = empty
+};
+
+// Stale and expire intervals of each data_validity, in seconds
+#define VALIDITY_FIELDS(F) \
+    F(callsign, 60, 70) /* ADS-B or Comm-B */ \
+    F(altitude_baro, 15, 70) /* ADS-B or Mode S */ \
+    F(altitude_geom, 60, 70) /* ADS-B only */ \
+    F(geom_delta, 60, 70) /* ADS-B only */ \
+    F(gs, 60, 70) /* ADS-B or Comm-B */ \
+    F(ias, 60, 70) /* ADS-B (rare) or Comm-B */ \
+    F(tas, 60, 70) /* ADS-B (rare) or Comm-B */ \
+    F(mach, 60, 70) /* Comm-B only */ \
+    F(track, 60, 70) /* ADS-B or Comm-B */ \
+    F(track_rate, 60, 70) /* Comm-B only */ \
+    F(roll, 60, 70) /* Comm-B only */ \
+    F(mag_heading, 60, 70) /* ADS-B (rare) or Comm-B */ \
+    F(true_heading, 60, 70) /* ADS-B only (rare) */ \
+    F(baro_rate, 60, 70) /* ADS-B or Comm-B */ \
+    F(geom_rate, 60, 70) /* ADS-B or Comm-B */ \
+    F(squawk, 15, 70) /* ADS-B or Mode S */ \
+    F(airground, 15, 70) /* ADS-B or Mode S */ \
+    F(nav_qnh, 60, 70) /* Comm-B only */ \
+    F(nav_altitude_mcp, 60, 70) /* ADS-B or Comm-B */ \
+    F(nav_altitude_fms, 60, 70) /* ADS-B or Comm-B */ \
+    F(nav_altitude_src, 60, 70) /* ADS-B or Comm-B */ \
+    F(nav_heading, 60, 70) /* ADS-B or Comm-B */ \
+    F(nav_modes, 60, 70) /* ADS-B or Comm-B */ \
+    F(cpr_odd, 60, 70) /* ADS-B only */ \
+    F(cpr_even, 60, 70) /* ADS-B only */ \
+    F(position, 60, 70) /* ADS-B only */ \
+    F(nic_a, 60, 70) /* ADS-B only */ \
+    F(nic_c, 60, 70) /* ADS-B only */ \
+    F(nic_baro, 60, 70) /* ADS-B only */ \
+    F(nac_p, 60, 70) /* ADS-B only */ \
+    F(nac_v, 60, 70) /* ADS-B only */ \
+    F(sil, 60, 70) /* ADS-B only */ \
+    F(gva, 60, 70) /* ADS-B only */ \
+    F(sda, 60, 70) /* ADS-B only */ \
+    F(emergency, 60, 70) \
+    F(alert, 60, 70) \
+    F(spi, 60, 70)
+
+enum {
+#define F(f,s,e) VALIDITY_##f,
+    VALIDITY_FIELDS(F)
+#undef F
+};
+
+static const struct {
+    uint32_t stale;
+    uint32_t expire;
+} validity_interval[] = {
+#define F(f,s,e) { (s) * 1000, (e) * 1000 },
+    VALIDITY_FIELDS(F)
+#undef F
+};
+
+// Shortest expire interval of any data_validity, set up by trackInit
+static uint64_t expire_interval_min;
+
+// Statistics of the calling thread, a tracking thread counts into its shard
+static _Thread_local struct stats *track_stats = &Modes.stats_current;
+static _Thread_local struct range_stats *track_range = &Modes.stats_range;
+
+static inline uint32_t aircraftHash(struct track_shard *sh, uint32_t addr) {
+    return (uint32_t) (((uint64_t) addr * 0x9E3779B97F4A7C15ULL) >> 32) & sh->index_mask;
+}
+
+static struct aircraft_index_entry *aircraftIndexFind(struct track_shard *sh, uint32_t addr) {
+    uint32_t h;
+
+    if (!sh->index)
+        return NULL;
+
+    for (h = aircraftHash(sh, addr); sh->index[h].slot; h = (h + 1) & sh->index_mask) {
+        if (sh->index[h].addr == addr)
+            return &sh->index[h];
+    }
+    return NULL;
+}
+
+static void aircraftIndexInsert(struct track_shard *sh, uint32_t addr, uint32_t slot) {
+    uint32_t h;
+
+    for (h = aircraftHash(sh, addr); sh->index[h].slot; h = (h + 1) & sh->index_mask);
+    sh->index[h].addr = addr;
+    sh->index[h].slot = slot;
+}
+
+static void aircraftIndexRemove(struct track_shard *sh, uint32_t addr) {
+    struct aircraft_index_entry *e = aircraftIndexFind(sh, addr);
+    uint32_t i, j, k;
+
+    if (!e)
+        return;
+
+    // shift later entries of the probe sequence back into the hole,
+    // unless their home slot lies cyclically in (i, j]
+    i = j = e - sh->index;
+    for (;;) {
+        j = (j + 1) & sh->index_mask;
+        if (!sh->index[j].slot)
+            break;
+        k = aircraftHash(sh, sh->index[j].addr);
+        if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        sh->index[i] = sh->index[j];
+        i = j;
+    }
+    sh->index[i].slot = 0;
+}
+
+// Size the index for at least twice the array capacity and rebuild it
+
+static bool aircraftIndexResize(struct track_shard *sh, unsigned capacity) {
+    uint32_t size = 1024;
+    unsigned i;
+
+    while (size < 2 * capacity)
+        size <<= 1;
+    if (sh->index && size == sh->index_mask + 1)
+        return true;
+
+    struct aircraft_index_entry *index = calloc(size, sizeof (*index));
+    if (!index) {
+        fprintf(stderr, "track: out of memory allocating aircraft index\n");
+        return false;
+    }
+
+    free(sh->index);
+    sh->index = index;
+    sh->index_mask = size - 1;
+    for (i = 0; i < sh->aircraft_count; ++i)
+        aircraftIndexInsert(sh, sh->aircrafts[i].meta.addr, i + 1);
+    return true;
+}
+
+// The protobuf metadata may point into the aircraft itself (see
+// generateAircraftProtoBuf), re-point it after the aircraft was moved
+
+static void trackAircraftMoved(struct aircraft *a) {
+    if (a->meta.flight != protobuf_c_empty_string)
+        a->meta.flight = a->callsign;
+    if (a->meta.nav_modes)
+        a->meta.nav_modes = &a->nav_modes;
+    if (a->meta.valid_source)
+        a->meta.valid_source = &a->valid_source;
+}
+
+// Make room for one more aircraft at the end of the array
+
+static bool trackReserveAircraft(struct track_shard *sh) {
+    struct aircraft *aircrafts;
+    unsigned alloc, i;
+
+    if (sh->aircraft_count < sh->aircraft_alloc)
+        return true;
+
+    alloc = sh->aircraft_alloc ? sh->aircraft_alloc * 2 : 256;
+    if (!aircraftIndexResize(sh, alloc))
+        return false;
+
+    aircrafts = realloc(sh->aircrafts, alloc * sizeof (struct aircraft));
+    if (!aircrafts) {
+        fprintf(stderr, "track: out of memory allocating %u aircraft\n", alloc);
+        return false;
+    }
+
+    if (aircrafts != sh->aircrafts) {
+        sh->aircrafts = aircrafts;
+        for (i = 0; i < sh->aircraft_count; ++i)
+            trackAircraftMoved(&sh->aircrafts[i]);
+    }
+    sh->aircraft_alloc = alloc;
+    return true;
+}
+
+// Remove the aircraft at position i, moving the last one into its place
+
+static void trackRemoveAircraft(struct track_shard *sh, unsigned i) {
+    struct aircraft *a = &sh->aircrafts[i];
+    unsigned last = --sh->aircraft_count;
+
+    aircraftIndexRemove(sh, a->meta.addr);
+    free(a->fatsv);
+    if (i != last) {
+        *a = sh->aircrafts[last];
+        trackAircraftMoved(a);
+        aircraftIndexFind(sh, a->meta.addr)->slot = i + 1;
+    }
+}
+
+// The shard tracking an address. Mode A/C replies all go to the first one,
+// which keeps the modeAC_* counts.
+
+static inline struct track_shard *trackShard(struct modesMessage *mm) {
+    if (Modes.track_threads < 2 || mm->msgtype == 32)
+        return &Modes.track_shards[0];
+    return &Modes.track_shards[(((uint64_t) (mm->addr * 0x9E3779B1U)) * Modes.track_threads) >> 32];
+}
+
+void trackCleanup() {
+    trackStopThreads();
+
+    for (int s = 0; s < Modes.track_threads && Modes.track_shards; s++) {
+        struct track_shard *sh = &Modes.track_shards[s];
+        for (unsigned i = 0; i < sh->aircraft_count; ++i)
+            free(sh->aircrafts[i].fatsv);
+        free(sh->aircrafts);
+        free(sh->index);
+        netQueueDestroy(&sh->queue);
+        pthread_mutex_destroy(&sh->room_mutex);
+        pthread_cond_destroy(&sh->room_cond);
+    }
+    free(Modes.track_shards);
+    Modes.track_shards = NULL;
+}
+
+//
+// Return a new aircraft structure at the end of the table of tracked
 // aircraft
 //
 
-static struct aircraft *trackCreateAircraft(struct modesMessage *mm) {
+static struct aircraft *trackCreateAircraft(struct track_shard *sh, struct modesMessage *mm) {
     static struct aircraft zeroAircraft;
-    struct aircraft *a = (struct aircraft *) malloc(sizeof (*a));
+    struct aircraft *a;
     int i;
 
+    if (!trackReserveAircraft(sh))
+        return NULL;
+
+    a = &sh->aircrafts[sh->aircraft_count++];
+    aircraftIndexInsert(sh, mm->addr, sh->aircraft_count);
+
     // Default everything to zero/NULL
     *a = zeroAircraft;
     aircraft_meta__init(&a->meta);
@@ -89,60 +331,32 @@ static struct aircraft *trackCreateAircraft(struct modesMessage *mm) {
     a->adsb_hrd = HEADING_MAGNETIC;
     a->adsb_tah = HEADING_GROUND_TRACK;
 
-    // prime FATSV defaults we only emit on change
-
-    // start off with the "last emitted" ACAS RA being blank (just the BDS 3,0
-    // or ES type code)
-    a->fatsv_emitted_bds_30[0] = 0x30;
-    a->fatsv_emitted_es_acas_ra[0] = 0xE2;
-    a->fatsv_emitted_adsb_version = -1;
-    a->fatsv_emitted_addrtype = AIRCRAFT_META__ADDR_TYPE__ADDR_UNKNOWN;
-
-    // don't immediately emit, let some data build up
-    a->fatsv_last_emitted = a->fatsv_last_force_emit = messageNow();
-
-    // Copy the first message so we can emit it later when a second message arrives.
-    a->first_message = *mm;
-
-    // initialize data validity ages
-#define F(f,s,e) do { a->f##_valid.stale_interval = (s) * 1000; a->f##_valid.expire_interval = (e) * 1000; } while (0)
-    F(callsign, 60, 70); // ADS-B or Comm-B
-    F(altitude_baro, 15, 70); // ADS-B or Mode S
-    F(altitude_geom, 60, 70); // ADS-B only
-    F(geom_delta, 60, 70); // ADS-B only
-    F(gs, 60, 70); // ADS-B or Comm-B
-    F(ias, 60, 70); // ADS-B (rare) or Comm-B
-    F(tas, 60, 70); // ADS-B (rare) or Comm-B
-    F(mach, 60, 70); // Comm-B only
-    F(track, 60, 70); // ADS-B or Comm-B
-    F(track_rate, 60, 70); // Comm-B only
-    F(roll, 60, 70); // Comm-B only
-    F(mag_heading, 60, 70); // ADS-B (rare) or Comm-B
-    F(true_heading, 60, 70); // ADS-B only (rare)
-    F(baro_rate, 60, 70); // ADS-B or Comm-B
-    F(geom_rate, 60, 70); // ADS-B or Comm-B
-    F(squawk, 15, 70); // ADS-B or Mode S
-    F(airground, 15, 70); // ADS-B or Mode S
-    F(nav_qnh, 60, 70); // Comm-B only
-    F(nav_altitude_mcp, 60, 70); // ADS-B or Comm-B
-    F(nav_altitude_fms, 60, 70); // ADS-B or Comm-B
-    F(nav_altitude_src, 60, 70); // ADS-B or Comm-B
-    F(nav_heading, 60, 70); // ADS-B or Comm-B
-    F(nav_modes, 60, 70); // ADS-B or Comm-B
-    F(cpr_odd, 60, 70); // ADS-B only
-    F(cpr_even, 60, 70); // ADS-B only
-    F(position, 60, 70); // ADS-B only
-    F(nic_a, 60, 70); // ADS-B only
-    F(nic_c, 60, 70); // ADS-B only
-    F(nic_baro, 60, 70); // ADS-B only
-    F(nac_p, 60, 70); // ADS-B only
-    F(nac_v, 60, 70); // ADS-B only
-    F(sil, 60, 70); // ADS-B only
-    F(gva, 60, 70); // ADS-B only
-    F(sda, 60, 70); // ADS-B only
+    // FATSV state lives in a separate block, only needed with that output
+    if (Modes.fatsv_out.service && (a->fatsv = calloc(1, sizeof (*a->fatsv)))) {
+        // prime FATSV defaults we only emit on change
+
+        // start off with the "last emitted" ACAS RA being blank (just the BDS 3,0
+        // or ES type code)
+        a->fatsv->emitted_bds_30[0] = 0x30;
+        a->fatsv->emitted_es_acas_ra[0] = 0xE2;
+        a->fatsv->emitted_adsb_version = -1;
+        a->fatsv->emitted_addrtype = AIRCRAFT_META__ADDR_TYPE__ADDR_UNKNOWN;
+
+        // don't immediately emit, let some data build up
+        a->fatsv->last_emitted = a->fatsv->last_force_emit = messageNow();
+    }
+
+    // initialize data validity, all times long ago
+    uint32_t past = (uint32_t) messageNow() - TRACK_TIME_PAST;
+#define F(f,s,e) do { \
+        a->f##_valid.interval = VALIDITY_##f; \
+        a->f##_valid.updated = a->f##_valid.stale = a->f##_valid.expires = past; \
+        a->f##_valid.next_reduce_forward = past; \
+    } while (0);
+    VALIDITY_FIELDS(F)
 #undef F
 
-    Modes.stats_current.unique_aircraft++;
+    track_stats->unique_aircraft++;
 
     return (a);
 }
@@ -154,40 +368,40 @@ static struct aircraft *trackCreateAircraft(struct modesMessage *mm) {
 // exists with this address.
 //
 
-static struct aircraft *trackFindAircraft(uint32_t addr) {
-    struct aircraft *a = Modes.aircrafts[addr % AIRCRAFTS_BUCKETS];
+static struct aircraft *trackFindAircraft(struct track_shard *sh, uint32_t addr) {
+    struct aircraft_index_entry *e = aircraftIndexFind(sh, addr);
 
-    while (a) {
-        if (a->meta.addr == addr) return (a);
-        a = a->next;
-    }
-    return (NULL);
+    if (!e)
+        return (NULL);
+    return &sh->aircrafts[e->slot - 1];
 }
 
 // Should we accept some new data from the given source?
 // If so, update the validity and return 1
 
 static int accept_data(data_validity *d, datasource_t source, struct modesMessage *mm, int reduce_often) {
-    if (messageNow() < d->updated)
+    uint32_t now = (uint32_t) messageNow();
+
+    if (trackTimeDiff(now, d->updated) < 0)
         return 0;
 
-    if (source < d->source && messageNow() < d->stale)
+    if (source < d->source && trackTimeDiff(now, d->stale) < 0)
         return 0;
 
     d->source = source;
-    d->updated = messageNow();
-    d->stale = messageNow() + (d->stale_interval ? d->stale_interval : 60000);
-    d->expires = messageNow() + (d->expire_interval ? d->expire_interval : 70000);
+    d->updated = now;
+    d->stale = now + validity_interval[d->interval].stale;
+    d->expires = now + validity_interval[d->interval].expire;
 
-    if (messageNow() > d->next_reduce_forward && !mm->sbs_in) {
+    if (trackTimeDiff(now, d->next_reduce_forward) > 0 && !mm->sbs_in) {
         if (mm->msgtype == 17 || reduce_often) {
-            d->next_reduce_forward = messageNow() + Modes.net_output_beast_reduce_interval;
+            d->next_reduce_forward = now + Modes.net_output_beast_reduce_interval;
         } else {
-            d->next_reduce_forward = messageNow() + Modes.net_output_beast_reduce_interval * 4;
+            d->next_reduce_forward = now + Modes.net_output_beast_reduce_interval * 4;
         }
         // make sure global CPR stays possible even at high interval:
         if (Modes.net_output_beast_reduce_interval > 7000 && mm->cpr_valid) {
-            d->next_reduce_forward = messageNow() + 7000;
+            d->next_reduce_forward = now + 7000;
         }
         mm->reduce_forward = 1;
     }
@@ -209,19 +423,19 @@ static void combine_validity(data_validity *to, const data_validity *from1, cons
     }
 
     to->source = (from1->source < from2->source) ? from1->source : from2->source; // the worse of the two input sources
-    to->updated = (from1->updated > from2->updated) ? from1->updated : from2->updated; // the *later* of the two update times
-    to->stale = (from1->stale < from2->stale) ? from1->stale : from2->stale; // the earlier of the two stale times
-    to->expires = (from1->expires < from2->expires) ? from1->expires : from2->expires; // the earlier of the two expiry times
+    to->updated = (trackTimeDiff(from1->updated, from2->updated) > 0) ? from1->updated : from2->updated; // the *later* of the two update times
+    to->stale = (trackTimeDiff(from1->stale, from2->stale) < 0) ? from1->stale : from2->stale; // the earlier of the two stale times
+    to->expires = (trackTimeDiff(from1->expires, from2->expires) < 0) ? from1->expires : from2->expires; // the earlier of the two expiry times
 }
 
 static int compare_validity(const data_validity *lhs, const data_validity *rhs) {
-    if (messageNow() < lhs->stale && lhs->source > rhs->source)
+    if (trackDataFresh(lhs) && lhs->source > rhs->source)
         return 1;
-    else if (messageNow() < rhs->stale && lhs->source < rhs->source)
+    else if (trackDataFresh(rhs) && lhs->source < rhs->source)
         return -1;
-    else if (lhs->updated > rhs->updated)
+    else if (trackTimeDiff(lhs->updated, rhs->updated) > 0)
         return 1;
-    else if (lhs->updated < rhs->updated)
+    else if (trackTimeDiff(lhs->updated, rhs->updated) < 0)
         return -1;
     else
         return 0;
@@ -287,8 +501,8 @@ static uint32_t update_polar_range(double lat, double lon) {
 
     range = greatcircle(Modes.receiver.latitude, Modes.receiver.longitude, lat, lon);
 
-    if ((range <= Modes.maxRange || Modes.maxRange == 0) && range > Modes.stats_current.longest_distance) {
-        Modes.stats_current.longest_distance = range;
+    if ((range <= Modes.maxRange || Modes.maxRange == 0) && range > track_stats->longest_distance) {
+        track_stats->longest_distance = range;
     }
 
     if (Modes.stats_polar_range) {
@@ -299,8 +513,8 @@ static uint32_t update_polar_range(double lat, double lon) {
             bucket = 0;
         }
         
-        if (bucket < POLAR_RANGE_BUCKETS && Modes.stats_range.polar_range[bucket] < range) {
-            Modes.stats_range.polar_range[bucket] = (uint32_t) range;
+        if (bucket < POLAR_RANGE_BUCKETS && track_range->polar_range[bucket] < range) {
+            track_range->polar_range[bucket] = (uint32_t) range;
         }
     }
 
@@ -427,7 +641,7 @@ static int doGlobalCPR(struct aircraft *a, struct modesMessage *mm, double *lat,
                     a->addr, *lat, *lon, Modes.maxRange / 1000.0, range / 1000.0);
 #endif
 
-            Modes.stats_current.cpr_global_range_checks++;
+            track_stats->cpr_global_range_checks++;
             return (-2); // we consider an out-of-range value to be bad data
         }
     }
@@ -438,7 +652,7 @@ static int doGlobalCPR(struct aircraft *a, struct modesMessage *mm, double *lat,
 
     // check speed limit
     if (trackDataValid(&a->position_valid) && mm->source <= a->position_valid.source && !speed_check(a, *lat, *lon, surface)) {
-        Modes.stats_current.cpr_global_speed_checks++;
+        track_stats->cpr_global_speed_checks++;
         return -2;
     }
 
@@ -463,7 +677,7 @@ static int doLocalCPR(struct aircraft *a, struct modesMessage *mm, double *lat,
         *rc = a->cpr_even_rc;
     }
 
-    if (messageNow() - a->position_valid.updated < (10 * 60 * 1000)) {
+    if ((uint32_t) messageNow() - a->position_valid.updated < (10 * 60 * 1000)) {
         reflat = a->meta.lat;
         reflon = a->meta.lon;
 
@@ -524,7 +738,7 @@ static int doLocalCPR(struct aircraft *a, struct modesMessage *mm, double *lat,
     if (range_limit > 0) {
         double range = greatcircle(reflat, reflon, *lat, *lon);
         if (range > range_limit) {
-            Modes.stats_current.cpr_local_range_checks++;
+            track_stats->cpr_local_range_checks++;
             return (-1);
         }
     }
@@ -534,15 +748,15 @@ static int doLocalCPR(struct aircraft *a, struct modesMessage *mm, double *lat,
 #ifdef DEBUG_CPR_CHECKS
         fprintf(stderr, "Speed check for %06X with local decoding failed\n", a->addr);
 #endif
-        Modes.stats_current.cpr_local_speed_checks++;
+        track_stats->cpr_local_speed_checks++;
         return -1;
     }
 
     return relative_to;
 }
 
-static uint64_t time_between(uint64_t t1, uint64_t t2) {
-    if (t1 >= t2)
+static uint32_t time_between(uint32_t t1, uint32_t t2) {
+    if (trackTimeDiff(t1, t2) >= 0)
         return t1 - t2;
     else
         return t2 - t1;
@@ -559,7 +773,7 @@ static void updatePosition(struct aircraft *a, struct modesMessage *mm) {
     surface = (mm->cpr_type == CPR_SURFACE);
 
     if (surface) {
-        ++Modes.stats_current.cpr_surface;
+        ++track_stats->cpr_surface;
 
         // Surface: 25 seconds if >25kt or speed unknown, 50 seconds otherwise
         if (mm->gs_valid && mm->gs.selected <= 25)
@@ -567,7 +781,7 @@ static void updatePosition(struct aircraft *a, struct modesMessage *mm) {
         else
             max_elapsed = 25000;
     } else {
-        ++Modes.stats_current.cpr_airborne;
+        ++track_stats->cpr_airborne;
 
         // Airborne: 10 seconds
         max_elapsed = 10000;
@@ -590,7 +804,7 @@ static void updatePosition(struct aircraft *a, struct modesMessage *mm) {
             // At least one of the CPRs is bad, mark them both invalid.
             // If we are not confident in the position, invalidate it as well.
 
-            Modes.stats_current.cpr_global_bad++;
+            track_stats->cpr_global_bad++;
 
             a->cpr_odd_valid.source = SOURCE_INVALID;
             a->cpr_even_valid.source = SOURCE_INVALID;
@@ -612,10 +826,10 @@ static void updatePosition(struct aircraft *a, struct modesMessage *mm) {
 #endif
             // No local reference for surface position available, or the two messages crossed a zone.
             // Nonfatal, try again later.
-            Modes.stats_current.cpr_global_skipped++;
+            track_stats->cpr_global_skipped++;
         } else {
             if (accept_data(&a->position_valid, mm->source, mm, 1)) {
-                Modes.stats_current.cpr_global_ok++;
+                track_stats->cpr_global_ok++;
 
                 if (a->pos_reliable_odd <= 0 || a->pos_reliable_even <= 0) {
                     a->pos_reliable_odd = 1;
@@ -630,7 +844,7 @@ static void updatePosition(struct aircraft *a, struct modesMessage *mm) {
                     a->gs_last_pos = a->meta.gs;
 
             } else {
-                Modes.stats_current.cpr_global_skipped++;
+                track_stats->cpr_global_skipped++;
                 location_result = -2;
             }
         }
@@ -641,20 +855,20 @@ static void updatePosition(struct aircraft *a, struct modesMessage *mm) {
         location_result = doLocalCPR(a, mm, &new_lat, &new_lon, &new_nic, &new_rc);
 
         if (location_result >= 0 && accept_data(&a->position_valid, mm->source, mm, 1)) {
-            Modes.stats_current.cpr_local_ok++;
+            track_stats->cpr_local_ok++;
             mm->cpr_relative = 1;
 
             if (trackDataValid(&a->gs_valid))
                 a->gs_last_pos = a->meta.gs;
 
             if (location_result == 1) {
-                Modes.stats_current.cpr_local_aircraft_relative++;
+                track_stats->cpr_local_aircraft_relative++;
             }
             if (location_result == 2) {
-                Modes.stats_current.cpr_local_receiver_relative++;
+                track_stats->cpr_local_receiver_relative++;
             }
         } else {
-            Modes.stats_current.cpr_local_skipped++;
+            track_stats->cpr_local_skipped++;
             location_result = -1;
         }
     }
@@ -673,11 +887,10 @@ static void updatePosition(struct aircraft *a, struct modesMessage *mm) {
         a->meta.nic = new_nic;
         a->meta.rc = new_rc;
 
-        double dip, ti, gv;
         // Update magnetic declination whenever position changes
         if (trackDataValid(&a->altitude_geom_valid)) {
             // Altitude given in feet but required to be in kilometer above WGS84 ellipsoid.
-            geomag_calc(a->meta.alt_geom * 0.0003048, a->meta.lat, a->meta.lon, -1.0, &a->meta.declination, &dip, &ti, &gv);
+            a->meta.declination = geomag_declination(a->meta.alt_geom * 0.0003048, a->meta.lat, a->meta.lon);
         }
 
         a->meta.distance = false;
@@ -993,6 +1206,7 @@ static int altitude_to_feet(int raw, altitude_unit_t unit) {
 //
 
 struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
+    struct track_shard *sh;
     struct aircraft *a;
     unsigned int cpr_new = 0;
 
@@ -1010,11 +1224,12 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
     _messageNow = mm->sysTimestampMsg;
 
     // Lookup our aircraft or create a new one
-    a = trackFindAircraft(mm->addr);
+    sh = trackShard(mm);
+    a = trackFindAircraft(sh, mm->addr);
     if (!a) { // If it's a currently unknown aircraft....
-        a = trackCreateAircraft(mm); // ., create a new record for it,
-        a->next = Modes.aircrafts[mm->addr % AIRCRAFTS_BUCKETS]; // .. and put it at the head of the list
-        Modes.aircrafts[mm->addr % AIRCRAFTS_BUCKETS] = a;
+        a = trackCreateAircraft(sh, mm); // ., create a new record for it
+        if (!a)
+            return NULL;
     }
 
     if (mm->signalLevel > 0) {
@@ -1024,6 +1239,10 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
     a->meta.seen = mm->sysTimestampMsg;
     a->meta.messages++;
 
+    // nothing accepted from this message expires earlier
+    if (a->next_expiry > messageNow() + expire_interval_min)
+        a->next_expiry = messageNow() + expire_interval_min;
+
     // update addrtype, we only ever go towards "more direct" types
     if (mm->addrtype < a->meta.addr_type) {
         a->meta.addr_type = mm->addrtype;
@@ -1415,8 +1634,10 @@ static void trackMatchAC(uint64_t now) {
     }
 
     // scan aircraft list, look for matches
-    for (int j = 0; j < AIRCRAFTS_BUCKETS; j++) {
-        for (struct aircraft *a = Modes.aircrafts[j]; a; a = a->next) {
+    for (int s = 0; s < Modes.track_threads; s++) {
+        struct track_shard *sh = &Modes.track_shards[s];
+        for (unsigned j = 0; j < sh->aircraft_count; j++) {
+            struct aircraft *a = &sh->aircrafts[j];
             if ((now - a->meta.seen) > 5000) {
                 continue;
             }
@@ -1484,89 +1705,114 @@ static void trackMatchAC(uint64_t now) {
     }
 }
 
+// Pull times older than TRACK_TIME_PAST forward, see data_validity
+
+static void validityClamp(data_validity *d, uint32_t now) {
+    uint32_t past = now - TRACK_TIME_PAST;
+
+    if (trackTimeDiff(d->updated, past) < 0)
+        d->updated = past;
+    if (trackTimeDiff(d->stale, past) < 0)
+        d->stale = past;
+    if (trackTimeDiff(d->expires, past) < 0)
+        d->expires = past;
+    if (trackTimeDiff(d->next_reduce_forward, past) < 0)
+        d->next_reduce_forward = past;
+}
+
 //
 //=========================================================================
 //
 // If we don't receive new nessages within TRACK_AIRCRAFT_TTL
 // we remove the aircraft from the list.
 //
+// Checks the aircraft from position j up to end and returns where it stopped.
+// a->next_expiry is the earliest time any data of the aircraft expires or it
+// is reaped, aircraft before that are skipped without looking at their data.
+// It is recomputed here and pulled forward by every message.
+//
 
-static void trackRemoveStaleAircraft(uint64_t now) {
-    for (int j = 0; j < AIRCRAFTS_BUCKETS; j++) {
-        struct aircraft *a = Modes.aircrafts[j];
-        struct aircraft *prev = NULL;
-
-        while (a) {
-            if ((now - a->meta.seen) > TRACK_AIRCRAFT_TTL ||
-                    (a->meta.messages == 1 && (now - a->meta.seen) > TRACK_AIRCRAFT_ONEHIT_TTL)) {
-                // Count aircraft where we saw only one message before reaping them.
-                // These are likely to be due to messages with bad addresses.
-                if (a->meta.messages == 1)
-                    Modes.stats_current.single_message_aircraft++;
-
-                // Remove the element from the linked list, with care
-                // if we are removing the first element
-                if (!prev) {
-                    Modes.aircrafts[j] = a->next;
-                    free(a);
-                    a = Modes.aircrafts[j];
-                } else {
-                    prev->next = a->next;
-                    free(a);
-                    a = prev->next;
-                }
-            } else {
-
-#define EXPIRE(_f) do { if (a->_f##_valid.source != SOURCE_INVALID && now >= a->_f##_valid.expires) { a->_f##_valid.source = SOURCE_INVALID; } } while (0)
-                EXPIRE(callsign);
-                EXPIRE(altitude_baro);
-                EXPIRE(altitude_geom);
-                EXPIRE(geom_delta);
-                EXPIRE(gs);
-                EXPIRE(ias);
-                EXPIRE(tas);
-                EXPIRE(mach);
-                EXPIRE(track);
-                EXPIRE(track_rate);
-                EXPIRE(roll);
-                EXPIRE(mag_heading);
-                EXPIRE(true_heading);
-                EXPIRE(baro_rate);
-                EXPIRE(geom_rate);
-                EXPIRE(squawk);
-                EXPIRE(airground);
-                EXPIRE(nav_qnh);
-                EXPIRE(nav_altitude_mcp);
-                EXPIRE(nav_altitude_fms);
-                EXPIRE(nav_altitude_src);
-                EXPIRE(nav_heading);
-                EXPIRE(nav_modes);
-                EXPIRE(cpr_odd);
-                EXPIRE(cpr_even);
-                EXPIRE(position);
-                EXPIRE(nic_a);
-                EXPIRE(nic_c);
-                EXPIRE(nic_baro);
-                EXPIRE(nac_p);
-                EXPIRE(sil);
-                EXPIRE(gva);
-                EXPIRE(sda);
+static unsigned trackRemoveStaleAircraft(struct track_shard *sh, uint64_t now, unsigned j, unsigned end) {
+    while (j < end && j < sh->aircraft_count) {
+        struct aircraft *a = &sh->aircrafts[j];
+        if (now < a->next_expiry) {
+            j++;
+        } else if ((now - a->meta.seen) > TRACK_AIRCRAFT_TTL ||
+                (a->meta.messages == 1 && (now - a->meta.seen) > TRACK_AIRCRAFT_ONEHIT_TTL)) {
+            // Count aircraft where we saw only one message before reaping them.
+            // These are likely to be due to messages with bad addresses.
+            if (a->meta.messages == 1)
+                track_stats->single_message_aircraft++;
+
+            // Remove the element; the last aircraft moves into
+            // position j and is checked next
+            trackRemoveAircraft(sh, j);
+        } else {
+            uint64_t next = a->meta.seen + 1 + (a->meta.messages == 1 ? TRACK_AIRCRAFT_ONEHIT_TTL : TRACK_AIRCRAFT_TTL);
+
+#define EXPIRE(_f) do { \
+        if (a->_f##_valid.source != SOURCE_INVALID) { \
+            int32_t left = trackTimeDiff(a->_f##_valid.expires, (uint32_t) now); \
+            if (left <= 0) \
+                a->_f##_valid.source = SOURCE_INVALID; \
+            else if (now + left < next) \
+                next = now + left; \
+        } \
+    } while (0)
+            EXPIRE(callsign);
+            EXPIRE(altitude_baro);
+            EXPIRE(altitude_geom);
+            EXPIRE(geom_delta);
+            EXPIRE(gs);
+            EXPIRE(ias);
+            EXPIRE(tas);
+            EXPIRE(mach);
+            EXPIRE(track);
+            EXPIRE(track_rate);
+            EXPIRE(roll);
+            EXPIRE(mag_heading);
+            EXPIRE(true_heading);
+            EXPIRE(baro_rate);
+            EXPIRE(geom_rate);
+            EXPIRE(squawk);
+            EXPIRE(airground);
+            EXPIRE(nav_qnh);
+            EXPIRE(nav_altitude_mcp);
+            EXPIRE(nav_altitude_fms);
+            EXPIRE(nav_altitude_src);
+            EXPIRE(nav_heading);
+            EXPIRE(nav_modes);
+            EXPIRE(cpr_odd);
+            EXPIRE(cpr_even);
+            EXPIRE(position);
+            EXPIRE(nic_a);
+            EXPIRE(nic_c);
+            EXPIRE(nic_baro);
+            EXPIRE(nac_p);
+            EXPIRE(sil);
+            EXPIRE(gva);
+            EXPIRE(sda);
 #undef EXPIRE
 
-                // reset position reliability when the position has expired
-                if (a->position_valid.source == SOURCE_INVALID) {
-                    a->pos_reliable_odd = 0;
-                    a->pos_reliable_even = 0;
-                }
+            // reset position reliability when the position has expired
+            if (a->position_valid.source == SOURCE_INVALID) {
+                a->pos_reliable_odd = 0;
+                a->pos_reliable_even = 0;
+            }
 
-                if (a->altitude_baro_valid.source == SOURCE_INVALID)
-                    a->altitude_baro_reliable = 0;
+            if (a->altitude_baro_valid.source == SOURCE_INVALID)
+                a->altitude_baro_reliable = 0;
 
-                prev = a;
-                a = a->next;
-            }
+            // keep the times of data not updated for long within TRACK_TIME_PAST
+#define F(f,s,e) validityClamp(&a->f##_valid, (uint32_t) now);
+            VALIDITY_FIELDS(F)
+#undef F
+
+            a->next_expiry = next;
+            j++;
         }
     }
+    return j;
 }
 
 
@@ -1576,14 +1822,250 @@ static void trackRemoveStaleAircraft(uint64_t now) {
 
 void trackPeriodicUpdate() {
     static uint64_t next_update;
+    static uint64_t sweep_start;
     uint64_t now = mstime();
+    bool swept = true;
+    int s;
+
+    // Check every aircraft once per second, spread over the calls within
+    // that second instead of the whole table at once
+    for (s = 0; s < Modes.track_threads; s++) {
+        if (Modes.track_shards[s].sweep_pos < Modes.track_shards[s].aircraft_count)
+            swept = false;
+    }
+    if (swept && now >= sweep_start + 1000) {
+        sweep_start = now;
+        for (s = 0; s < Modes.track_threads; s++)
+            Modes.track_shards[s].sweep_pos = 0;
+    }
+    for (s = 0; s < Modes.track_threads; s++) {
+        struct track_shard *sh = &Modes.track_shards[s];
+        if (sh->sweep_pos < sh->aircraft_count) {
+            uint64_t elapsed = now - sweep_start;
+            unsigned end = sh->aircraft_count;
+            if (elapsed < 1000)
+                end = (unsigned) ((uint64_t) end * (elapsed + 1) / 1000);
+            sh->sweep_pos = trackRemoveStaleAircraft(sh, now, sh->sweep_pos, end);
+        }
+    }
 
     // Only do updates once per second
     if (now >= next_update) {
         next_update = now + 1000;
-        trackRemoveStaleAircraft(now);
         if (Modes.mode_ac) {
             trackMatchAC(now);
         }
     }
 }
+
+//
+// Tracking threads
+//
+// With --track-threads above 1 every shard gets a thread. useModesMessage()
+// on the decoding thread queues each message for the shard owning its
+// address, that thread tracks it and writes its output, so the output of a
+// shard keeps its order while the shards interleave.
+//
+// Tracking threads hold track_lock for reading while they work through a
+// batch of messages. Everything else using aircraft, the modeAC_* counts
+// or the output writers takes it for writing with trackLockShards(), which
+// waits for the current batches to finish.
+//
+
+static pthread_rwlock_t track_lock;
+static pthread_mutex_t track_output_mutex = PTHREAD_MUTEX_INITIALIZER; // one tracking thread writes output at a time
+static atomic_bool track_threads_stop;
+static bool track_threaded;
+
+void trackInit(void) {
+    if (Modes.track_threads < 1)
+        Modes.track_threads = 1;
+
+    Modes.track_shards = calloc(Modes.track_threads, sizeof (struct track_shard));
+    if (!Modes.track_shards) {
+        fprintf(stderr, "track: out of memory allocating shards\n");
+        exit(1);
+    }
+    for (int s = 0; s < Modes.track_threads; s++) {
+        Modes.track_shards[s].queue.eventfd = -1;
+        pthread_mutex_init(&Modes.track_shards[s].room_mutex, NULL);
+        pthread_cond_init(&Modes.track_shards[s].room_cond, NULL);
+    }
+
+    expire_interval_min = validity_interval[0].expire;
+    for (size_t i = 1; i < sizeof (validity_interval) / sizeof (validity_interval[0]); i++) {
+        if (validity_interval[i].expire < expire_interval_min)
+            expire_interval_min = validity_interval[i].expire;
+    }
+}
+
+// Track the queued messages of a shard until its queue is empty
+
+static void trackDrainQueue(struct track_shard *sh) {
+    struct modesMessage *mm;
+    void *owner;
+    uint32_t flags, len;
+
+    do {
+        pthread_rwlock_rdlock(&track_lock);
+        for (unsigned n = 0; n < TRACK_THREAD_BATCH; n++) {
+            if (!(mm = (struct modesMessage *) netQueuePeek(&sh->queue, &owner, &flags, &len)))
+                break;
+
+            struct aircraft *a = trackUpdateFromMessage(mm);
+            sh->message_now = messageNow();
+
+            pthread_mutex_lock(&track_output_mutex);
+            outputModesMessage(mm, a);
+            pthread_mutex_unlock(&track_output_mutex);
+
+            netQueueRelease(&sh->queue);
+
+            // wake trackQueueMessage() waiting for room
+            atomic_thread_fence(memory_order_seq_cst);
+            if (atomic_load(&sh->room_wanted)) {
+                pthread_mutex_lock(&sh->room_mutex);
+                pthread_cond_signal(&sh->room_cond);
+                pthread_mutex_unlock(&sh->room_mutex);
+            }
+        }
+        pthread_rwlock_unlock(&track_lock);
+    } while (mm);
+}
+
+static void *trackThreadEntryPoint(void *arg) {
+    struct track_shard *sh = arg;
+    struct pollfd pfd = {sh->queue.eventfd, POLLIN, 0};
+
+    track_stats = &sh->stats;
+    track_range = &sh->range;
+
+    for (;;) {
+        // messages queued before the stop request are still tracked
+        bool stop = atomic_load(&track_threads_stop);
+        trackDrainQueue(sh);
+        if (stop)
+            break;
+        if (poll(&pfd, 1, -1) > 0)
+            netQueueClearEvent(&sh->queue);
+    }
+    return NULL;
+}
+
+void trackStartThreads(void) {
+    pthread_rwlockattr_t attr;
+
+    if (Modes.track_threads < 2 || track_threaded)
+        return;
+
+    // trackLockShards goes ahead of tracking threads coming back for more
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&track_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    atomic_store(&track_threads_stop, false);
+    for (int s = 0; s < Modes.track_threads; s++) {
+        struct track_shard *sh = &Modes.track_shards[s];
+
+        if (!netQueueInit(&sh->queue, TRACK_QUEUE_SIZE)) {
+            fprintf(stderr, "Out of memory allocating tracking queues\n");
+            exit(1);
+        }
+        if (pthread_create(&sh->thread, NULL, trackThreadEntryPoint, sh)) {
+            fprintf(stderr, "Unable to create tracking thread: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+    track_threaded = true;
+}
+
+void trackStopThreads(void) {
+    uint64_t one = 1;
+
+    if (!track_threaded)
+        return;
+
+    atomic_store(&track_threads_stop, true);
+    for (int s = 0; s < Modes.track_threads; s++) {
+        // wake the thread
+        if (write(Modes.track_shards[s].queue.eventfd, &one, sizeof (one)) < 0) {
+            fprintf(stderr, "Unable to wake tracking thread: %s\n", strerror(errno));
+        }
+    }
+    for (int s = 0; s < Modes.track_threads; s++)
+        pthread_join(Modes.track_shards[s].thread, NULL);
+    track_threaded = false;
+    pthread_rwlock_destroy(&track_lock);
+
+    trackMergeStats();
+}
+
+// Hand a message to the tracking thread of its shard. If that thread is
+// behind, sleep until it makes room, which holds up decoding the same way
+// tracking inline would.
+
+void trackQueueMessage(struct modesMessage *mm) {
+    struct track_shard *sh = trackShard(mm);
+
+    if (netQueuePush(&sh->queue, NULL, 0, mm, sizeof (*mm)))
+        return;
+
+    pthread_mutex_lock(&sh->room_mutex);
+    atomic_store(&sh->room_wanted, true);
+    // pairs with the fence in trackDrainQueue(), either the push sees the
+    // room made or the tracking thread sees room_wanted
+    atomic_thread_fence(memory_order_seq_cst);
+    while (!netQueuePush(&sh->queue, NULL, 0, mm, sizeof (*mm)))
+        pthread_cond_wait(&sh->room_cond, &sh->room_mutex);
+    atomic_store(&sh->room_wanted, false);
+    pthread_mutex_unlock(&sh->room_mutex);
+}
+
+void trackLockShards(void) {
+    if (!track_threaded)
+        return;
+
+    pthread_rwlock_wrlock(&track_lock);
+
+    // validity checks outside of message tracking go by the newest message
+    for (int s = 0; s < Modes.track_threads; s++) {
+        if (Modes.track_shards[s].message_now > _messageNow)
+            _messageNow = Modes.track_shards[s].message_now;
+    }
+}
+
+void trackUnlockShards(void) {
+    if (track_threaded)
+        pthread_rwlock_unlock(&track_lock);
+}
+
+void trackLockOutput(void) {
+    if (track_threaded)
+        pthread_mutex_lock(&track_output_mutex);
+}
+
+void trackUnlockOutput(void) {
+    if (track_threaded)
+        pthread_mutex_unlock(&track_output_mutex);
+}
+
+// Add the statistics counted by the tracking threads to Modes.stats_current
+// and Modes.stats_range. Call with the shards locked.
+
+void trackMergeStats(void) {
+    if (Modes.track_threads < 2)
+        return;
+
+    for (int s = 0; s < Modes.track_threads; s++) {
+        struct track_shard *sh = &Modes.track_shards[s];
+
+        add_stats(&Modes.stats_current, &sh->stats, &Modes.stats_current);
+        reset_stats(&sh->stats);
+        for (int i = 0; i < POLAR_RANGE_BUCKETS; i++) {
+            if (sh->range.polar_range[i] > Modes.stats_range.polar_range[i])
+                Modes.stats_range.polar_range[i] = sh->range.polar_range[i];
+            sh->range.polar_range[i] = 0;
+        }
+    }
+}
@@ -70,22 +70,71 @@
 
 #define ALTITUDE_BARO_RELIABLE_MAX 20
 
+/* Oldest data_validity time kept, in milliseconds before now */
+#define TRACK_TIME_PAST (1U << 30)
+
 // data moves through three states:
 //  fresh: data is valid. Updates from a less reliable source are not accepted.
 //  stale: data is valid. Updates from a less reliable source are accepted.
 //  expired: data is not valid.
 
+// Times are the low 32 bits of the millisecond clock, which wrap every 49 days,
+// and are compared through trackTimeDiff. The expiry pass pulls any time older
+// than TRACK_TIME_PAST forward so differences never overflow. The stale and
+// expire intervals are per field and shared by all aircraft, see track.c.
+
 typedef struct {
-    uint64_t stale_interval; /* how long after an update until the data is stale */
-    uint64_t expire_interval; /* how long after an update until the data expires */
-    uint64_t updated; /* when it arrived */
-    uint64_t stale; /* when it goes stale */
-    uint64_t expires; /* when it expires */
-    uint64_t next_reduce_forward; /* when to next forward the data for reduced beast output */
-    datasource_t source; /* where the data came from */
-    uint32_t padding;
+    uint32_t updated; /* when it arrived */
+    uint32_t stale; /* when it goes stale */
+    uint32_t expires; /* when it expires */
+    uint32_t next_reduce_forward; /* when to next forward the data for reduced beast output */
+    uint8_t source; /* where the data came from, a datasource_t */
+    uint8_t interval; /* which stale/expire intervals apply */
 } data_validity;
 
+/* FATSV "last emitted" state of one aircraft, kept out of struct aircraft
+ * as it is only needed when the FATSV output is enabled
+ */
+struct aircraft_fatsv {
+    uint64_t last_emitted; // time (millis) aircraft was last FA emitted
+    uint64_t last_force_emit; // time (millis) we last emitted only-on-change data
+    int emitted_altitude_baro; // last FA emitted altitude
+    int emitted_altitude_geom; //      -"-         GNSS altitude
+    int emitted_baro_rate; //      -"-         barometric rate
+    int emitted_geom_rate; //      -"-         geometric rate
+    float emitted_track; //      -"-         true track
+    float emitted_track_rate; //      -"-         track rate of change
+    float emitted_mag_heading; //      -"-         magnetic heading
+    float emitted_true_heading; //      -"-         true heading
+    float emitted_roll; //      -"-         roll angle
+    float emitted_gs; //      -"-         groundspeed
+    unsigned emitted_ias; //      -"-         IAS
+    unsigned emitted_tas; //      -"-         TAS
+    float emitted_mach; //      -"-         Mach number
+    AircraftMeta__AirGround emitted_airground; //      -"-         air/ground state
+    unsigned emitted_nav_altitude_mcp; //      -"-         MCP altitude
+    unsigned emitted_nav_altitude_fms; //      -"-         FMS altitude
+    unsigned emitted_nav_altitude_src; //      -"-         automation altitude source
+    float emitted_nav_heading; //      -"-         target heading
+    nav_modes_t emitted_nav_modes; //      -"-         enabled navigation modes
+    float emitted_nav_qnh; //      -"-         altimeter setting
+    unsigned char emitted_bds_10[7]; //      -"-         BDS 1,0 message
+    unsigned char emitted_bds_30[7]; //      -"-         BDS 3,0 message
+    unsigned char emitted_es_status[7]; //      -"-         ES operational status message
+    unsigned char emitted_es_acas_ra[7]; //      -"-         ES ACAS RA report message
+    char emitted_callsign[12]; //      -"-         callsign
+    AircraftMeta__AddrType emitted_addrtype; //      -"-         address type (assumed ADSB_ICAO initially)
+    int emitted_adsb_version; //      -"-         ADS-B version (assumed non-ADS-B initially)
+    unsigned emitted_category; //      -"-         ADS-B emitter category (assumed A0 initially)
+    unsigned emitted_squawk; //      -"-         squawk
+    unsigned emitted_nac_p; //      -"-         NACp
+    unsigned emitted_nac_v; //      -"-         NACv
+    unsigned emitted_sil; //      -"-         SIL
+    AircraftMeta__SilType emitted_sil_type; //      -"-         SIL supplement
+    unsigned emitted_nic_baro; //      -"-         NICbaro
+    AircraftMeta__Emergency emitted_emergency; //      -"-         emergency/priority status
+};
+
 /* Structure used to describe the state of one tracked aircraft */
 struct aircraft {
     // Aircraft metadata that is shared with webapp.
@@ -93,11 +142,10 @@ struct aircraft {
     AircraftMeta__NavModes nav_modes;
     AircraftMeta__ValidSource valid_source;
     // Remaining variables are all readsb internal use.
-    uint64_t fatsv_last_emitted; // time (millis) aircraft was last FA emitted
-    uint64_t fatsv_last_force_emit; // time (millis) we last emitted only-on-change data
     double signalLevel[8]; // Last 8 Signal Amplitudes
     int signalNext; // next index of signalLevel to use
     int altitude_baro_reliable;
+    uint64_t next_expiry; // no data expires and no reaping before this, see trackRemoveStaleAircraft
     int geom_delta; // Difference between Geometric and Baro altitudes
     unsigned cpr_odd_lat;
     unsigned cpr_odd_lon;
@@ -165,43 +213,7 @@ struct aircraft {
     unsigned nic_c : 1; // NIC supplement C from opstatus
     int modeA_hit; // did our squawk match a possible mode A reply in the last check period?
     int modeC_hit; // did our altitude match a possible mode C reply in the last check period?
-    int fatsv_emitted_altitude_baro; // last FA emitted altitude
-    int fatsv_emitted_altitude_geom; //      -"-         GNSS altitude
-    int fatsv_emitted_baro_rate; //      -"-         barometric rate
-    int fatsv_emitted_geom_rate; //      -"-         geometric rate
-    float fatsv_emitted_track; //      -"-         true track
-    float fatsv_emitted_track_rate; //      -"-         track rate of change
-    float fatsv_emitted_mag_heading; //      -"-         magnetic heading
-    float fatsv_emitted_true_heading; //      -"-         true heading
-    float fatsv_emitted_roll; //      -"-         roll angle
-    float fatsv_emitted_gs; //      -"-         groundspeed
-    unsigned fatsv_emitted_ias; //      -"-         IAS
-    unsigned fatsv_emitted_tas; //      -"-         TAS
-    float fatsv_emitted_mach; //      -"-         Mach number
-    AircraftMeta__AirGround fatsv_emitted_airground; //      -"-         air/ground state
-    unsigned fatsv_emitted_nav_altitude_mcp; //      -"-         MCP altitude
-    unsigned fatsv_emitted_nav_altitude_fms; //      -"-         FMS altitude
-    unsigned fatsv_emitted_nav_altitude_src; //      -"-         automation altitude source
-    float fatsv_emitted_nav_heading; //      -"-         target heading
-    nav_modes_t fatsv_emitted_nav_modes; //      -"-         enabled navigation modes
-    float fatsv_emitted_nav_qnh; //      -"-         altimeter setting
-    unsigned char fatsv_emitted_bds_10[7]; //      -"-         BDS 1,0 message
-    unsigned char fatsv_emitted_bds_30[7]; //      -"-         BDS 3,0 message
-    unsigned char fatsv_emitted_es_status[7]; //      -"-         ES operational status message
-    unsigned char fatsv_emitted_es_acas_ra[7]; //      -"-         ES ACAS RA report message
-    char fatsv_emitted_callsign[12]; //      -"-         callsign
-    AircraftMeta__AddrType fatsv_emitted_addrtype; //      -"-         address type (assumed ADSB_ICAO initially)
-    int fatsv_emitted_adsb_version; //      -"-         ADS-B version (assumed non-ADS-B initially)
-    unsigned fatsv_emitted_category; //      -"-         ADS-B emitter category (assumed A0 initially)
-    unsigned fatsv_emitted_squawk; //      -"-         squawk
-    unsigned fatsv_emitted_nac_p; //      -"-         NACp
-    unsigned fatsv_emitted_nac_v; //      -"-         NACv
-    unsigned fatsv_emitted_sil; //      -"-         SIL
-    AircraftMeta__SilType fatsv_emitted_sil_type; //      -"-         SIL supplement
-    unsigned fatsv_emitted_nic_baro; //      -"-         NICbaro
-    AircraftMeta__Emergency fatsv_emitted_emergency; //      -"-         emergency/priority status
-    struct modesMessage first_message; // A copy of the first message we received for this aircraft.
-    struct aircraft *next; // Next aircraft in our linked list
+    struct aircraft_fatsv *fatsv; // FATSV output state, only allocated when that output is enabled
 };
 
 /* Mode A/C tracking is done separately, not via the aircraft list,
@@ -212,16 +224,22 @@ extern uint32_t modeAC_count[4096];
 extern uint32_t modeAC_match[4096];
 extern uint32_t modeAC_age[4096];
 
+/* signed difference t1 - t2 of two data_validity times */
+static inline int32_t
+trackTimeDiff(uint32_t t1, uint32_t t2) {
+    return (int32_t) (t1 - t2);
+}
+
 /* is this bit of data valid? */
 static inline int
 trackDataValid(const data_validity *v) {
-    return (v->source != SOURCE_INVALID && messageNow() < v->expires);
+    return (v->source != SOURCE_INVALID && trackTimeDiff((uint32_t) messageNow(), v->expires) < 0);
 }
 
 /* is this bit of data fresh? */
 static inline int
 trackDataFresh(const data_validity *v) {
-    return (v->source != SOURCE_INVALID && messageNow() < v->stale);
+    return (v->source != SOURCE_INVALID && trackTimeDiff((uint32_t) messageNow(), v->stale) < 0);
 }
 
 /* what's the age of this data, in milliseconds? */
@@ -229,11 +247,50 @@ static inline uint64_t
 trackDataAge(const data_validity *v) {
     if (v->source == SOURCE_INVALID)
         return ~(uint64_t) 0;
-    if (v->updated >= messageNow())
+    int32_t age = trackTimeDiff((uint32_t) messageNow(), v->updated);
+    if (age <= 0)
         return 0;
-    return (messageNow() - v->updated);
+    return (uint64_t) age;
+}
+
+/* when did this data arrive, as full millisecond time? */
+static inline uint64_t
+trackDataUpdated(const data_validity *v) {
+    return messageNow() + (int64_t) trackTimeDiff(v->updated, (uint32_t) messageNow());
 }
 
+/* Most tracking threads, see --track-threads */
+#define TRACK_MAX_THREADS 16
+
+/* Bytes of messages queued for each tracking thread */
+#define TRACK_QUEUE_SIZE (1024 * 1024)
+
+/* Messages a tracking thread handles before letting trackLockShards() in */
+#define TRACK_THREAD_BATCH 256
+
+/* One part of the aircraft table, by hash of the address. Each shard is
+ * owned by a tracking thread when there are several of them, with its own
+ * statistics merged by trackMergeStats(). Anything else reading or changing
+ * aircraft must hold trackLockShards().
+ */
+struct aircraft_index_entry;
+struct track_shard {
+    struct aircraft *aircrafts; // Tracked aircraft of this shard, see track.c
+    unsigned aircraft_count; // Number of entries in use in aircrafts
+    unsigned aircraft_alloc; // Number of entries allocated in aircrafts
+    struct aircraft_index_entry *index; // Address -> aircrafts slot
+    uint32_t index_mask;
+    unsigned sweep_pos; // Next aircraft to check for expiry
+    uint64_t message_now; // messageNow() of the last message tracked
+    struct stats stats; // Counted by the tracking thread, merged by trackMergeStats()
+    struct range_stats range;
+    struct net_queue queue; // Messages waiting for the tracking thread
+    atomic_bool room_wanted; // the decoding thread waits for room in queue
+    pthread_mutex_t room_mutex;
+    pthread_cond_t room_cond; // signalled when room_wanted and a message was taken off queue
+    pthread_t thread;
+};
+
 /* Update aircraft state from data in the provided mesage.
  * Return the tracked aircraft.
  */
@@ -243,6 +300,30 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm);
 /* Call periodically */
 void trackPeriodicUpdate();
 
+/* Free the aircraft table on exit */
+void trackCleanup();
+
+/* Set up the aircraft table shards */
+void trackInit(void);
+
+/* Start and stop the tracking threads for --track-threads above 1 */
+void trackStartThreads(void);
+void trackStopThreads(void);
+
+/* Queue a message for the tracking thread of its shard */
+void trackQueueMessage(struct modesMessage *mm);
+
+/* Exclude the tracking threads while using aircraft outside of them */
+void trackLockShards(void);
+void trackUnlockShards(void);
+
+/* Exclude the tracking threads from the output writers */
+void trackLockOutput(void);
+void trackUnlockOutput(void);
+
+/* Add the tracking thread statistics to Modes.stats_current */
+void trackMergeStats(void);
+
 /* Convert from a (hex) mode A value to a 0-4095 index */
 static inline unsigned
 modeAToIndex(unsigned modeA) {
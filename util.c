@@ -56,11 +56,11 @@
 #include <stdlib.h>
 #include <sys/time.h>
 
-uint64_t _messageNow = 0;
+_Thread_local uint64_t _messageNow = 0;
 
 uint64_t mstime(void) {
     if (Modes.sdr_type == SDR_IFILE) {
-        return Modes.ifile_now;
+        return __atomic_load_n(&Modes.ifile_now, __ATOMIC_RELAXED); // also read by the network thread
     }
 
     struct timeval tv;
@@ -30,7 +30,7 @@
 uint64_t mstime(void);
 
 /* Returns the time for the current message we're dealing with */
-extern uint64_t _messageNow;
+extern _Thread_local uint64_t _messageNow;
 
 static inline uint64_t
 messageNow() {
@@ -132,6 +132,7 @@ static void view1090Init(void) {
     modesChecksumInit(Modes.nfix_crc);
     icaoFilterInit();
     modeACInit();
+    trackInit();
     interactiveInit();
 }
 
@@ -258,7 +259,6 @@ int main(int argc, char **argv) {
 
     // Keep going till the user does something that stops us
     while (!Modes.exit) {
-        struct timespec r = {0, 100 * 1000 * 1000};
         icaoFilterExpire();
         trackPeriodicUpdate();
         modesNetPeriodicWork();
@@ -273,18 +273,11 @@ int main(int argc, char **argv) {
             continue;
         }
 
-        nanosleep(&r, NULL);
+        modesNetWait(100);
     }
 
-    /* Go through tracked aircraft chain and free up any used memory */
-    for (int j = 0; j < AIRCRAFTS_BUCKETS; j++) {
-        struct aircraft *a = Modes.aircrafts[j], *n;
-        while (a) {
-            n = a->next;
-            if (a) free(a);
-            a = n;
-        }
-    }
+    trackCleanup();
+    geomag_cleanup();
     // Free local service and client
     if (s) free(s);
     if (con->addr_info) {
@@ -298,6 +291,7 @@ int main(int argc, char **argv) {
 
 exit:
     interactiveCleanup();
+    icaoFilterCleanup();
     return (0);
 }
 //